@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <cpu_model/cpu_model.h>
+#include <extra/utils.h>
+
+// Simulation throughput benchmark
+// Each program is executed in a loop (the CPU is reset once the PC
+// runs past the end of the program) for a fixed number of instructions
+// by every engine, then the MIPS reached by each of them are reported.
+// The pipeline retires an instruction per cycle, its MIPS are the
+// millions of cpu_step() per second.
+
+// Instructions executed by each call of the functional model
+#define FUNCTIONAL_CHUNK 64
+
+typedef enum {
+	ENGINE_PIPELINE,	// cpu_step()
+	ENGINE_SWITCH,		// cpu_run_functional(), switch dispatch
+	ENGINE_THREADED,	// cpu_run_functional(), computed gotos
+	ENGINE_JIT,			// cpu_run_functional(), translated to x86-64
+	ENGINE_BLOCKS,		// cpu_run_functional(), translated to closures
+	ENGINE_NUM
+} engine_t;
+
+static const char *engine_name[ENGINE_NUM] = {
+	"cpu_step",
+	"functional (switch)",
+	"functional (threaded)",
+	"functional (jit)",
+	"functional (blocks)",
+};
+
+static double elapsed_sec(struct timespec *start, struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) +
+	       (double)(end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// Run the loaded program for the given instructions, returns the MIPS
+static double bench_engine(cpu_t *cpu, int program_size, engine_t engine, long instructions) {
+	struct timespec start, end;
+	long   done = 0;
+	uint32_t pc;
+
+	cpu_reset(cpu);
+	if (engine == ENGINE_SWITCH)
+		cpu_set_dispatch(cpu, FUNC_DISPATCH_SWITCH);
+	else if (engine == ENGINE_JIT)
+		cpu_set_dispatch(cpu, FUNC_DISPATCH_JIT);
+	else if (engine == ENGINE_BLOCKS)
+		cpu_set_dispatch(cpu, FUNC_DISPATCH_BLOCKS);
+	else
+		cpu_set_dispatch(cpu, FUNC_DISPATCH_THREADED);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (engine == ENGINE_PIPELINE) {
+		for (done = 0; done < instructions; done++) {
+			pc = cpu_get_pc(cpu);
+			// Restart once the whole program went through the pipeline
+			if (pc != (uint32_t)-1 && pc >= (uint32_t)(program_size + 4))
+				cpu_reset(cpu);
+			cpu_step(cpu);
+		}
+	} else {
+		while (done < instructions) {
+			done += cpu_run_functional(cpu, FUNCTIONAL_CHUNK);
+			if (cpu_get_pc(cpu) >= (uint32_t)program_size)
+				cpu_reset(cpu);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (double)done / elapsed_sec(&start, &end) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+	cpu_t *cpu;
+	FILE  *fd;
+	long   instructions;
+	int    program_size;
+	int    i, e;
+	double mips[ENGINE_NUM];
+
+	if (argc < 3) {
+		fprintf(stderr, "Wrong usage: %s <instructions> <filename.mem>...\n", argv[0]);
+		exit(-1);
+	}
+	instructions = atol(argv[1]);
+
+	cpu = (cpu_t *)cpu_create(NULL);
+	if (cpu == NULL) {
+		fprintf(stderr, "[BENCH] cpu_create() failed\n");
+		exit(-3);
+	}
+
+	for (i = 2; i < argc; i++) {
+		fd = fopen(argv[i], "r");
+		if (fd == NULL) {
+			fprintf(stderr, "[BENCH] fopen() failed | filename: %s\n", argv[i]);
+			exit(-2);
+		}
+		cpu_reset(cpu);
+		program_size = cpu_load_program(cpu, fd);
+		fclose(fd);
+		if (program_size <= 0) {
+			fprintf(stderr, "[BENCH] cpu_load_program() failed or empty program\n");
+			exit(-4);
+		}
+
+		printf("[BENCH] %s, %ld instructions\n", argv[i], instructions);
+		for (e = 0; e < ENGINE_NUM; e++) {
+			mips[e] = bench_engine(cpu, program_size, (engine_t)e, instructions);
+			printf("[BENCH]   %-22s %8.2f MIPS  (x%.1f)\n", engine_name[e], mips[e], mips[e] / mips[ENGINE_PIPELINE]);
+		}
+	}
+
+	cpu_free(cpu);
+	return 0;
+}
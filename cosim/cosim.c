@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <cpu_model/cpu_model.h>
+#include <extra/utils.h>
+#include <extra/cosim.h>
+
+// Lockstep co-simulation driver (see extra/cosim.h)
+// The model side creates the session <name> (e.g. /dlx), waits for the
+// HDL, then runs the program with the pipeline until it halts, the
+// cycle limit is reached or a retired instruction differs from the
+// HDL's one. On a mismatch both records, the pipeline registers and the
+// register file of the model are printed.
+// With --hdl the driver stands in for the HDL: it attaches to the
+// session and sends the instructions retired by its own pipeline, the
+// way a testbench of the HDL does. --fault <n> corrupts the value of
+// the first register written from the n-th instruction on, to see the
+// mismatch reported. Both sides halt as the batch runner does.
+// --slots <n> sets the records of the ring, --cycles compares the write
+// back cycles as well, --config <delayslot>,<yes|no>,<yes|no>[,<predictor>]
+// the microarchitecture (the build options by default).
+// Returns 0 if every instruction matched, 1 on a mismatch, -1 on error
+
+typedef struct {
+	cosimPort_t *port;
+	uint64_t     fault;		// Instruction to corrupt from, 0 if none
+	uint64_t     sent;
+	bool         stopped;	// By the model
+} hdl_t;
+
+// commitHook_t of the stand-in
+static void hdl_send(void *ctx, const commitRecord_t *record) {
+	hdl_t          *hdl = (hdl_t *)ctx;
+	commitRecord_t  sent = *record;
+
+	if (hdl->stopped)
+		return;
+	hdl->sent++;
+	if (hdl->fault != 0 && hdl->sent >= hdl->fault && (sent.flags & COMMIT_REG)) {
+		sent.value ^= 1;
+		hdl->fault = 0;
+	}
+	if (cosim_send(hdl->port, &sent) < 0)
+		hdl->stopped = true;
+}
+
+// true once the program has halted, as the batch runner
+static bool halted(cpu_t *cpu, int program_size) {
+	uint32_t pc = cpu_get_pc(cpu);
+	return (pc != (uint32_t)-1 && pc >= (uint32_t)(program_size + 4)) || cpu_get_idle(cpu) != 0;
+}
+
+static void print_latches(cpu_t *cpu) {
+	const pipeBank_t *bank = PIPE_CUR(cpu);
+	const char *stage[] = { "IF/ID", "ID/EX", "EX/MEM", "MEM/WB" };
+	uint32_t pc[] = { bank->fetch.pc, bank->decode.pc, bank->ex.pc, bank->mem.pc };
+	uint32_t instr[] = { bank->fetch.instr, bank->decode.instr, bank->ex.instr, bank->mem.instr };
+	char str[DISASM_LEN];
+	int i;
+
+	printf("Pipeline registers of the model:\n");
+	for (i = 0; i < 4; i++) {
+		disassemble(instr[i], str, sizeof(str));
+		printf("  %-6s pc 0x%08x  %08x %s\n", stage[i], pc[i]*4, instr[i], str);
+	}
+	printf("Registers of the model:\n");
+	for (i = 0; i < REGS_NUM; i++)
+		printf("  R%-2d 0x%08x%s", i, cpu_get_reg(cpu, i), i % 4 == 3 ? "\n" : "");
+}
+
+// <delayslot>,<yes|no>,<yes|no>[,<predictor>], returns 0, -1 if not valid
+static int parse_config(const char *arg, cpu_config_t *config) {
+	unsigned delayslot;
+	char     forwarding[4], relative_jump[4], predictor[16] = "none", end;
+	int      n, kind;
+
+	n = sscanf(arg, "%u,%3[a-z],%3[a-z],%15[a-z_]%c", &delayslot, forwarding, relative_jump, predictor, &end);
+	kind = predictor_kind(predictor);
+	if ((n != 3 && n != 4) || kind < 0 ||
+	    (strcmp(forwarding, "yes") != 0 && strcmp(forwarding, "no") != 0) ||
+	    (strcmp(relative_jump, "yes") != 0 && strcmp(relative_jump, "no") != 0) ||
+	    delayslot < 1 || delayslot > MAX_DELAYSLOT)
+		return -1;
+	config->delayslot     = (uint8_t)delayslot;
+	config->forwarding    = strcmp(forwarding, "yes") == 0;
+	config->relative_jump = strcmp(relative_jump, "yes") == 0;
+	config->predictor     = (uint8_t)kind;
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	cpu_config_t      config = CPU_CONFIG_DEFAULT;
+	const cpuStats_t *stats;
+	cosimPort_t      *port;
+	hdl_t             hdl;
+	cpu_t            *cpu;
+	FILE             *fd;
+	bool              as_hdl = false, cycles = false;
+	uint32_t          slots = 0;
+	uint64_t          max_cycles, fault = 0;
+	int               first = 1, program_size, ret = 0;
+
+	while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+		if (strcmp(argv[first], "--hdl") == 0) {
+			as_hdl = true;
+			first++;
+		} else if (strcmp(argv[first], "--fault") == 0 && first + 1 < argc) {
+			fault = strtoull(argv[first + 1], NULL, 0);
+			first += 2;
+		} else if (strcmp(argv[first], "--slots") == 0 && first + 1 < argc) {
+			slots = (uint32_t)strtoul(argv[first + 1], NULL, 0);
+			first += 2;
+		} else if (strcmp(argv[first], "--cycles") == 0) {
+			cycles = true;
+			first++;
+		} else if (strcmp(argv[first], "--config") == 0 && first + 1 < argc) {
+			if (parse_config(argv[first + 1], &config) < 0) {
+				fprintf(stderr, "[COSIM] Not a valid config: %s\n", argv[first + 1]);
+				exit(-1);
+			}
+			first += 2;
+		} else {
+			break;
+		}
+	}
+	if (argc != first + 3) {
+		fprintf(stderr, "Wrong usage: %s [--hdl [--fault <n>]] [--slots <n>] [--cycles] [--config <delayslot>,<yes|no>,<yes|no>[,<predictor>]] "
+		        "<name> <max_cycles> <filename.mem>\n", argv[0]);
+		exit(-1);
+	}
+	max_cycles = strtoull(argv[first + 1], NULL, 0);
+
+	cpu = (cpu_t *)cpu_create(&config);
+	if (cpu == NULL) {
+		fprintf(stderr, "[COSIM] cpu_create() failed\n");
+		exit(-3);
+	}
+	cpu_set_trace(cpu, NULL);
+	fd = fopen(argv[first + 2], "r");
+	if (fd == NULL) {
+		fprintf(stderr, "[COSIM] fopen() failed | filename: %s\n", argv[first + 2]);
+		exit(-2);
+	}
+	program_size = cpu_load_program(cpu, fd);
+	fclose(fd);
+	if (program_size <= 0) {
+		fprintf(stderr, "[COSIM] cpu_load_program() failed or empty program | filename: %s\n", argv[first + 2]);
+		exit(-2);
+	}
+	stats = cpu_get_stats(cpu);
+
+	if (as_hdl) {
+		port = cosim_attach(argv[first], COSIM_TIMEOUT_MS);
+		if (port == NULL)
+			exit(-1);
+		memset(&hdl, 0, sizeof(hdl));
+		hdl.port  = port;
+		hdl.fault = fault;
+		cpu_set_commit_hook(cpu, hdl_send, &hdl);
+		while (!hdl.stopped && !halted(cpu, program_size) && (max_cycles == 0 || stats->cycles < max_cycles))
+			cpu_step(cpu);
+		cosim_finish(port);
+		printf("HDL stand-in: %llu instructions sent%s\n", (unsigned long long)hdl.sent,
+		       hdl.stopped ? ", stopped by the model" : "");
+		cosim_close(port);
+		cpu_free(cpu);
+		return 0;
+	}
+
+	port = cosim_create(argv[first], slots, cycles);
+	if (port == NULL)
+		exit(-1);
+	if (cosim_wait_attach(port, COSIM_TIMEOUT_MS) < 0) {
+		cosim_close(port);
+		exit(-1);
+	}
+	cpu_set_commit_hook(cpu, cosim_check_hook, port);
+	while (port->diff == 0 && !halted(cpu, program_size) && (max_cycles == 0 || stats->cycles < max_cycles))
+		cpu_step(cpu);
+	// At the cycle limit the HDL may be ahead, nothing left to compare
+	if (port->diff == 0 && halted(cpu, program_size))
+		cosim_end(port);
+
+	if (port->diff == 0) {
+		printf("Lockstep OK: %llu instructions, %llu cycles\n",
+		       (unsigned long long)port->checked, (unsigned long long)stats->cycles);
+	} else {
+		cosim_report(port, stdout);
+		print_latches(cpu);
+		ret = 1;
+	}
+	cosim_close(port);
+	cpu_free(cpu);
+	return ret;
+}
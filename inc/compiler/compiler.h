@@ -73,6 +73,15 @@ void label_add(const char *name, int address, Section sec);
 // Get label address
 int find_label_address(const char *name);
 
+// Write the TEXT labels into filename.sym, one "address name" per line
+// Returns 0 on success
+int label_write_table(const char *filename);
+
+// Write the binary image filename.bin (see extra/image.h): the text,
+// the RODATA segment and the TEXT labels
+// Returns 0 on success
+int image_write(const char *filename, const uint32_t *text, int text_size);
+
 //////////////////////////////
 // Register Aliasing
 //////////////////////////////
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <cpu_model/peripherals/bus/bus.h>
 
 #define NOP_Instruction 0x54000000
@@ -72,20 +73,111 @@
 #define OPCODE_SLEUI	0x3C
 #define OPCODE_SGEUI	0x3D
 
-#ifdef DELAYSLOT3
-#define DELAYSLOT 3
-#endif
+#define MAX_DELAYSLOT 3
 
-#ifdef DELAYSLOT2
-#define DELAYSLOT 2
+// Branch predictors, see BRANCH PREDICTION
+typedef enum {
+	PREDICT_NONE,		// Delay slots
+	PREDICT_NOT_TAKEN,
+	PREDICT_BIMODAL,
+	PREDICT_GSHARE,
+	PREDICT_KINDS
+} predictorKind_t;
+
+// Microarchitecture, selected at runtime when the CPU is created
+typedef struct {
+	uint8_t	delayslot;		// Instructions executed after a jump, 1..MAX_DELAYSLOT
+							// With a predictor, the ones squashed by a misprediction
+	bool	forwarding;		// ALU and MEM out forwarded to the decode stage
+	bool	relative_jump;	// Jump targets relative to the next PC, otherwise absolute
+	uint8_t	predictor;		// predictorKind_t
+} cpu_config_t;
+
+// Default configuration, from the build options:
+// DELAYSLOT1/2/3, FORWARDING, RELATIVE_JUMP,
+// PREDICTOR_NOT_TAKEN/BIMODAL/GSHARE
+#if defined(DELAYSLOT3)
+#define CONFIG_DEFAULT_DELAYSLOT	3
+#elif defined(DELAYSLOT2)
+#define CONFIG_DEFAULT_DELAYSLOT	2
+#else
+#define CONFIG_DEFAULT_DELAYSLOT	1
 #endif
-
-#ifdef DELAYSLOT1
-#define DELAYSLOT 1
+#ifdef FORWARDING
+#define CONFIG_DEFAULT_FORWARDING	true
+#else
+#define CONFIG_DEFAULT_FORWARDING	false
 #endif
+#ifdef RELATIVE_JUMP
+#define CONFIG_DEFAULT_RELATIVE_JUMP	true
+#else
+#define CONFIG_DEFAULT_RELATIVE_JUMP	false
+#endif
+#if defined(PREDICTOR_GSHARE)
+#define CONFIG_DEFAULT_PREDICTOR	PREDICT_GSHARE
+#elif defined(PREDICTOR_BIMODAL)
+#define CONFIG_DEFAULT_PREDICTOR	PREDICT_BIMODAL
+#elif defined(PREDICTOR_NOT_TAKEN)
+#define CONFIG_DEFAULT_PREDICTOR	PREDICT_NOT_TAKEN
+#else
+#define CONFIG_DEFAULT_PREDICTOR	PREDICT_NONE
+#endif
+#define CPU_CONFIG_DEFAULT	((cpu_config_t){ CONFIG_DEFAULT_DELAYSLOT, CONFIG_DEFAULT_FORWARDING, \
+								CONFIG_DEFAULT_RELATIVE_JUMP, CONFIG_DEFAULT_PREDICTOR })
 
 #define REGS_NUM 32
 
+// ALU operations: FUNC_ name, result of the operands a and b
+#define ALU_OPS(X) \
+	X(NOP,	0) \
+	X(SLL,	a << b) \
+	X(SRL,	a >> b) \
+	X(SRA,	(uint32_t)((int32_t)a >> b)) \
+	X(ADD,	(uint32_t)((int32_t)a + (int32_t)b)) \
+	X(ADDU,	a + b) \
+	X(SUB,	(uint32_t)((int32_t)a - (int32_t)b)) \
+	X(SUBU,	a - b) \
+	X(AND,	a & b) \
+	X(OR,	a | b) \
+	X(XOR,	a ^ b) \
+	X(SEQ,	(a == b) ? 1 : 0) \
+	X(SNE,	(a != b) ? 1 : 0) \
+	X(SLT,	((int32_t)a < (int32_t)b) ? 1 : 0) \
+	X(SGT,	((int32_t)a > (int32_t)b) ? 1 : 0) \
+	X(SLE,	((int32_t)a <= (int32_t)b) ? 1 : 0) \
+	X(SGE,	((int32_t)a >= (int32_t)b) ? 1 : 0) \
+	X(SLTU,	(a < b) ? 1 : 0) \
+	X(SGTU,	(a > b) ? 1 : 0) \
+	X(SLEU,	(a <= b) ? 1 : 0) \
+	X(SGEU,	(a >= b) ? 1 : 0)
+
+// Handlers of the functional model, one for each kind of instruction
+// R_ and I_ handlers take the operand b from rs2 or from the immediate
+typedef enum {
+	H_NOP,
+	H_INVALID,
+#define X(name, expr)	H_R_##name, H_I_##name,
+	ALU_OPS(X)
+#undef X
+	H_LW, H_LH, H_LHU, H_LB, H_LBU,
+	H_STORE,
+	H_J, H_JAL, H_JR, H_JALR, H_BEQZ, H_BNEZ,
+	H_BREAK,		// Stop before the instruction, see cpu_fast_forward()
+	H_NUM
+} funcHandler_t;
+
+// How the functional model moves from a handler to the next one
+typedef enum {
+	FUNC_DISPATCH_THREADED,		// Computed gotos, when the compiler supports them
+	FUNC_DISPATCH_SWITCH,
+	FUNC_DISPATCH_JIT,			// Blocks translated to x86-64 code, see cpu_jit.c
+	FUNC_DISPATCH_BLOCKS		// Blocks translated to closures, see cpu_block.c
+} funcDispatch_t;
+
+// Translators of the functional model, NULL until the first use
+typedef struct jit jit_t;
+typedef struct blockCache blockCache_t;
+
 typedef enum {
 	nop,
 	jump,
@@ -94,27 +186,43 @@ typedef enum {
 	neqz
 } jump_t;
 
+// Control word, packed in a single 32-bit register
 typedef struct{
-	uint16_t 	ALU_opcode;
-	uint8_t 	rd;
-	uint8_t 	opcode;
-	jump_t 		jmp_eqz_neqz;
-	bool 		writeRF;
-	bool 		useImm;
-	bool 		writeMem;
-	bool 		readMem;
-	bool		useRegisterToJump;
+	uint32_t	ALU_opcode			: 11;
+	uint32_t	opcode				: 6;
+	uint32_t	rd					: 5;
+	uint32_t	jmp_eqz_neqz		: 3;	// jump_t
+	uint32_t	writeRF				: 1;
+	uint32_t	useImm				: 1;
+	uint32_t	writeMem			: 1;
+	uint32_t	readMem				: 1;
+	uint32_t	useRegisterToJump	: 1;
 } controlWord_t;
 
+// Predecoded instruction, one for each IRAM word
+#define DECODED_VALID		0x01	// Matches the IRAM content
+#define DECODED_NOP			0x02
+#define DECODED_READ_RS1	0x04	// rs1 is read from the RF
+#define DECODED_READ_RS2	0x08	// rs2 is read from the RF
+
+typedef struct {
+	uint32_t		instr;
+	uint32_t		imm;
+	controlWord_t	controlWord;
+	uint8_t			rs1, rs2, rd;
+	uint8_t			flags;
+	uint8_t			handler;	// funcHandler_t
+} decodedOp_t;
+
 typedef struct {
 	uint32_t instr;
+	uint32_t pc;
 	uint32_t nextPC;
+	uint32_t predicted;		// Word fetched next, see predictor_next()
+	bool	 flushed;		// Squashed by a misprediction, never retired
 
 	// Controls
-	controlWord_t controlWord;
-
-	// Extra
-	char instr_str[64];
+	decodedOp_t op;
 } pipeFetch_t;
 
 // Set correct variable to use
@@ -130,9 +238,10 @@ typedef struct {
 
 	// Propagate old signals
 	uint32_t nextPC;
-	
-	// Extra
-	char instr_str[64];
+	uint32_t predicted;
+	bool	 flushed;
+	uint32_t instr;
+	uint32_t pc;
 } pipeDecode_t;
 
 typedef struct{
@@ -148,17 +257,19 @@ typedef struct{
 
 	// Propagate old signals
 	uint32_t nextPC;
+	uint32_t predicted;
+	bool	 flushed;
 	uint32_t rs1_val;		// To be used as jump register
 	uint32_t rs2_val;		// To be used as DRAM_data
 	uint8_t  rd;
-	
-	// Extra
-	char instr_str[64];
+	uint32_t instr;
+	uint32_t pc;
 } pipeEx_t;
 
 typedef struct{
 	// New signals to feed the next steps
 	uint32_t DRAM_out;
+	uint32_t DRAM_data;		// Word stored, for the commit trace
 
 	// Controls
 	controlWord_t controlWord;
@@ -167,49 +278,535 @@ typedef struct{
 	uint32_t rs1_val;		// To be used as jump register
 	uint32_t ALU_out; 
 	uint32_t nextPC;
+	uint32_t predicted;
+	bool	 flushed;
 	uint8_t  rd;
 	bool	jump;			// If true PC = computedPC
-	
-	// Extra
-	char instr_str[64];
-
+	uint32_t instr;
+	uint32_t pc;
 } pipeMem_t;
 
-// CPU State
+// Disassembly cache entry
+#define DISASM_LEN 32
+typedef struct {
+	uint32_t instr;		// Instruction the string refers to
+	bool	 valid;
+	char	 str[DISASM_LEN];
+} disasmEntry_t;
+
+// Pipeline registers
 typedef struct {
+	pipeFetch_t  fetch;		// IF-ID registers
+	pipeDecode_t decode; 	// ID-EX registers
+	pipeEx_t	 ex;		// EX-ME registers
+	pipeMem_t	 mem;		// ME-WB registers
+} pipeBank_t;
+
+// Register write of a recent instruction, as seen by the following ones
+typedef struct {
+	uint32_t old;		// Value in the RF before the write
+	uint32_t fwd;		// Value on the forwarding paths
+	uint32_t near;		// Register bit, if the next instruction doesn't see the written value
+	uint32_t far;		// Register bit, if the one after doesn't see it
+	uint8_t  rd;		// 0 when nothing has been written
+	bool	 load;
+} funcWrite_t;
+
+// Jump of a recent instruction, taking place config.delayslot instructions later
+typedef struct {
+	uint32_t target;	// Word address
+	bool	 valid;
+} funcRedirect_t;
+
+// Functional model state
+typedef struct {
+	bool			active;		// The pipeline is empty and the PC is the next instruction
+	funcRedirect_t	redirect[MAX_DELAYSLOT];	// Jumps of the last config.delayslot instructions
+	uint8_t			head;		// Oldest jump
+	funcWrite_t		w[2];		// Writes of the last two instructions, w[0] is the newest
+	uint32_t		hazard;		// Registers whose value in the RF isn't the one seen by the next instruction
+	uint8_t			ghosts;		// Oldest pipeline registers holding instructions already executed,
+								// only their jump is left to the pipeline
+	uint64_t		retired;	// Instructions executed by the functional model
+} funcState_t;
+
+#define PIPE_STAGES	4		// Pipeline registers
+
+// Written by cpu_counters_write()
+typedef enum {
+	COUNTERS_JSON,		// An object per line
+	COUNTERS_CSV		// cycle,counter,value rows
+} countersFormat_t;
+
+// Jumps resolved with a branch predictor, cleared with the statistics
+typedef struct {
+	uint64_t branches;			// BEQZ and BNEZ
+	uint64_t branch_misses;		// Direction or target mispredicted
+	uint64_t jumps;				// J, JAL, JR, JALR
+	uint64_t jump_misses;
+	uint64_t returns;			// JR R31, also in the jumps
+	uint64_t return_misses;
+	uint64_t flushed;			// Instructions squashed by the mispredicts,
+								// neither retired nor committed
+} predictorStats_t;
+
+// Pipeline statistics, cleared by cpu_reset() and cpu_clear_stats()
+typedef struct {
+	uint64_t cycles;		// cpu_step() calls
+	uint64_t retired;		// Instructions written back
+	uint64_t nops;			// NOPs written back: delay slots and hazards
+							// left to the program, as no stage stalls
+} cpuStats_t;
+
+// Idle loop detection, see cpu_get_idle()
+#define IDLE_LOOP_MAX		16		// Longest loop checked, in words
+#define IDLE_MIN_CYCLES		16		// Cycles the whole pipeline needs to only hold the loop
+
+typedef struct {
+	uint32_t head;		// First word of the loop
+	uint32_t len;		// Words of the loop, 0 if the fetch isn't going around one
+	uint32_t last;		// Word fetched in the previous cycle
+	uint64_t steady;	// Consecutive cycles the fetch followed the loop
+} idleState_t;
+
+typedef struct cpu cpu_t;
+typedef struct commitTrace commitTrace_t;
+typedef struct commitRecord commitRecord_t;
+typedef struct cpuCounters cpuCounters_t;
+typedef struct predictor predictor_t;
+
+// Called with each instruction retired by the pipeline
+typedef void (*commitHook_t)(void *ctx, const commitRecord_t *record);
+
+// One cycle of the pipeline, specialized for each configuration
+typedef void (*cpuStepFn_t)(cpu_t *cpu);
+
+// CPU State
+struct cpu {
+	cpu_config_t	config;
+	cpuStepFn_t		step;		// Kernel of the configuration
+
 	uint8_t iteration;
 
     uint32_t pc;
     uint32_t regs[REGS_NUM];
 	bus_t bus;
 
-	// Pipeline
-	pipeFetch_t  *pipeFetch;	// IF-ID registers
-	pipeDecode_t *pipeDecode; 	// ID-EX registers
-	pipeEx_t	 *pipeEx;		// EX-ME registers
-	pipeMem_t	 *pipeMem;		// ME-WB registers
-} cpu_t;
-
+	// Pipeline, double buffered:
+	// stages read the current bank and write the next one,
+	// the banks are swapped at the end of each cycle
+	pipeBank_t	pipe[2];
+	uint8_t		cur;
+
+	// Trace of the pipeline activity, NULL when nobody is listening
+	FILE			*trace;
+	// Disassembly cache, one entry per IRAM word (plus one for
+	// out of range addresses), allocated on the first request
+	disasmEntry_t	*disasm;
+
+	// Predecoded IRAM, one entry per IRAM word
+	// An entry is invalidated when its IRAM word is written
+	decodedOp_t		*decoded;
+	decodedOp_t		decoded_oob;	// Used for addresses out of IRAM
+
+	// Functional model, see cpu_run_functional()
+	funcState_t		func;
+	uint32_t		breakpoint;		// IRAM word the functional model stops at, FF_NO_MARKER if none
+	funcDispatch_t	dispatch;
+	jit_t			*jit;
+	blockCache_t	*blocks;
+	uint64_t		*bbv;			// Instructions executed per block start, see cpu_set_bbv()
+
+	cpuStats_t		stats;
+	cpuCounters_t	*counters;		// NULL until counting, see cpu_set_counters()
+	bool			counting;
+	FILE			*counters_fd;	// Periodic write, see cpu_counters_every()
+	countersFormat_t counters_format;
+	uint64_t		counters_every;
+	uint64_t		counters_next;	// Cycle of the next write, UINT64_MAX if none
+	idleState_t		idle;
+	predictor_t		*predictor;		// NULL with PREDICT_NONE, see cpu_predictor.c
+	predictorStats_t predict;
+	bool			flush;			// Set by the stage resolving a mispredicted jump
+	commitTrace_t	*commit;		// Retired instructions, NULL when not traced
+	commitHook_t	commit_hook;	// NULL if none, see cpu_set_commit_hook()
+	void			*commit_ctx;
+};
+
+// Base of the jump target, pc is a word address
+#define JUMP_BASE(config, pc)	((config)->relative_jump ? ((pc) + 1)*4 : 0)
+
+// Bank holding the registers latched at the end of the previous cycle
+#define PIPE_CUR(cpu)	(&(cpu)->pipe[(cpu)->cur])
+// Bank being written during the current cycle
+#define PIPE_NEXT(cpu)	(&(cpu)->pipe[(cpu)->cur ^ 1])
 
 
 ////////////////////////////////////
 // PIPELINE
 ////////////////////////////////////
 
+// Control unit, returns the control word of the instruction
+controlWord_t control_unit(uint32_t instr);
+
+// Extract the fields of the instruction and its control word
+void decode_instruction(uint32_t instr, decodedOp_t *op);
+
+// Each stage reads the previous pipe and fills the next one,
+// returns the filled pipe or NULL on error
+
 // Fetch instruction
-pipeFetch_t *instruction_fetch(void *handle);
+pipeFetch_t *instruction_fetch(void *handle, pipeFetch_t *pipeFetch);
 
 // Decode instruction
-pipeDecode_t* instruction_decode(void *handle, pipeFetch_t *pipeFetch); 
+pipeDecode_t* instruction_decode(void *handle, const pipeFetch_t *pipeFetch, pipeDecode_t *pipeDecode); 
 
 // Ex stage
-pipeEx_t* instruction_exe(void *handle, pipeDecode_t *pipeDecode);
+pipeEx_t* instruction_exe(void *handle, const pipeDecode_t *pipeDecode, pipeEx_t *pipeEx);
 
 // Mem stage
-pipeMem_t* instruction_mem(void *handle, pipeEx_t *pipeEx);
+pipeMem_t* instruction_mem(void *handle, const pipeEx_t *pipeEx, pipeMem_t *pipeMem);
 
 // WriteBack stage
-void instruction_WB(void *handle, pipeMem_t *pipeMem);
+void instruction_WB(void *handle, const pipeMem_t *pipeMem);
+
+// ALU, returns 0 on success or -1 if ALU_opcode doesn't exist
+int alu_execute(uint16_t ALU_opcode, uint32_t a, uint32_t b, uint32_t *ALU_out);
+
+// Keep the loaded half-word/byte of the memory word, extending it
+uint32_t load_extend(uint8_t opcode, uint32_t data);
+
+// Keep the stored half-word/byte of the register
+uint32_t store_mask(controlWord_t controlWord, uint32_t data);
+
+////////////////////////////////////
+// FUNCTIONAL MODEL
+////////////////////////////////////
+// Execute n instructions at ISA level, with no pipeline registers.
+// The architectural results (registers, memory, delay slots, hazards
+// not covered by the forwarding) are the pipeline ones.
+// Instructions already in the pipeline are completed first, the next
+// cpu_step() restarts the pipeline from the current PC.
+// Returns the number of executed instructions
+uint64_t cpu_run_functional(void *handle, uint64_t n);
+
+// Give the architectural state back to the pipeline, called by cpu_step()
+void cpu_leave_functional(void *handle);
+
+// Select the dispatch of the functional model,
+// FUNC_DISPATCH_THREADED falls back to the switch if not supported
+void cpu_set_dispatch(void *handle, funcDispatch_t dispatch);
+
+// No marker for cpu_fast_forward()
+#define FF_NO_MARKER	((uint32_t)-1)
+
+// Execute up to n instructions with the functional model, stopping
+// before the IRAM word marker (FF_NO_MARKER to run all of them), then
+// refill the pipeline and clear the statistics, so that they only
+// cover the region of interest run by cpu_step() from there.
+// The pipeline may restart a few instructions past the marker, when
+// they read registers not written back yet (see cpu_leave_functional()).
+// Returns the number of executed instructions
+uint64_t cpu_fast_forward(void *handle, uint64_t n, uint32_t marker);
+
+// Basic block vector: while counts is not NULL, the functional model
+// runs by blocks and adds the instructions executed by each of them to
+// counts[first IRAM word of the block], counts has IRAM_SIZE entries.
+// Instructions run outside a block are counted by themselves
+void cpu_set_bbv(void *handle, uint64_t *counts);
+
+////////////////////////////////////
+// CHECKPOINTS
+////////////////////////////////////
+// Save the architectural state (PC, registers, memories, functional
+// model state) after completing the instructions in the pipeline.
+// Returns 0 on success, -1 on error
+int cpu_checkpoint_save(void *handle, FILE *fd);
+
+// Restore a state saved with the same cpu_config_t, the CPU is left on
+// the functional model and the statistics are cleared. Returns 0 on success, -1 on error
+int cpu_checkpoint_load(void *handle, FILE *fd);
+
+////////////////////////////////////
+// COMMIT TRACE
+////////////////////////////////////
+// Binary trace of the instructions retired by the pipeline, for the
+// comparison with the HDL. The records are encoded in a ring of chunks
+// and written to the file by a thread of the trace, so cpu_step() only
+// waits when the writer is behind by the whole ring.
+// The instructions run by the functional model (fast-forward, skipped
+// idle loops) are not in it.
+//
+// Layout: "DLXC" magic, version, then one record per instruction:
+//	flags byte (COMMIT_*)
+//	cycle, varint delta from the previous record, unless COMMIT_TICK
+//	pc, zigzag varint of the jump from the next word, unless COMMIT_SEQ
+//	instruction, 4 bytes little endian
+//	COMMIT_REG: register byte, varint value
+//	COMMIT_LOAD/COMMIT_STORE: address, zigzag varint delta from the
+//	previous access, varint data
+// A COMMIT_RESET record, only the flags, marks a cpu_reset(): the deltas
+// start again from zero
+#define COMMIT_MAGIC		0x43584c44		// "DLXC"
+#define COMMIT_VERSION		1
+#define COMMIT_RECORD_MAX	36				// Bytes of the longest record
+
+#define COMMIT_REG		0x01		// Register written
+#define COMMIT_LOAD		0x02
+#define COMMIT_STORE	0x04
+#define COMMIT_SEQ		0x08		// PC is the word after the previous one, not encoded
+#define COMMIT_RESET	0x10
+#define COMMIT_TICK		0x20		// Cycle after the one of the previous record, not encoded
+
+struct commitRecord {
+	uint64_t cycle;			// Cycle the instruction is written back
+	uint32_t pc;			// Word address
+	uint32_t instr;
+	uint32_t value;			// Written to the register
+	uint32_t addr;			// Memory word accessed
+	uint32_t data;			// Loaded, as written to the register, or stored
+	uint8_t  rd;
+	uint8_t  flags;			// COMMIT_*, COMMIT_SEQ and COMMIT_TICK are set by the encoder
+};
+
+// State of the deltas, the same for the encoder and the decoder
+typedef struct {
+	uint64_t cycle;
+	uint32_t pc;
+	uint32_t addr;
+} commitCoder_t;
+
+// Encode the record in buf, at least COMMIT_RECORD_MAX bytes.
+// Returns the bytes written
+size_t commit_encode(commitCoder_t *coder, const commitRecord_t *record, uint8_t *buf);
+
+// Decode the record at buf, of len bytes.
+// Returns the bytes read, 0 if the record is truncated
+size_t commit_decode(commitCoder_t *coder, const uint8_t *buf, size_t len, commitRecord_t *record);
+
+// Print the record on one line, the instruction disassembled, with no
+// newline
+void commit_print(FILE *fd, const commitRecord_t *record);
+
+// Start tracing the retired instructions to filename, replacing any
+// previous trace. Returns 0 on success, -1 on error
+int cpu_commit_open(void *handle, const char *filename);
+
+// Flush and close the trace, if any. Returns 0 if every record has
+// been written, -1 on error
+int cpu_commit_close(void *handle);
+
+// Call hook with every instruction retired by the pipeline, as it is
+// written back, NULL to stop. The records are the ones of the trace,
+// COMMIT_SEQ and COMMIT_TICK aside
+void cpu_set_commit_hook(void *handle, commitHook_t hook, void *ctx);
+
+// Record of the instruction written back, called by cpu_step()
+void cpu_commit(cpu_t *cpu, const pipeMem_t *pipeMem);
+
+// Mark a reset in the trace, called by cpu_reset()
+void cpu_commit_reset(cpu_t *cpu);
+
+////////////////////////////////////
+// PERFORMANCE COUNTERS
+////////////////////////////////////
+// Breakdown of cpuStats_t, counted by kernels of their own (see
+// cpu_step_kernel()): a CPU not counting runs the same code as without
+// counters. Cleared with the statistics. Like them, they leave out the
+// instructions of the functional model, and count the idle loop
+// iterations skipped by cpu_skip_idle().
+typedef enum {
+	ACCESS_WORD,
+	ACCESS_HALF,
+	ACCESS_BYTE,
+	ACCESS_WIDTHS
+} accessWidth_t;
+
+struct cpuCounters {
+	uint64_t bubbles[PIPE_STAGES];	// Cycles a pipeline register held a NOP, or nothing
+									// while filling: IF/ID, ID/EX, EX/MEM, MEM/WB
+	uint64_t fwd_alu;				// Operands forwarded from the EX stage, see forward_alu_out()
+	uint64_t fwd_mem;				// Operands forwarded from the MEM stage, see forward_mem_out()
+	uint64_t taken;					// BEQZ and BNEZ
+	uint64_t not_taken;
+	uint64_t jumps;					// J, JAL, JR, JALR
+	uint64_t loads[ACCESS_WIDTHS];
+	uint64_t stores[ACCESS_WIDTHS];
+	uint64_t opcode[64];			// Instructions retired by opcode
+	uint64_t rtype[64];				// R-type ones by function, if below 64
+};
+
+// Start or stop counting, the counters are kept
+void cpu_set_counters(void *handle, bool enable);
+
+// Get the performance counters
+const cpuCounters_t *cpu_get_counters(void *handle);
+
+// Write the statistics and the counters at the current cycle, the
+// opcodes never retired are left out, the predictor statistics are in
+// with a predictor. header adds the CSV header.
+// Returns 0, -1 on error
+int cpu_counters_write(void *handle, FILE *fd, countersFormat_t format, bool header);
+
+// Also count, and write the counters every interval cycles (0 stops).
+// The CSV header is written first. Returns 0, -1 on error
+int cpu_counters_every(void *handle, FILE *fd, countersFormat_t format, uint64_t interval);
+
+// Periodic write, called by cpu_step() on the cycle it's due and by
+// cpu_skip_idle() at the end of the period reaching it
+void cpu_counters_tick(cpu_t *cpu);
+
+// Count the len words of the idle loop at head retired iterations times,
+// called by cpu_skip_idle()
+void cpu_counters_idle(cpu_t *cpu, uint32_t head, uint32_t len, uint64_t iterations);
+
+// Zero the counters, called with the statistics cleared
+void cpu_clear_counters(cpu_t *cpu);
+
+////////////////////////////////////
+// BRANCH PREDICTION
+////////////////////////////////////
+// With a predictor the jumps have no delay slots. The fetch stage asks
+// the predictor for the word to fetch next, the stage resolving the
+// jumps (EX, MEM or WB for config.delayslot 1, 2 or 3) checks it: on a
+// misprediction the instructions fetched after the jump are squashed
+// and the fetch restarts from the right word, config.delayslot cycles
+// lost. The squashed ones flow down the pipeline as NOPs but aren't
+// retired: they are counted in predictorStats_t.flushed only, not in the
+// statistics, the counters or the commit records.
+// The direction of BEQZ and BNEZ is predicted by PREDICT_NOT_TAKEN,
+// PREDICT_BIMODAL or PREDICT_GSHARE, the targets of every jump by a BTB,
+// the ones of JR R31 by a return address stack. The tables are updated
+// as the jumps are resolved.
+// The programs must not rely on the delay slots (e.g. NOPs in them).
+// The functional model executes the delay slots, so it isn't available
+// with a predictor: no fast-forward, no checkpoints.
+#define PREDICT_TABLE_BITS	10		// 2-bit counters, global history of gshare
+#define PREDICT_BTB_BITS	8		// BTB entries, direct mapped
+#define PREDICT_RAS_DEPTH	16
+
+// Name of the predictor: none, not_taken, bimodal, gshare
+const char *predictor_name(predictorKind_t kind);
+
+// Predictor of the name, -1 if not known
+int predictor_kind(const char *name);
+
+// Tables of the predictor, NULL with PREDICT_NONE or on error
+predictor_t *predictor_create(predictorKind_t kind);
+
+void predictor_free(predictor_t *predictor);
+
+// Forget what has been learned, called by cpu_reset()
+void predictor_reset(predictor_t *predictor);
+
+// Word to fetch after the instruction op at pc, called by the fetch stage
+uint32_t predictor_next(cpu_t *cpu, uint32_t pc, const decodedOp_t *op);
+
+// Train the predictor with the jump instr at pc, resolved to the word
+// actual while predicted was fetched after it.
+// Returns true if mispredicted
+bool predictor_resolve(cpu_t *cpu, uint32_t pc, uint32_t instr, bool taken, uint32_t actual, uint32_t predicted);
+
+// Resolve the jumps of the len words of the idle loop at head, all
+// predicted right, iterations times. Called by cpu_skip_idle()
+void predictor_idle(cpu_t *cpu, uint32_t head, uint32_t len, uint64_t iterations);
+
+// Get the statistics of the predictor
+const predictorStats_t *cpu_get_predictor_stats(void *handle);
+
+// Handler of the predecoded instruction
+funcHandler_t func_select_handler(const decodedOp_t *op);
+
+// Execute n instructions with the interpreter, whatever the dispatch
+uint64_t func_interpret(cpu_t *cpu, uint64_t n);
+
+////////////////////////////////////
+// BLOCKS
+////////////////////////////////////
+// The translators run the functional model by blocks: from an IRAM word
+// up to a jump followed by its delay slots (or BLOCK_MAX instructions),
+// so that no jump is pending when a block is left.
+// The hazards inside the block are resolved while translating: each
+// register read becomes the RF, the value overwritten by an earlier
+// instruction of the block or a constant. A block is entered only if its
+// first two instructions don't read the hazards left before it
+// (reads0/reads1), and on exit funcState_t is left as by the interpreter.
+#define BLOCK_MAX		64
+#define BLOCK_LEN_MAX	(BLOCK_MAX + MAX_DELAYSLOT)
+
+#define BLOCK_IS_JUMP(h)	((h) >= H_J && (h) <= H_BNEZ)
+// Left to the interpreter
+#define BLOCK_IS_LEFT(h)	((h) == H_INVALID || (h) == H_BREAK)
+
+// Where a value read by an instruction of the block is
+typedef enum {
+	SRC_REG,		// RF
+	SRC_OLD,		// RF value overwritten by an instruction of the block
+	SRC_CONST
+} blockSrcKind_t;
+
+typedef struct {
+	blockSrcKind_t	kind;
+	uint32_t		val;	// Register, instruction or constant
+} blockSrc_t;
+
+// funcWrite_t of an instruction of the block, as known while translating
+typedef struct {
+	int			idx;		// Instruction of the block, -1 before the block
+	uint8_t		rd;
+	uint32_t	near;
+	uint32_t	far;
+	bool		load;
+	bool		fwd_const;	// The forwarded value is fwd, otherwise the written one
+	uint32_t	fwd;
+} blockWrite_t;
+
+typedef struct {
+	uint32_t			pc;
+	int					n;
+	int					branch;						// Jump of the block, -1 if none
+	const cpu_config_t	*config;
+	const decodedOp_t	*op[BLOCK_LEN_MAX];
+	blockSrc_t			a[BLOCK_LEN_MAX];			// Operands of each instruction:
+	blockSrc_t			b[BLOCK_LEN_MAX];			// rs1, rs2 or immediate
+	blockWrite_t		w[BLOCK_LEN_MAX + 1][2];	// Writes seen by each instruction, w[n] on exit
+	bool				old[BLOCK_LEN_MAX];			// The value overwritten by the instruction is needed
+	uint32_t			reads0;						// Registers read by the first two instructions
+	uint32_t			reads1;
+} blockInfo_t;
+
+// Analyze the block at pc, returns its instructions, 0 if it can't be translated.
+// The overwritten values needed to leave after the last instruction or
+// after a store are marked as well
+int block_analyze(cpu_t *cpu, uint32_t pc, blockInfo_t *info);
+
+// Value overwritten and value forwarded by w[k], where w are the writes
+// seen by an instruction
+blockSrc_t block_old(blockInfo_t *info, const blockWrite_t *w, int k);
+blockSrc_t block_fwd(blockInfo_t *info, const blockWrite_t *w, int k);
+
+// Execute n instructions with the blocks translated to closures
+uint64_t block_run(cpu_t *cpu, uint64_t n);
+
+// The IRAM word idx has been written
+void block_invalidate(blockCache_t *cache, uint32_t idx);
+
+// Free the translated blocks
+void block_free(blockCache_t *cache);
+
+////////////////////////////////////
+// JIT
+////////////////////////////////////
+// Execute n instructions translating the IRAM into x86-64 code,
+// what can't be translated is left to the interpreter.
+// On other hosts the closures run instead
+uint64_t jit_run(cpu_t *cpu, uint64_t n);
+
+// The IRAM word idx has been written
+void jit_invalidate(jit_t *jit, uint32_t idx);
+
+// Free the translated code
+void jit_free(jit_t *jit);
 
 
 
@@ -219,8 +816,20 @@ void instruction_WB(void *handle, pipeMem_t *pipeMem);
 // Execute one step
 void cpu_step(void *handle);
 
-// Create CPU instance
-void* cpu_create();
+// Create CPU instance with the given microarchitecture, NULL for
+// CPU_CONFIG_DEFAULT
+void* cpu_create(const cpu_config_t *config);
+
+// Change the microarchitecture, the CPU is reset and the translations
+// dropped. Returns 0, -1 if the configuration is not valid
+int cpu_set_config(void *handle, const cpu_config_t *config);
+
+// Get the microarchitecture
+const cpu_config_t *cpu_get_config(void *handle);
+
+// Pipeline kernel specialized for the configuration, and counting the
+// performance counters or not. NULL if not valid
+cpuStepFn_t cpu_step_kernel(const cpu_config_t *config, bool counting);
 
 // Reset CPU
 void cpu_reset(void *handle); 
@@ -231,11 +840,44 @@ void cpu_load_instr(void *handle, uint32_t addr, uint32_t instr);
 // Load data into read only memory
 void cpu_load_rodata(void *handle, uint32_t addr, uint32_t data);
 
-// Forward ALU result to the ID stage
-void forward_alu_out(cpu_t *cpu);
+// Predecode the whole IRAM
+void cpu_predecode(void *handle);
+
+// Free CPU instance
+void cpu_free(void *handle);
+
+// Set where the pipeline activity is printed, NULL to disable it
+void cpu_set_trace(void *handle, FILE *fd);
 
-// Forward MEM out to the ID stage
-void forward_mem_out(cpu_t *cpu);
+// Drop the predecoded copy of the IRAM word idx and its translations
+void cpu_invalidate_decoded(void *handle, uint32_t idx);
+
+// Clear the pipeline statistics
+void cpu_clear_stats(void *handle);
+
+// Follow the fetched word, called by cpu_step()
+void cpu_track_idle(cpu_t *cpu, uint32_t pc);
+
+// Returns the period in cycles of the idle loop the pipeline is
+// spinning in, 0 if none. A loop is idle when its instructions don't
+// access the memory nor write registers, so that nothing can break it:
+// its jumps read registers that never change again. It is reported once
+// the pipeline holds nothing else and the loop jump has been resolved
+uint32_t cpu_get_idle(void *handle);
+
+// Skip up to the given cycles of the idle loop, advancing the
+// statistics, the counters and the predictor as the pipeline would, a
+// periodic write due made at the end of the period reaching it. Only
+// whole periods of the pipeline state are skipped. Nothing is skipped
+// while the instructions retired are traced or hooked (see
+// cpu_commit_open()). Returns the skipped cycles, 0 if not idle
+uint64_t cpu_skip_idle(void *handle, uint64_t cycles);
+
+// Forward ALU result to the ID stage, returns the operands forwarded
+uint32_t forward_alu_out(cpu_t *cpu);
+
+// Forward MEM out to the ID stage, returns the operands forwarded
+uint32_t forward_mem_out(cpu_t *cpu);
 ////////////////////////////////////
 // GETTER
 ////////////////////////////////////
@@ -248,9 +890,22 @@ uint32_t cpu_get_reg(void *handle, int idx);
 // Get a data from the memory
 uint32_t cpu_get_mem_data(void *handle, uint32_t addr);	
 
+// cpu_get_mem_data() of the execution engines, the DRAM is read inline
+static inline uint32_t cpu_load_word(cpu_t *cpu, uint32_t addr){
+	if(addr - DRAM_BASE < DRAM_SIZE)
+		return mem_load(&cpu->bus.dram, addr - DRAM_BASE);
+	return cpu_get_mem_data(cpu, addr);
+}
+
 // Get a IRAM content 
 uint32_t cpu_get_instr(void *handle, uint32_t addr);
 
+// Get the predecoded IRAM content, decoding it if not valid
+const decodedOp_t *cpu_get_decoded(void *handle, uint32_t addr);
+
+// Get the pipeline statistics
+const cpuStats_t *cpu_get_stats(void *handle);
+
 ////////////////////////////////////
 // WRITING
 ////////////////////////////////////
@@ -260,12 +915,35 @@ void cpu_write_reg(void* handle, int idx, uint32_t data);
 // Write data to memory
 void cpu_write_mem_data(void *handle, uint32_t addr, uint32_t data);
 
+// cpu_write_mem_data() of the execution engines, the DRAM is written inline
+static inline void cpu_store_word(cpu_t *cpu, uint32_t addr, uint32_t data){
+	if(addr - DRAM_BASE < DRAM_SIZE)
+		mem_store(&cpu->bus.dram, addr - DRAM_BASE, data);
+	else
+		cpu_write_mem_data(cpu, addr, data);
+}
+
 ////////////////////////////////////
 // EXTRA 
 ////////////////////////////////////
 // Return the string of the instruction
 char *identify_instruction(uint32_t instr);
 
+// Write the string of the instruction into buf
+void disassemble(uint32_t instr, char *buf, size_t len);
+
+// Return the string of the instruction at the IRAM address addr,
+// the string is cached until the IRAM word changes
+const char *cpu_disasm(void *handle, uint32_t addr, uint32_t instr);
+
 // Print only when debug flag
 void print_debug(char *s);
+
+// Format and print only when debug flag,
+// without it the arguments are never formatted
+#ifdef DEBUG
+#define PRINT_DEBUG(...)	printf(__VA_ARGS__)
+#else
+#define PRINT_DEBUG(...)	do { if(0) printf(__VA_ARGS__); } while(0)
+#endif
 #endif //CPU_MODEL_H
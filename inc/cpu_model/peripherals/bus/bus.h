@@ -1,6 +1,7 @@
 #ifndef BUS_H
 #define BUS_H
 
+#include <stdbool.h>
 #include <cpu_model/peripherals/memory/memory.h>
 #include <cpu_model/peripherals/uart/uart.h>
 
@@ -17,6 +18,11 @@
 #define IRAM_BASE	0x20000000
 #define IRAM_SIZE	0x00001000
 
+// Extended ram, sparse: up to the end of the address space, the pages
+// take host memory only once written
+#define XRAM_BASE	0x40000000
+#define XRAM_SIZE	0xc0000000
+
 //////////////////////////////////
 // Memory mapped peripherals
 //////////////////////////////////
@@ -27,11 +33,51 @@
 #define UART1_RX		(UART1_BASE + UART_RX_OFFSET)
 #define UART1_STATUS	(UART1_BASE + UART_STATUS_OFFSET)
 
+//////////////////////////////////
+// Address decode
+//////////////////////////////////
+// The word address space is split in pages, every page is found with
+// one shift and one load: read_page/write_page hold the host words of
+// the RAM backed pages, NULL when the access goes to the device of the
+// page (MMIO, or RAM needing more than a store: read only or IRAM).
+// Every memory starts on a page and covers whole pages.
+// The XRAM pages have no entry until they are touched: a read maps the
+// shared zero page, a write maps a page of its own
+#define BUS_PAGE_BITS	MEM_PAGE_BITS
+#define BUS_PAGE_WORDS	(1u << BUS_PAGE_BITS)
+#define BUS_PAGE_MASK	(BUS_PAGE_WORDS - 1)
+#define BUS_PAGES		(1u << (32 - BUS_PAGE_BITS))
+#define BUS_DEVICES_MAX	8
+
+// Device handlers, addr is the bus address. Return 0 when OK
+typedef int (*busRead_t)(void *ctx, uint32_t addr, uint32_t *out);
+typedef int (*busWrite_t)(void *ctx, uint32_t addr, uint32_t val);
+
+typedef struct {
+	busRead_t	read;		// NULL if not readable
+	busWrite_t	write;		// NULL if not writable
+	void		*ctx;
+} busDevice_t;
+
 typedef struct {
+	// Indexed by page, allocated at bus_init(). Only the pages touched
+	// by the lookups take host memory
+	uint32_t	**read_page;
+	uint32_t	**write_page;
+	uint8_t		*device;				// 1 + index in devices, 0 if not mapped
+	busDevice_t	devices[BUS_DEVICES_MAX];
+	int			ndevices;
+
 	memory_t	iram;
 	memory_t	dram;
 	memory_t	rodata;
+	sparseMem_t	xram;
 	uart_t		*uart1;
+
+	// Called after an IRAM word is written, with its index,
+	// so that whatever was derived from the old word is dropped
+	void		(*iram_write_cb)(void *ctx, uint32_t idx);
+	void		*iram_write_ctx;
 } bus_t;
 
 int bus_read(bus_t *bus, uint32_t addr, uint32_t *out);
@@ -39,4 +85,17 @@ int bus_write(bus_t *bus, uint32_t addr, uint32_t val);
 int bus_init(bus_t *bus);
 int bus_reset(bus_t *bus);
 void bus_free(bus_t *bus);
+
+// Map the memory at its base address, reads and, if writable, writes
+// go straight to its words. The device, if any, takes the other accesses.
+// Returns 0 when OK
+int bus_map_memory(bus_t *bus, memory_t *mem, bool writable, const busDevice_t *device);
+
+// Map a device on the pages covering [base, base + size)
+// Returns 0 when OK
+int bus_map_device(bus_t *bus, uint32_t base, uint32_t size, const busDevice_t *device);
+
+// Words of the XRAM page, allocated and mapped if never written.
+// Returns NULL if the allocation fails
+uint32_t *bus_xram_page(bus_t *bus, uint32_t page);
 #endif //BUS_H
@@ -3,12 +3,29 @@
 
 #include <stdint.h>
 
+// The memories are word addressed, each word is kept as a host word:
+// the half-words and bytes are the low bits of the word (see
+// load_extend() and store_mask()), so no byte order is visible to the
+// program. Only the checkpoints expose it, they are in host byte order
 typedef struct {
-	uint8_t *data;
+	uint32_t *data;
 	uint32_t size;			// In words
 	uint32_t base_addr;		// To be used for memory map
 } memory_t;
 
+// Sparse memory, for the large regions: the words are kept in pages
+// allocated on the first write. The pages never written are all the
+// same read only zero page, the first write of a page copies it
+#define MEM_PAGE_BITS	12
+#define MEM_PAGE_WORDS	(1u << MEM_PAGE_BITS)
+
+typedef struct {
+	uint32_t **page;		// Indexed by page, NULL if never written
+	uint32_t pages;			// Size, in pages
+	uint32_t touched;		// Pages allocated
+	uint32_t base_addr;
+} sparseMem_t;
+
 typedef struct {
 	memory_t iram;
 	memory_t dram;
@@ -26,7 +43,45 @@ int mem_read(memory_t *mem, uint32_t addr, uint32_t *out);
 // Returns 0 when OK
 int mem_write(memory_t *mem, uint32_t addr, uint32_t val);
 
+// Fast paths, idx is the word index inside the memory and it is
+// not checked: the caller has already matched the address
+static inline uint32_t mem_load(const memory_t *mem, uint32_t idx){
+	return mem->data[idx];
+}
+
+static inline void mem_store(memory_t *mem, uint32_t idx, uint32_t val){
+	mem->data[idx] = val;
+}
+
+// Copy n words from src to the memory from addr
+// Returns 0 when OK, -1 if they don't fit
+int mem_copy_in(memory_t *mem, uint32_t addr, const uint32_t *src, uint32_t n);
+
+// Copy n words of the memory from addr to dst
+// Returns 0 when OK, -1 if they are not all in the memory
+int mem_copy_out(const memory_t *mem, uint32_t addr, uint32_t *dst, uint32_t n);
+
+// Zero the whole memory
+void mem_clear(memory_t *mem);
+
 // Free memory
 void mem_free(memory_t *mem);
 
+// Initialize a sparse memory of pages*MEM_PAGE_WORDS words, nothing
+// is allocated but the page index
+// Returns 0 when OK
+int sparse_init(sparseMem_t *mem, uint32_t pages, uint32_t base_addr);
+
+// The shared zero page, never written
+const uint32_t *sparse_zero_page(void);
+
+// Words of the page, allocated if never written. Returns NULL if the
+// allocation fails
+uint32_t *sparse_page(sparseMem_t *mem, uint32_t page);
+
+// Drop all the pages, the memory reads as zero again
+void sparse_clear(sparseMem_t *mem);
+
+void sparse_free(sparseMem_t *mem);
+
 #endif //MEMORY_H
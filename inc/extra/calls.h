@@ -0,0 +1,78 @@
+#ifndef CALLS_H
+#define CALLS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cpu_model/cpu_model.h>
+#include <extra/utils.h>
+
+// Shadow call stack of a guest program, built from the instructions it
+// retires (see cpu_set_commit_hook()). Following the calling convention
+// of programs/stdlib.asm, the first instruction retired away from a JAL
+// or a JALR (past its delay slots) enters a function, the one away from
+// a JR R31 returns; a return with nothing called is ignored, e.g. from
+// the function the program starts in.
+//
+// Each path of calls is a node of a calling context tree holding the
+// cycles spent on top of the stack there. calls_sum() gives each
+// function its calls, its inclusive cycles (callees included, recursion
+// counted once) and its exclusive ones; calls_fold() writes the tree as
+// folded stacks, the input of flamegraph.pl.
+
+#define CALL_DEPTH_MAX	256		// Deeper calls are counted in the deepest function
+
+typedef enum {
+	XFER_NONE,
+	XFER_CALL,			// JAL, JALR
+	XFER_RETURN,		// JR R31
+	XFER_JUMP,			// J, other JRs, branches
+} callXfer_t;
+
+// Node of the calling context tree: a function called along a path
+typedef struct callNode {
+	uint32_t		func;		// Entry address
+	uint64_t		calls;
+	uint64_t		self;		// Cycles with it on top of the stack
+	uint64_t		total;		// With its callees, see calls_sum()
+	struct callNode	*parent;
+	struct callNode	*child;		// First callee
+	struct callNode	*sibling;	// Next callee of the parent
+} callNode_t;
+
+// Zeroed before the first instruction
+typedef struct {
+	callNode_t	root;			// The function the program starts in
+	callNode_t	*top;
+	int			depth;
+	uint64_t	overflow;		// Calls past CALL_DEPTH_MAX not returned yet
+	callXfer_t	xfer;			// Last jump retired, until it lands
+	uint32_t	next;			// Address retired next if nothing jumps
+	uint64_t	cycle;			// Of the last instruction retired
+	bool		started;
+	bool		failed;			// Out of memory, the tree is partial
+} callTree_t;
+
+// Per function, by entry address
+typedef struct {
+	uint64_t	calls[IRAM_SIZE];
+	uint64_t	inclusive[IRAM_SIZE];
+	uint64_t	exclusive[IRAM_SIZE];
+	uint32_t	on_path[IRAM_SIZE];	// Frames of the function above the node visited
+} callFuncs_t;
+
+// Follow an instruction retired
+void calls_retired(callTree_t *calls, const commitRecord_t *record);
+
+// Sum the totals of the tree and add the cycles of each function to
+// funcs, zeroed by the caller
+void calls_sum(callTree_t *calls, callFuncs_t *funcs);
+
+// Write a "caller;callee cycles" line per node with cycles on top of the
+// stack, named after the labels (the address if none precedes it).
+// Returns 0, -1 on error
+int calls_fold(const callTree_t *calls, FILE *fd, const programLabel_t *labels, int nlabels);
+
+// Free the nodes of the tree
+void calls_free(callTree_t *calls);
+
+#endif //CALLS_H
@@ -0,0 +1,133 @@
+#ifndef COSIM_H
+#define COSIM_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <cpu_model/cpu_model.h>
+
+// Lockstep co-simulation with an external simulator (the HDL of the
+// DLX): the HDL sends each instruction it retires, the model checks it
+// against its own as it is written back (see cpu_set_commit_hook()).
+// Each record holds the PC, the instruction, the register written and
+// the memory word accessed, so the register files and the memories
+// match as long as the records do.
+//
+// The records go through a single producer single consumer ring in
+// POSIX shared memory (/dev/shm/<name>), created by the model and
+// attached by the HDL. No lock, no system call while running: each side
+// owns one index and reads the other one only when its cached copy says
+// the ring is full or empty. The indexes are published every
+// COSIM_BATCH records, so the cache lines holding them move between
+// the cores once per batch instead of once per record; each side
+// publishes its own before waiting for the other, so a batch left half
+// done never blocks.
+//
+// The HDL runs ahead of the model by the records the ring holds at most.
+// The model stops at the first mismatch and tells the HDL through state.
+// Neither side waits for the other more than COSIM_TIMEOUT_MS.
+
+#define COSIM_MAGIC		0x4d534f43		// "COSM"
+#define COSIM_VERSION	1
+#define COSIM_SLOTS		4096			// Default ring size, a power of two
+#define COSIM_BATCH		64				// Records per index update, divides the slots
+#define COSIM_LINE		64				// Cache line
+#define COSIM_TIMEOUT_MS	10000
+
+// Session state, in the shared memory
+typedef enum {
+	COSIM_WAITING,		// Created by the model, no HDL yet
+	COSIM_RUNNING,		// Attached by the HDL
+	COSIM_DONE,			// The HDL has sent its last record
+	COSIM_STOPPED,		// The model has found a mismatch, or has quit
+} cosimState_t;
+
+// Layout of the shared memory, the ring follows the header
+typedef struct {
+	_Alignas(COSIM_LINE) uint32_t magic;	// Written last by the model
+	uint32_t				version;
+	uint32_t				slots;
+	_Atomic uint32_t		state;			// cosimState_t
+	_Alignas(COSIM_LINE) _Atomic uint64_t tail;	// Records sent, written by the HDL
+	_Alignas(COSIM_LINE) _Atomic uint64_t head;	// Records checked, written by the model
+	_Alignas(COSIM_LINE) commitRecord_t ring[];
+} cosimShm_t;
+
+// Fields of a record that differ
+#define COSIM_DIFF_PC		0x01
+#define COSIM_DIFF_INSTR	0x02
+#define COSIM_DIFF_REG		0x04	// Register written, or its value
+#define COSIM_DIFF_MEM		0x08	// Load or store, address or data
+#define COSIM_DIFF_CYCLE	0x10	// Only if checked, see cosim_create()
+#define COSIM_DIFF_MISSING	0x20	// One side has retired fewer instructions,
+									// or the HDL has stopped answering
+
+// One end of the ring, private to the process
+typedef struct {
+	cosimShm_t		*shm;
+	size_t			size;				// Of the mapping
+	char			name[64];
+	bool			owner;				// Created here, unlinked on close
+	uint64_t		index;				// Own index: tail for the HDL, head for the model
+	uint64_t		other;				// Last seen index of the other side
+	// Model side
+	bool			cycles;				// Check the cycles as well
+	uint64_t		checked;			// Records matched
+	uint32_t		diff;				// COSIM_DIFF_* of the first mismatch, 0 if none
+	commitRecord_t	model;				// First mismatch, has_ false for
+	commitRecord_t	hdl;				// the side that retired nothing
+	bool			has_model;
+	bool			has_hdl;
+} cosimPort_t;
+
+// Model side: create the shared memory /name with a ring of slots
+// records (COSIM_SLOTS if 0), replacing any left by a previous session.
+// With cycles the write back cycles are compared too, the HDL must count
+// them as cpu_get_stats() does.
+// Returns NULL on error
+cosimPort_t *cosim_create(const char *name, uint32_t slots, bool cycles);
+
+// Wait up to timeout_ms for the HDL to attach.
+// Returns 0 when attached, -1 on timeout
+int cosim_wait_attach(cosimPort_t *port, int timeout_ms);
+
+// HDL side: attach to the shared memory /name, waiting up to timeout_ms
+// for the model to create it.
+// Returns NULL on error or timeout
+cosimPort_t *cosim_attach(const char *name, int timeout_ms);
+
+// HDL side: send the record of an instruction retired, waiting if the
+// ring is full.
+// Returns 0, -1 if the model has stopped or stopped answering
+int cosim_send(cosimPort_t *port, const commitRecord_t *record);
+
+// HDL side: publish the records sent and mark the end of the session
+void cosim_finish(cosimPort_t *port);
+
+// Model side: next record of the HDL, waiting for it.
+// Returns 1, 0 if the HDL has finished and no record is left, -1 if it
+// stopped answering
+int cosim_recv(cosimPort_t *port, commitRecord_t *record);
+
+// Model side: compare the record of the model with the next one of the
+// HDL. The first mismatch is kept in the port and the HDL is stopped.
+// Returns 0 if they match, -1 otherwise
+int cosim_check(cosimPort_t *port, const commitRecord_t *record);
+
+// commitHook_t of the model side, ctx is the port. Nothing is checked
+// after the first mismatch
+void cosim_check_hook(void *ctx, const commitRecord_t *record);
+
+// Model side: the model has nothing more to retire, check that the HDL
+// has finished as well.
+// Returns 0, -1 if the HDL has sent more records
+int cosim_end(cosimPort_t *port);
+
+// Model side: print the first mismatch, if any, to fd
+void cosim_report(const cosimPort_t *port, FILE *fd);
+
+// Leave the session: the model stops the HDL if still running, then the
+// shared memory is unmapped and, on the model side, removed
+void cosim_close(cosimPort_t *port);
+
+#endif //COSIM_H
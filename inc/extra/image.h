@@ -0,0 +1,47 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+#include <stdint.h>
+
+// Binary program image, written by the compiler next to the .mem file
+// (name.asm → name.asm.bin) and mapped by cpu_load_program().
+//
+// Layout, in host byte order (as the checkpoints):
+//	imageHeader_t, imageSection_t[nsections], payloads
+// Every payload starts at a multiple of IMAGE_ALIGN bytes, so that the
+// words are copied to the memories straight from the mapped file.
+// TEXT and RODATA are the words of the memory at addr, SYMTAB the TEXT
+// labels (the same of the .sym file)
+
+#define IMAGE_MAGIC		0x494c5844		// "DLXI"
+#define IMAGE_VERSION	1
+#define IMAGE_ALIGN		64
+#define IMAGE_ALIGN_UP(x)	(((x) + IMAGE_ALIGN - 1) & ~(uint32_t)(IMAGE_ALIGN - 1))
+
+// Header flags
+#define IMAGE_RELATIVE_JUMP		0x1		// Jumps encoded relative to the PC
+
+// Section types
+#define IMAGE_TEXT		1
+#define IMAGE_RODATA	2
+#define IMAGE_SYMTAB	3
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t nsections;
+} imageHeader_t;
+
+typedef struct {
+	uint32_t type;
+	uint32_t addr;			// Bus address of the first word, 0 for SYMTAB
+	uint32_t size;			// Words, or symbols for SYMTAB
+	uint32_t offset;		// From the beginning of the file, in bytes
+} imageSection_t;
+
+typedef struct {
+	uint32_t addr;			// Byte address, as the labels of the compiler
+	char	 name[64];		// NUL terminated
+} imageSymbol_t;
+
+#endif //IMAGE_H
@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <stdio.h>
+#include <stdint.h>
 
 // ANSI escape helpers
 #define CLEAR_SCREEN()       printf("\033[2J\033[H")				// Clear terminal
@@ -27,11 +28,29 @@
 #define QUIT 2
 #define CONTINUE 3
 
-void capture_cpu_step(void *handle);
-void draw_program_panel(void *handle); 
-void draw_left_panel(int step);
+// State of the interactive panels, one for each CPU shown
+typedef struct {
+	int  program_size;								// Instructions in the program panel
+	char step_output[MAX_STEP_LINES][MAX_LINE_LEN];	// Pipeline activity of the last step
+	int  step_line_count;
+} tui_t;
+
+void capture_cpu_step(tui_t *tui, void *handle);
+void draw_program_panel(tui_t *tui, void *handle); 
+void draw_left_panel(const tui_t *tui, int step);
 void print_state(void *handle);
 void draw_registers(void *handle);
-int press_and_continue(void *handle, int step);
+int press_and_continue(tui_t *tui, void *handle, int step);
 int cpu_load_program(void *handle, FILE *fd);
+
+// TEXT label of a program
+typedef struct {
+	uint32_t addr;			// IRAM word
+	char	 name[64];
+} programLabel_t;
+
+int program_load_labels(const char *filename, programLabel_t **labels);
+const programLabel_t *program_label_of(const programLabel_t *labels, int n, uint32_t addr);
+void program_addr_name(const programLabel_t *labels, int n, uint32_t addr, const char *fallback, char *buf, size_t size);
+int program_find_label(const char *filename, const char *label);
 #endif
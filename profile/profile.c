@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <cpu_model/cpu_model.h>
+#include <extra/utils.h>
+#include <extra/calls.h>
+
+// Per-PC profiler
+// Runs the program with the pipeline until it halts or the cycle limit
+// is reached, counting the executions of each IRAM address as the
+// instructions are written back (see cpu_set_commit_hook()). No stage
+// stalls, the program fills the delay slots and the hazards with NOPs:
+// the cycle of each NOP is a stall of the last instruction retired
+// before it that isn't one, e.g. the load or the branch it waits for,
+// and not of the NOP. Prints the addresses executed, hottest first:
+// address, executions, stalls, % of the cycles (its own and its stalls),
+// label (from the .sym file, or the SYMTAB of a .bin image) and
+// disassembly.
+// --top <n> prints the n hottest only (20, 0 for all), --address the
+// whole listing in program order with its labels instead,
+// --config <delayslot>,<yes|no>,<yes|no>[,<predictor>] the
+// microarchitecture (the build options by default). With a predictor the
+// instructions a misprediction squashes aren't retired, nor counted as
+// executed: the cycles they take are stalls of the jump.
+// With --calls the functions are profiled too, through a shadow call
+// stack (see extra/calls.h), named after their labels: they are printed
+// with their calls, their inclusive cycles (callees included, recursion
+// counted once) and their exclusive ones. --folded <file> also writes
+// the calling context tree as folded stacks, a "caller;callee cycles"
+// line per path, the input of flamegraph.pl.
+// Returns 0, -1 on error
+
+typedef struct {
+    uint64_t count[IRAM_SIZE];     // Executions
+    uint64_t stalls[IRAM_SIZE];    // NOPs retired after it, cycles retiring nothing
+    uint64_t cycles[IRAM_SIZE];    // Attributed, executions and stalls
+    uint32_t last;                 // Last instruction not a NOP, IRAM_SIZE if none yet
+    uint64_t orphans;              // NOPs retired before any other instruction
+    uint64_t cycle;                // Of the last instruction retired, 0 if none yet
+    callTree_t *calls;             // NULL without --calls
+} profile_t;
+
+// commitHook_t of the profiler
+static void profile_retired(void *ctx, const commitRecord_t *record) {
+    profile_t *profile = (profile_t *)ctx;
+    uint32_t   pc = record->pc;
+
+    // The cycles retiring nothing since the last one, taken by the
+    // instructions a misprediction squashed
+    if (profile->cycle != 0 && profile->last < IRAM_SIZE) {
+        profile->stalls[profile->last] += record->cycle - profile->cycle - 1;
+        profile->cycles[profile->last] += record->cycle - profile->cycle - 1;
+    }
+    profile->cycle = record->cycle;
+    if (pc >= IRAM_SIZE)
+        return;
+    profile->count[pc]++;
+    if (((record->instr >> 26) & 0x3F) != OPCODE_NOP) {
+        profile->last = pc;
+        profile->cycles[pc]++;
+    } else if (profile->last < IRAM_SIZE) {
+        profile->stalls[profile->last]++;
+        profile->cycles[profile->last]++;
+    } else {
+        profile->orphans++;
+    }
+    if (profile->calls != NULL)
+        calls_retired(profile->calls, record);
+}
+
+// true once the program has halted, as the batch runner
+static bool halted(cpu_t *cpu, int program_size) {
+    uint32_t pc = cpu_get_pc(cpu);
+    return (pc != (uint32_t)-1 && pc >= (uint32_t)(program_size + 4)) || cpu_get_idle(cpu) != 0;
+}
+
+// <delayslot>,<yes|no>,<yes|no>[,<predictor>], returns 0, -1 if not valid
+static int parse_config(const char *arg, cpu_config_t *config) {
+    unsigned delayslot;
+    char     forwarding[4], relative_jump[4], predictor[16] = "none", end;
+    int      n, kind;
+
+    n = sscanf(arg, "%u,%3[a-z],%3[a-z],%15[a-z_]%c", &delayslot, forwarding, relative_jump, predictor, &end);
+    kind = predictor_kind(predictor);
+    if ((n != 3 && n != 4) || kind < 0 ||
+        (strcmp(forwarding, "yes") != 0 && strcmp(forwarding, "no") != 0) ||
+        (strcmp(relative_jump, "yes") != 0 && strcmp(relative_jump, "no") != 0) ||
+        delayslot < 1 || delayslot > MAX_DELAYSLOT)
+        return -1;
+    config->delayslot     = (uint8_t)delayslot;
+    config->forwarding    = strcmp(forwarding, "yes") == 0;
+    config->relative_jump = strcmp(relative_jump, "yes") == 0;
+    config->predictor     = (uint8_t)kind;
+    return 0;
+}
+
+static const profile_t *sort_profile;
+
+// Hottest first, then the most executed, then by address
+static int hotter(const void *a, const void *b) {
+    uint32_t pa = *(const uint32_t *)a, pb = *(const uint32_t *)b;
+    uint64_t ca = sort_profile->cycles[pa], cb = sort_profile->cycles[pb];
+
+    if (ca != cb)
+        return ca > cb ? -1 : 1;
+    ca = sort_profile->count[pa];
+    cb = sort_profile->count[pb];
+    if (ca != cb)
+        return ca > cb ? -1 : 1;
+    return pa < pb ? -1 : pa > pb;
+}
+
+static void print_line(cpu_t *cpu, const profile_t *profile, uint64_t cycles, uint32_t pc,
+                       const programLabel_t *labels, int nlabels) {
+    uint32_t instr = cpu_get_instr(cpu, pc);
+    char     where[80], str[DISASM_LEN];
+
+    program_addr_name(labels, nlabels, pc, "", where, sizeof(where));
+    disassemble(instr, str, sizeof(str));
+    printf("  0x%08x %12llu %12llu %7.2f%%  %-24s %08x %s\n", pc * 4,
+           (unsigned long long)profile->count[pc], (unsigned long long)profile->stalls[pc],
+           cycles ? 100.0 * (double)profile->cycles[pc] / (double)cycles : 0.0,
+           where, instr, str);
+}
+
+////////////////////////////////////
+// CALL GRAPH
+////////////////////////////////////
+static const callFuncs_t *sort_funcs;
+
+// Most inclusive cycles first
+static int heavier(const void *a, const void *b) {
+    uint32_t pa = *(const uint32_t *)a, pb = *(const uint32_t *)b;
+    uint64_t ca = sort_funcs->inclusive[pa], cb = sort_funcs->inclusive[pb];
+
+    if (ca != cb)
+        return ca > cb ? -1 : 1;
+    return pa < pb ? -1 : pa > pb;
+}
+
+static void print_calls(callTree_t *calls, uint64_t cycles, const programLabel_t *labels, int nlabels) {
+    callFuncs_t *funcs = (callFuncs_t *)calloc(1, sizeof(callFuncs_t));
+    uint32_t    *order = (uint32_t *)malloc(IRAM_SIZE * sizeof(uint32_t));
+    uint32_t     pc, n = 0;
+    char         name[80], fallback[16];
+
+    if (funcs == NULL || order == NULL) {
+        fprintf(stderr, "[PROFILE] calloc() failed\n");
+        free(funcs);
+        free(order);
+        return;
+    }
+    calls_sum(calls, funcs);
+    for (pc = 0; pc < IRAM_SIZE; pc++)
+        if (funcs->calls[pc] != 0)
+            order[n++] = pc;
+    sort_funcs = funcs;
+    qsort(order, n, sizeof(uint32_t), heavier);
+
+    printf("\nFunctions:\n  %-24s %12s %14s %8s %14s %8s\n", "function", "calls", "inclusive", "", "exclusive", "");
+    for (pc = 0; pc < n; pc++) {
+        snprintf(fallback, sizeof(fallback), "0x%08x", order[pc] * 4);
+        program_addr_name(labels, nlabels, order[pc], fallback, name, sizeof(name));
+        printf("  %-24s %12llu %14llu %7.2f%% %14llu %7.2f%%\n", name, (unsigned long long)funcs->calls[order[pc]],
+               (unsigned long long)funcs->inclusive[order[pc]],
+               cycles ? 100.0 * (double)funcs->inclusive[order[pc]] / (double)cycles : 0.0,
+               (unsigned long long)funcs->exclusive[order[pc]],
+               cycles ? 100.0 * (double)funcs->exclusive[order[pc]] / (double)cycles : 0.0);
+    }
+    if (calls->failed)
+        printf("Out of memory, deeper calls counted in their caller\n");
+    free(order);
+    free(funcs);
+}
+
+int main(int argc, char *argv[]) {
+    cpu_config_t      config = CPU_CONFIG_DEFAULT;
+    const cpuStats_t *stats;
+    programLabel_t   *labels = NULL;
+    profile_t        *profile;
+    uint32_t         *order, pc, executed = 0;
+    uint64_t          max_cycles, flushed;
+    cpu_t            *cpu;
+    FILE             *fd;
+    bool              by_address = false, with_calls = false;
+    const char       *folded = NULL;
+    callTree_t        calls;
+    int               first = 1, top = 20, program_size, nlabels, i, l = 0, ret = 0;
+
+    while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+        if (strcmp(argv[first], "--top") == 0 && first + 1 < argc) {
+            top = atoi(argv[first + 1]);
+            first += 2;
+        } else if (strcmp(argv[first], "--address") == 0) {
+            by_address = true;
+            first++;
+        } else if (strcmp(argv[first], "--calls") == 0) {
+            with_calls = true;
+            first++;
+        } else if (strcmp(argv[first], "--folded") == 0 && first + 1 < argc) {
+            with_calls = true;
+            folded = argv[first + 1];
+            first += 2;
+        } else if (strcmp(argv[first], "--config") == 0 && first + 1 < argc) {
+            if (parse_config(argv[first + 1], &config) < 0) {
+                fprintf(stderr, "[PROFILE] Not a valid config: %s\n", argv[first + 1]);
+                exit(-1);
+            }
+            first += 2;
+        } else {
+            break;
+        }
+    }
+    if (argc != first + 2 || top < 0) {
+        fprintf(stderr, "Wrong usage: %s [--top <n>] [--address] [--calls] [--folded <file>] [--config <delayslot>,<yes|no>,<yes|no>[,<predictor>]] "
+                "<max_cycles> <filename.mem>\n", argv[0]);
+        exit(-1);
+    }
+    max_cycles = strtoull(argv[first], NULL, 0);
+
+    cpu = (cpu_t *)cpu_create(&config);
+    profile = (profile_t *)calloc(1, sizeof(profile_t));
+    order   = (uint32_t *)malloc(IRAM_SIZE * sizeof(uint32_t));
+    if (cpu == NULL || profile == NULL || order == NULL) {
+        fprintf(stderr, "[PROFILE] cpu_create() or calloc() failed\n");
+        exit(-3);
+    }
+    cpu_set_trace(cpu, NULL);
+    fd = fopen(argv[first + 1], "r");
+    if (fd == NULL) {
+        fprintf(stderr, "[PROFILE] fopen() failed | filename: %s\n", argv[first + 1]);
+        exit(-2);
+    }
+    program_size = cpu_load_program(cpu, fd);
+    fclose(fd);
+    if (program_size <= 0) {
+        fprintf(stderr, "[PROFILE] cpu_load_program() failed or empty program | filename: %s\n", argv[first + 1]);
+        exit(-2);
+    }
+    // Without labels the addresses are still listed
+    nlabels = program_load_labels(argv[first + 1], &labels);
+    if (nlabels < 0)
+        nlabels = 0;
+
+    profile->last = IRAM_SIZE;
+    memset(&calls, 0, sizeof(calls));
+    if (with_calls)
+        profile->calls = &calls;
+    stats = cpu_get_stats(cpu);
+    cpu_set_commit_hook(cpu, profile_retired, profile);
+    while (!halted(cpu, program_size) && (max_cycles == 0 || stats->cycles < max_cycles))
+        cpu_step(cpu);
+
+    for (pc = 0; pc < IRAM_SIZE; pc++)
+        if (profile->count[pc] != 0)
+            order[executed++] = pc;
+    flushed = cpu_get_predictor_stats(cpu)->flushed;
+    printf("Profile of %s: %llu cycles, %llu instructions, %llu NOPs, %llu cycles filling the pipeline",
+           argv[first + 1], (unsigned long long)stats->cycles, (unsigned long long)stats->retired,
+           (unsigned long long)stats->nops, (unsigned long long)(stats->cycles - stats->retired - flushed));
+    if (config.predictor != PREDICT_NONE)
+        printf(", %llu instructions squashed by the mispredicts", (unsigned long long)flushed);
+    printf("\n");
+    if (profile->orphans != 0)
+        printf("%llu NOPs retired before any other instruction\n", (unsigned long long)profile->orphans);
+    printf("  %-10s %12s %12s %8s  %-24s %s\n", "address", "executions", "stalls", "cycles", "label", "instruction");
+
+    if (by_address) {
+        for (i = 0; i < (int)executed; i++) {
+            pc = order[i];
+            // Labels of the executed code only
+            for (; l < nlabels && labels[l].addr < pc; l++)
+                ;
+            for (; l < nlabels && labels[l].addr == pc; l++)
+                printf("%s:\n", labels[l].name);
+            print_line(cpu, profile, stats->cycles, pc, labels, nlabels);
+        }
+    } else {
+        sort_profile = profile;
+        qsort(order, executed, sizeof(uint32_t), hotter);
+        for (i = 0; i < (int)executed && (top == 0 || i < top); i++)
+            print_line(cpu, profile, stats->cycles, order[i], labels, nlabels);
+    }
+
+    if (with_calls && calls.started) {
+        print_calls(&calls, stats->cycles, labels, nlabels);
+        if (folded != NULL) {
+            fd = fopen(folded, "w");
+            if (fd == NULL) {
+                fprintf(stderr, "[PROFILE] fopen() failed | filename: %s\n", folded);
+                ret = -1;
+            } else {
+                ret = calls_fold(&calls, fd, labels, nlabels);
+                if (fclose(fd) != 0)
+                    ret = -1;
+                if (ret == 0)
+                    printf("Folded stacks written to %s\n", folded);
+            }
+        }
+        calls_free(&calls);
+    }
+
+    free(labels);
+    free(order);
+    free(profile);
+    cpu_free(cpu);
+    return ret;
+}
@@ -0,0 +1,20 @@
+; ============================================================
+; bench_stdlib.asm
+; Hot loop over the stdlib routines not using the UART,
+; executed forever by the benchmark (make bench)
+; ============================================================
+
+.rodata
+msg  db "The quick brown fox jumps over the lazy dog, again and again", 10, 0
+
+.text
+addi sp, r0, #0x0FFF    ; init stack pointer
+loop:
+addi a0, r0, #msg       ; a0 = string address
+jal  strlen             ; v0 = length in words
+nop
+j    loop
+nop
+
+; Include section
+.include "stdlib.asm"
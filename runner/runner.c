@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cpu_model/cpu_model.h>
+#include <extra/utils.h>
+
+// Headless batch runner
+// Each program is run by the pipeline from reset until it halts or a
+// limit is reached. The programs are run in parallel by --jobs threads
+// (one per core by default), each with its own CPU, then a JSON object
+// per program is printed on its own line, in the order of the arguments:
+//	{"program": ..., "config": ..., "status": ..., "pc": ..., "cycles": ...,
+//	 "retired": ..., "nops": ..., "fill": ..., "skipped": ..., "cpi": ...,
+//	 "seconds": ..., "mips": ..., "mispredicts": ..., "accuracy": ...,
+//	 "mpki": ..., "flushed": ...}
+// status is one of
+//	"halted"             the PC ran past the last instruction and the
+//	                     pipeline is drained, or the program is spinning
+//	                     in an idle loop (see cpu_get_idle())
+//	"cycle_limit"        max_cycles simulated
+//	"instruction_limit"  max_instructions retired
+//	"error"              the program can't be loaded, or its commit
+//	                     trace can't be written
+// A limit of 0 means no limit. mips are the simulated instructions
+// retired per host second.
+// No stage stalls, the cycles above one per instruction are split in
+// "nops", delay slots and hazards the program fills with NOPs, and
+// "fill", cycles retiring nothing while the pipeline fills.
+// With --skip-idle an idle loop runs up to the limits, skipping its
+// cycles in bulk, "skipped" reports how many.
+// Each --config <delayslot>,<forwarding yes|no>,<relative_jump yes|no>
+// [,<predictor>] runs every program once more on that microarchitecture,
+// "config" reports it. Without any, the build options are used.
+// Each --grid <delayslots>:<forwardings>:<relative_jumps>[:<predictors>]
+// adds the cross product of the comma separated values, e.g.
+// 1,2,3:yes,no:yes:none,gshare.
+// The predictors are none (delay slots), not_taken, bimodal and gshare
+// (see predictor_kind()). "mispredicts" are the jumps resolved to another
+// word than the one fetched after them, "accuracy" the fraction of the
+// jumps predicted right (0 if none), "mpki" the mispredicts per thousand
+// retired instructions, "flushed" the instructions fetched past them and
+// squashed. The flushed ones aren't retired, so the cycles they take are
+// left out of "fill" and raise the CPI.
+// With --csv a header and a row per job are printed instead of JSON.
+// With --commit-trace each job writes the instructions it retires to
+// <filename>.<delayslot><forwarding><relative_jump>.commit, e.g.
+// prog.asm.mem.1yesno.commit (see cpu_commit_open()), the predictor
+// follows if any, e.g. prog.asm.mem.1yesno.gshare.commit.
+// With --counters <json|csv> each job writes its performance counters at
+// the end to <filename>.<delayslot><forwarding><relative_jump>.counters.
+// <json|csv>, named as the commit traces, and every --counters-every
+// <cycles> as well if given (see cpu_counters_write()).
+// Returns 0 if every program has been loaded
+
+typedef enum {
+	RUN_HALTED,
+	RUN_CYCLE_LIMIT,
+	RUN_INSTRUCTION_LIMIT,
+	RUN_ERROR,
+} runStatus_t;
+
+static const char *status_name[] = {
+	"halted",
+	"cycle_limit",
+	"instruction_limit",
+	"error",
+};
+
+// Limits shared by every job
+typedef struct {
+	uint64_t      max_cycles;
+	uint64_t      max_instructions;
+	bool          skip_idle;
+	const char  **programs;
+	cpu_config_t *configs;		// One job for each program and config
+	int           nconfigs;
+	bool          csv;
+	bool          commit;
+	bool          counters;
+	countersFormat_t counters_format;
+	uint64_t      counters_every;
+} options_t;
+
+typedef struct {
+	int          job;
+	runStatus_t  status;
+	uint32_t     pc;
+	cpuStats_t   stats;
+	predictorStats_t predict;
+	uint64_t     skipped;
+	double       seconds;
+} result_t;
+
+typedef struct pool pool_t;
+
+typedef struct {
+	pthread_t        thread;
+	int              id;
+	pool_t          *pool;
+	pthread_mutex_t  lock;		// Guards the deque
+	int             *jobs;		// Deque: jobs[top..bottom-1]
+	int              top, bottom;
+	result_t        *results;	// Results of the jobs run by the worker
+	int              count;
+} worker_t;
+
+struct pool {
+	const options_t *options;
+	worker_t        *worker;
+	int              workers;
+};
+
+static double elapsed_sec(struct timespec *start, struct timespec *end) {
+	return (double)(end->tv_sec - start->tv_sec) +
+	       (double)(end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// JSON string, only quotes, backslashes and control characters need escaping
+static void print_json_string(const char *s) {
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", (unsigned char)*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+// Run the loaded program until it halts or a limit is reached
+static runStatus_t run(cpu_t *cpu, int program_size, uint64_t max_cycles, uint64_t max_instructions,
+		bool skip_idle, uint64_t *skipped) {
+	const cpuStats_t *stats = cpu_get_stats(cpu);
+	uint64_t left;
+	uint32_t pc;
+
+	*skipped = 0;
+	while (1) {
+		pc = cpu_get_pc(cpu);
+		if (pc != (uint32_t)-1 && pc >= (uint32_t)(program_size + 4))
+			return RUN_HALTED;
+		if (max_cycles != 0 && stats->cycles >= max_cycles)
+			return RUN_CYCLE_LIMIT;
+		if (max_instructions != 0 && stats->retired >= max_instructions)
+			return RUN_INSTRUCTION_LIMIT;
+		if (cpu_get_idle(cpu) != 0) {
+			if (!skip_idle || (max_cycles == 0 && max_instructions == 0))
+				return RUN_HALTED;
+			// Up to the nearest limit, the rest of the period is stepped,
+			// all of it with a commit trace
+			left = UINT64_MAX;
+			if (max_cycles != 0)
+				left = max_cycles - stats->cycles;
+			if (max_instructions != 0 && max_instructions - stats->retired < left)
+				left = max_instructions - stats->retired;
+			left = cpu_skip_idle(cpu, left);
+			*skipped += left;
+			if (left != 0)
+				continue;
+		}
+		cpu_step(cpu);
+	}
+}
+
+// <delayslot><forwarding><relative_jump>[.<predictor>] of the file names
+static void config_tag(const cpu_config_t *config, char *tag, size_t len) {
+	snprintf(tag, len, "%u%s%s%s%s", config->delayslot, config->forwarding ? "yes" : "no",
+	         config->relative_jump ? "yes" : "no", config->predictor != PREDICT_NONE ? "." : "",
+	         config->predictor != PREDICT_NONE ? predictor_name(config->predictor) : "");
+}
+
+// Run a job on the CPU of the worker
+static void run_job(cpu_t *cpu, const options_t *options, int job, result_t *result) {
+	const cpuStats_t *stats = cpu_get_stats(cpu);
+	const char       *filename = options->programs[job / options->nconfigs];
+	struct timespec   start, end;
+	FILE             *fd, *counters = NULL;
+	char              tag[64];
+	int               program_size = -1;
+
+	memset(result, 0, sizeof(*result));
+	result->job = job;
+
+	cpu_set_config(cpu, &options->configs[job % options->nconfigs]);
+	fd = fopen(filename, "r");
+	if (fd == NULL) {
+		fprintf(stderr, "[RUNNER] fopen() failed | filename: %s\n", filename);
+	} else {
+		program_size = cpu_load_program(cpu, fd);
+		fclose(fd);
+		if (program_size <= 0)
+			fprintf(stderr, "[RUNNER] cpu_load_program() failed or empty program | filename: %s\n", filename);
+	}
+	if (program_size <= 0) {
+		result->status = RUN_ERROR;
+		return;
+	}
+
+	config_tag(cpu_get_config(cpu), tag, sizeof(tag));
+	if (options->commit) {
+		char name[512];
+		snprintf(name, sizeof(name), "%s.%s.commit", filename, tag);
+		if (cpu_commit_open(cpu, name) < 0) {
+			result->status = RUN_ERROR;
+			return;
+		}
+	}
+
+	if (options->counters) {
+		char name[512];
+		snprintf(name, sizeof(name), "%s.%s.counters.%s", filename, tag,
+		         options->counters_format == COUNTERS_JSON ? "json" : "csv");
+		counters = fopen(name, "w");
+		if (counters == NULL) {
+			fprintf(stderr, "[RUNNER] fopen() failed | filename: %s\n", name);
+			cpu_commit_close(cpu);
+			result->status = RUN_ERROR;
+			return;
+		}
+		cpu_set_counters(cpu, true);
+		cpu_counters_every(cpu, counters, options->counters_format, options->counters_every);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	result->status = run(cpu, program_size, options->max_cycles, options->max_instructions,
+	                     options->skip_idle, &result->skipped);
+	if (cpu_commit_close(cpu) < 0)
+		result->status = RUN_ERROR;
+	if (counters != NULL) {
+		// The header has been written already if periodic
+		if (cpu_counters_write(cpu, counters, options->counters_format, options->counters_every == 0) < 0 ||
+		    fclose(counters) != 0)
+			result->status = RUN_ERROR;
+		cpu_counters_every(cpu, NULL, options->counters_format, 0);
+		cpu_set_counters(cpu, false);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result->seconds = elapsed_sec(&start, &end);
+	result->pc      = cpu_get_pc(cpu);
+	result->stats   = *stats;
+	result->predict = *cpu_get_predictor_stats(cpu);
+}
+
+// CSV field, quoted when it holds separators or quotes
+static void print_csv_string(const char *s) {
+	if (strpbrk(s, ",\"\r\n") == NULL) {
+		fputs(s, stdout);
+		return;
+	}
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"')
+			putchar('"');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+static void print_result(const options_t *options, const result_t *result) {
+	const cpuStats_t   *stats  = &result->stats;
+	const cpu_config_t *config = &options->configs[result->job % options->nconfigs];
+	const char         *yes = options->csv ? "yes" : "true", *no = options->csv ? "no" : "false";
+	uint64_t            predicted = result->predict.branches + result->predict.jumps;
+	uint64_t            misses = result->predict.branch_misses + result->predict.jump_misses;
+	double              accuracy = predicted ? 1.0 - (double)misses / (double)predicted : 0.0;
+	double              mpki = stats->retired ? (double)misses * 1000.0 / (double)stats->retired : 0.0;
+	uint64_t            fill = stats->cycles - stats->retired - result->predict.flushed;
+
+	if (options->csv) {
+		print_csv_string(options->programs[result->job / options->nconfigs]);
+		printf(",%u,%s,%s,%s,%u,%llu,%llu,%llu,%llu,%llu,%.6f,%.6f,%.3f,%s,%llu,%.6f,%.3f,%llu\n",
+		       config->delayslot, config->forwarding ? yes : no, config->relative_jump ? yes : no,
+		       status_name[result->status], result->pc * 4,
+		       (unsigned long long)stats->cycles, (unsigned long long)stats->retired,
+		       (unsigned long long)stats->nops, (unsigned long long)fill,
+		       (unsigned long long)result->skipped,
+		       stats->retired ? (double)stats->cycles / (double)stats->retired : 0.0,
+		       result->seconds, result->seconds > 0 ? (double)stats->retired / result->seconds / 1e6 : 0.0,
+		       predictor_name(config->predictor), (unsigned long long)misses, accuracy, mpki,
+		       (unsigned long long)result->predict.flushed);
+		return;
+	}
+	printf("{\"program\": ");
+	print_json_string(options->programs[result->job / options->nconfigs]);
+	printf(", \"config\": {\"delayslot\": %u, \"forwarding\": %s, \"relative_jump\": %s, \"predictor\": \"%s\"}",
+	       config->delayslot, config->forwarding ? yes : no, config->relative_jump ? yes : no,
+	       predictor_name(config->predictor));
+	printf(", \"status\": \"%s\", \"pc\": %u, \"cycles\": %llu, \"retired\": %llu, \"nops\": %llu, \"fill\": %llu, "
+	       "\"skipped\": %llu, \"cpi\": %.6f, \"seconds\": %.6f, \"mips\": %.3f, \"mispredicts\": %llu, "
+	       "\"accuracy\": %.6f, \"mpki\": %.3f, \"flushed\": %llu}\n",
+	       status_name[result->status], result->pc * 4,
+	       (unsigned long long)stats->cycles, (unsigned long long)stats->retired,
+	       (unsigned long long)stats->nops, (unsigned long long)fill,
+	       (unsigned long long)result->skipped,
+	       stats->retired ? (double)stats->cycles / (double)stats->retired : 0.0,
+	       result->seconds, result->seconds > 0 ? (double)stats->retired / result->seconds / 1e6 : 0.0,
+	       (unsigned long long)misses, accuracy, mpki, (unsigned long long)result->predict.flushed);
+}
+
+// <delayslot>,<yes|no>,<yes|no>[,<predictor>], returns 0, -1 if not valid
+static int parse_config(const char *arg, cpu_config_t *config) {
+	unsigned delayslot;
+	char     forwarding[4], relative_jump[4], predictor[16] = "none", end;
+	int      n, kind;
+
+	n = sscanf(arg, "%u,%3[a-z],%3[a-z],%15[a-z_]%c", &delayslot, forwarding, relative_jump, predictor, &end);
+	kind = predictor_kind(predictor);
+	if ((n != 3 && n != 4) || kind < 0 ||
+	    (strcmp(forwarding, "yes") != 0 && strcmp(forwarding, "no") != 0) ||
+	    (strcmp(relative_jump, "yes") != 0 && strcmp(relative_jump, "no") != 0) ||
+	    delayslot < 1 || delayslot > MAX_DELAYSLOT)
+		return -1;
+	config->delayslot     = (uint8_t)delayslot;
+	config->forwarding    = strcmp(forwarding, "yes") == 0;
+	config->relative_jump = strcmp(relative_jump, "yes") == 0;
+	config->predictor     = (uint8_t)kind;
+	return 0;
+}
+
+// Predictors of a comma separated list, returns their number, -1 if not valid
+static int parse_predictors(const char *list, uint8_t *values) {
+	char name[16];
+	int  n = 0, kind;
+	size_t len;
+
+	while (*list != '\0') {
+		len = strcspn(list, ",");
+		if (n == PREDICT_KINDS || len >= sizeof(name))
+			return -1;
+		memcpy(name, list, len);
+		name[len] = '\0';
+		if ((kind = predictor_kind(name)) < 0)
+			return -1;
+		values[n++] = (uint8_t)kind;
+		list += len;
+		if (*list == ',' && *++list == '\0')
+			return -1;
+	}
+	return n;
+}
+
+// yes/no values of a comma separated list, returns their number, -1 if not valid
+static int parse_bools(const char *list, size_t len, bool *values) {
+	int n = 0;
+
+	while (len > 0) {
+		if (n == 2)
+			return -1;
+		if (len >= 3 && strncmp(list, "yes", 3) == 0) {
+			values[n++] = true;
+			list += 3, len -= 3;
+		} else if (len >= 2 && strncmp(list, "no", 2) == 0) {
+			values[n++] = false;
+			list += 2, len -= 2;
+		} else {
+			return -1;
+		}
+		if (len > 0 && *list != ',')
+			return -1;
+		if (len > 0)
+			list++, len--;
+	}
+	return n;
+}
+
+// <delayslots>:<forwardings>:<relative_jumps>[:<predictors>], appends the
+// cross product to the configs, returns 0, -1 if not valid
+static int parse_grid(const char *arg, cpu_config_t *configs, int *nconfigs) {
+	const char *forwardings, *relative_jumps, *predictors;
+	uint8_t     delayslot[MAX_DELAYSLOT], predictor[PREDICT_KINDS] = { PREDICT_NONE };
+	bool        forwarding[2], relative_jump[2];
+	int         nd = 0, nf, nr, np = 1, d, f, r, p;
+	char       *end;
+
+	forwardings    = strchr(arg, ':');
+	relative_jumps = forwardings != NULL ? strchr(forwardings + 1, ':') : NULL;
+	predictors     = relative_jumps != NULL ? strchr(relative_jumps + 1, ':') : NULL;
+	if (relative_jumps == NULL)
+		return -1;
+	if (predictors == NULL)
+		predictors = relative_jumps + strlen(relative_jumps);
+	else if ((np = parse_predictors(predictors + 1, predictor)) <= 0)
+		return -1;
+	while (arg < forwardings) {
+		unsigned long value = strtoul(arg, &end, 10);
+		if (end == arg || (end != forwardings && *end != ',') ||
+		    value < 1 || value > MAX_DELAYSLOT || nd == MAX_DELAYSLOT)
+			return -1;
+		delayslot[nd++] = (uint8_t)value;
+		arg = end == forwardings ? end : end + 1;
+	}
+	nf = parse_bools(forwardings + 1, relative_jumps - forwardings - 1, forwarding);
+	nr = parse_bools(relative_jumps + 1, predictors - relative_jumps - 1, relative_jump);
+	if (nd == 0 || nf <= 0 || nr <= 0)
+		return -1;
+
+	for (d = 0; d < nd; d++) {
+		for (f = 0; f < nf; f++) {
+			for (r = 0; r < nr; r++) {
+				for (p = 0; p < np; p++) {
+					configs[*nconfigs].delayslot     = delayslot[d];
+					configs[*nconfigs].forwarding    = forwarding[f];
+					configs[*nconfigs].relative_jump = relative_jump[r];
+					configs[*nconfigs].predictor     = predictor[p];
+					(*nconfigs)++;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////
+// WORKERS
+////////////////////////////////////
+// Each worker owns a CPU and a deque of jobs, dealt round robin at
+// start. The owner takes the jobs from the bottom of its deque, once
+// it's empty it steals from the top of the others, so that the long
+// jobs don't leave the other cores idle. No job is added while
+// running: a worker finding every deque empty is done.
+// The results are kept by each worker and merged in the job order.
+
+// Owner: newest job
+static int deque_pop(worker_t *worker) {
+	int job = -1;
+	pthread_mutex_lock(&worker->lock);
+	if (worker->top < worker->bottom)
+		job = worker->jobs[--worker->bottom];
+	pthread_mutex_unlock(&worker->lock);
+	return job;
+}
+
+// Thieves: oldest job
+static int deque_steal(worker_t *victim) {
+	int job = -1;
+	pthread_mutex_lock(&victim->lock);
+	if (victim->top < victim->bottom)
+		job = victim->jobs[victim->top++];
+	pthread_mutex_unlock(&victim->lock);
+	return job;
+}
+
+static void *worker_main(void *arg) {
+	worker_t *worker = (worker_t *)arg;
+	pool_t   *pool   = worker->pool;
+	cpu_t    *cpu;
+	int       job, i;
+
+	cpu = (cpu_t *)cpu_create(NULL);
+	if (cpu == NULL) {
+		fprintf(stderr, "[RUNNER] cpu_create() failed\n");
+		return NULL;		// The others steal its jobs
+	}
+	cpu_set_trace(cpu, NULL);
+
+	while (1) {
+		job = deque_pop(worker);
+		for (i = 1; job < 0 && i < pool->workers; i++)
+			job = deque_steal(&pool->worker[(worker->id + i) % pool->workers]);
+		if (job < 0)
+			break;
+		run_job(cpu, pool->options, job, &worker->results[worker->count++]);
+	}
+
+	cpu_free(cpu);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	options_t  options;
+	pool_t     pool;
+	result_t  *merged;
+	bool      *done;
+	int        i, first = 1, jobs, errors = 0;
+	long       cores;
+
+	memset(&options, 0, sizeof(options));
+	// A grid adds at most every configuration
+	options.configs = (cpu_config_t *)malloc((argc + 1) * MAX_DELAYSLOT*4*PREDICT_KINDS * sizeof(cpu_config_t));
+	if (options.configs == NULL) {
+		fprintf(stderr, "[RUNNER] malloc() failed\n");
+		exit(-3);
+	}
+	cores        = sysconf(_SC_NPROCESSORS_ONLN);
+	pool.workers = cores > 0 ? (int)cores : 1;
+	while (first < argc && strncmp(argv[first], "--", 2) == 0) {
+		if (strcmp(argv[first], "--skip-idle") == 0) {
+			options.skip_idle = true;
+			first++;
+		} else if (strcmp(argv[first], "--jobs") == 0 && first + 1 < argc) {
+			pool.workers = atoi(argv[first + 1]);
+			first += 2;
+		} else if (strcmp(argv[first], "--config") == 0 && first + 1 < argc) {
+			if (parse_config(argv[first + 1], &options.configs[options.nconfigs++]) < 0) {
+				fprintf(stderr, "[RUNNER] Not a valid config: %s\n", argv[first + 1]);
+				exit(-1);
+			}
+			first += 2;
+		} else if (strcmp(argv[first], "--grid") == 0 && first + 1 < argc) {
+			if (parse_grid(argv[first + 1], options.configs, &options.nconfigs) < 0) {
+				fprintf(stderr, "[RUNNER] Not a valid grid: %s\n", argv[first + 1]);
+				exit(-1);
+			}
+			first += 2;
+		} else if (strcmp(argv[first], "--csv") == 0) {
+			options.csv = true;
+			first++;
+		} else if (strcmp(argv[first], "--commit-trace") == 0) {
+			options.commit = true;
+			first++;
+		} else if (strcmp(argv[first], "--counters") == 0 && first + 1 < argc) {
+			if (strcmp(argv[first + 1], "json") != 0 && strcmp(argv[first + 1], "csv") != 0) {
+				fprintf(stderr, "[RUNNER] Not a valid counters format: %s\n", argv[first + 1]);
+				exit(-1);
+			}
+			options.counters        = true;
+			options.counters_format = strcmp(argv[first + 1], "json") == 0 ? COUNTERS_JSON : COUNTERS_CSV;
+			first += 2;
+		} else if (strcmp(argv[first], "--counters-every") == 0 && first + 1 < argc) {
+			options.counters_every = strtoull(argv[first + 1], NULL, 0);
+			first += 2;
+		} else {
+			break;
+		}
+	}
+	if (argc < first + 3 || pool.workers <= 0) {
+		fprintf(stderr, "Wrong usage: %s [--skip-idle] [--jobs <threads>] [--csv] [--commit-trace] [--counters <json|csv> [--counters-every <cycles>]] [--config <delayslot>,<yes|no>,<yes|no>[,<predictor>]]... "
+		        "[--grid <delayslots>:<forwardings>:<relative_jumps>[:<predictors>]]... <max_cycles> <max_instructions> <filename.mem>...\n", argv[0]);
+		exit(-1);
+	}
+	if (options.nconfigs == 0)
+		options.configs[options.nconfigs++] = CPU_CONFIG_DEFAULT;
+	options.max_cycles       = strtoull(argv[first], NULL, 0);
+	options.max_instructions = strtoull(argv[first + 1], NULL, 0);
+	options.programs         = (const char **)&argv[first + 2];
+	jobs                     = (argc - first - 2) * options.nconfigs;
+	if (pool.workers > jobs)
+		pool.workers = jobs;
+
+	pool.options = &options;
+	pool.worker  = (worker_t *)calloc(pool.workers, sizeof(worker_t));
+	merged       = (result_t *)calloc(jobs, sizeof(result_t));
+	done         = (bool *)calloc(jobs, sizeof(bool));
+	if (pool.worker == NULL || merged == NULL || done == NULL) {
+		fprintf(stderr, "[RUNNER] calloc() failed\n");
+		exit(-3);
+	}
+	for (i = 0; i < pool.workers; i++) {
+		pool.worker[i].id      = i;
+		pool.worker[i].pool    = &pool;
+		pool.worker[i].jobs    = (int *)malloc(jobs * sizeof(int));
+		pool.worker[i].results = (result_t *)malloc(jobs * sizeof(result_t));
+		if (pool.worker[i].jobs == NULL || pool.worker[i].results == NULL) {
+			fprintf(stderr, "[RUNNER] malloc() failed\n");
+			exit(-3);
+		}
+		pthread_mutex_init(&pool.worker[i].lock, NULL);
+	}
+	// The first jobs are at the bottom, taken first by their owner
+	for (i = jobs - 1; i >= 0; i--) {
+		worker_t *worker = &pool.worker[i % pool.workers];
+		worker->jobs[worker->bottom++] = i;
+	}
+
+	for (i = 0; i < pool.workers; i++) {
+		if (pthread_create(&pool.worker[i].thread, NULL, worker_main, &pool.worker[i]) != 0) {
+			fprintf(stderr, "[RUNNER] pthread_create() failed\n");
+			exit(-3);
+		}
+	}
+	for (i = 0; i < pool.workers; i++)
+		pthread_join(pool.worker[i].thread, NULL);
+
+	for (i = 0; i < pool.workers; i++) {
+		for (int r = 0; r < pool.worker[i].count; r++) {
+			merged[pool.worker[i].results[r].job] = pool.worker[i].results[r];
+			done[pool.worker[i].results[r].job]   = true;
+		}
+		pthread_mutex_destroy(&pool.worker[i].lock);
+		free(pool.worker[i].jobs);
+		free(pool.worker[i].results);
+	}
+	if (options.csv)
+		printf("program,delayslot,forwarding,relative_jump,status,pc,cycles,retired,nops,fill,skipped,cpi,seconds,mips,"
+		       "predictor,mispredicts,accuracy,mpki,flushed\n");
+	for (i = 0; i < jobs; i++) {
+		if (!done[i]) {
+			merged[i].job    = i;
+			merged[i].status = RUN_ERROR;
+		}
+		if (merged[i].status == RUN_ERROR)
+			errors++;
+		print_result(&options, &merged[i]);
+	}
+
+	free(pool.worker);
+	free(options.configs);
+	free(merged);
+	free(done);
+	return errors ? -4 : 0;
+}
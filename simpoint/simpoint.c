@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <cpu_model/cpu_model.h>
+#include <extra/utils.h>
+
+// SimPoint-style sampling
+// 1. The program is run by the functional model, counting the
+//    instructions executed by each basic block in every interval of
+//    fixed length: its basic block vector (BBV), written to <file>.bb
+// 2. The BBVs are normalized, randomly projected to few dimensions and
+//    clustered by k-means. The number of clusters is the smallest whose
+//    BIC score reaches 90% of the best one, the interval closest to the
+//    centroid of each cluster is its simulation point, weighted by the
+//    fraction of the intervals in the cluster: <file>.simpoints and
+//    <file>.weights, one "<value> <cluster>" line per cluster
+// 3. The program is run again up to each simulation point, whose state
+//    is saved in <file>.<interval>.ckpt
+// 4. Each checkpoint is restored and its interval run by the pipeline,
+//    the weighted CPIs estimate the CPI of the whole program, compared
+//    with a pipeline run of all the profiled intervals.
+// The program ends when the PC runs past its last instruction, the last
+// interval is dropped if not complete.
+
+// Dimensions of the projected BBVs
+#define DIMS			15
+// k-means iterations and initializations for each number of clusters
+#define KMEANS_ITER		100
+#define KMEANS_SEEDS	5
+// Fraction of the BIC range the chosen clustering has to reach
+#define BIC_THRESHOLD	0.9
+// Instructions executed by each call of the functional model
+#define FUNCTIONAL_CHUNK 64
+
+typedef struct {
+	double	 (*point)[DIMS];	// Projected BBVs
+	int		 n;					// Intervals
+	int		 k;					// Clusters
+	double	 (*centroid)[DIMS];
+	int		 *cluster;			// Cluster of each interval
+	int		 *size;				// Intervals of each cluster
+} clustering_t;
+
+// Deterministic pseudo random numbers, xorshift64
+static uint64_t rng_state = 0x2545f4914f6cdd1dULL;
+
+static double rng_uniform(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (double)(rng_state >> 11) / (double)(1ULL << 53);
+}
+
+static void load(cpu_t *cpu, const char *filename, int *program_size) {
+	FILE *fd = fopen(filename, "r");
+	if (fd == NULL) {
+		fprintf(stderr, "[SIMPOINT] fopen() failed | filename: %s\n", filename);
+		exit(-2);
+	}
+	cpu_reset(cpu);
+	*program_size = cpu_load_program(cpu, fd);
+	fclose(fd);
+	if (*program_size <= 0) {
+		fprintf(stderr, "[SIMPOINT] cpu_load_program() failed or empty program\n");
+		exit(-4);
+	}
+}
+
+// Run an interval with the functional model,
+// returns false if the program ended first
+static bool run_interval(cpu_t *cpu, int program_size, uint64_t interval) {
+	uint64_t done = 0, chunk;
+
+	while (done < interval) {
+		if (cpu_get_pc(cpu) != (uint32_t)-1 && cpu_get_pc(cpu) >= (uint32_t)program_size)
+			return false;
+		chunk = interval - done < FUNCTIONAL_CHUNK ? interval - done : FUNCTIONAL_CHUNK;
+		done += cpu_run_functional(cpu, chunk);
+	}
+	return true;
+}
+
+// Profile the program, returns the number of intervals
+static int profile(cpu_t *cpu, const char *filename, uint64_t interval, int max_intervals,
+		double (*point)[DIMS]) {
+	static uint64_t bbv[IRAM_SIZE];
+	static double   projection[IRAM_SIZE][DIMS];
+	char     name[256];
+	FILE    *fd;
+	int      program_size, n, d;
+	uint32_t pc;
+
+	// Random projection matrix, uniform in [-1, 1]
+	for (pc = 0; pc < IRAM_SIZE; pc++)
+		for (d = 0; d < DIMS; d++)
+			projection[pc][d] = 2.0 * rng_uniform() - 1.0;
+
+	snprintf(name, sizeof(name), "%s.bb", filename);
+	fd = fopen(name, "w");
+	if (fd == NULL) {
+		fprintf(stderr, "[SIMPOINT] fopen() failed | filename: %s\n", name);
+		exit(-2);
+	}
+
+	load(cpu, filename, &program_size);
+	cpu_set_bbv(cpu, bbv);
+	for (n = 0; n < max_intervals; n++) {
+		memset(bbv, 0, sizeof(bbv));
+		if (!run_interval(cpu, program_size, interval))
+			break;
+
+		// SimPoint format, the block ids start from 1
+		fprintf(fd, "T");
+		memset(point[n], 0, sizeof(point[n]));
+		for (pc = 0; pc < IRAM_SIZE; pc++) {
+			if (bbv[pc] == 0)
+				continue;
+			fprintf(fd, ":%u:%llu ", pc + 1, (unsigned long long)bbv[pc]);
+			for (d = 0; d < DIMS; d++)
+				point[n][d] += projection[pc][d] * (double)bbv[pc] / (double)interval;
+		}
+		fprintf(fd, "\n");
+	}
+	cpu_set_bbv(cpu, NULL);
+	fclose(fd);
+	printf("[SIMPOINT] BBVs: %s, %d intervals of %llu instructions\n", name, n, (unsigned long long)interval);
+	return n;
+}
+
+static double distance2(const double *a, const double *b) {
+	double sum = 0, diff;
+	int    d;
+	for (d = 0; d < DIMS; d++) {
+		diff = a[d] - b[d];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+// k-means++ initialization followed by Lloyd iterations,
+// returns the sum of the squared distances from the centroids
+static double kmeans(clustering_t *c) {
+	double *closest = (double *)malloc(c->n * sizeof(double));
+	double  total, target, dist, best, distortion;
+	int     i, j, d, changed, iter;
+
+	if (closest == NULL) {
+		fprintf(stderr, "[SIMPOINT] malloc() failed\n");
+		exit(-3);
+	}
+
+	// Each new centroid is an interval picked with probability
+	// proportional to its squared distance from the closest centroid
+	memcpy(c->centroid[0], c->point[(int)(rng_uniform() * c->n)], sizeof(c->centroid[0]));
+	for (i = 0; i < c->n; i++)
+		closest[i] = distance2(c->point[i], c->centroid[0]);
+	for (j = 1; j < c->k; j++) {
+		total = 0;
+		for (i = 0; i < c->n; i++)
+			total += closest[i];
+		target = rng_uniform() * total;
+		for (i = 0; i < c->n - 1 && target >= closest[i]; i++)
+			target -= closest[i];
+		memcpy(c->centroid[j], c->point[i], sizeof(c->centroid[j]));
+		for (i = 0; i < c->n; i++) {
+			dist = distance2(c->point[i], c->centroid[j]);
+			if (dist < closest[i])
+				closest[i] = dist;
+		}
+	}
+
+	for (i = 0; i < c->n; i++)
+		c->cluster[i] = -1;
+	for (iter = 0; iter < KMEANS_ITER; iter++) {
+		changed = 0;
+		for (i = 0; i < c->n; i++) {
+			best = INFINITY;
+			for (j = 0; j < c->k; j++) {
+				dist = distance2(c->point[i], c->centroid[j]);
+				if (dist < best) {
+					best = dist;
+					d    = j;
+				}
+			}
+			if (c->cluster[i] != d) {
+				c->cluster[i] = d;
+				changed++;
+			}
+		}
+		if (changed == 0)
+			break;
+
+		// Empty clusters keep their centroid
+		memset(c->size, 0, c->k * sizeof(int));
+		for (i = 0; i < c->n; i++)
+			c->size[c->cluster[i]]++;
+		for (j = 0; j < c->k; j++)
+			if (c->size[j] > 0)
+				memset(c->centroid[j], 0, sizeof(c->centroid[j]));
+		for (i = 0; i < c->n; i++)
+			for (d = 0; d < DIMS; d++)
+				c->centroid[c->cluster[i]][d] += c->point[i][d] / c->size[c->cluster[i]];
+	}
+
+	memset(c->size, 0, c->k * sizeof(int));
+	distortion = 0;
+	for (i = 0; i < c->n; i++) {
+		c->size[c->cluster[i]]++;
+		distortion += distance2(c->point[i], c->centroid[c->cluster[i]]);
+	}
+	free(closest);
+	return distortion;
+}
+
+// Bayesian information criterion of the clustering, spherical
+// gaussians with the same variance (as in X-means and SimPoint)
+static double bic(const clustering_t *c, double distortion) {
+	double variance, loglike = 0, params;
+	int    j;
+
+	variance = c->n > c->k ? distortion / (c->n - c->k) : 0;
+	if (variance < 1e-12)
+		variance = 1e-12;
+	for (j = 0; j < c->k; j++) {
+		if (c->size[j] == 0)
+			continue;
+		loglike += -c->size[j] / 2.0 * log(2 * M_PI)
+		           - c->size[j] * DIMS / 2.0 * log(variance)
+		           - (c->size[j] - 1) / 2.0
+		           + c->size[j] * log((double)c->size[j])
+		           - c->size[j] * log((double)c->n);
+	}
+	params = (c->k - 1) + DIMS * c->k + 1;
+	return loglike - params / 2.0 * log((double)c->n);
+}
+
+// Cluster the intervals with 1 to max_k clusters, keeping the first
+// one reaching BIC_THRESHOLD of the BIC range
+static void cluster(clustering_t *c, int max_k) {
+	clustering_t trial;
+	double      *score, distortion, best, min, max;
+	int        **cluster_of;
+	int          k, s;
+
+	if (max_k > c->n)
+		max_k = c->n;
+	score      = (double *)malloc((max_k + 1) * sizeof(double));
+	cluster_of = (int **)calloc(max_k + 1, sizeof(int *));
+	trial          = *c;
+	trial.centroid = malloc(max_k * sizeof(trial.centroid[0]));
+	trial.cluster  = (int *)malloc(c->n * sizeof(int));
+	trial.size     = (int *)malloc(max_k * sizeof(int));
+	if (score == NULL || cluster_of == NULL || trial.centroid == NULL || trial.cluster == NULL || trial.size == NULL) {
+		fprintf(stderr, "[SIMPOINT] malloc() failed\n");
+		exit(-3);
+	}
+
+	// The best of KMEANS_SEEDS initializations for each k
+	for (k = 1; k <= max_k; k++) {
+		trial.k = k;
+		best    = INFINITY;
+		cluster_of[k] = (int *)malloc(c->n * sizeof(int));
+		if (cluster_of[k] == NULL) {
+			fprintf(stderr, "[SIMPOINT] malloc() failed\n");
+			exit(-3);
+		}
+		for (s = 0; s < KMEANS_SEEDS; s++) {
+			distortion = kmeans(&trial);
+			if (distortion < best) {
+				best     = distortion;
+				score[k] = bic(&trial, distortion);
+				memcpy(cluster_of[k], trial.cluster, c->n * sizeof(int));
+			}
+		}
+	}
+
+	min = max = score[1];
+	for (k = 2; k <= max_k; k++) {
+		if (score[k] < min) min = score[k];
+		if (score[k] > max) max = score[k];
+	}
+	for (k = 1; k < max_k && score[k] < min + BIC_THRESHOLD * (max - min); k++)
+		;
+
+	// Centroids of the chosen clustering
+	c->k = k;
+	memcpy(c->cluster, cluster_of[k], c->n * sizeof(int));
+	memset(c->size, 0, k * sizeof(int));
+	memset(c->centroid, 0, k * sizeof(c->centroid[0]));
+	for (s = 0; s < c->n; s++)
+		c->size[c->cluster[s]]++;
+	for (s = 0; s < c->n; s++)
+		for (int d = 0; d < DIMS; d++)
+			c->centroid[c->cluster[s]][d] += c->point[s][d] / c->size[c->cluster[s]];
+	printf("[SIMPOINT] %d clusters (BIC %.1f, range %.1f - %.1f)\n", k, score[k], min, max);
+
+	for (k = 1; k <= max_k; k++)
+		free(cluster_of[k]);
+	free(cluster_of);
+	free(score);
+	free(trial.centroid);
+	free(trial.cluster);
+	free(trial.size);
+}
+
+// Simulation point of each cluster: the interval closest to its centroid
+static void choose(const clustering_t *c, int *simpoint) {
+	double best, dist;
+	int    i, j;
+
+	for (j = 0; j < c->k; j++) {
+		best        = INFINITY;
+		simpoint[j] = -1;
+		for (i = 0; i < c->n; i++) {
+			if (c->cluster[i] != j)
+				continue;
+			dist = distance2(c->point[i], c->centroid[j]);
+			if (dist < best) {
+				best        = dist;
+				simpoint[j] = i;
+			}
+		}
+	}
+}
+
+static void write_simpoints(const char *filename, const clustering_t *c, const int *simpoint) {
+	char  name[256];
+	FILE *fd;
+	int   j;
+
+	snprintf(name, sizeof(name), "%s.simpoints", filename);
+	fd = fopen(name, "w");
+	if (fd == NULL) {
+		fprintf(stderr, "[SIMPOINT] fopen() failed | filename: %s\n", name);
+		exit(-2);
+	}
+	for (j = 0; j < c->k; j++)
+		if (simpoint[j] >= 0)
+			fprintf(fd, "%d %d\n", simpoint[j], j);
+	fclose(fd);
+
+	snprintf(name, sizeof(name), "%s.weights", filename);
+	fd = fopen(name, "w");
+	if (fd == NULL) {
+		fprintf(stderr, "[SIMPOINT] fopen() failed | filename: %s\n", name);
+		exit(-2);
+	}
+	for (j = 0; j < c->k; j++)
+		if (simpoint[j] >= 0)
+			fprintf(fd, "%f %d\n", (double)c->size[j] / c->n, j);
+	fclose(fd);
+}
+
+static void checkpoint_name(char *name, size_t size, const char *filename, int interval) {
+	snprintf(name, size, "%s.%d.ckpt", filename, interval);
+}
+
+// Run the program again, saving the state at the start of each simulation point
+static void save_checkpoints(cpu_t *cpu, const char *filename, uint64_t interval,
+		const clustering_t *c, const int *simpoint) {
+	char  name[256];
+	FILE *fd;
+	int   program_size, i, j, last = -1;
+
+	for (j = 0; j < c->k; j++)
+		if (simpoint[j] > last)
+			last = simpoint[j];
+
+	load(cpu, filename, &program_size);
+	for (i = 0; i <= last; i++) {
+		for (j = 0; j < c->k; j++) {
+			if (simpoint[j] != i)
+				continue;
+			checkpoint_name(name, sizeof(name), filename, i);
+			fd = fopen(name, "wb");
+			if (fd == NULL || cpu_checkpoint_save(cpu, fd) != 0) {
+				fprintf(stderr, "[SIMPOINT] Saving the checkpoint failed | filename: %s\n", name);
+				exit(-5);
+			}
+			fclose(fd);
+		}
+		run_interval(cpu, program_size, interval);
+	}
+}
+
+// CPI of the pipeline from the current state, over the given instructions
+static double pipeline_cpi(cpu_t *cpu, uint64_t instructions) {
+	const cpuStats_t *stats = cpu_get_stats(cpu);
+
+	cpu_clear_stats(cpu);
+	while (stats->retired < instructions)
+		cpu_step(cpu);
+	return (double)stats->cycles / (double)stats->retired;
+}
+
+int main(int argc, char *argv[]) {
+	cpu_t        *cpu;
+	clustering_t  c;
+	FILE         *fd;
+	char          name[256];
+	uint64_t      interval, max_instructions;
+	int           max_k, program_size, j, *simpoint;
+	double        cpi, estimate = 0, reference;
+
+	if (argc < 5) {
+		fprintf(stderr, "Wrong usage: %s <filename.mem> <interval> <max_clusters> <max_instructions>\n", argv[0]);
+		exit(-1);
+	}
+	interval         = strtoull(argv[2], NULL, 0);
+	max_k            = atoi(argv[3]);
+	max_instructions = strtoull(argv[4], NULL, 0);
+	if (interval == 0 || max_k <= 0 || max_instructions < interval) {
+		fprintf(stderr, "[SIMPOINT] At least an interval and a cluster are needed\n");
+		exit(-1);
+	}
+
+	cpu = (cpu_t *)cpu_create(NULL);
+	if (cpu == NULL) {
+		fprintf(stderr, "[SIMPOINT] cpu_create() failed\n");
+		exit(-3);
+	}
+
+	memset(&c, 0, sizeof(c));
+	c.point    = malloc(max_instructions / interval * sizeof(c.point[0]));
+	c.centroid = malloc(max_k * sizeof(c.centroid[0]));
+	c.cluster  = (int *)malloc(max_instructions / interval * sizeof(int));
+	c.size     = (int *)malloc(max_k * sizeof(int));
+	simpoint   = (int *)malloc(max_k * sizeof(int));
+	if (c.point == NULL || c.centroid == NULL || c.cluster == NULL || c.size == NULL || simpoint == NULL) {
+		fprintf(stderr, "[SIMPOINT] malloc() failed\n");
+		exit(-3);
+	}
+
+	c.n = profile(cpu, argv[1], interval, (int)(max_instructions / interval), c.point);
+	if (c.n == 0) {
+		fprintf(stderr, "[SIMPOINT] The program is shorter than an interval\n");
+		exit(-4);
+	}
+	cluster(&c, max_k);
+	choose(&c, simpoint);
+	write_simpoints(argv[1], &c, simpoint);
+	save_checkpoints(cpu, argv[1], interval, &c, simpoint);
+
+	// Detailed simulation of the simulation points only
+	for (j = 0; j < c.k; j++) {
+		if (simpoint[j] < 0)
+			continue;
+		checkpoint_name(name, sizeof(name), argv[1], simpoint[j]);
+		fd = fopen(name, "rb");
+		if (fd == NULL || cpu_checkpoint_load(cpu, fd) != 0) {
+			fprintf(stderr, "[SIMPOINT] Loading the checkpoint failed | filename: %s\n", name);
+			exit(-5);
+		}
+		fclose(fd);
+		cpi = pipeline_cpi(cpu, interval);
+		estimate += cpi * c.size[j] / c.n;
+		printf("[SIMPOINT]   cluster %2d: interval %5d, weight %.3f, CPI %.4f\n",
+		       j, simpoint[j], (double)c.size[j] / c.n, cpi);
+	}
+
+	// Detailed simulation of everything, as reference
+	load(cpu, argv[1], &program_size);
+	reference = pipeline_cpi(cpu, (uint64_t)c.n * interval);
+	printf("[SIMPOINT] Estimated CPI %.4f, full run CPI %.4f (error %.2f%%), %.1f%% of the instructions simulated\n",
+	       estimate, reference, 100.0 * fabs(estimate - reference) / reference, 100.0 * c.k / c.n);
+
+	free(c.point);
+	free(c.centroid);
+	free(c.cluster);
+	free(c.size);
+	free(simpoint);
+	cpu_free(cpu);
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include <cpu_model/cpu_model.h>
 #include <compiler/compiler.h>
+#include <extra/image.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -35,6 +36,9 @@ Section get_section_marker(const char *p) {
 uint8_t rodata_seg[MAX_DATA_BYTES];
 int     rodata_size = 0;
 
+// TEXT segment, for the binary image. Zero words are loaded as NOP
+uint32_t text_seg[IRAM_SIZE];
+
 int rodata_append(const uint8_t *bytes, int len) {
     if (rodata_size + len > MAX_DATA_BYTES) {
         fprintf(stderr, "[RODATA] Segment full (max %d bytes)\n", MAX_DATA_BYTES);
@@ -263,6 +267,102 @@ int find_label_address(const char *name) {
     return 0;
 }
 
+// Write the TEXT labels, the simulators look them up by name
+int label_write_table(const char *filename) {
+    char  out_name[256];
+    FILE *fd_out;
+
+    snprintf(out_name, sizeof(out_name), "%s.sym", filename);
+    fd_out = fopen(out_name, "w");
+    if (!fd_out) {
+        fprintf(stderr, "[ERROR] Cannot open output '%s'\n", out_name);
+        return 1;
+    }
+    for (int i = 0; i < num_labels; i++)
+        if (labels[i].section == SEC_TEXT)
+            fprintf(fd_out, "%08x %s\n", (unsigned)labels[i].address, labels[i].name);
+    fclose(fd_out);
+    return 0;
+}
+
+//////////////////////////////
+// Binary image
+//////////////////////////////
+
+// Zero padding up to the payload at offset
+static int image_pad(FILE *fd_out, uint32_t offset) {
+    static const uint8_t zero[IMAGE_ALIGN];
+    long pad = (long)offset - ftell(fd_out);
+    return pad < 0 || fwrite(zero, 1, pad, fd_out) != (size_t)pad;
+}
+
+int image_write(const char *filename, const uint32_t *text, int text_size) {
+    char            out_name[256];
+    FILE           *fd_out;
+    imageHeader_t   header;
+    imageSection_t  sections[3];
+    imageSymbol_t   symbol;
+    uint32_t        rodata[MAX_DATA_BYTES / 4];
+    uint32_t        rodata_words = (rodata_size + 3) / 4;
+    uint32_t        nsymbols = 0;
+    uint32_t        offset;
+    int             i, err = 0;
+
+    snprintf(out_name, sizeof(out_name), "%s.bin", filename);
+    fd_out = fopen(out_name, "wb");
+    if (!fd_out) {
+        fprintf(stderr, "[ERROR] Cannot open output '%s'\n", out_name);
+        return 1;
+    }
+
+    // Words as the loader of the .mem file builds them
+    memset(rodata, 0, sizeof(rodata));
+    for (i = 0; i < rodata_size; i++)
+        rodata[i / 4] |= ((uint32_t)rodata_seg[i]) << ((i % 4) * 8);
+    for (i = 0; i < num_labels; i++)
+        if (labels[i].section == SEC_TEXT)
+            nsymbols++;
+
+    // Payloads after the section table, each one aligned
+    offset = IMAGE_ALIGN_UP(sizeof(header) + sizeof(sections));
+    sections[0] = (imageSection_t){ IMAGE_TEXT, IRAM_BASE, (uint32_t)text_size, offset };
+    offset = IMAGE_ALIGN_UP(offset + text_size * 4);
+    sections[1] = (imageSection_t){ IMAGE_RODATA, RODATA_BASE, rodata_words, offset };
+    offset = IMAGE_ALIGN_UP(offset + rodata_words * 4);
+    sections[2] = (imageSection_t){ IMAGE_SYMTAB, 0, nsymbols, offset };
+
+    header.magic     = IMAGE_MAGIC;
+    header.version   = IMAGE_VERSION;
+#ifdef RELATIVE_JUMP
+    header.flags     = IMAGE_RELATIVE_JUMP;
+#else
+    header.flags     = 0;
+#endif
+    header.nsections = 3;
+
+    err |= fwrite(&header, sizeof(header), 1, fd_out) != 1;
+    err |= fwrite(sections, sizeof(sections), 1, fd_out) != 1;
+    err |= image_pad(fd_out, sections[0].offset);
+    err |= fwrite(text, 4, text_size, fd_out) != (size_t)text_size;
+    err |= image_pad(fd_out, sections[1].offset);
+    err |= fwrite(rodata, 4, rodata_words, fd_out) != rodata_words;
+    err |= image_pad(fd_out, sections[2].offset);
+    for (i = 0; i < num_labels; i++) {
+        if (labels[i].section != SEC_TEXT)
+            continue;
+        memset(&symbol, 0, sizeof(symbol));
+        symbol.addr = (uint32_t)labels[i].address;
+        strncpy(symbol.name, labels[i].name, sizeof(symbol.name) - 1);
+        err |= fwrite(&symbol, sizeof(symbol), 1, fd_out) != 1;
+    }
+    err |= fclose(fd_out) != 0;
+    if (err) {
+        fprintf(stderr, "[ERROR] Cannot write output '%s'\n", out_name);
+        return 1;
+    }
+    return 0;
+}
+
 //////////////////////////////
 // Register Aliasing
 //////////////////////////////
@@ -802,9 +902,16 @@ int main(int argc, char *argv[]) {
         text_line++;
     }
 
+    if (label_write_table(argv[1]))
+        exit(1);
+
     //////////////////////////////////////////////////////////////
     // Pass 2 — emit @TEXT instructions
     //////////////////////////////////////////////////////////////
+    if (text_line > IRAM_SIZE) {
+        fprintf(stderr, "[ERROR] %d instructions, the IRAM holds %d\n", text_line, IRAM_SIZE);
+        exit(1);
+    }
     rewind(fd);
     fprintf(fd_out, "@TEXT\n");
 
@@ -890,6 +997,7 @@ int main(int argc, char *argv[]) {
         }
 
         fprintf(fd_out, "%08x\n", hex);
+        text_seg[line_number - 1] = hex ? hex : NOP_Instruction;
     }
 
     //////////////////////////////////////////////////////////////
@@ -910,6 +1018,8 @@ int main(int argc, char *argv[]) {
 
     fclose(fd);
     fclose(fd_out);
+    if (image_write(argv[1], text_seg, line_number))
+        exit(1);
 
     printf("[OK] %s\n", out_name);
     printf("     TEXT:   %d instructions\n", line_number);
@@ -0,0 +1,688 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <cpu_model/cpu_model.h>
+
+////////////////////////////////////
+// BLOCKS
+////////////////////////////////////
+// Analysis of the blocks shared by the translators, and the portable
+// one: each block becomes an array of closures, one for each instruction,
+// with the operands already resolved to pointers (RF, values overwritten
+// by the block, constants). The blocks are linked to their successors,
+// so that a loop runs without looking anything up.
+// Writing an IRAM word that has been translated drops every block.
+
+////////////////////////////////////
+// Analysis
+////////////////////////////////////
+static blockSrc_t block_src(blockSrcKind_t kind, uint32_t val){
+	blockSrc_t src = { kind, val };
+	return src;
+}
+
+blockSrc_t block_old(blockInfo_t *info, const blockWrite_t *w, int k){
+	info->old[w[k].idx] = true;
+	return block_src(SRC_OLD, w[k].idx);
+}
+
+// Value written by w[k], the newer write may have overwritten it
+static blockSrc_t block_value(blockInfo_t *info, const blockWrite_t *w, int k){
+	if(k == 1 && w[0].idx >= 0 && w[0].rd == w[1].rd)
+		return block_old(info, w, 0);
+	return block_src(SRC_REG, w[k].rd);
+}
+
+blockSrc_t block_fwd(blockInfo_t *info, const blockWrite_t *w, int k){
+	if(w[k].fwd_const)
+		return block_src(SRC_CONST, w[k].fwd);
+	return block_value(info, w, k);
+}
+
+// Register r as read by the instruction i, as FUNC_READ()
+static blockSrc_t block_read(blockInfo_t *info, int i, uint8_t r){
+	const blockWrite_t *w = info->w[i];
+
+	if(!((w[0].near | w[1].far) & (1u << r)))
+		return block_src(SRC_REG, r);
+	if(info->config->forwarding){
+		if(w[0].rd == r && !w[0].load)
+			return block_fwd(info, w, 0);
+		if(w[1].rd == r)
+			return block_fwd(info, w, 1);
+		return block_old(info, w, 0);
+	}
+	if(w[1].rd == r)
+		return block_old(info, w, 1);
+	return block_old(info, w, 0);
+}
+
+// RF write of the instruction i, as func_write()
+// val is the written value when fwd is constant
+static void block_write(blockInfo_t *info, int i, uint8_t rd, bool load, bool fwd_const, uint32_t fwd, uint32_t val){
+	blockWrite_t *w = info->w[i + 1];
+
+	w[1] = info->w[i][0];
+	memset(&w[0], 0, sizeof(blockWrite_t));
+	w[0].idx = i;
+	w[0].rd	 = rd;
+	if(rd == 0)
+		return;
+	w[0].load		= load;
+	w[0].fwd_const	= fwd_const;
+	w[0].fwd		= fwd;
+	if(info->config->forwarding){
+		if(load || (fwd_const && fwd != val))
+			w[0].near = 1u << rd;
+		if(fwd_const && fwd != val)
+			w[0].far = 1u << rd;
+	}else{
+		w[0].near = 1u << rd;
+		w[0].far  = 1u << rd;
+	}
+}
+
+// The block is left after the instruction i
+static void block_mark_exit(blockInfo_t *info, int i){
+	const blockWrite_t	*w = info->w[i + 1];
+	int					k;
+
+	for(k = 0; k < 2; k++){
+		if(w[k].idx < 0 || w[k].rd == 0)
+			continue;
+		block_old(info, w, k);
+		block_fwd(info, w, k);
+	}
+}
+
+// Instructions of the block at pc, the jump comes with its delay slots
+static int block_extent(cpu_t *cpu, uint32_t pc, const decodedOp_t **op, int *branch){
+	int i, j;
+
+	*branch = -1;
+	for(i = 0; i < BLOCK_MAX && pc + i < IRAM_SIZE; i++){
+		op[i] = cpu_get_decoded(cpu, pc + i);
+		if(BLOCK_IS_LEFT(op[i]->handler))
+			return i;
+		if(!BLOCK_IS_JUMP(op[i]->handler))
+			continue;
+		// Jumps in the delay slots are left to the interpreter
+		for(j = 1; j <= cpu->config.delayslot; j++){
+			if(pc + i + j >= IRAM_SIZE)
+				return i;
+			op[i + j] = cpu_get_decoded(cpu, pc + i + j);
+			if(BLOCK_IS_LEFT(op[i + j]->handler) || BLOCK_IS_JUMP(op[i + j]->handler))
+				return i;
+		}
+		*branch = i;
+		return i + 1 + cpu->config.delayslot;
+	}
+	return i;
+}
+
+// Registers read by the instruction
+static uint32_t block_reads(const decodedOp_t *op){
+	uint32_t reads = 0;
+	if(op->flags & DECODED_NOP)
+		return 0;
+	if(op->flags & DECODED_READ_RS1)
+		reads |= 1u << op->rs1;
+	if(op->flags & DECODED_READ_RS2)
+		reads |= 1u << op->rs2;
+	return reads;
+}
+
+// Operands and writes of each instruction, as its handler in cpu_functional_core.h
+int block_analyze(cpu_t *cpu, uint32_t pc, blockInfo_t *info){
+	const decodedOp_t	*op;
+	uint32_t			link, target;
+	int					i;
+
+	memset(info, 0, sizeof(blockInfo_t));
+	info->pc	 = pc;
+	info->config = &cpu->config;
+	info->n	 = block_extent(cpu, pc, info->op, &info->branch);
+	if(info->n == 0)
+		return 0;
+	info->w[0][0].idx = -1;
+	info->w[0][1].idx = -1;
+
+	for(i = 0; i < info->n; i++){
+		op		= info->op[i];
+		link	= (pc + i + 1)*4;
+		target	= JUMP_BASE(info->config, pc + i) + op->imm;
+		info->a[i] = block_src(SRC_CONST, 0);
+		info->b[i] = block_src(SRC_CONST, 0);
+		switch (op->handler) {
+			case H_NOP:
+			case H_J:
+				block_write(info, i, 0, false, false, 0, 0);
+				break;
+			case H_LW:
+			case H_LH:
+			case H_LHU:
+			case H_LB:
+			case H_LBU:
+				info->a[i] = block_read(info, i, op->rs1);
+				info->b[i] = block_src(SRC_CONST, op->imm);
+				block_write(info, i, op->rd, true, false, 0, 0);
+				break;
+			case H_STORE:
+				info->a[i] = block_read(info, i, op->rs1);
+				info->b[i] = block_read(info, i, op->rs2);
+				block_write(info, i, 0, false, false, 0, 0);
+				break;
+			// The link instructions forward the ALU out, not the stored NPC
+			case H_JAL:
+				block_write(info, i, op->rd, false, true, target, link);
+				break;
+			case H_JALR:
+				info->a[i] = block_read(info, i, op->rs1);
+				block_write(info, i, op->rd, false, true, target, link);
+				break;
+			case H_JR:
+			case H_BEQZ:
+			case H_BNEZ:
+				info->a[i] = block_read(info, i, op->rs1);
+				block_write(info, i, 0, false, false, 0, 0);
+				break;
+			default:
+				// H_R_ and H_I_ alternate in the ALU_OPS() order
+				if((op->handler - H_R_NOP) & 1){
+					info->a[i] = block_read(info, i, op->rs1);
+					info->b[i] = block_src(SRC_CONST, op->imm);
+				}else {
+					// R0 is not read by the R-Type instructions
+					if(op->flags & DECODED_READ_RS1)
+						info->a[i] = block_read(info, i, op->rs1);
+					if(op->flags & DECODED_READ_RS2)
+						info->b[i] = block_read(info, i, op->rs2);
+				}
+				block_write(info, i, op->rd, false, false, 0, 0);
+				break;
+		}
+	}
+
+	// Left at the end, or after a store writing translated IRAM words
+	block_mark_exit(info, info->n - 1);
+	for(i = 0; i < info->n; i++)
+		if(info->op[i]->handler == H_STORE)
+			block_mark_exit(info, i);
+
+	info->reads0 = block_reads(info->op[0]);
+	info->reads1 = info->n > 1 ? block_reads(info->op[1]) : 0;
+	return info->n;
+}
+
+////////////////////////////////////
+// Closures
+////////////////////////////////////
+typedef struct blockOp blockOp_t;
+
+// Execute the instruction, returns false if the block must be left
+typedef bool (*blockFn_t)(cpu_t *cpu, const blockOp_t *op);
+
+struct blockOp {
+	blockFn_t		fn;
+	const uint32_t	*a;			// Operands
+	const uint32_t	*b;
+	uint32_t		*rd;		// Written register, the sink when nothing is written
+	uint32_t		*old;		// Where the overwritten value is kept, the sink if not needed
+	uint32_t		ca;			// Constant operands
+	uint32_t		cb;
+	uint32_t		imm;		// Store offset, link
+	uint32_t		val;		// Store mask, jump target
+	uint8_t			opcode;
+};
+
+// State left by the block after one of its instructions, see funcState_t
+typedef struct {
+	funcWrite_t		w[2];		// rd, near, far, load, and the constant fwd
+	const uint32_t	*old[2];
+	const uint32_t	*fwd[2];	// NULL if constant
+	bool			before;		// w[1] is the write before the block
+	uint32_t		pc;			// Next instruction, if not the outcome of the jump
+	bool			outcome;	// The jump takes place after this instruction
+	int				pending;	// Queue slot of the jump still to take place, -1 if none
+} blockExit_t;
+
+typedef struct block block_t;
+struct block {
+	uint32_t	pc;
+	int			n;
+	uint32_t	reads0;			// Registers read by the first two instructions,
+	uint32_t	reads1;			// they mustn't be hazards on entry
+	bool		chainable;		// Hazards on exit known while translating
+	uint32_t	exit_hazard;
+	uint32_t	exit_far;
+	bool		conditional;	// Ends with a branch
+	bool		indirect;		// Ends with a jump to a register
+	bool		keeps_before;	// An exit keeps the write before the block, see block_leave()
+	block_t		*next[2];		// Successors: taken, not taken
+	blockExit_t	tail;
+	blockExit_t	*side;			// For each instruction, used after the stores
+	blockOp_t	*op;			// Closures, allocated after the block
+};
+
+struct blockCache {
+	block_t		*map[IRAM_SIZE];	// Block at each word, NULL if not translated yet
+	block_t		untranslatable;
+	uint8_t		covered[IRAM_SIZE];	// Translated words
+	bool		flush;				// A translated word has been written
+	// Running block
+	uint32_t	old[BLOCK_LEN_MAX];	// RF value overwritten by each instruction
+	uint32_t	sink;
+	bool		taken;				// Outcome of the jump
+	uint32_t	target;				// Word address
+};
+
+#define X(name, expr) \
+	static bool block_##name(cpu_t *cpu, const blockOp_t *op){ \
+		uint32_t a = *op->a; \
+		uint32_t b = *op->b; \
+		(void)cpu; (void)a; (void)b; \
+		*op->old = *op->rd; \
+		*op->rd	 = (expr); \
+		return true; \
+	}
+ALU_OPS(X)
+#undef X
+
+static const blockFn_t block_alu[] = {
+#define X(name, expr)	block_##name,
+	ALU_OPS(X)
+#undef X
+};
+
+static bool block_nop(cpu_t *cpu, const blockOp_t *op){
+	(void)cpu;
+	(void)op;
+	return true;
+}
+
+static bool block_load(cpu_t *cpu, const blockOp_t *op){
+	uint32_t data = load_extend(op->opcode, cpu_load_word(cpu, *op->a + *op->b));
+	*op->old = *op->rd;
+	*op->rd	 = data;
+	return true;
+}
+
+// Leaves the block if translated IRAM words have been written
+static bool block_store(cpu_t *cpu, const blockOp_t *op){
+	cpu_store_word(cpu, *op->a + op->imm, *op->b & op->val);
+	return !cpu->blocks->flush;
+}
+
+static bool block_j(cpu_t *cpu, const blockOp_t *op){
+	cpu->blocks->taken	= true;
+	cpu->blocks->target	= op->val;
+	return true;
+}
+
+static bool block_jal(cpu_t *cpu, const blockOp_t *op){
+	*op->old = *op->rd;
+	*op->rd	 = op->imm;
+	return block_j(cpu, op);
+}
+
+static bool block_jr(cpu_t *cpu, const blockOp_t *op){
+	cpu->blocks->taken	= true;
+	cpu->blocks->target	= *op->a/4;
+	return true;
+}
+
+static bool block_jalr(cpu_t *cpu, const blockOp_t *op){
+	block_jr(cpu, op);
+	*op->old = *op->rd;
+	*op->rd	 = op->imm;
+	return true;
+}
+
+static bool block_beqz(cpu_t *cpu, const blockOp_t *op){
+	cpu->blocks->taken	= (*op->a == 0);
+	cpu->blocks->target	= op->val;
+	return true;
+}
+
+static bool block_bnez(cpu_t *cpu, const blockOp_t *op){
+	cpu->blocks->taken	= (*op->a != 0);
+	cpu->blocks->target	= op->val;
+	return true;
+}
+
+// Where the value is found while running, constant is the storage of SRC_CONST
+static const uint32_t *block_ptr(cpu_t *cpu, blockSrc_t src, uint32_t *constant){
+	switch (src.kind) {
+		case SRC_REG:
+			return &cpu->regs[src.val];
+		case SRC_OLD:
+			return &cpu->blocks->old[src.val];
+		default:
+			*constant = src.val;
+			return constant;
+	}
+}
+
+// Closure of the instruction i
+static void block_closure(cpu_t *cpu, blockInfo_t *info, int i, blockOp_t *op){
+	blockCache_t		*cache = cpu->blocks;
+	const decodedOp_t	*dec = info->op[i];
+	int					h = dec->handler;
+	bool				writes = true;
+
+	op->a		= block_ptr(cpu, info->a[i], &op->ca);
+	op->b		= block_ptr(cpu, info->b[i], &op->cb);
+	op->opcode	= dec->controlWord.opcode;
+	op->imm		= (info->pc + i + 1)*4;
+	op->val		= (JUMP_BASE(info->config, info->pc + i) + dec->imm)/4;
+	switch (h) {
+		case H_NOP:
+			op->fn = block_nop;
+			writes = false;
+			break;
+		case H_LW:
+		case H_LH:
+		case H_LHU:
+		case H_LB:
+		case H_LBU:
+			op->fn = block_load;
+			break;
+		case H_STORE:
+			op->fn	= block_store;
+			op->imm	= dec->imm;
+			op->val	= store_mask(dec->controlWord, 0xffffffff);
+			writes	= false;
+			break;
+		case H_J:
+			op->fn = block_j;
+			writes = false;
+			break;
+		case H_JAL:
+			op->fn = block_jal;
+			break;
+		case H_JR:
+			op->fn = block_jr;
+			writes = false;
+			break;
+		case H_JALR:
+			op->fn = block_jalr;
+			break;
+		case H_BEQZ:
+			op->fn = block_beqz;
+			writes = false;
+			break;
+		case H_BNEZ:
+			op->fn = block_bnez;
+			writes = false;
+			break;
+		default:
+			// H_R_ and H_I_ alternate in the ALU_OPS() order
+			op->fn = block_alu[(h - H_R_NOP) >> 1];
+			break;
+	}
+	if(!writes || dec->rd == 0){
+		op->rd	= &cache->sink;
+		op->old	= &cache->sink;
+		return;
+	}
+	op->rd	= &cpu->regs[dec->rd];
+	op->old	= info->old[i] ? &cache->old[i] : &cache->sink;
+}
+
+// State left after the instruction i
+static void block_exit(cpu_t *cpu, blockInfo_t *info, int i, blockExit_t *exit){
+	const blockWrite_t	*w = info->w[i + 1];
+	blockSrc_t			src;
+	int					k = info->branch;
+	int					j;
+
+	memset(exit, 0, sizeof(blockExit_t));
+	for(j = 0; j < 2; j++){
+		if(w[j].idx < 0){
+			exit->before = true;
+			continue;
+		}
+		exit->w[j].rd	= w[j].rd;
+		exit->w[j].near	= w[j].near;
+		exit->w[j].far	= w[j].far;
+		exit->w[j].load	= w[j].load;
+		if(w[j].rd == 0)
+			continue;
+		exit->old[j] = block_ptr(cpu, block_old(info, w, j), NULL);
+		src = block_fwd(info, w, j);
+		if(src.kind == SRC_CONST)
+			exit->w[j].fwd = src.val;
+		else
+			exit->fwd[j] = block_ptr(cpu, src, NULL);
+	}
+
+	exit->pc		= info->pc + i + 1;
+	exit->pending	= -1;
+	if(k >= 0 && i == k + info->config->delayslot)
+		exit->outcome = true;
+	else if(k >= 0 && i >= k)
+		exit->pending = k - (i - info->config->delayslot + 1);	// Queued from the oldest of the last delayslot instructions
+}
+
+// Leave funcState_t and the PC as the interpreter would
+static void block_leave(cpu_t *cpu, const block_t *block, const blockExit_t *exit){
+	blockCache_t	*cache = cpu->blocks;
+	funcState_t		*f = &cpu->func;
+	int				k, j;
+
+	for(k = 1; k >= 0; k--){
+		if(k == 1 && exit->before){
+			// Only the write before the block can be moved
+			f->w[1] = f->w[0];
+			continue;
+		}
+		f->w[k].rd		= exit->w[k].rd;
+		f->w[k].near	= exit->w[k].near;
+		f->w[k].far		= exit->w[k].far;
+		if(exit->w[k].rd == 0)
+			continue;
+		f->w[k].load	= exit->w[k].load;
+		f->w[k].old		= *exit->old[k];
+		f->w[k].fwd		= exit->fwd[k] != NULL ? *exit->fwd[k] : exit->w[k].fwd;
+	}
+	f->hazard = f->w[0].near | f->w[1].far;
+
+	if(exit->outcome){
+		cpu->pc = cache->taken ? cache->target : block->pc + block->n;
+		return;
+	}
+	if(exit->pending >= 0){
+		f->head = 0;
+		for(j = 0; j < cpu->config.delayslot; j++){
+			f->redirect[j].valid	= (j == exit->pending) && cache->taken;
+			f->redirect[j].target	= cache->target;
+		}
+	}
+	cpu->pc = exit->pc;
+}
+
+static void block_drop(block_t *block){
+	free(block->side);
+	free(block);
+}
+
+// Translate the block at pc, NULL if it can't be
+static block_t *block_translate(cpu_t *cpu, blockCache_t *cache, uint32_t pc){
+	blockInfo_t	info;
+	block_t		*block;
+	int			i;
+
+	if(block_analyze(cpu, pc, &info) == 0){
+		cache->map[pc] = &cache->untranslatable;
+		return NULL;
+	}
+	block = (block_t*)calloc(1, sizeof(block_t) + info.n*sizeof(blockOp_t));
+	if(block != NULL)
+		block->side = (blockExit_t*)calloc(info.n, sizeof(blockExit_t));
+	if(block == NULL || block->side == NULL){
+		fprintf(stderr, "[BLOCKS] calloc() failed\n");
+		free(block);
+		return NULL;
+	}
+	block->op		= (blockOp_t*)(block + 1);
+	block->pc		= pc;
+	block->n		= info.n;
+	block->reads0	= info.reads0;
+	block->reads1	= info.reads1;
+	// With one instruction the hazards on exit depend on the one before
+	block->chainable	= info.n > 1;
+	block->exit_hazard	= info.w[info.n][0].near | info.w[info.n][1].far;
+	block->exit_far		= info.w[info.n][0].far;
+	if(info.branch >= 0){
+		block->conditional	= info.op[info.branch]->handler == H_BEQZ || info.op[info.branch]->handler == H_BNEZ;
+		block->indirect		= info.op[info.branch]->handler == H_JR || info.op[info.branch]->handler == H_JALR;
+	}
+
+	for(i = 0; i < info.n; i++){
+		block_closure(cpu, &info, i, &block->op[i]);
+		if(info.op[i]->handler == H_STORE)
+			block_exit(cpu, &info, i, &block->side[i]);
+	}
+	block_exit(cpu, &info, info.n - 1, &block->tail);
+	block->keeps_before = block->tail.before || block->side[0].before;
+
+	cache->map[pc] = block;
+	for(i = 0; i < info.n; i++)
+		cache->covered[pc + i] = 1;
+	return block;
+}
+
+static block_t *block_lookup(cpu_t *cpu, blockCache_t *cache, uint32_t pc){
+	block_t *block;
+
+	if(pc >= IRAM_SIZE)
+		return NULL;
+	block = cache->map[pc];
+	if(block == NULL)
+		return block_translate(cpu, cache, pc);
+	if(block == &cache->untranslatable)
+		return NULL;
+	return block;
+}
+
+// No pending jump and no hazard on the registers read at first
+static bool block_can_enter(cpu_t *cpu, const block_t *block){
+	funcState_t	*f = &cpu->func;
+	int			j;
+
+	for(j = 0; j < cpu->config.delayslot; j++)
+		if(f->redirect[j].valid)
+			return false;
+	return !(f->hazard & block->reads0) && !(f->w[0].far & block->reads1);
+}
+
+static void block_flush(blockCache_t *cache){
+	int i;
+
+	for(i = 0; i < IRAM_SIZE; i++)
+		if(cache->map[i] != NULL && cache->map[i] != &cache->untranslatable)
+			block_drop(cache->map[i]);
+	memset(cache->map, 0, sizeof(cache->map));
+	memset(cache->covered, 0, sizeof(cache->covered));
+	cache->flush = false;
+}
+
+// Run the block, returns the instructions executed and the state left
+// in exit, for block_leave()
+static int block_exec(cpu_t *cpu, const block_t *block, const blockExit_t **exit){
+	int i;
+
+	for(i = 0; i < block->n; i++){
+		if(!block->op[i].fn(cpu, &block->op[i])){
+			*exit = &block->side[i];
+			return i + 1;
+		}
+	}
+	*exit = &block->tail;
+	return block->n;
+}
+
+// Execute n instructions
+uint64_t block_run(cpu_t *cpu, uint64_t n){
+	blockCache_t	*cache = cpu->blocks;
+	block_t			*block, *next, *last;
+	const blockExit_t	*exit;
+	uint64_t		done = 0;
+	int				executed, x;
+
+	if(cache == NULL){
+		cache = cpu->blocks = (blockCache_t*)calloc(1, sizeof(blockCache_t));
+		if(cache == NULL){
+			fprintf(stderr, "[BLOCKS] calloc() failed, using the interpreter\n");
+			cpu->dispatch = FUNC_DISPATCH_THREADED;
+			return func_interpret(cpu, n);
+		}
+	}
+
+	while(done < n){
+		if(cache->flush)
+			block_flush(cache);
+		block = block_lookup(cpu, cache, cpu->pc);
+		if(block == NULL || (uint64_t)block->n > n - done || !block_can_enter(cpu, block)){
+			if(cpu->bbv != NULL && cpu->pc < IRAM_SIZE)
+				cpu->bbv[cpu->pc]++;
+			if(func_interpret(cpu, 1) == 0)
+				break;		// At the breakpoint
+			done++;
+			continue;
+		}
+
+		// Follow the successors until one has to be looked up or checked.
+		// funcState_t and the PC are only left by the last block run: a
+		// linked successor doesn't need them
+		last = NULL;
+		exit = NULL;
+		while(block != NULL && (uint64_t)block->n <= n - done){
+			if(last != NULL && block->keeps_before)
+				block_leave(cpu, last, exit);
+			last = block;
+			executed = block_exec(cpu, block, &exit);
+			done += executed;
+			cpu->func.retired += executed;
+			if(cpu->bbv != NULL)
+				cpu->bbv[block->pc] += executed;
+			if(executed < block->n)
+				break;
+
+			x = block->conditional && !cache->taken;
+			next = block->next[x];
+			// The successor of a jump to a register is the last target
+			if(block->indirect && next != NULL && next->pc != cache->target)
+				next = NULL;
+			if(next == NULL){
+				block_leave(cpu, block, exit);
+				last = NULL;
+				next = block_lookup(cpu, cache, cpu->pc);
+				if(next == NULL || cache->flush || !block_can_enter(cpu, next))
+					break;
+				// The hazards left by the block are known not to stop the successor
+				if(block->chainable &&
+					!(next->reads0 & block->exit_hazard) && !(next->reads1 & block->exit_far))
+					block->next[x] = next;
+			}
+			block = next;
+		}
+		if(last != NULL)
+			block_leave(cpu, last, exit);
+	}
+	return done;
+}
+
+void block_invalidate(blockCache_t *cache, uint32_t idx){
+	if(cache != NULL && idx < IRAM_SIZE && cache->covered[idx])
+		cache->flush = true;
+}
+
+void block_free(blockCache_t *cache){
+	if(cache == NULL)
+		return;
+	block_flush(cache);
+	free(cache);
+}
@@ -0,0 +1,167 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <cpu_model/cpu_model.h>
+
+////////////////////////////////////
+// CHECKPOINTS
+////////////////////////////////////
+// Architectural state at an instruction boundary: PC, RF, memories and
+// the functional model state (pending jumps, hazards of the last two
+// instructions). The pipeline is completed before saving, so that the
+// checkpoint is restored on the functional model and the next
+// cpu_step() refills the pipeline from there.
+// The UART connection is not part of it.
+//
+// Layout, in host byte order:
+//	ckptHeader_t, regs, funcState_t, IRAM, DRAM, RODATA,
+//	number of XRAM pages written, then each page index and its words
+
+#define CKPT_MAGIC		0x54504b43		// "CKPT"
+#define CKPT_VERSION	3		// Sparse XRAM
+
+// Options changing the meaning of the state
+#define CKPT_CONFIG(config)	((uint32_t)((config)->delayslot | (config)->forwarding << 8 | (config)->relative_jump << 9))
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t config;
+	uint32_t pc;
+	uint64_t retired;		// Instructions executed before the checkpoint
+} ckptHeader_t;
+
+static int ckpt_write(FILE *fd, const void *data, size_t size){
+	if(fwrite(data, 1, size, fd) != size){
+		fprintf(stderr, "[CHECKPOINT] fwrite() failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int ckpt_read(FILE *fd, void *data, size_t size){
+	if(fread(data, 1, size, fd) != size){
+		fprintf(stderr, "[CHECKPOINT] fread() failed, truncated checkpoint\n");
+		return -1;
+	}
+	return 0;
+}
+
+// Only the XRAM pages written are saved
+static int ckpt_write_xram(FILE *fd, const sparseMem_t *xram){
+	uint32_t	left = xram->touched;
+	uint32_t	page;
+
+	if(ckpt_write(fd, &left, sizeof(left)))
+		return -1;
+	for(page = 0; left > 0; page++){
+		if(xram->page[page] == NULL)
+			continue;
+		if(ckpt_write(fd, &page, sizeof(page)) ||
+			ckpt_write(fd, xram->page[page], MEM_PAGE_WORDS*4))
+			return -1;
+		left--;
+	}
+	return 0;
+}
+
+static int ckpt_read_xram(FILE *fd, bus_t *bus){
+	uint32_t	count;
+	uint32_t	page;
+	uint32_t	*words;
+
+	if(ckpt_read(fd, &count, sizeof(count)))
+		return -1;
+	while(count-- > 0){
+		if(ckpt_read(fd, &page, sizeof(page)))
+			return -1;
+		if(page >= bus->xram.pages){
+			fprintf(stderr, "[CHECKPOINT] XRAM page %u out of the memory\n", page);
+			return -1;
+		}
+		if((words = bus_xram_page(bus, page)) == NULL ||
+			ckpt_read(fd, words, MEM_PAGE_WORDS*4))
+			return -1;
+	}
+	return 0;
+}
+
+// Save the state
+int cpu_checkpoint_save(void *handle, FILE *fd){
+	cpu_t			*cpu = (cpu_t*)handle;
+	ckptHeader_t	header;
+	if(cpu == NULL || fd == NULL){
+		fprintf(stderr, "[CHECKPOINT] CPU or file is NULL\n");
+		return -1;
+	}
+	// Saved and restored by the functional model
+	if(cpu->config.predictor != PREDICT_NONE){
+		fprintf(stderr, "[CHECKPOINT] Not available with a branch predictor\n");
+		return -1;
+	}
+
+	// Completes the instructions in the pipeline
+	cpu_run_functional(cpu, 0);
+
+	memset(&header, 0, sizeof(header));
+	header.magic	= CKPT_MAGIC;
+	header.version	= CKPT_VERSION;
+	header.config	= CKPT_CONFIG(&cpu->config);
+	header.pc		= cpu->pc;
+	header.retired	= cpu->func.retired;
+	if(ckpt_write(fd, &header, sizeof(header)) ||
+		ckpt_write(fd, cpu->regs, sizeof(cpu->regs)) ||
+		ckpt_write(fd, &cpu->func, sizeof(cpu->func)) ||
+		ckpt_write(fd, cpu->bus.iram.data, cpu->bus.iram.size*4) ||
+		ckpt_write(fd, cpu->bus.dram.data, cpu->bus.dram.size*4) ||
+		ckpt_write(fd, cpu->bus.rodata.data, cpu->bus.rodata.size*4) ||
+		ckpt_write_xram(fd, &cpu->bus.xram))
+		return -1;
+	return 0;
+}
+
+// Restore the state, the CPU is left on the functional model
+int cpu_checkpoint_load(void *handle, FILE *fd){
+	cpu_t			*cpu = (cpu_t*)handle;
+	ckptHeader_t	header;
+	uint32_t		idx;
+	if(cpu == NULL || fd == NULL){
+		fprintf(stderr, "[CHECKPOINT] CPU or file is NULL\n");
+		return -1;
+	}
+	// Saved and restored by the functional model
+	if(cpu->config.predictor != PREDICT_NONE){
+		fprintf(stderr, "[CHECKPOINT] Not available with a branch predictor\n");
+		return -1;
+	}
+
+	if(ckpt_read(fd, &header, sizeof(header)))
+		return -1;
+	if(header.magic != CKPT_MAGIC || header.version != CKPT_VERSION){
+		fprintf(stderr, "[CHECKPOINT] Not a checkpoint or wrong version\n");
+		return -1;
+	}
+	if(header.config != CKPT_CONFIG(&cpu->config)){
+		fprintf(stderr, "[CHECKPOINT] Saved with other options: 0x%x, expected 0x%x\n", header.config, CKPT_CONFIG(&cpu->config));
+		return -1;
+	}
+
+	cpu_reset(cpu);
+	if(ckpt_read(fd, cpu->regs, sizeof(cpu->regs)) ||
+		ckpt_read(fd, &cpu->func, sizeof(cpu->func)) ||
+		ckpt_read(fd, cpu->bus.iram.data, cpu->bus.iram.size*4) ||
+		ckpt_read(fd, cpu->bus.dram.data, cpu->bus.dram.size*4) ||
+		ckpt_read(fd, cpu->bus.rodata.data, cpu->bus.rodata.size*4) ||
+		ckpt_read_xram(fd, &cpu->bus))
+		return -1;
+	cpu->pc				= header.pc;
+	cpu->func.retired	= header.retired;
+	cpu->func.active	= true;
+
+	// The IRAM has been overwritten behind the bus
+	for(idx = 0; idx < IRAM_SIZE; idx++)
+		cpu_invalidate_decoded(cpu, idx);
+	cpu_predecode(cpu);
+	return 0;
+}
@@ -0,0 +1,338 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <cpu_model/cpu_model.h>
+
+////////////////////////////////////
+// ENCODING
+////////////////////////////////////
+static inline uint8_t *put_varint(uint8_t *p, uint64_t val){
+	while(val >= 0x80){
+		*p++ = (uint8_t)val | 0x80;
+		val >>= 7;
+	}
+	*p++ = (uint8_t)val;
+	return p;
+}
+
+// NULL if the varint doesn't end before end
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *val){
+	uint64_t	v = 0;
+	int			shift;
+
+	for(shift = 0; p < end && shift < 64; shift += 7){
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		if((*p++ & 0x80) == 0){
+			*val = v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Small deltas of both signs in few bytes
+#define ZIGZAG(d)		(((uint32_t)(d) << 1) ^ (uint32_t)((int32_t)(d) >> 31))
+#define UNZIGZAG(z)		((uint32_t)((z) >> 1) ^ (uint32_t)-(int32_t)((z) & 1))
+
+size_t commit_encode(commitCoder_t *coder, const commitRecord_t *record, uint8_t *buf){
+	uint8_t		*p = buf + 1;
+	uint8_t		flags = record->flags & ~(COMMIT_SEQ | COMMIT_TICK);
+
+	if(flags & COMMIT_RESET){
+		memset(coder, 0, sizeof(*coder));
+		*buf = COMMIT_RESET;
+		return 1;
+	}
+	if(record->pc == coder->pc + 1)
+		flags |= COMMIT_SEQ;
+	if(record->cycle == coder->cycle + 1)
+		flags |= COMMIT_TICK;
+	*buf = flags;
+
+	if(!(flags & COMMIT_TICK))
+		p = put_varint(p, record->cycle - coder->cycle);
+	if(!(flags & COMMIT_SEQ))
+		p = put_varint(p, ZIGZAG(record->pc - (coder->pc + 1)));
+	p[0] = (uint8_t)record->instr;
+	p[1] = (uint8_t)(record->instr >> 8);
+	p[2] = (uint8_t)(record->instr >> 16);
+	p[3] = (uint8_t)(record->instr >> 24);
+	p += 4;
+	if(flags & COMMIT_REG){
+		*p++ = record->rd;
+		p = put_varint(p, record->value);
+	}
+	if(flags & (COMMIT_LOAD | COMMIT_STORE)){
+		p = put_varint(p, ZIGZAG(record->addr - coder->addr));
+		p = put_varint(p, record->data);
+		coder->addr = record->addr;
+	}
+	coder->cycle	= record->cycle;
+	coder->pc		= record->pc;
+	return (size_t)(p - buf);
+}
+
+size_t commit_decode(commitCoder_t *coder, const uint8_t *buf, size_t len, commitRecord_t *record){
+	const uint8_t	*p = buf + 1;
+	const uint8_t	*end = buf + len;
+	uint64_t		v;
+
+	if(len == 0)
+		return 0;
+	memset(record, 0, sizeof(*record));
+	record->flags = *buf;
+	if(record->flags & COMMIT_RESET){
+		memset(coder, 0, sizeof(*coder));
+		return 1;
+	}
+
+	record->cycle = coder->cycle + 1;
+	if(!(record->flags & COMMIT_TICK)){
+		if((p = get_varint(p, end, &v)) == NULL)
+			return 0;
+		record->cycle = coder->cycle + v;
+	}
+	record->pc = coder->pc + 1;
+	if(!(record->flags & COMMIT_SEQ)){
+		if((p = get_varint(p, end, &v)) == NULL)
+			return 0;
+		record->pc += UNZIGZAG((uint32_t)v);
+	}
+	if(end - p < 4)
+		return 0;
+	record->instr = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+	p += 4;
+	if(record->flags & COMMIT_REG){
+		if(p == end)
+			return 0;
+		record->rd = *p++;
+		if((p = get_varint(p, end, &v)) == NULL)
+			return 0;
+		record->value = (uint32_t)v;
+	}
+	if(record->flags & (COMMIT_LOAD | COMMIT_STORE)){
+		if((p = get_varint(p, end, &v)) == NULL)
+			return 0;
+		record->addr = coder->addr + UNZIGZAG((uint32_t)v);
+		if((p = get_varint(p, end, &v)) == NULL)
+			return 0;
+		record->data = (uint32_t)v;
+		coder->addr = record->addr;
+	}
+	coder->cycle	= record->cycle;
+	coder->pc		= record->pc;
+	return (size_t)(p - buf);
+}
+
+void commit_print(FILE *fd, const commitRecord_t *record){
+	char str[DISASM_LEN];
+
+	if(record->flags & COMMIT_RESET){
+		fprintf(fd, "reset");
+		return;
+	}
+	disassemble(record->instr, str, sizeof(str));
+	fprintf(fd, "cycle %llu  pc 0x%08x  %08x %-20s", (unsigned long long)record->cycle,
+			record->pc*4, record->instr, str);
+	if(record->flags & COMMIT_REG)
+		fprintf(fd, "  R%u = 0x%08x", record->rd, record->value);
+	if(record->flags & COMMIT_LOAD)
+		fprintf(fd, "  load [0x%08x] = 0x%08x", record->addr, record->data);
+	if(record->flags & COMMIT_STORE)
+		fprintf(fd, "  store [0x%08x] = 0x%08x", record->addr, record->data);
+}
+
+////////////////////////////////////
+// WRITER
+////////////////////////////////////
+// The CPU fills the chunk at head, the writer thread writes the full
+// ones from tail. Only a full chunk is handed over, so the lock is
+// taken once per chunk
+#define COMMIT_CHUNK	(64*1024)
+#define COMMIT_CHUNKS	16
+
+struct commitTrace {
+	FILE			*fd;
+	pthread_t		writer;
+	pthread_mutex_t	lock;
+	pthread_cond_t	filled;		// A chunk to write, or closing
+	pthread_cond_t	emptied;	// A chunk to fill
+	uint8_t			chunk[COMMIT_CHUNKS][COMMIT_CHUNK];
+	size_t			used[COMMIT_CHUNKS];
+	unsigned		head;
+	unsigned		tail;
+	unsigned		full;		// Chunks handed over, not written yet
+	bool			closing;
+	bool			error;		// A write failed, the trace is truncated
+	commitCoder_t	coder;
+};
+
+static void *commit_writer(void *arg){
+	commitTrace_t	*trace = (commitTrace_t*)arg;
+	unsigned		idx;
+
+	pthread_mutex_lock(&trace->lock);
+	while(1){
+		while(trace->full == 0 && !trace->closing)
+			pthread_cond_wait(&trace->filled, &trace->lock);
+		if(trace->full == 0)
+			break;
+		idx = trace->tail;
+		pthread_mutex_unlock(&trace->lock);
+
+		if(!trace->error && fwrite(trace->chunk[idx], 1, trace->used[idx], trace->fd) != trace->used[idx]){
+			fprintf(stderr, "[COMMIT] fwrite() failed, the trace is truncated\n");
+			trace->error = true;
+		}
+
+		pthread_mutex_lock(&trace->lock);
+		trace->tail = (trace->tail + 1) % COMMIT_CHUNKS;
+		trace->full--;
+		pthread_cond_signal(&trace->emptied);
+	}
+	pthread_mutex_unlock(&trace->lock);
+	return NULL;
+}
+
+// Hand the chunk at head over to the writer, waiting for a free one
+static void commit_submit(commitTrace_t *trace){
+	pthread_mutex_lock(&trace->lock);
+	trace->full++;
+	pthread_cond_signal(&trace->filled);
+	while(trace->full == COMMIT_CHUNKS)
+		pthread_cond_wait(&trace->emptied, &trace->lock);
+	trace->head = (trace->head + 1) % COMMIT_CHUNKS;
+	trace->used[trace->head] = 0;
+	pthread_mutex_unlock(&trace->lock);
+}
+
+static void commit_put(commitTrace_t *trace, const commitRecord_t *record){
+	size_t *used = &trace->used[trace->head];
+
+	*used += commit_encode(&trace->coder, record, trace->chunk[trace->head] + *used);
+	if(*used > COMMIT_CHUNK - COMMIT_RECORD_MAX)
+		commit_submit(trace);
+}
+
+////////////////////////////////////
+// CPU
+////////////////////////////////////
+int cpu_commit_open(void *handle, const char *filename){
+	cpu_t			*cpu = (cpu_t*)handle;
+	commitTrace_t	*trace;
+	uint32_t		header[2] = { COMMIT_MAGIC, COMMIT_VERSION };
+
+	if(cpu == NULL || filename == NULL){
+		fprintf(stderr, "[COMMIT] CPU or filename is NULL\n");
+		return -1;
+	}
+	cpu_commit_close(cpu);
+
+	trace = (commitTrace_t*)calloc(1, sizeof(commitTrace_t));
+	if(trace == NULL){
+		fprintf(stderr, "[COMMIT] calloc() failed\n");
+		return -1;
+	}
+	trace->fd = fopen(filename, "wb");
+	if(trace->fd == NULL){
+		fprintf(stderr, "[COMMIT] fopen() failed | filename: %s\n", filename);
+		free(trace);
+		return -1;
+	}
+	if(fwrite(header, sizeof(header), 1, trace->fd) != 1){
+		fprintf(stderr, "[COMMIT] fwrite() failed | filename: %s\n", filename);
+		fclose(trace->fd);
+		free(trace);
+		return -1;
+	}
+	pthread_mutex_init(&trace->lock, NULL);
+	pthread_cond_init(&trace->filled, NULL);
+	pthread_cond_init(&trace->emptied, NULL);
+	if(pthread_create(&trace->writer, NULL, commit_writer, trace)){
+		fprintf(stderr, "[COMMIT] pthread_create() failed\n");
+		fclose(trace->fd);
+		free(trace);
+		return -1;
+	}
+	cpu->commit = trace;
+	return 0;
+}
+
+int cpu_commit_close(void *handle){
+	cpu_t			*cpu = (cpu_t*)handle;
+	commitTrace_t	*trace;
+	bool			error;
+
+	if(cpu == NULL || cpu->commit == NULL)
+		return 0;
+	trace = cpu->commit;
+	cpu->commit = NULL;
+
+	pthread_mutex_lock(&trace->lock);
+	if(trace->used[trace->head] > 0){
+		trace->full++;
+		trace->head = (trace->head + 1) % COMMIT_CHUNKS;
+	}
+	trace->closing = true;
+	pthread_cond_signal(&trace->filled);
+	pthread_mutex_unlock(&trace->lock);
+	pthread_join(trace->writer, NULL);
+
+	error = trace->error;
+	if(fclose(trace->fd) != 0)
+		error = true;
+	pthread_mutex_destroy(&trace->lock);
+	pthread_cond_destroy(&trace->filled);
+	pthread_cond_destroy(&trace->emptied);
+	free(trace);
+	return error ? -1 : 0;
+}
+
+void cpu_commit(cpu_t *cpu, const pipeMem_t *pipeMem){
+	commitRecord_t record;
+
+	record.cycle	= cpu->stats.cycles;
+	record.pc		= pipeMem->pc;
+	record.instr	= pipeMem->instr;
+	record.flags	= 0;
+	if(pipeMem->controlWord.writeRF && pipeMem->rd != 0){
+		record.flags	|= COMMIT_REG;
+		record.rd		= pipeMem->rd;
+		record.value	= cpu->regs[pipeMem->rd];
+	}
+	if(pipeMem->controlWord.readMem){
+		record.flags	|= COMMIT_LOAD;
+		record.addr		= pipeMem->ALU_out;
+		record.data		= pipeMem->DRAM_out;
+	}else if(pipeMem->controlWord.writeMem){
+		record.flags	|= COMMIT_STORE;
+		record.addr		= pipeMem->ALU_out;
+		record.data		= pipeMem->DRAM_data;
+	}
+	if(cpu->commit != NULL)
+		commit_put(cpu->commit, &record);
+	if(cpu->commit_hook != NULL)
+		cpu->commit_hook(cpu->commit_ctx, &record);
+}
+
+void cpu_set_commit_hook(void *handle, commitHook_t hook, void *ctx){
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[COMMIT] CPU is NULL\n");
+		return;
+	}
+	cpu->commit_hook	= hook;
+	cpu->commit_ctx		= ctx;
+}
+
+void cpu_commit_reset(cpu_t *cpu){
+	commitRecord_t record;
+
+	if(cpu->commit == NULL)
+		return;
+	memset(&record, 0, sizeof(record));
+	record.flags = COMMIT_RESET;
+	commit_put(cpu->commit, &record);
+}
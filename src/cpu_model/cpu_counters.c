@@ -0,0 +1,265 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <cpu_model/cpu_model.h>
+
+static const char *stage_name[PIPE_STAGES]	= { "IF/ID", "ID/EX", "EX/MEM", "MEM/WB" };
+static const char *width_name[ACCESS_WIDTHS]	= { "word", "half", "byte" };
+
+////////////////////////////////////
+// NAMES
+////////////////////////////////////
+// First word of the disassembly, fallback if the instruction is not known
+static void mnemonic(uint32_t instr, const char *fallback, unsigned code, char *buf){
+	char	str[DISASM_LEN];
+	size_t	len;
+
+	disassemble(instr, str, sizeof(str));
+	len = strcspn(str, " ");
+	if(len == 0 || len >= DISASM_LEN || strncmp(str, "UNKNOWN", len) == 0 ||
+			(str[0] == 'R' && isdigit((unsigned char)str[1]))){
+		snprintf(buf, DISASM_LEN, "%s_0x%02x", fallback, code);
+		return;
+	}
+	memcpy(buf, str, len);
+	buf[len] = '\0';
+}
+
+static void opcode_name(unsigned opcode, char *buf){
+	if(opcode == OPCODE_RTYPE){
+		strcpy(buf, "RTYPE");
+		return;
+	}
+	mnemonic((uint32_t)opcode << 26, "OPCODE", opcode, buf);
+}
+
+static void func_name(unsigned func, char *buf){
+	mnemonic(func, "FUNC", func, buf);
+}
+
+////////////////////////////////////
+// WRITERS
+////////////////////////////////////
+// Groups in the order written, JSON and CSV alike. The predictor ones
+// only with a predictor (predict not NULL)
+static void write_json(FILE *fd, const cpuStats_t *stats, const cpuCounters_t *counters, const predictorStats_t *predict){
+	char	name[DISASM_LEN];
+	bool	first;
+	int		i;
+
+	fprintf(fd, "{\"cycles\":%llu,\"retired\":%llu,\"nops\":%llu,\"bubbles\":{",
+			(unsigned long long)stats->cycles, (unsigned long long)stats->retired, (unsigned long long)stats->nops);
+	for(i = 0; i < PIPE_STAGES; i++)
+		fprintf(fd, "%s\"%s\":%llu", i ? "," : "", stage_name[i], (unsigned long long)counters->bubbles[i]);
+	fprintf(fd, "},\"forwarding\":{\"alu\":%llu,\"mem\":%llu}", (unsigned long long)counters->fwd_alu,
+			(unsigned long long)counters->fwd_mem);
+	fprintf(fd, ",\"branches\":{\"taken\":%llu,\"not_taken\":%llu},\"jumps\":%llu", (unsigned long long)counters->taken,
+			(unsigned long long)counters->not_taken, (unsigned long long)counters->jumps);
+	fprintf(fd, ",\"loads\":{");
+	for(i = 0; i < ACCESS_WIDTHS; i++)
+		fprintf(fd, "%s\"%s\":%llu", i ? "," : "", width_name[i], (unsigned long long)counters->loads[i]);
+	fprintf(fd, "},\"stores\":{");
+	for(i = 0; i < ACCESS_WIDTHS; i++)
+		fprintf(fd, "%s\"%s\":%llu", i ? "," : "", width_name[i], (unsigned long long)counters->stores[i]);
+	fprintf(fd, "},\"opcodes\":{");
+	for(i = 0, first = true; i < 64; i++){
+		if(counters->opcode[i] == 0)
+			continue;
+		opcode_name(i, name);
+		fprintf(fd, "%s\"%s\":%llu", first ? "" : ",", name, (unsigned long long)counters->opcode[i]);
+		first = false;
+	}
+	fprintf(fd, "},\"rtype\":{");
+	for(i = 0, first = true; i < 64; i++){
+		if(counters->rtype[i] == 0)
+			continue;
+		func_name(i, name);
+		fprintf(fd, "%s\"%s\":%llu", first ? "" : ",", name, (unsigned long long)counters->rtype[i]);
+		first = false;
+	}
+	fprintf(fd, "}");
+	if(predict != NULL)
+		fprintf(fd, ",\"predictor\":{\"branches\":%llu,\"branch_misses\":%llu,\"jumps\":%llu,\"jump_misses\":%llu,"
+				"\"returns\":%llu,\"return_misses\":%llu,\"flushed\":%llu}", (unsigned long long)predict->branches,
+				(unsigned long long)predict->branch_misses, (unsigned long long)predict->jumps,
+				(unsigned long long)predict->jump_misses, (unsigned long long)predict->returns,
+				(unsigned long long)predict->return_misses, (unsigned long long)predict->flushed);
+	fprintf(fd, "}\n");
+}
+
+static void csv_row(FILE *fd, uint64_t cycle, const char *group, const char *name, uint64_t value){
+	fprintf(fd, "%llu,%s%s%s,%llu\n", (unsigned long long)cycle, group, group[0] ? "." : "", name,
+			(unsigned long long)value);
+}
+
+static void write_csv(FILE *fd, const cpuStats_t *stats, const cpuCounters_t *counters, const predictorStats_t *predict){
+	uint64_t	cycle = stats->cycles;
+	char		name[DISASM_LEN];
+	int			i;
+
+	csv_row(fd, cycle, "", "retired", stats->retired);
+	csv_row(fd, cycle, "", "nops", stats->nops);
+	for(i = 0; i < PIPE_STAGES; i++)
+		csv_row(fd, cycle, "bubbles", stage_name[i], counters->bubbles[i]);
+	csv_row(fd, cycle, "forwarding", "alu", counters->fwd_alu);
+	csv_row(fd, cycle, "forwarding", "mem", counters->fwd_mem);
+	csv_row(fd, cycle, "branches", "taken", counters->taken);
+	csv_row(fd, cycle, "branches", "not_taken", counters->not_taken);
+	csv_row(fd, cycle, "", "jumps", counters->jumps);
+	for(i = 0; i < ACCESS_WIDTHS; i++)
+		csv_row(fd, cycle, "loads", width_name[i], counters->loads[i]);
+	for(i = 0; i < ACCESS_WIDTHS; i++)
+		csv_row(fd, cycle, "stores", width_name[i], counters->stores[i]);
+	for(i = 0; i < 64; i++){
+		if(counters->opcode[i] == 0)
+			continue;
+		opcode_name(i, name);
+		csv_row(fd, cycle, "opcodes", name, counters->opcode[i]);
+	}
+	for(i = 0; i < 64; i++){
+		if(counters->rtype[i] == 0)
+			continue;
+		func_name(i, name);
+		csv_row(fd, cycle, "rtype", name, counters->rtype[i]);
+	}
+	if(predict == NULL)
+		return;
+	csv_row(fd, cycle, "predictor", "branches", predict->branches);
+	csv_row(fd, cycle, "predictor", "branch_misses", predict->branch_misses);
+	csv_row(fd, cycle, "predictor", "jumps", predict->jumps);
+	csv_row(fd, cycle, "predictor", "jump_misses", predict->jump_misses);
+	csv_row(fd, cycle, "predictor", "returns", predict->returns);
+	csv_row(fd, cycle, "predictor", "return_misses", predict->return_misses);
+	csv_row(fd, cycle, "predictor", "flushed", predict->flushed);
+}
+
+////////////////////////////////////
+// CPU
+////////////////////////////////////
+// Not counted yet
+static const cpuCounters_t no_counters;
+
+// The first multiple of the interval past the current cycle
+static uint64_t next_write(const cpu_t *cpu){
+	if(cpu->counters_every == 0)
+		return UINT64_MAX;
+	return (cpu->stats.cycles / cpu->counters_every + 1) * cpu->counters_every;
+}
+
+void cpu_set_counters(void *handle, bool enable){
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[COUNTERS] CPU is NULL\n");
+		return;
+	}
+	if(enable && cpu->counters == NULL){
+		cpu->counters = (cpuCounters_t*)calloc(1, sizeof(cpuCounters_t));
+		if(cpu->counters == NULL){
+			fprintf(stderr, "[COUNTERS] calloc() failed\n");
+			return;
+		}
+	}
+	cpu->counting	= enable;
+	cpu->step		= cpu_step_kernel(&cpu->config, enable);
+}
+
+const cpuCounters_t *cpu_get_counters(void *handle){
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[COUNTERS] CPU is NULL\n");
+		return NULL;
+	}
+	return cpu->counters != NULL ? cpu->counters : &no_counters;
+}
+
+int cpu_counters_write(void *handle, FILE *fd, countersFormat_t format, bool header){
+	cpu_t *cpu = (cpu_t*)handle;
+	const predictorStats_t *predict;
+	if(cpu == NULL || fd == NULL){
+		fprintf(stderr, "[COUNTERS] CPU or file is NULL\n");
+		return -1;
+	}
+	predict = cpu->predictor != NULL ? &cpu->predict : NULL;
+	if(format == COUNTERS_JSON){
+		write_json(fd, &cpu->stats, cpu_get_counters(cpu), predict);
+	}else{
+		if(header)
+			fprintf(fd, "cycle,counter,value\n");
+		write_csv(fd, &cpu->stats, cpu_get_counters(cpu), predict);
+	}
+	return ferror(fd) ? -1 : 0;
+}
+
+int cpu_counters_every(void *handle, FILE *fd, countersFormat_t format, uint64_t interval){
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL || (fd == NULL && interval > 0)){
+		fprintf(stderr, "[COUNTERS] CPU or file is NULL\n");
+		return -1;
+	}
+	if(interval == 0){
+		cpu->counters_fd	= NULL;
+		cpu->counters_every	= 0;
+		cpu->counters_next	= next_write(cpu);
+		return 0;
+	}
+	if(format == COUNTERS_CSV)
+		fprintf(fd, "cycle,counter,value\n");
+	cpu->counters_fd		= fd;
+	cpu->counters_format	= format;
+	cpu->counters_every		= interval;
+	cpu->counters_next		= next_write(cpu);
+	cpu_set_counters(cpu, true);
+	return cpu->counting ? 0 : -1;
+}
+
+void cpu_counters_tick(cpu_t *cpu){
+	cpu_counters_write(cpu, cpu->counters_fd, cpu->counters_format, false);
+	cpu->counters_next = next_write(cpu);
+}
+
+void cpu_counters_idle(cpu_t *cpu, uint32_t head, uint32_t len, uint64_t iterations){
+	cpuCounters_t		*counters = cpu->counters;
+	const decodedOp_t	*op;
+	uint32_t			idx;
+	uint8_t				opcode;
+	bool				zero;
+	int					k;
+
+	for(idx = head; idx < head + len; idx++){
+		op		= cpu_get_decoded(cpu, idx);
+		opcode	= (op->instr >> 26) & 0x3F;
+		// Nothing written by the loop, the branches always go the same way
+		zero	= cpu->regs[op->rs1] == 0;
+		counters->opcode[opcode] += iterations;
+		switch(opcode){
+			case OPCODE_RTYPE:
+				if((op->instr & 0x7FF) < 64)
+					counters->rtype[op->instr & 0x7FF] += iterations;
+				break;
+			case OPCODE_BEQZ: case OPCODE_BNEZ:
+				if(zero == (opcode == OPCODE_BEQZ))
+					counters->taken += iterations;
+				else
+					counters->not_taken += iterations;
+				break;
+			case OPCODE_J: case OPCODE_JAL: case OPCODE_JR: case OPCODE_JALR:
+				counters->jumps += iterations;
+				break;
+			default:
+				break;
+		}
+		// Each pipeline register holds each word once an iteration
+		if(opcode == OPCODE_NOP)
+			for(k = 0; k < PIPE_STAGES; k++)
+				counters->bubbles[k] += iterations;
+	}
+}
+
+void cpu_clear_counters(cpu_t *cpu){
+	if(cpu->counters != NULL)
+		memset(cpu->counters, 0, sizeof(cpuCounters_t));
+	cpu->counters_next = next_write(cpu);
+}
@@ -0,0 +1,443 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <cpu_model/cpu_model.h>
+
+////////////////////////////////////
+// FUNCTIONAL MODEL
+////////////////////////////////////
+// Each instruction is executed as a whole, the pipeline is only
+// mimicked where it is visible to the program:
+//	- the PC is redirected config.delayslot instructions after the jump
+//	- the decode stage reads the RF before the two previous instructions
+//	  wrote it back: their values are seen only through the forwarding
+//	  paths (not at all without config.forwarding, and not the loaded
+//	  value of the previous instruction)
+// An unknown ALU operation is executed as a NOP.
+//
+// The instructions are predecoded into a handler each, the interpreter
+// (cpu_functional_core.h) chains the handlers with computed gotos, or
+// with a switch when the compiler doesn't support them.
+// The translators (cpu_block.c, cpu_jit.c) run blocks of instructions
+// instead, and fall back here for the instructions they can't run.
+
+// Instructions executed at most to give the state back to the pipeline
+#define FUNC_LEAVE_MAX 64
+
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define FUNC_HAS_THREADED
+#endif
+
+// Register as read by the decode stage, when it has been written by
+// one of the two previous instructions
+static uint32_t func_read_hazard(cpu_t *cpu, uint8_t r){
+	funcState_t *f = &cpu->func;
+	if(cpu->config.forwarding){
+		if(f->w[0].rd == r && !f->w[0].load)
+			return f->w[0].fwd;		// ALU out of the previous instruction
+		if(f->w[1].rd == r)
+			return f->w[1].fwd;		// MEM out of the one before
+		return f->w[0].old;			// Loaded by the previous instruction, not ready
+	}
+	if(f->w[1].rd == r)
+		return f->w[1].old;
+	return f->w[0].old;
+}
+
+// The jump of config.delayslot instructions ago leaves its place to the
+// new one, returns the old one
+static inline funcRedirect_t func_push_redirect(cpu_t *cpu, bool valid, uint32_t target){
+	funcState_t		*f = &cpu->func;
+	funcRedirect_t	redirect = f->redirect[f->head];
+	f->redirect[f->head].valid	= valid;
+	f->redirect[f->head].target	= target;
+	if(++f->head == cpu->config.delayslot)
+		f->head = 0;
+	return redirect;
+}
+
+// RF write of the instruction, rd = 0 when nothing is written
+// fwd is the value on the forwarding paths, load if it comes from MEM
+static inline void func_write(cpu_t *cpu, uint8_t rd, uint32_t val, uint32_t fwd, bool load){
+	funcState_t	*f = &cpu->func;
+	funcWrite_t	*w = &f->w[0];
+
+	f->w[1] = f->w[0];
+	w->rd	= rd;
+	w->near	= 0;
+	w->far	= 0;
+	if(rd != 0){
+		w->old	= cpu->regs[rd];
+		w->fwd	= fwd;
+		w->load	= load;
+		if(cpu->config.forwarding){
+			if(load || fwd != val)
+				w->near = 1u << rd;
+			if(fwd != val)
+				w->far = 1u << rd;
+		}else{
+			w->near = 1u << rd;
+			w->far	= 1u << rd;
+		}
+		cpu->regs[rd] = val;
+	}
+	f->hazard = w->near | f->w[1].far;
+}
+
+// Last stages of an instruction coming from the pipeline registers: RF write
+// and PC redirection, returns the redirection taking place after it
+static funcRedirect_t func_retire(cpu_t *cpu, controlWord_t controlWord, uint8_t rd, bool jump,
+	uint32_t nextPC, uint32_t ALU_out, uint32_t DRAM_out, uint32_t rs1_val){
+	uint32_t val;
+
+	if(jump)
+		val = nextPC;
+	else if(controlWord.readMem)
+		val = DRAM_out;
+	else
+		val = ALU_out;
+	func_write(cpu, controlWord.writeRF ? rd : 0, val, controlWord.readMem ? DRAM_out : ALU_out, controlWord.readMem);
+
+	cpu->func.retired++;
+	return func_push_redirect(cpu, jump || controlWord.useRegisterToJump,
+		controlWord.useRegisterToJump ? rs1_val/4 : ALU_out/4);
+}
+
+// Ex stage, returns false on unknown operations
+static inline bool func_exe(const cpu_config_t *config, const pipeDecode_t *op, uint32_t *ALU_out, bool *toJump){
+	uint32_t operandA, operandB;
+
+	if(op->controlWord.jmp_eqz_neqz != nop){
+		operandA = config->relative_jump ? op->nextPC : 0;
+	}else {
+		operandA = op->rs1_val;
+	}
+	operandB = op->controlWord.useImm ? op->imm : op->rs2_val;
+	if(alu_execute(op->controlWord.ALU_opcode, operandA, operandB, ALU_out) < 0){
+		fprintf(stderr, "[FUNCTIONAL] Unknown ALU_opcode = %x at PC 0x%08x\n", op->controlWord.ALU_opcode, op->pc*4);
+		return false;
+	}
+
+	switch (op->controlWord.jmp_eqz_neqz) {
+		case jump:
+		case jump_link:
+			*toJump = true;
+			break;
+		case eqz:
+			*toJump = (op->rs1_val == 0x0);
+			break;
+		case neqz:
+			*toJump = (op->rs1_val != 0x0);
+			break;
+		default:
+			*toJump = false;
+			break;
+	}
+	return true;
+}
+
+// Mem stage
+static inline uint32_t func_mem(cpu_t *cpu, controlWord_t controlWord, uint32_t ALU_out, uint32_t rs2_val){
+	if(controlWord.readMem)
+		return load_extend(controlWord.opcode, cpu_load_word(cpu, ALU_out));
+	if(controlWord.writeMem)
+		cpu_store_word(cpu, ALU_out, store_mask(controlWord, rs2_val));
+	return 0;
+}
+
+// Predecoded instruction at pc
+static inline const decodedOp_t *func_fetch(cpu_t *cpu, uint32_t pc){
+	if(pc < IRAM_SIZE && (cpu->decoded[pc].flags & DECODED_VALID))
+		return &cpu->decoded[pc];
+	return cpu_get_decoded(cpu, pc);
+}
+
+// Register as read by the decode stage
+#define FUNC_READ(r)	((f->hazard & (1u << (r))) ? func_read_hazard(cpu, (r)) : cpu->regs[(r)])
+
+#ifdef FUNC_HAS_THREADED
+#define FUNC_CORE		func_run_threaded
+#define FUNC_THREADED
+#include "cpu_functional_core.h"
+#undef FUNC_THREADED
+#undef FUNC_CORE
+#endif
+
+#define FUNC_CORE		func_run_switch
+#include "cpu_functional_core.h"
+#undef FUNC_CORE
+
+// Execute n instructions with the interpreter, the translators
+// interpret with the threaded one
+uint64_t func_interpret(cpu_t *cpu, uint64_t n){
+#ifdef FUNC_HAS_THREADED
+	if(cpu->dispatch != FUNC_DISPATCH_SWITCH)
+		return func_run_threaded(cpu, n);
+#endif
+	return func_run_switch(cpu, n);
+}
+
+// Execute n instructions with the selected dispatch
+static uint64_t func_run(cpu_t *cpu, uint64_t n){
+	if(cpu->bbv != NULL)
+		return block_run(cpu, n);		// Counts the executed blocks
+	if(cpu->dispatch == FUNC_DISPATCH_JIT)
+		return jit_run(cpu, n);
+	if(cpu->dispatch == FUNC_DISPATCH_BLOCKS)
+		return block_run(cpu, n);
+	return func_interpret(cpu, n);
+}
+
+// Handler of the predecoded instruction
+funcHandler_t func_select_handler(const decodedOp_t *op){
+	controlWord_t controlWord = op->controlWord;
+
+	if(op->flags & DECODED_NOP)
+		return H_NOP;
+
+	switch (controlWord.opcode) {
+		case OPCODE_NOP:		// Zero word
+			return H_NOP;
+		case OPCODE_RTYPE:
+			switch (controlWord.ALU_opcode) {
+#define X(name, expr) \
+				case FUNC_##name: \
+					return H_R_##name;
+				ALU_OPS(X)
+#undef X
+				default:
+					return H_INVALID;
+			}
+		case OPCODE_J:		return H_J;
+		case OPCODE_JAL:	return H_JAL;
+		case OPCODE_JR:		return H_JR;
+		case OPCODE_JALR:	return H_JALR;
+		case OPCODE_BEQZ:	return H_BEQZ;
+		case OPCODE_BNEZ:	return H_BNEZ;
+		case OPCODE_LW:		return H_LW;
+		case OPCODE_LH:		return H_LH;
+		case OPCODE_LHU:	return H_LHU;
+		case OPCODE_LB:		return H_LB;
+		case OPCODE_LBU:	return H_LBU;
+		case OPCODE_SW:
+		case OPCODE_SH:
+		case OPCODE_SB:
+			return H_STORE;
+		default:
+			// I-Type ALU operations, the unknown ones write nothing
+			if(!controlWord.writeRF)
+				return H_NOP;
+			switch (controlWord.ALU_opcode) {
+#define X(name, expr) \
+				case FUNC_##name: \
+					return H_I_##name;
+				ALU_OPS(X)
+#undef X
+				default:
+					return H_INVALID;
+			}
+	}
+}
+
+// Complete the instructions in the pipeline, so that the functional
+// model starts from the first one not executed yet
+static void func_enter(cpu_t *cpu){
+	pipeBank_t	*cur = PIPE_CUR(cpu);
+	pipeEx_t	*ex;
+	pipeMem_t	*mem;
+	uint32_t	ALU_out = 0;
+	uint32_t	DRAM_out;
+	bool		jump = false;
+	uint64_t	retired = cpu->func.retired;
+	uint8_t		ghosts = cpu->func.ghosts;
+
+	memset(&cpu->func, 0, sizeof(funcState_t));
+	cpu->func.retired = retired;
+
+	if(cpu->iteration == 0){
+		// Nothing fetched yet
+		cpu->pc++;
+		cpu->func.active = true;
+		return;
+	}
+
+	// From the oldest, each latch is valid once its stage has run
+	if(cpu->iteration > 3){
+		mem = &cur->mem;
+		if(ghosts > 0)
+			func_push_redirect(cpu, mem->controlWord.useRegisterToJump, mem->rs1_val/4);
+		else
+			func_retire(cpu, mem->controlWord, mem->rd, mem->jump, mem->nextPC, mem->ALU_out, mem->DRAM_out, mem->rs1_val);
+	}
+	if(cpu->iteration > 2){
+		ex = &cur->ex;
+		if(ghosts > 1){
+			func_push_redirect(cpu, ex->controlWord.useRegisterToJump, ex->rs1_val/4);
+		}else {
+			DRAM_out = func_mem(cpu, ex->controlWord, ex->ALU_out, ex->rs2_val);
+			func_retire(cpu, ex->controlWord, ex->rd, ex->jump, ex->nextPC, ex->ALU_out, DRAM_out, ex->rs1_val);
+		}
+	}
+	if(cpu->iteration > 1 && ghosts > 2){
+		func_push_redirect(cpu, cur->decode.controlWord.useRegisterToJump, cur->decode.rs1_val/4);
+	}else if(cpu->iteration > 1){
+		pipeDecode_t in = cur->decode;	// Operands already read and forwarded
+		DRAM_out = 0;
+		if(func_exe(&cpu->config, &in, &ALU_out, &jump))
+			DRAM_out = func_mem(cpu, in.controlWord, ALU_out, in.rs2_val);
+		else
+			memset(&in.controlWord, 0, sizeof(controlWord_t));
+		func_retire(cpu, in.controlWord, in.rd, jump, in.nextPC, ALU_out, DRAM_out, in.rs1_val);
+	}
+
+	// The fetched instruction is executed from scratch
+	cpu->pc = cur->fetch.pc;
+	memset(cpu->pipe, 0, sizeof(cpu->pipe));
+	cpu->cur = 0;
+	cpu->iteration = 0;
+	cpu->func.active = true;
+}
+
+// Registers read by the instruction
+static inline uint32_t func_reads(const decodedOp_t *op){
+	uint32_t reads = 0;
+	if(op->flags & DECODED_NOP)
+		return 0;
+	if(op->flags & DECODED_READ_RS1)
+		reads |= 1u << op->rs1;
+	if(op->flags & DECODED_READ_RS2)
+		reads |= 1u << op->rs2;
+	return reads;
+}
+
+// The pipeline restarts with the writes already in the RF, so the
+// next two instructions mustn't depend on the hazards
+static bool func_can_leave(cpu_t *cpu){
+	funcState_t		*f = &cpu->func;
+	funcRedirect_t	redirect = f->redirect[f->head];	// Taken after the next instruction
+	uint32_t		next_pc = redirect.valid ? redirect.target : cpu->pc + 1;
+
+	if(func_reads(cpu_get_decoded(cpu, cpu->pc)) & f->hazard)
+		return false;
+	return (func_reads(cpu_get_decoded(cpu, next_pc)) & f->w[0].far) == 0;
+}
+
+// Execute n instructions
+uint64_t cpu_run_functional(void *handle, uint64_t n){
+	cpu_t		*cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[FUNCTIONAL] CPU is NULL\n");
+		return 0;
+	}
+	// The jumps would take the delay slots
+	if(cpu->config.predictor != PREDICT_NONE){
+		fprintf(stderr, "[FUNCTIONAL] Not available with a branch predictor\n");
+		return 0;
+	}
+
+	if(!cpu->func.active)
+		func_enter(cpu);
+
+	return func_run(cpu, n);
+}
+
+// Give the architectural state back to the pipeline
+void cpu_leave_functional(void *handle){
+	cpu_t			*cpu = (cpu_t*)handle;
+	pipeBank_t		*cur;
+	funcRedirect_t	*redirect;
+	int				i;
+	if(cpu == NULL){
+		fprintf(stderr, "[FUNCTIONAL] CPU is NULL\n");
+		return;
+	}
+	if(!cpu->func.active)
+		return;
+
+	for(i = 0; i < FUNC_LEAVE_MAX && !func_can_leave(cpu); i++)
+		func_interpret(cpu, 1);
+	if(i == FUNC_LEAVE_MAX)
+		fprintf(stderr, "[FUNCTIONAL] Pipeline restarted with pending hazards at PC 0x%08x\n", cpu->pc*4);
+
+	// Pipeline as left by the cycle fetching the PC: the stages after
+	// hold the pending jumps of the previous instructions, already
+	// executed, so that they are taken after the right delay slot
+	memset(cpu->pipe, 0, sizeof(cpu->pipe));
+	cpu->cur = 0;
+	cur = PIPE_CUR(cpu);
+	for(i = 1; i <= cpu->config.delayslot; i++){
+		redirect = &cpu->func.redirect[(cpu->func.head + cpu->config.delayslot - i) % cpu->config.delayslot];
+		if(!redirect->valid)
+			continue;
+		switch (i) {
+			case 1:
+				cur->decode.controlWord.useRegisterToJump = 1;
+				cur->decode.rs1_val = redirect->target*4;
+				break;
+			case 2:
+				cur->ex.controlWord.useRegisterToJump = 1;
+				cur->ex.rs1_val = redirect->target*4;
+				break;
+			default:
+				cur->mem.controlWord.useRegisterToJump = 1;
+				cur->mem.rs1_val = redirect->target*4;
+				break;
+		}
+	}
+	cur->fetch.pc		= cpu->pc;
+	cur->fetch.op		= *cpu_get_decoded(cpu, cpu->pc);
+	cur->fetch.instr	= cur->fetch.op.instr;
+	cur->fetch.nextPC	= (cpu->pc + 1)*4;
+	cpu->iteration = 5;
+	cpu->func.ghosts = 3;
+	cpu->func.active = false;
+}
+
+// Select the dispatch of the functional model
+void cpu_set_dispatch(void *handle, funcDispatch_t dispatch){
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[FUNCTIONAL] CPU is NULL\n");
+		return;
+	}
+	cpu->dispatch = dispatch;
+}
+
+// Move the breakpoint, the predecoded copies of both words are dropped
+static void func_set_breakpoint(cpu_t *cpu, uint32_t idx){
+	uint32_t old = cpu->breakpoint;
+	cpu->breakpoint = idx;
+	cpu_invalidate_decoded(cpu, old);
+	cpu_invalidate_decoded(cpu, idx);
+}
+
+// Skip to the region of interest
+uint64_t cpu_fast_forward(void *handle, uint64_t n, uint32_t marker){
+	cpu_t		*cpu = (cpu_t*)handle;
+	uint64_t	retired;
+	if(cpu == NULL){
+		fprintf(stderr, "[FUNCTIONAL] CPU is NULL\n");
+		return 0;
+	}
+
+	retired = cpu->func.retired;
+	func_set_breakpoint(cpu, marker);
+	cpu_run_functional(cpu, n);
+	func_set_breakpoint(cpu, FF_NO_MARKER);
+
+	// The pipeline is refilled now, so that the region of interest
+	// starts with the first cpu_step()
+	cpu_leave_functional(cpu);
+	cpu_clear_stats(cpu);
+	return cpu->func.retired - retired;
+}
+
+void cpu_set_bbv(void *handle, uint64_t *counts){
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[FUNCTIONAL] CPU is NULL\n");
+		return;
+	}
+	cpu->bbv = counts;
+}
@@ -0,0 +1,188 @@
+// Interpreter of the functional model, included by cpu_functional.c
+// once for each dispatch:
+//	FUNC_CORE		name of the function
+//	FUNC_THREADED	the handlers jump to each other with computed gotos,
+//					otherwise a switch selects them
+// Each handler executes a whole instruction: RF read, ALU, memory,
+// RF write and the jump taking place after it.
+
+#ifdef FUNC_THREADED
+#define HANDLER(name)	L_##name:
+// Every handler has its own indirect jump to the next one
+#define DISPATCH() { \
+	if(++i == n) \
+		goto done; \
+	op = func_fetch(cpu, pc); \
+	goto *handlers[op->handler]; \
+}
+#else
+#define HANDLER(name)	case H_##name:
+#define DISPATCH() { \
+	i++; \
+	continue; \
+}
+#endif
+
+// End of the instruction, the jump of config.delayslot instructions ago is taken
+#define NEXT(taken, to) { \
+	redirect = func_push_redirect(cpu, (taken), (to)); \
+	pc = redirect.valid ? redirect.target : pc + 1; \
+	DISPATCH(); \
+}
+
+#define LOAD(name) \
+	HANDLER(name) { \
+		a = FUNC_READ(op->rs1); \
+		data = load_extend(OPCODE_##name, cpu_load_word(cpu, a + op->imm)); \
+		func_write(cpu, op->rd, data, data, true); \
+		NEXT(false, 0); \
+	}
+
+static uint64_t FUNC_CORE(cpu_t *cpu, uint64_t n){
+	funcState_t			*f = &cpu->func;
+	const decodedOp_t	*op;
+	funcRedirect_t		redirect;
+	uint32_t			pc = cpu->pc;
+	uint64_t			i = 0;
+	uint32_t			a, b, ALU_out, data;
+
+#ifdef FUNC_THREADED
+	static const void *handlers[H_NUM] = {
+		[H_NOP]		= &&L_NOP,
+		[H_INVALID]	= &&L_INVALID,
+#define X(name, expr) \
+		[H_R_##name] = &&L_R_##name, \
+		[H_I_##name] = &&L_I_##name,
+		ALU_OPS(X)
+#undef X
+		[H_LW]		= &&L_LW,
+		[H_LH]		= &&L_LH,
+		[H_LHU]		= &&L_LHU,
+		[H_LB]		= &&L_LB,
+		[H_LBU]		= &&L_LBU,
+		[H_STORE]	= &&L_STORE,
+		[H_J]		= &&L_J,
+		[H_JAL]		= &&L_JAL,
+		[H_JR]		= &&L_JR,
+		[H_JALR]	= &&L_JALR,
+		[H_BEQZ]	= &&L_BEQZ,
+		[H_BNEZ]	= &&L_BNEZ,
+		[H_BREAK]	= &&L_BREAK,
+	};
+
+	if(n == 0)
+		goto done;
+	op = func_fetch(cpu, pc);
+	goto *handlers[op->handler];
+#else
+	while(i < n){
+		op = func_fetch(cpu, pc);
+		switch (op->handler) {
+#endif
+
+	HANDLER(NOP) {
+		func_write(cpu, 0, 0, 0, false);
+		NEXT(false, 0);
+	}
+
+	HANDLER(INVALID) {
+		fprintf(stderr, "[FUNCTIONAL] Unknown ALU_opcode = %x at PC 0x%08x\n", op->controlWord.ALU_opcode, pc*4);
+		func_write(cpu, 0, 0, 0, false);
+		NEXT(false, 0);
+	}
+
+	// R0 is not read by the R-Type instructions
+#define X(name, expr) \
+	HANDLER(R_##name) { \
+		a = (op->flags & DECODED_READ_RS1) ? FUNC_READ(op->rs1) : 0; \
+		b = (op->flags & DECODED_READ_RS2) ? FUNC_READ(op->rs2) : 0; \
+		ALU_out = (expr); \
+		func_write(cpu, op->rd, ALU_out, ALU_out, false); \
+		NEXT(false, 0); \
+	} \
+	HANDLER(I_##name) { \
+		a = FUNC_READ(op->rs1); \
+		b = op->imm; \
+		ALU_out = (expr); \
+		func_write(cpu, op->rd, ALU_out, ALU_out, false); \
+		NEXT(false, 0); \
+	}
+	ALU_OPS(X)
+#undef X
+
+	LOAD(LW)
+	LOAD(LH)
+	LOAD(LHU)
+	LOAD(LB)
+	LOAD(LBU)
+
+	HANDLER(STORE) {
+		a = FUNC_READ(op->rs1);
+		b = FUNC_READ(op->rs2);
+		cpu_store_word(cpu, a + op->imm, store_mask(op->controlWord, b));
+		func_write(cpu, 0, 0, 0, false);
+		NEXT(false, 0);
+	}
+
+	// The link instructions forward the ALU out, not the stored NPC
+	HANDLER(J) {
+		ALU_out = JUMP_BASE(&cpu->config, pc) + op->imm;
+		func_write(cpu, 0, 0, 0, false);
+		NEXT(true, ALU_out/4);
+	}
+
+	HANDLER(JAL) {
+		ALU_out = JUMP_BASE(&cpu->config, pc) + op->imm;
+		func_write(cpu, op->rd, (pc + 1)*4, ALU_out, false);
+		NEXT(true, ALU_out/4);
+	}
+
+	HANDLER(JR) {
+		a = FUNC_READ(op->rs1);
+		func_write(cpu, 0, 0, 0, false);
+		NEXT(true, a/4);
+	}
+
+	HANDLER(JALR) {
+		a = FUNC_READ(op->rs1);
+		ALU_out = JUMP_BASE(&cpu->config, pc) + op->imm;
+		func_write(cpu, op->rd, (pc + 1)*4, ALU_out, false);
+		NEXT(true, a/4);
+	}
+
+	HANDLER(BEQZ) {
+		a = FUNC_READ(op->rs1);
+		ALU_out = JUMP_BASE(&cpu->config, pc) + op->imm;
+		func_write(cpu, 0, 0, 0, false);
+		NEXT(a == 0, ALU_out/4);
+	}
+
+	HANDLER(BNEZ) {
+		a = FUNC_READ(op->rs1);
+		ALU_out = JUMP_BASE(&cpu->config, pc) + op->imm;
+		func_write(cpu, 0, 0, 0, false);
+		NEXT(a != 0, ALU_out/4);
+	}
+
+	// Left to the caller, without executing it
+	HANDLER(BREAK) {
+		goto done;
+	}
+
+#ifndef FUNC_THREADED
+			default:
+				// Never predecoded
+				DISPATCH();
+		}
+	}
+#endif
+done:
+	cpu->pc = pc;
+	f->retired += i;
+	return i;
+}
+
+#undef LOAD
+#undef NEXT
+#undef DISPATCH
+#undef HANDLER
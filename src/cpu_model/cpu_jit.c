@@ -0,0 +1,960 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <cpu_model/cpu_model.h>
+
+////////////////////////////////////
+// JIT
+////////////////////////////////////
+// Dynamic translation of the functional model to x86-64 code, the
+// blocks and their hazards come from block_analyze().
+//
+// Generated code:
+//	rbx		cpu_t
+//	r13		instructions left, each block takes its length on entry
+//	r15		DRAM data
+//	rsp		overwritten values of the block, see JIT_FRAME
+// The registers stay in cpu_t. DRAM accesses are inline, everything else
+// goes through the bus. A block jumps to the next one once the dispatcher
+// has translated it (chaining), the indirect jumps look the table up.
+// Writing an IRAM word that has been translated drops the whole cache.
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+
+#if DRAM_BASE != 0
+#error "The inline DRAM access expects DRAM_BASE at 0"
+#endif
+
+#define JIT_CODE_SIZE	(16 << 20)
+
+// Stack frame: the RF value overwritten by each instruction of the
+// block, then the outcome of the jump
+#define JIT_SLOT_OLD(i)		(4*(i))
+#define JIT_SLOT_TARGET		(4*BLOCK_LEN_MAX)
+#define JIT_SLOT_TAKEN		(4*BLOCK_LEN_MAX + 4)
+#define JIT_FRAME			((((4*BLOCK_LEN_MAX + 8) + 15) & ~15) + 8)	// rsp aligned after the 6 pushes
+
+// x86-64 registers and condition codes
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+// Operations with the 0x81 /digit encoding, reg-reg opcode is digit*8+1
+#define ALU_ADD	0
+#define ALU_OR	1
+#define ALU_AND	4
+#define ALU_SUB	5
+#define ALU_XOR	6
+#define ALU_CMP	7
+
+// Shifts with the 0xD3/0xC1 /digit encoding
+#define SH_SHL	4
+#define SH_SHR	5
+#define SH_SAR	7
+
+#define CPU_OFF(field)		((int32_t)offsetof(cpu_t, field))
+#define REG_OFF(r)			(CPU_OFF(regs) + 4*(int32_t)(r))
+#define W_OFF(k, field)		(CPU_OFF(func.w) + (int32_t)((k)*sizeof(funcWrite_t) + offsetof(funcWrite_t, field)))
+#define REDIRECT_OFF(j, field)	(CPU_OFF(func.redirect) + (int32_t)((j)*sizeof(funcRedirect_t) + offsetof(funcRedirect_t, field)))
+
+typedef struct jitBlock jitBlock_t;
+
+// Exit of a block towards a known address
+typedef struct {
+	uint8_t		*site;		// jmp rel32, to the stub until chained
+	uint32_t	target;		// Word address
+	jitBlock_t	*from;
+} jitExit_t;
+
+struct jitBlock {
+	uint32_t	pc;
+	uint32_t	len;
+	uint32_t	reads0;			// Registers read by the first two instructions,
+	uint32_t	reads1;			// they mustn't be hazards on entry
+	bool		chainable;		// Hazards on exit known while translating
+	uint32_t	exit_hazard;
+	uint32_t	exit_far;
+	uint8_t		*checked;		// Entry checking the state left by the previous instruction
+	uint8_t		*fast;			// Entry when it is known to be fine
+	jitExit_t	exit[2];		// Taken, not taken
+};
+
+typedef int64_t (*jitEnter_t)(cpu_t *cpu, const uint8_t *code, int64_t left);
+
+struct jit {
+	uint8_t		*code;					// Code cache
+	size_t		used;
+	size_t		base;					// Size of the trampolines, kept on flush
+	jitEnter_t	enter;					// From C to a block, returns the instructions left
+	uint8_t		*leave;					// From a block back to C
+	uint8_t		*entry[IRAM_SIZE];		// Checked entry of the block at each word, NULL if none
+	jitBlock_t	*map[IRAM_SIZE];		// Block at each word, NULL if not translated yet
+	jitBlock_t	blocks[IRAM_SIZE];
+	uint32_t	nblocks;
+	jitBlock_t	untranslatable;
+	uint8_t		covered[IRAM_SIZE];		// Translated words
+	bool		flush;					// A translated word has been written
+	jitExit_t	*link;					// Exit taken before it was chained, set by the generated code
+};
+
+typedef struct {
+	uint8_t		*p;
+	uint8_t		*end;
+	bool		full;
+} jitBuf_t;
+
+typedef struct {
+	cpu_t				*cpu;
+	jit_t				*jit;
+	jitBlock_t			*block;
+	blockInfo_t			info;
+	uint8_t				*side[BLOCK_LEN_MAX];		// Store leaving the block after writing the IRAM
+	jitBuf_t			b;
+} jitCtx_t;
+
+////////////////////////////////////
+// Emitter
+////////////////////////////////////
+static void jit_emit8(jitBuf_t *b, uint8_t v){
+	if(b->p >= b->end){
+		b->full = true;
+		return;
+	}
+	*b->p++ = v;
+}
+
+static void jit_emit32(jitBuf_t *b, uint32_t v){
+	int i;
+	for(i = 0; i < 4; i++)
+		jit_emit8(b, (v >> (8*i)) & 0xff);
+}
+
+static void jit_emit64(jitBuf_t *b, uint64_t v){
+	jit_emit32(b, (uint32_t)v);
+	jit_emit32(b, (uint32_t)(v >> 32));
+}
+
+// ModRM of [base + disp32], base is RBX or RSP
+static void jit_modrm_mem(jitBuf_t *b, uint8_t reg, uint8_t base, int32_t disp){
+	jit_emit8(b, 0x80 | (reg & 7) << 3 | base);
+	if(base == RSP)
+		jit_emit8(b, 0x24);
+	jit_emit32(b, (uint32_t)disp);
+}
+
+// mov reg, [base + disp]
+static void jit_load(jitBuf_t *b, uint8_t reg, uint8_t base, int32_t disp){
+	jit_emit8(b, 0x8B);
+	jit_modrm_mem(b, reg, base, disp);
+}
+
+// mov [base + disp], reg
+static void jit_store(jitBuf_t *b, uint8_t base, int32_t disp, uint8_t reg){
+	jit_emit8(b, 0x89);
+	jit_modrm_mem(b, reg, base, disp);
+}
+
+// mov dword [base + disp], imm
+static void jit_store_imm(jitBuf_t *b, uint8_t base, int32_t disp, uint32_t imm){
+	jit_emit8(b, 0xC7);
+	jit_modrm_mem(b, 0, base, disp);
+	jit_emit32(b, imm);
+}
+
+// mov byte [base + disp], imm
+static void jit_store_imm8(jitBuf_t *b, uint8_t base, int32_t disp, uint8_t imm){
+	jit_emit8(b, 0xC6);
+	jit_modrm_mem(b, 0, base, disp);
+	jit_emit8(b, imm);
+}
+
+// mov reg, imm
+static void jit_mov_imm(jitBuf_t *b, uint8_t reg, uint32_t imm){
+	jit_emit8(b, 0xB8 + reg);
+	jit_emit32(b, imm);
+}
+
+// op dst, src
+static void jit_alu_rr(jitBuf_t *b, uint8_t alu, uint8_t dst, uint8_t src){
+	jit_emit8(b, alu << 3 | 1);
+	jit_emit8(b, 0xC0 | src << 3 | dst);
+}
+
+// op dst, imm
+static void jit_alu_ri(jitBuf_t *b, uint8_t alu, uint8_t dst, uint32_t imm){
+	jit_emit8(b, 0x81);
+	jit_emit8(b, 0xC0 | alu << 3 | dst);
+	jit_emit32(b, imm);
+}
+
+// op r13, imm
+static void jit_alu_r13(jitBuf_t *b, uint8_t alu, uint32_t imm){
+	jit_emit8(b, 0x49);
+	jit_alu_ri(b, alu, 5, imm);
+}
+
+// setcc al; movzx eax, al
+static void jit_setcc(jitBuf_t *b, uint8_t cc){
+	jit_emit8(b, 0x0F);
+	jit_emit8(b, 0x90 | cc);
+	jit_emit8(b, 0xC0);
+	jit_emit8(b, 0x0F);
+	jit_emit8(b, 0xB6);
+	jit_emit8(b, 0xC0);
+}
+
+// mov rax, imm64; call rax
+static void jit_call(jitBuf_t *b, const void *fn){
+	jit_emit8(b, 0x48);
+	jit_emit8(b, 0xB8);
+	jit_emit64(b, (uint64_t)(uintptr_t)fn);
+	jit_emit8(b, 0xFF);
+	jit_emit8(b, 0xD0);
+}
+
+// Forward jumps, return the rel32 to patch
+static uint8_t *jit_jcc(jitBuf_t *b, uint8_t cc){
+	uint8_t *at;
+	jit_emit8(b, 0x0F);
+	jit_emit8(b, 0x80 | cc);
+	at = b->p;
+	jit_emit32(b, 0);
+	return at;
+}
+
+static uint8_t *jit_jmp(jitBuf_t *b){
+	uint8_t *at;
+	jit_emit8(b, 0xE9);
+	at = b->p;
+	jit_emit32(b, 0);
+	return at;
+}
+
+static void jit_patch(jitBuf_t *b, uint8_t *at, const uint8_t *to){
+	int32_t rel;
+	if(at == NULL || b->full)
+		return;
+	rel = (int32_t)(to - (at + 4));
+	memcpy(at, &rel, 4);
+}
+
+// jmp to, backward
+static void jit_jmp_to(jitBuf_t *b, const uint8_t *to){
+	jit_patch(b, jit_jmp(b), to);
+}
+
+////////////////////////////////////
+// Translation
+////////////////////////////////////
+static void jit_emit_src(jitCtx_t *c, uint8_t reg, blockSrc_t src){
+	switch (src.kind) {
+		case SRC_REG:
+			jit_load(&c->b, reg, RBX, REG_OFF(src.val));
+			break;
+		case SRC_OLD:
+			jit_load(&c->b, reg, RSP, JIT_SLOT_OLD(src.val));
+			break;
+		default:
+			jit_mov_imm(&c->b, reg, src.val);
+			break;
+	}
+}
+
+// Write eax to rd, saving the old value if it is read later
+static void jit_emit_rd(jitCtx_t *c, int i, uint8_t rd){
+	if(rd == 0)
+		return;
+	if(c->info.old[i]){
+		jit_load(&c->b, RDX, RBX, REG_OFF(rd));
+		jit_store(&c->b, RSP, JIT_SLOT_OLD(i), RDX);
+	}
+	jit_store(&c->b, RBX, REG_OFF(rd), RAX);
+}
+
+// Accesses outside the DRAM: read only data, IRAM, peripherals
+static uint32_t jit_mem_read(cpu_t *cpu, uint32_t addr){
+	return cpu_get_mem_data(cpu, addr);
+}
+
+// Returns true if translated code has been overwritten
+static uint32_t jit_mem_write(cpu_t *cpu, uint32_t addr, uint32_t data){
+	cpu_write_mem_data(cpu, addr, data);
+	return cpu->jit->flush;
+}
+
+// x86 translation of the ALU operations
+typedef enum {
+	JIT_ALU_ZERO,
+	JIT_ALU_ARITH,		// code is the 0x81 digit
+	JIT_ALU_SHIFT,		// code is the 0xD3 digit
+	JIT_ALU_SET			// code is the condition
+} jitAluKind_t;
+
+enum {
+#define X(name, expr)	JIT_OP_##name,
+	ALU_OPS(X)
+#undef X
+	JIT_OP_NUM
+};
+
+static const struct {
+	uint8_t kind;
+	uint8_t code;
+} jit_alu[JIT_OP_NUM] = {
+	[JIT_OP_NOP]	= { JIT_ALU_ZERO,	0 },
+	[JIT_OP_SLL]	= { JIT_ALU_SHIFT,	SH_SHL },
+	[JIT_OP_SRL]	= { JIT_ALU_SHIFT,	SH_SHR },
+	[JIT_OP_SRA]	= { JIT_ALU_SHIFT,	SH_SAR },
+	[JIT_OP_ADD]	= { JIT_ALU_ARITH,	ALU_ADD },
+	[JIT_OP_ADDU]	= { JIT_ALU_ARITH,	ALU_ADD },
+	[JIT_OP_SUB]	= { JIT_ALU_ARITH,	ALU_SUB },
+	[JIT_OP_SUBU]	= { JIT_ALU_ARITH,	ALU_SUB },
+	[JIT_OP_AND]	= { JIT_ALU_ARITH,	ALU_AND },
+	[JIT_OP_OR]		= { JIT_ALU_ARITH,	ALU_OR },
+	[JIT_OP_XOR]	= { JIT_ALU_ARITH,	ALU_XOR },
+	[JIT_OP_SEQ]	= { JIT_ALU_SET,	CC_E },
+	[JIT_OP_SNE]	= { JIT_ALU_SET,	CC_NE },
+	[JIT_OP_SLT]	= { JIT_ALU_SET,	CC_L },
+	[JIT_OP_SGT]	= { JIT_ALU_SET,	CC_G },
+	[JIT_OP_SLE]	= { JIT_ALU_SET,	CC_LE },
+	[JIT_OP_SGE]	= { JIT_ALU_SET,	CC_GE },
+	[JIT_OP_SLTU]	= { JIT_ALU_SET,	CC_B },
+	[JIT_OP_SGTU]	= { JIT_ALU_SET,	CC_A },
+	[JIT_OP_SLEU]	= { JIT_ALU_SET,	CC_BE },
+	[JIT_OP_SGEU]	= { JIT_ALU_SET,	CC_AE },
+};
+
+// eax = eax op b
+static void jit_emit_alu(jitCtx_t *c, int alu, blockSrc_t b){
+	jitBuf_t *buf = &c->b;
+	uint8_t	 code = jit_alu[alu].code;
+
+	if(jit_alu[alu].kind == JIT_ALU_ZERO){
+		jit_alu_rr(buf, ALU_XOR, RAX, RAX);
+		return;
+	}
+	if(b.kind == SRC_CONST){
+		switch (jit_alu[alu].kind) {
+			case JIT_ALU_SHIFT:
+				// As the shift by cl, only the 5 LSBs are used
+				jit_emit8(buf, 0xC1);
+				jit_emit8(buf, 0xC0 | code << 3 | RAX);
+				jit_emit8(buf, b.val & 31);
+				break;
+			case JIT_ALU_SET:
+				jit_alu_ri(buf, ALU_CMP, RAX, b.val);
+				jit_setcc(buf, code);
+				break;
+			default:
+				jit_alu_ri(buf, code, RAX, b.val);
+				break;
+		}
+		return;
+	}
+	jit_emit_src(c, RCX, b);
+	switch (jit_alu[alu].kind) {
+		case JIT_ALU_SHIFT:
+			jit_emit8(buf, 0xD3);
+			jit_emit8(buf, 0xC0 | code << 3 | RAX);
+			break;
+		case JIT_ALU_SET:
+			jit_alu_rr(buf, ALU_CMP, RAX, RCX);
+			jit_setcc(buf, code);
+			break;
+		default:
+			jit_alu_rr(buf, code, RAX, RCX);
+			break;
+	}
+}
+
+// eax = mem[eax]
+static void jit_emit_mem_read(jitCtx_t *c){
+	jitBuf_t *b = &c->b;
+	uint8_t	 *slow, *done;
+
+	jit_alu_ri(b, ALU_CMP, RAX, DRAM_SIZE);
+	slow = jit_jcc(b, CC_AE);
+	// mov eax, [r15 + rax*4]
+	jit_emit8(b, 0x41); jit_emit8(b, 0x8B); jit_emit8(b, 0x04); jit_emit8(b, 0x87);
+	done = jit_jmp(b);
+	jit_patch(b, slow, b->p);
+	// mov esi, eax; mov rdi, rbx
+	jit_emit8(b, 0x89); jit_emit8(b, 0xC6);
+	jit_emit8(b, 0x48); jit_emit8(b, 0x89); jit_emit8(b, 0xDF);
+	jit_call(b, (const void*)jit_mem_read);
+	jit_patch(b, done, b->p);
+}
+
+// mem[eax] = ecx, leaves the block if the IRAM has been written
+static void jit_emit_mem_write(jitCtx_t *c, int i){
+	jitBuf_t *b = &c->b;
+	uint8_t	 *slow, *done;
+
+	jit_alu_ri(b, ALU_CMP, RAX, DRAM_SIZE);
+	slow = jit_jcc(b, CC_AE);
+	// mov [r15 + rax*4], ecx
+	jit_emit8(b, 0x41); jit_emit8(b, 0x89); jit_emit8(b, 0x0C); jit_emit8(b, 0x87);
+	done = jit_jmp(b);
+	jit_patch(b, slow, b->p);
+	// mov edx, ecx; mov esi, eax; mov rdi, rbx
+	jit_emit8(b, 0x89); jit_emit8(b, 0xCA);
+	jit_emit8(b, 0x89); jit_emit8(b, 0xC6);
+	jit_emit8(b, 0x48); jit_emit8(b, 0x89); jit_emit8(b, 0xDF);
+	jit_call(b, (const void*)jit_mem_write);
+	// test eax, eax
+	jit_emit8(b, 0x85); jit_emit8(b, 0xC0);
+	c->side[i] = jit_jcc(b, CC_NE);
+	jit_patch(b, done, b->p);
+}
+
+// Translate the instruction i of the block, as its handler in cpu_functional_core.h
+static void jit_emit_instr(jitCtx_t *c, int i){
+	jitBuf_t			*b = &c->b;
+	const decodedOp_t	*op = c->info.op[i];
+	uint32_t			pc = c->block->pc + i;
+	uint32_t			link = (pc + 1)*4;
+	uint32_t			mask;
+	int					h = op->handler;
+	int					alu;
+
+	switch (h) {
+		case H_NOP:
+		case H_J:
+			break;
+
+		case H_LW:
+		case H_LH:
+		case H_LHU:
+		case H_LB:
+		case H_LBU:
+			jit_emit_src(c, RAX, c->info.a[i]);
+			if(op->imm != 0)
+				jit_alu_ri(b, ALU_ADD, RAX, op->imm);
+			jit_emit_mem_read(c);
+			// Extension as load_extend()
+			if(h != H_LW){
+				jit_emit8(b, 0x0F);
+				jit_emit8(b, h == H_LH ? 0xBF : h == H_LHU ? 0xB7 : h == H_LB ? 0xBE : 0xB6);
+				jit_emit8(b, 0xC0);
+			}
+			jit_emit_rd(c, i, op->rd);
+			break;
+
+		case H_STORE:
+			jit_emit_src(c, RAX, c->info.a[i]);
+			jit_emit_src(c, RCX, c->info.b[i]);
+			if(op->imm != 0)
+				jit_alu_ri(b, ALU_ADD, RAX, op->imm);
+			mask = store_mask(op->controlWord, 0xffffffff);
+			if(mask != 0xffffffff)
+				jit_alu_ri(b, ALU_AND, RCX, mask);
+			jit_emit_mem_write(c, i);
+			break;
+
+		// The link instructions forward the ALU out, not the stored NPC
+		case H_JAL:
+			jit_mov_imm(b, RAX, link);
+			jit_emit_rd(c, i, op->rd);
+			break;
+
+		case H_JR:
+		case H_JALR:
+			jit_emit_src(c, RAX, c->info.a[i]);
+			// shr eax, 2
+			jit_emit8(b, 0xC1); jit_emit8(b, 0xE8); jit_emit8(b, 2);
+			jit_store(b, RSP, JIT_SLOT_TARGET, RAX);
+			if(h == H_JR)
+				break;
+			jit_mov_imm(b, RAX, link);
+			jit_emit_rd(c, i, op->rd);
+			break;
+
+		case H_BEQZ:
+		case H_BNEZ:
+			jit_emit_src(c, RAX, c->info.a[i]);
+			// test eax, eax; setcc al; mov [rsp + taken], al
+			jit_emit8(b, 0x85); jit_emit8(b, 0xC0);
+			jit_setcc(b, h == H_BEQZ ? CC_E : CC_NE);
+			jit_emit8(b, 0x88);
+			jit_modrm_mem(b, RAX, RSP, JIT_SLOT_TAKEN);
+			break;
+
+		default:
+			// H_R_ and H_I_ alternate in the ALU_OPS() order
+			alu = (h - H_R_NOP) >> 1;
+			jit_emit_src(c, RAX, c->info.a[i]);
+			jit_emit_alu(c, alu, c->info.b[i]);
+			jit_emit_rd(c, i, op->rd);
+			break;
+	}
+}
+
+// Store func.w[k] as after the instruction i
+static void jit_emit_write_state(jitCtx_t *c, int i, int k){
+	jitBuf_t			*b = &c->b;
+	const blockWrite_t	*w = c->info.w[i + 1];
+	blockSrc_t			src;
+	int					j;
+
+	if(w[k].idx < 0){
+		// Written before the block, only func.w[0] can be moved to func.w[1]
+		for(j = 0; j < (int)(sizeof(funcWrite_t)/4); j++){
+			jit_load(b, RAX, RBX, W_OFF(0, old) + 4*j);
+			jit_store(b, RBX, W_OFF(1, old) + 4*j, RAX);
+		}
+		return;
+	}
+	jit_store_imm8(b, RBX, W_OFF(k, rd), w[k].rd);
+	jit_store_imm(b, RBX, W_OFF(k, near), w[k].near);
+	jit_store_imm(b, RBX, W_OFF(k, far), w[k].far);
+	if(w[k].rd == 0)
+		return;
+	jit_store_imm8(b, RBX, W_OFF(k, load), w[k].load);
+	jit_emit_src(c, RAX, block_old(&c->info, w, k));
+	jit_store(b, RBX, W_OFF(k, old), RAX);
+	src = block_fwd(&c->info, w, k);
+	if(src.kind == SRC_CONST){
+		jit_store_imm(b, RBX, W_OFF(k, fwd), src.val);
+	}else {
+		jit_emit_src(c, RAX, src);
+		jit_store(b, RBX, W_OFF(k, fwd), RAX);
+	}
+}
+
+// Hazards as left by the instruction i
+static void jit_emit_state(jitCtx_t *c, int i){
+	jitBuf_t			*b = &c->b;
+	const blockWrite_t	*w = c->info.w[i + 1];
+
+	jit_emit_write_state(c, i, 1);
+	jit_emit_write_state(c, i, 0);
+	if(w[1].idx < 0){
+		// or eax, [func.w[1].far]
+		jit_mov_imm(b, RAX, w[0].near);
+		jit_emit8(b, 0x0B);
+		jit_modrm_mem(b, RAX, RBX, W_OFF(1, far));
+		jit_store(b, RBX, CPU_OFF(func.hazard), RAX);
+	}else {
+		jit_store_imm(b, RBX, CPU_OFF(func.hazard), w[0].near | w[1].far);
+	}
+}
+
+// eax = word address after the jump of the block
+static void jit_emit_outcome(jitCtx_t *c){
+	jitBuf_t			*b = &c->b;
+	const decodedOp_t	*op = c->info.op[c->info.branch];
+	uint32_t			pc = c->block->pc + c->info.branch;
+	uint32_t			target = (JUMP_BASE(c->info.config, pc) + op->imm)/4;
+
+	switch (op->handler) {
+		case H_JR:
+		case H_JALR:
+			jit_load(b, RAX, RSP, JIT_SLOT_TARGET);
+			break;
+		case H_BEQZ:
+		case H_BNEZ:
+			// cmp byte [rsp + taken], 0; cmovne eax, ecx
+			jit_mov_imm(b, RAX, c->block->pc + c->info.n);
+			jit_mov_imm(b, RCX, target);
+			jit_emit8(b, 0x80);
+			jit_modrm_mem(b, 7, RSP, JIT_SLOT_TAKEN);
+			jit_emit8(b, 0);
+			jit_emit8(b, 0x0F); jit_emit8(b, 0x45); jit_emit8(b, 0xC1);
+			break;
+		default:
+			jit_mov_imm(b, RAX, target);
+			break;
+	}
+}
+
+// Leave towards a known address, through the stub until chained
+static void jit_emit_exit(jitCtx_t *c, int x, uint32_t target){
+	jitBuf_t	*b = &c->b;
+	jitExit_t	*exit = &c->block->exit[x];
+
+	if(target < IRAM_SIZE){
+		exit->site		= b->p;
+		exit->target	= target;
+		exit->from		= c->block;
+		// jmp rel32 to the next instruction
+		jit_emit8(b, 0xE9);
+		jit_emit32(b, 0);
+		// mov rax, &jit->link; mov rcx, exit; mov [rax], rcx
+		jit_emit8(b, 0x48); jit_emit8(b, 0xB8);
+		jit_emit64(b, (uint64_t)(uintptr_t)&c->jit->link);
+		jit_emit8(b, 0x48); jit_emit8(b, 0xB9);
+		jit_emit64(b, (uint64_t)(uintptr_t)exit);
+		jit_emit8(b, 0x48); jit_emit8(b, 0x89); jit_emit8(b, 0x08);
+	}
+	jit_store_imm(b, RBX, CPU_OFF(pc), target);
+	jit_jmp_to(b, c->jit->leave);
+}
+
+// Leave towards the address in eax, looking the block up
+static void jit_emit_exit_indirect(jitCtx_t *c){
+	jitBuf_t *b = &c->b;
+
+	jit_store(b, RBX, CPU_OFF(pc), RAX);
+	jit_alu_ri(b, ALU_CMP, RAX, IRAM_SIZE);
+	jit_patch(b, jit_jcc(b, CC_AE), c->jit->leave);
+	// mov rcx, entry; mov rcx, [rcx + rax*8]; test rcx, rcx
+	jit_emit8(b, 0x48); jit_emit8(b, 0xB9);
+	jit_emit64(b, (uint64_t)(uintptr_t)c->jit->entry);
+	jit_emit8(b, 0x48); jit_emit8(b, 0x8B); jit_emit8(b, 0x0C); jit_emit8(b, 0xC1);
+	jit_emit8(b, 0x48); jit_emit8(b, 0x85); jit_emit8(b, 0xC9);
+	jit_patch(b, jit_jcc(b, CC_E), c->jit->leave);
+	// jmp rcx
+	jit_emit8(b, 0xFF); jit_emit8(b, 0xE1);
+}
+
+// End of the block
+static void jit_emit_tail(jitCtx_t *c){
+	jitBuf_t			*b = &c->b;
+	uint32_t			next = c->block->pc + c->info.n;
+	const decodedOp_t	*op;
+	uint32_t			target;
+	uint8_t				*not_taken;
+
+	jit_emit_state(c, c->info.n - 1);
+	if(c->info.branch < 0){
+		jit_emit_exit(c, 0, next);
+		return;
+	}
+	op		= c->info.op[c->info.branch];
+	target	= (JUMP_BASE(c->info.config, c->block->pc + c->info.branch) + op->imm)/4;
+	switch (op->handler) {
+		case H_JR:
+		case H_JALR:
+			jit_emit_outcome(c);
+			jit_emit_exit_indirect(c);
+			break;
+		case H_BEQZ:
+		case H_BNEZ:
+			jit_emit8(b, 0x80);
+			jit_modrm_mem(b, 7, RSP, JIT_SLOT_TAKEN);
+			jit_emit8(b, 0);
+			not_taken = jit_jcc(b, CC_E);
+			jit_emit_exit(c, 0, target);
+			jit_patch(b, not_taken, b->p);
+			jit_emit_exit(c, 1, next);
+			break;
+		default:
+			jit_emit_exit(c, 0, target);
+			break;
+	}
+}
+
+// Leave the block after the store i wrote translated IRAM words,
+// the cache is dropped before anything else runs
+static void jit_emit_side_exit(jitCtx_t *c, int i){
+	jitBuf_t			*b = &c->b;
+	int					k = c->info.branch;
+	int					j;
+	const int			delayslot = c->info.config->delayslot;
+	const decodedOp_t	*op;
+
+	if(c->info.n - (i + 1) > 0)
+		jit_alu_r13(b, ALU_ADD, c->info.n - (i + 1));
+	jit_emit_state(c, i);
+	if(k >= 0 && i == k + delayslot){
+		jit_emit_outcome(c);
+		jit_store(b, RBX, CPU_OFF(pc), RAX);
+	}else {
+		if(k >= 0 && i > k && i < k + delayslot){
+			// The jump is still pending: the last delayslot instructions
+			// go in the queue from the oldest
+			op = c->info.op[k];
+			jit_store_imm8(b, RBX, CPU_OFF(func.head), 0);
+			for(j = 0; j < delayslot; j++){
+				if(i - delayslot + 1 + j != k){
+					jit_store_imm8(b, RBX, REDIRECT_OFF(j, valid), 0);
+					continue;
+				}
+				if(op->handler == H_BEQZ || op->handler == H_BNEZ){
+					jit_load(b, RAX, RSP, JIT_SLOT_TAKEN);
+					jit_emit8(b, 0x88);
+					jit_modrm_mem(b, RAX, RBX, REDIRECT_OFF(j, valid));
+				}else {
+					jit_store_imm8(b, RBX, REDIRECT_OFF(j, valid), 1);
+				}
+				jit_emit_outcome(c);
+				jit_store(b, RBX, REDIRECT_OFF(j, target), RAX);
+			}
+		}
+		jit_store_imm(b, RBX, CPU_OFF(pc), c->block->pc + i + 1);
+	}
+	jit_jmp_to(b, c->jit->leave);
+}
+
+static void jit_emit_block(jitCtx_t *c){
+	jitBuf_t	*b = &c->b;
+	jitBlock_t	*block = c->block;
+	uint8_t		*fail[MAX_DELAYSLOT + 3];
+	int			nfail = 0;
+	int			i;
+
+	memset(c->side, 0, sizeof(c->side));
+
+	// No pending jump and no hazard on the registers read at first
+	block->checked = b->p;
+	for(i = 0; i < c->info.config->delayslot; i++){
+		jit_emit8(b, 0x80);
+		jit_modrm_mem(b, 7, RBX, REDIRECT_OFF(i, valid));
+		jit_emit8(b, 0);
+		fail[nfail++] = jit_jcc(b, CC_NE);
+	}
+	if(block->reads0){
+		jit_emit8(b, 0xF7);
+		jit_modrm_mem(b, 0, RBX, CPU_OFF(func.hazard));
+		jit_emit32(b, block->reads0);
+		fail[nfail++] = jit_jcc(b, CC_NE);
+	}
+	if(block->reads1){
+		jit_emit8(b, 0xF7);
+		jit_modrm_mem(b, 0, RBX, W_OFF(0, far));
+		jit_emit32(b, block->reads1);
+		fail[nfail++] = jit_jcc(b, CC_NE);
+	}
+
+	// Enough instructions left
+	block->fast = b->p;
+	jit_alu_r13(b, ALU_CMP, c->info.n);
+	fail[nfail++] = jit_jcc(b, CC_L);
+	jit_alu_r13(b, ALU_SUB, c->info.n);
+
+	for(i = 0; i < c->info.n; i++)
+		jit_emit_instr(c, i);
+	jit_emit_tail(c);
+
+	for(i = 0; i < c->info.n; i++){
+		if(c->info.op[i]->handler != H_STORE)
+			continue;
+		jit_patch(b, c->side[i], b->p);
+		jit_emit_side_exit(c, i);
+	}
+
+	for(i = 0; i < nfail; i++)
+		jit_patch(b, fail[i], b->p);
+	jit_store_imm(b, RBX, CPU_OFF(pc), block->pc);
+	jit_jmp_to(b, c->jit->leave);
+}
+
+// Translate the block at pc, NULL if it can't be
+static jitBlock_t *jit_translate(cpu_t *cpu, jit_t *jit, uint32_t pc){
+	jitCtx_t		ctx;
+	jitCtx_t		*c = &ctx;
+	jitBlock_t		*block;
+	int				i;
+
+	memset(c, 0, sizeof(jitCtx_t));
+	c->cpu = cpu;
+	c->jit = jit;
+	if(block_analyze(cpu, pc, &c->info) == 0){
+		jit->map[pc] = &jit->untranslatable;
+		return NULL;
+	}
+
+	block = &jit->blocks[jit->nblocks];
+	memset(block, 0, sizeof(jitBlock_t));
+	block->pc		= pc;
+	block->len		= c->info.n;
+	block->reads0	= c->info.reads0;
+	block->reads1	= c->info.reads1;
+	c->block = block;
+
+	c->b.p	 = jit->code + jit->used;
+	c->b.end = jit->code + JIT_CODE_SIZE;
+	jit_emit_block(c);
+	if(c->b.full){
+		jit->flush = true;
+		return NULL;
+	}
+	jit->used = c->b.p - jit->code;
+
+	// With one instruction the hazards on exit depend on the one before
+	block->chainable	= c->info.n > 1;
+	block->exit_hazard	= c->info.w[c->info.n][0].near | c->info.w[c->info.n][1].far;
+	block->exit_far		= c->info.w[c->info.n][0].far;
+
+	jit->nblocks++;
+	jit->map[pc]	= block;
+	jit->entry[pc]	= block->checked;
+	for(i = 0; i < c->info.n; i++)
+		jit->covered[pc + i] = 1;
+	return block;
+}
+
+static jitBlock_t *jit_lookup(cpu_t *cpu, jit_t *jit, uint32_t pc){
+	jitBlock_t *block;
+
+	if(pc >= IRAM_SIZE)
+		return NULL;
+	block = jit->map[pc];
+	if(block == NULL)
+		return jit_translate(cpu, jit, pc);
+	if(block == &jit->untranslatable)
+		return NULL;
+	return block;
+}
+
+// The exit has been taken, jump straight to the next block from now on
+static void jit_chain(cpu_t *cpu, jit_t *jit, jitExit_t *exit){
+	jitBlock_t	*from = exit->from;
+	jitBlock_t	*to = jit_lookup(cpu, jit, exit->target);
+	jitBuf_t	b;
+
+	if(to == NULL || jit->flush || !from->chainable)
+		return;
+	if((to->reads0 & from->exit_hazard) || (to->reads1 & from->exit_far))
+		return;
+	memset(&b, 0, sizeof(jitBuf_t));
+	jit_patch(&b, exit->site + 1, to->fast);
+}
+
+static void jit_flush(jit_t *jit){
+	memset(jit->entry, 0, sizeof(jit->entry));
+	memset(jit->map, 0, sizeof(jit->map));
+	memset(jit->covered, 0, sizeof(jit->covered));
+	jit->nblocks	= 0;
+	jit->used		= jit->base;
+	jit->flush		= false;
+	jit->link		= NULL;
+}
+
+// Code cache and trampolines
+static jit_t *jit_create(void){
+	jit_t		*jit;
+	jitBuf_t	b;
+
+	jit = (jit_t*)calloc(1, sizeof(jit_t));
+	if(jit == NULL){
+		fprintf(stderr, "[JIT] calloc() failed\n");
+		return NULL;
+	}
+	jit->code = (uint8_t*)mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(jit->code == MAP_FAILED){
+		fprintf(stderr, "[JIT] mmap() failed\n");
+		free(jit);
+		return NULL;
+	}
+
+	memset(&b, 0, sizeof(jitBuf_t));
+	b.p		= jit->code;
+	b.end	= jit->code + JIT_CODE_SIZE;
+	// push rbx, rbp, r12-r15; sub rsp, JIT_FRAME
+	jit_emit8(&b, 0x53); jit_emit8(&b, 0x55);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x54);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x55);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x56);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x57);
+	jit_emit8(&b, 0x48); jit_alu_ri(&b, ALU_SUB, RSP, JIT_FRAME);
+	// mov rbx, rdi; mov r13, rdx; mov r15, [rbx + dram]; jmp rsi
+	jit_emit8(&b, 0x48); jit_emit8(&b, 0x89); jit_emit8(&b, 0xFB);
+	jit_emit8(&b, 0x49); jit_emit8(&b, 0x89); jit_emit8(&b, 0xD5);
+	jit_emit8(&b, 0x4C); jit_emit8(&b, 0x8B);
+	jit_modrm_mem(&b, 7, RBX, CPU_OFF(bus.dram.data));
+	jit_emit8(&b, 0xFF); jit_emit8(&b, 0xE6);
+
+	// mov rax, r13; add rsp, JIT_FRAME; pop r15-r12, rbp, rbx; ret
+	jit->leave = b.p;
+	jit_emit8(&b, 0x4C); jit_emit8(&b, 0x89); jit_emit8(&b, 0xE8);
+	jit_emit8(&b, 0x48); jit_alu_ri(&b, ALU_ADD, RSP, JIT_FRAME);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x5F);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x5E);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x5D);
+	jit_emit8(&b, 0x41); jit_emit8(&b, 0x5C);
+	jit_emit8(&b, 0x5D); jit_emit8(&b, 0x5B);
+	jit_emit8(&b, 0xC3);
+
+	jit->enter	= (jitEnter_t)(void*)jit->code;
+	jit->base	= b.p - jit->code;
+	jit->used	= jit->base;
+	return jit;
+}
+
+// Execute n instructions
+uint64_t jit_run(cpu_t *cpu, uint64_t n){
+	jit_t		*jit = cpu->jit;
+	jitBlock_t	*block;
+	uint64_t	done = 0;
+	int64_t		left;
+
+	if(jit == NULL){
+		jit = cpu->jit = jit_create();
+		if(jit == NULL){
+			fprintf(stderr, "[JIT] Not available, using the interpreter\n");
+			cpu->dispatch = FUNC_DISPATCH_THREADED;
+			return func_interpret(cpu, n);
+		}
+	}
+
+	while(done < n){
+		if(jit->flush)
+			jit_flush(jit);
+		block = jit_lookup(cpu, jit, cpu->pc);
+		if(block == NULL || block->len > n - done){
+			if(func_interpret(cpu, 1) == 0)
+				break;		// At the breakpoint
+			done++;
+			continue;
+		}
+		left = jit->enter(cpu, block->checked, (int64_t)(n - done));
+		if((uint64_t)left == n - done){
+			// Entry refused, the previous instructions are still in the way
+			done += func_interpret(cpu, 1);
+			continue;
+		}
+		cpu->func.retired += n - done - left;
+		done = n - left;
+		if(jit->link != NULL){
+			jit_chain(cpu, jit, jit->link);
+			jit->link = NULL;
+		}
+	}
+	return done;
+}
+
+void jit_invalidate(jit_t *jit, uint32_t idx){
+	if(idx < IRAM_SIZE && jit->covered[idx])
+		jit->flush = true;
+}
+
+void jit_free(jit_t *jit){
+	if(jit == NULL)
+		return;
+	munmap(jit->code, JIT_CODE_SIZE);
+	free(jit);
+}
+
+#else
+// No translator for this host, the closures run instead
+
+uint64_t jit_run(cpu_t *cpu, uint64_t n){
+	return block_run(cpu, n);
+}
+
+void jit_invalidate(jit_t *jit, uint32_t idx){
+	(void)jit;
+	(void)idx;
+}
+
+void jit_free(jit_t *jit){
+	(void)jit;
+}
+#endif
@@ -6,17 +6,10 @@
 #include <string.h>
 
 // Control Unit Emulation
-controlWord_t control_unit(uint32_t instr, cpu_t *cpu){
+controlWord_t control_unit(uint32_t instr){
 	controlWord_t cw;
 	uint32_t opcode;
 	uint16_t func;
-	char s[128];
-
-
-#ifdef FORWARDING
-	forward_mem_out(cpu);
-	forward_alu_out(cpu);
-#endif
 
 	cw.ALU_opcode   		= FUNC_NOP;
 	cw.jmp_eqz_neqz 		= nop;
@@ -33,8 +26,7 @@ controlWord_t control_unit(uint32_t instr, cpu_t *cpu){
 	opcode = (instr >> (32-6)) & 0x3F;
 	cw.opcode = opcode;
 	func = instr & 0x7FF;
-	sprintf(s, "[CONTROL] OPCODE = 0x%02x\n", opcode);
-	print_debug(s);
+	PRINT_DEBUG("[CONTROL] OPCODE = 0x%02x\n", opcode);
 	// Decode instruction
 	if (opcode == OPCODE_NOP) {
 		// Do nothing
@@ -182,209 +174,219 @@ controlWord_t control_unit(uint32_t instr, cpu_t *cpu){
 	return cw;
 }
 
+// Print the activity of a stage to the trace consumer
+// The text is produced only if someone is listening
+static void trace_stage(cpu_t *cpu, const char *stage, uint32_t pc, uint32_t instr){
+#ifndef AVOID_PRINT
+	if(cpu->trace == NULL)
+		return;
+	if(instr == 0 || ((instr >> (32-6)) & 0x3F) == OPCODE_NOP)
+		fprintf(cpu->trace, "[%s] NOP\n", stage);
+	else
+		fprintf(cpu->trace, "[%s] %s\n", stage, cpu_disasm(cpu, pc, instr));
+#else
+	(void)cpu; (void)stage; (void)pc; (void)instr;
+#endif
+}
+
+// Extract the fields of the instruction and its control word
+// The result only depends on the instruction word, so it is
+// computed once for each IRAM word and reused by the fetch stage
+void decode_instruction(uint32_t instr, decodedOp_t *op){
+	uint32_t opcode;
+
+	memset(op, 0, sizeof(decodedOp_t));
+	op->instr		= instr;
+	op->controlWord	= control_unit(instr);
+	op->flags		= DECODED_VALID;
+
+	// Get opcode
+	opcode = (instr >> (32-6)) & 0x3F;
+	if (opcode == OPCODE_NOP) {
+		// Do nothing
+		op->flags |= DECODED_NOP;
+	} else if (opcode == 0x00) {	
+		// R-Type
+		// | opcode (6) | rs1 (5) | rs2 (5) | rd (5) | func (11) |
+		op->rs1 = (instr >> (32-11)) & 0x1F;
+		op->rs2 = (instr >> (32-16)) & 0x1F;
+		op->rd  = (instr >> (32-21)) & 0x1F;
+
+		// R0 is not read from the RF
+		if(op->rs1 != 0)
+			op->flags |= DECODED_READ_RS1;
+		if(op->rs2 != 0)
+			op->flags |= DECODED_READ_RS2;
+	} else if (opcode == OPCODE_J || opcode == OPCODE_JAL || opcode == OPCODE_JR || opcode == OPCODE_JALR) {	
+		// J-Type
+		// | opcode (6) | immediate (26) |
+		op->imm = instr & 0x03FFFFFF;
+		// Sign extension 
+		if(op->imm >> 25)
+			op->imm |= 0xFC000000;
+		if(opcode == OPCODE_JR || opcode == OPCODE_JALR) {
+			op->rs1 = (instr >> (32-11)) & 0x1F;
+			op->flags |= DECODED_READ_RS1;
+		}
+		if(opcode == OPCODE_JAL || opcode == OPCODE_JALR)
+			op->rd = 31;				// Store the NPC to the register 31
+	} else { 
+		// I-Type
+		// | opcode (6) | rs1 (5) | rd (5) | immediate (16) |
+		op->rs1 = (instr >> (32-11)) & 0x1F;
+		op->rd  = (instr >> (32-16)) & 0x1F;
+		op->imm = instr & 0xFFFF;
+		
+		// Sign extension
+		if(op->imm >> 15)
+			op->imm |= 0xFFFF0000;
+		op->flags |= DECODED_READ_RS1;
+	
+		// In case of a store, mem[rs1_val + offset] = rs2_val (R[rd]) 
+		if(opcode == OPCODE_SW  || opcode == OPCODE_SH || opcode == OPCODE_SB){
+			op->rs2 = op->rd;
+			op->flags |= DECODED_READ_RS2;
+		}
+	}
+	op->handler = func_select_handler(op);
+}
+
 // This is a pipelined processor
 // IF -> ID -> EX -> MEM -> WB
 
 // Fetch instruction
-// Returns instr and nextPc
-pipeFetch_t *instruction_fetch(void *handle) {
+// Returns instr, nextPc, the predecoded instruction and the word to
+// fetch next
+pipeFetch_t *instruction_fetch(void *handle, pipeFetch_t *pipeFetch) {
 	if(handle == NULL){
 		fprintf(stderr, "[FETCH] Failed to access CPU\n");
 		return NULL;
 	}
 	cpu_t *cpu = (cpu_t*) handle;
-	char s[64];
-	pipeFetch_t *pipeFetch;
-	pipeFetch = (pipeFetch_t*)malloc(sizeof(pipeFetch_t));
-	if(pipeFetch == NULL){
-		fprintf(stderr, "[FETCH] Failed to allocate memory for pipeFetch\n");
-		return NULL;
-	}
-	pipeFetch->instr = cpu_get_instr(cpu,cpu_get_pc(cpu));
+	pipeFetch->pc = cpu_get_pc(cpu);
+	pipeFetch->op = *cpu_get_decoded(cpu, pipeFetch->pc);
+	pipeFetch->instr = pipeFetch->op.instr;
 	
-	sprintf(s, "[FETCH] Instr: %#010x\n", pipeFetch->instr);
-	print_debug(s);
+	PRINT_DEBUG("[FETCH] Instr: %#010x\n", pipeFetch->instr);
 
-	char *temp;
-	temp = identify_instruction(pipeFetch->instr);
-	strcpy(pipeFetch->instr_str, temp);
-	free(temp);
 	pipeFetch->nextPC = (cpu->pc+1)*4;
+	// Only the jumps are looked up, as if the IRAM had predecode bits
+	pipeFetch->predicted = pipeFetch->pc + 1;
+	pipeFetch->flushed = false;
+	if(cpu->predictor != NULL && pipeFetch->op.controlWord.jmp_eqz_neqz != nop)
+		pipeFetch->predicted = predictor_next(cpu, pipeFetch->pc, &pipeFetch->op);
 
 #ifndef AVOID_PRINT
-	printf("[FETCH] %s\n", pipeFetch->instr_str);
+	if(cpu->trace != NULL)
+		fprintf(cpu->trace, "[FETCH] %s\n", cpu_disasm(cpu, pipeFetch->pc, pipeFetch->instr));
 #endif
 	return pipeFetch;	
 }
 
 // Decode instruction
-// Will works as control unit too
-// Returns control useful for next pipes too
-pipeDecode_t* instruction_decode(void *handle, pipeFetch_t *pipeFetch) {
+// The instruction has been already decoded, this stage
+// reads the register file
+pipeDecode_t* instruction_decode(void *handle, const pipeFetch_t *pipeFetch, pipeDecode_t *pipeDecode) {
 	if(handle == NULL){
 		fprintf(stderr, "[DECODE] Failed to access CPU\n");
-		free(pipeFetch);
 		return NULL;
 	}
 	if (pipeFetch == NULL) {
 		fprintf(stderr, "[DECODE] Failed to access pipeFetch or not reached yet\n");
 		return NULL;
 	}
-	char s[128];
 	cpu_t *cpu = (cpu_t*)handle;
-	pipeDecode_t *pipeDecode;
-	uint32_t instr = pipeFetch->instr;
-	uint32_t nextPC  = pipeFetch->nextPC;
-	uint32_t opcode;
-	uint16_t func;
-	uint8_t  rd		 = 0;
-	uint8_t  rs1	 = 0;
-	uint8_t  rs2	 = 0;
-	uint32_t rs1_val = 0;
-	uint32_t rs2_val = 0;
-	uint32_t imm	 = 0;
-
+	const decodedOp_t *op = &pipeFetch->op;
 
-	pipeDecode = (pipeDecode_t*)malloc(sizeof(pipeDecode_t));
-	if(pipeDecode == NULL){
-		fprintf(stderr, "Failed to allocate memory for pipeDecode\n");
-		return NULL;
-	}
 	memset(pipeDecode, 0, sizeof(pipeDecode_t));
+	pipeDecode->instr	= pipeFetch->instr;
+	pipeDecode->pc		= pipeFetch->pc;
+	pipeDecode->flushed	= pipeFetch->flushed;
 
-	// Get opcode
-	opcode = (instr >> (32-6)) & 0x3F;
-	sprintf(s, "[DECODE] OPCODE = 0x%02x\n", opcode);
-	print_debug(s);
-	// Decode instruction
-	if (opcode == OPCODE_NOP) {
+	PRINT_DEBUG("[DECODE] OPCODE = 0x%02x\n", (pipeFetch->instr >> (32-6)) & 0x3F);
+	if (op->flags & DECODED_NOP) {
 		// Do nothing
-#ifndef AVOID_PRINT
-		printf("[DECODE] NOP\n");
-#endif
+		trace_stage(cpu, "DECODE", pipeDecode->pc, pipeDecode->instr);
 		return pipeDecode;
-	} else if (opcode == 0x00) {	
-		// R-Type
-		// | opcode (6) | rs1 (5) | rs2 (5) | rd (5) | func (11) |
-		
-		rs1  = (instr >> (32-11)) & 0x1F;
-		rs2  = (instr >> (32-16)) & 0x1F;
-		rd   = (instr >> (32-21)) & 0x1F;
-		func = instr & 0x7FF;
-
-		// Acces RF to read the registers
-		if(rs1 == 0)
-			rs1_val = 0;
-		else
-			rs1_val = cpu_get_reg(cpu, rs1);
-		
-		if(rs2 == 0)
-			rs2_val = 0;
-		else
-			rs2_val = cpu_get_reg(cpu, rs2);
-
-		sprintf(s, "[DECODE]: RTYPE | rs1: R%-2d [%d] | rs2: R%-2d [%d] | r: R%-2d | func: %#06x\n", rs1, rs1_val, rs2, rs2_val, rd, func);
-		print_debug(s);
-
-
-	} else if (opcode == OPCODE_J || opcode == OPCODE_JAL || opcode == OPCODE_JR || opcode == OPCODE_JALR) {	
-		// J-Type
-		// | opcode (6) | immediate (26) |
-		imm = instr & 0x03FFFFFF;
-		// Sign extension 
-		if(imm >> 25)
-			imm |= 0xFC000000;
-		if(opcode == OPCODE_JR || opcode == OPCODE_JALR) {
-			rs1 = (instr >> (32-11)) & 0x1F;
-			rs1_val = cpu_get_reg(cpu, rs1);
-			sprintf(s, "[DECODE]: JRTYPE | R%-2d [%#08x]\n", rs1, rs1_val);
-		}else{
-			sprintf(s, "[DECODE]: JTYPE | imm: %#08x\n", imm);
-		}
-		print_debug(s);
-		
-		// Get controls signal to use to the next steps
-		switch (opcode) {
-			case OPCODE_JR:
-			case OPCODE_J:
-				break;
-			case OPCODE_JALR:
-			case OPCODE_JAL:
-				rd = 31;				// Store the NPC to the register 31
-				break;
-			default:
-				// If not a branch/jump instr
-				// Should never goes here
-				fprintf(stderr, "[Decode] J-Type - shouldn't be here\n");
-				free(pipeFetch);	// Free used mem
-				return NULL;
-				break;
-		}
-	} else { 
-		// I-Type
-		// | opcode (6) | rs1 (5) | rd (5) | immediate (16) |
-		
-		rs1 = (instr >> (32-11)) & 0x1F;
-		rd  = (instr >> (32-16)) & 0x1F;
-		imm = instr & 0xFFFF;
-		
-		// Sign extension
-		if(imm >> 15)
-			imm |= 0xFFFF0000;
-		
-		// Acces RF to read the registers
-		rs1_val = cpu_get_reg(cpu, rs1);
-	
-		if(opcode == OPCODE_SW  || opcode == OPCODE_SH || opcode == OPCODE_SB){
-			rs2 = rd;
-			rs2_val = cpu_get_reg(cpu, rd);		// In case of a store, mem[rs1_val + offset] = rs2_val (R[rd]) 
-			sprintf(s, "[DECODE]: ITYPE | rs: R%-2d [0x%x] | r_off: R%-2d [0x%x] | imm: %#08x\n", rs2, rs2_val, rs1, rs1_val, imm);
-		}else{
-			sprintf(s, "[DECODE]: ITYPE | rs1: R%-2d [0x%x] | rd: R%-2d | imm: %#08x\n", rs1, rs1_val, rd, imm);
-		}
-		print_debug(s);
-
 	}
 
-	pipeDecode->nextPC 	= nextPC;
-	pipeDecode->rd 		= rd;
-	pipeDecode->rs1_val = rs1_val;
-	pipeDecode->rs2_val = rs2_val;
-	pipeDecode->imm 	= imm;
-	pipeDecode->rs1 	= rs1;
-	pipeDecode->rs2 	= rs2;
+	// Acces RF to read the registers
+	if(op->flags & DECODED_READ_RS1)
+		pipeDecode->rs1_val = cpu_get_reg(cpu, op->rs1);
+	if(op->flags & DECODED_READ_RS2)
+		pipeDecode->rs2_val = cpu_get_reg(cpu, op->rs2);
 
+	PRINT_DEBUG("[DECODE]: rs1: R%-2d [0x%x] | rs2: R%-2d [0x%x] | rd: R%-2d | imm: %#08x\n", op->rs1, pipeDecode->rs1_val, op->rs2, pipeDecode->rs2_val, op->rd, op->imm);
 
-	pipeDecode->controlWord = pipeFetch->controlWord;
-	strcpy(pipeDecode->instr_str, pipeFetch->instr_str);
-#ifndef AVOID_PRINT
-	printf("[DECODE] %s\n", pipeDecode->instr_str);
-#endif
-	// Previous pipe is now useless
-	free(pipeFetch);
-	
+	pipeDecode->nextPC 	= pipeFetch->nextPC;
+	pipeDecode->predicted	= pipeFetch->predicted;
+	pipeDecode->rd 		= op->rd;
+	pipeDecode->imm 	= op->imm;
+	pipeDecode->rs1 	= op->rs1;
+	pipeDecode->rs2 	= op->rs2;
+
+	pipeDecode->controlWord = op->controlWord;
+	trace_stage(cpu, "DECODE", pipeDecode->pc, pipeDecode->instr);
 
 	return pipeDecode;
 }
 
-// Ex stage
-pipeEx_t* instruction_exe(void *handle, pipeDecode_t *pipeDecode) {
-	cpu_t *cpu = (cpu_t*)handle;
-	char s[64];
-	if(cpu == NULL){
-		fprintf(stderr, "[EXE] Failed to access CPU\n");
-		free(pipeDecode);
-		return NULL;
+// ALU, shared by every execution engine
+// Returns 0 on success, -1 if ALU_opcode is not implemented
+int alu_execute(uint16_t ALU_opcode, uint32_t a, uint32_t b, uint32_t *ALU_out) {
+	switch (ALU_opcode) {
+#define X(name, expr) \
+		case FUNC_##name: \
+			*ALU_out = (expr); \
+			break;
+		ALU_OPS(X)
+#undef X
+		default:
+			return -1;
 	}
+	return 0;
+}
+
+// The stage resolving the jumps updates the PC
+#define PIPE_JUMP_UPDATE(cpu, stage) do { \
+	if((stage)->controlWord.useRegisterToJump) \
+		(cpu)->pc = (stage)->rs1_val/4; \
+	else if((stage)->jump) \
+		(cpu)->pc = (stage)->ALU_out/4; \
+	else \
+		(cpu)->pc++; \
+} while(0)
+
+// With a predictor the PC has already followed the prediction: the
+// stage resolving the jumps only redirects it when mispredicted, and
+// asks for the younger instructions to be flushed
+#define PIPE_JUMP_RESOLVE(cpu, stage) do { \
+	uint32_t actual; \
+	if((stage)->controlWord.jmp_eqz_neqz != nop){ \
+		if((stage)->controlWord.useRegisterToJump) \
+			actual = (stage)->rs1_val/4; \
+		else if((stage)->jump) \
+			actual = (stage)->ALU_out/4; \
+		else \
+			actual = (stage)->pc + 1; \
+		if(predictor_resolve((cpu), (stage)->pc, (stage)->instr, (stage)->jump, actual, (stage)->predicted)){ \
+			(cpu)->pc		= actual; \
+			(cpu)->flush	= true; \
+		} \
+	} \
+} while(0)
+
+// Ex stage, delayslot, relative_jump and predict are constants in the kernels
+static inline __attribute__((always_inline))
+pipeEx_t* exe_stage(cpu_t *cpu, const pipeDecode_t *pipeDecode, pipeEx_t *pipeEx, const int delayslot, const bool relative_jump,
+	const bool predict) {
 	if (pipeDecode == NULL) {
 		fprintf(stderr, "[EXE]Failed to access pipeDecode or not reached yet\n");
 		return NULL;
 	}
-	pipeEx_t *pipeEx;
 	uint16_t ALU_opcode = pipeDecode->controlWord.ALU_opcode;
 	
-	sprintf(s, "[EXE] ALU_OPCODE: 0x%x\n", pipeDecode->controlWord.ALU_opcode);
-	print_debug(s);
+	PRINT_DEBUG("[EXE] ALU_OPCODE: 0x%x\n", pipeDecode->controlWord.ALU_opcode);
 
 	uint32_t 	ALU_out=0;
 	bool		toJump = false;
@@ -392,174 +394,54 @@ pipeEx_t* instruction_exe(void *handle, pipeDecode_t *pipeDecode) {
 	uint32_t operandA;
 	uint32_t operandB;
 
-	pipeEx = (pipeEx_t*)malloc(sizeof(pipeEx_t));
-	if(pipeEx == NULL) {
-		fprintf(stderr, "Failed to allocate memory for pipeEx\n");
-		printf("[EXE] Failed to allocate memory for pipeEx\n");
-		return NULL;
-	}
 	memset(pipeEx, 0, sizeof(pipeEx_t));
 
 
 	if(pipeDecode->controlWord.jmp_eqz_neqz != nop){
-#ifdef RELATIVE_JUMP
-		operandA = pipeDecode->nextPC;		// We're using pc as multiply of 4 inside the datapath
-		sprintf(s, "[EXE] Using next PC as operand A: 0x%08x\n", operandA);
-#else		
-		operandA = 0;
-		sprintf(s, "[EXE] Jumping, 0x0 as operand A\n");
-#endif
-		print_debug(s);
+		if(relative_jump){
+			operandA = pipeDecode->nextPC;		// We're using pc as multiply of 4 inside the datapath
+			PRINT_DEBUG("[EXE] Using next PC as operand A: 0x%08x\n", operandA);
+		}else{
+			operandA = 0;
+			PRINT_DEBUG("[EXE] Jumping, 0x0 as operand A\n");
+		}
 	}else {
 		operandA = pipeDecode->rs1_val;
-		sprintf(s, "[EXE] Using RS1 as operand A: 0x%08x\n", operandA);
-		print_debug(s);
+		PRINT_DEBUG("[EXE] Using RS1 as operand A: 0x%08x\n", operandA);
 	}
 	if(pipeDecode->controlWord.useImm){
 		operandB = pipeDecode->imm;
-		sprintf(s, "[EXE] Using immediate as operand B: 0x%08x\n", operandB);
-		print_debug(s);
+		PRINT_DEBUG("[EXE] Using immediate as operand B: 0x%08x\n", operandB);
 	}else{
 		operandB = pipeDecode->rs2_val;
-		sprintf(s, "[EXE] Using RS2 as operand B: 0x%08x\n", operandB);
-		print_debug(s);
+		PRINT_DEBUG("[EXE] Using RS2 as operand B: 0x%08x\n", operandB);
 	}
-	switch (ALU_opcode) {
-		case 0:
-			sprintf(s, "[EXE] NOP\n");
-			print_debug(s);
-			break;
-		case FUNC_SLL:
-			ALU_out = operandA << operandB;
-			sprintf(s, "[EXE] SLL\n");
-			print_debug(s);
-			break;
-		case FUNC_SRL:
-			ALU_out = operandA >> operandB;
-			sprintf(s, "[EXE] SRL\n");
-			print_debug(s);
-			break;
-		case FUNC_SRA:
-			// with integer, the >> should be arithmetic
-			ALU_out = (int32_t)((int32_t)operandA >> operandB);
-			sprintf(s, "[EXE] SRA\n");
-			print_debug(s);
-			break;
-		case FUNC_ADD:
-			ALU_out = (int32_t)((int32_t)operandA + (int32_t)operandB);
-			sprintf(s, "[EXE] ADD\n");
-			print_debug(s);
-			break;
-		case FUNC_ADDU:
-			ALU_out = (operandA + operandB);
-			sprintf(s, "[EXE] ADDU\n");
-			print_debug(s);
-			break;
-		case FUNC_SUB:
-			ALU_out = (int32_t)((int32_t)operandA - (int32_t)operandB);
-			sprintf(s, "[EXE] SUB\n");
-			print_debug(s);
-			break;
-		case FUNC_SUBU:
-			ALU_out = (operandA - operandB);
-			sprintf(s, "[EXE] SUBU\n");
-			print_debug(s);
-			break;
-		case FUNC_AND:
-			ALU_out = (operandA & operandB);
-			sprintf(s, "[EXE] AND\n");
-			print_debug(s);
-			break;
-		case FUNC_OR:
-			ALU_out = (operandA | operandB);
-			sprintf(s, "[EXE] OR\n");
-			print_debug(s);
-			break;
-		case FUNC_XOR:
-			ALU_out = (operandA ^ operandB);
-			sprintf(s, "[EXE] XOR\n");
-			print_debug(s);
-			break;
-		case FUNC_SEQ:
-			ALU_out = (operandA == operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SEQ\n");
-			print_debug(s);
-			break;
-		case FUNC_SNE:
-			ALU_out = (operandA != operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SNE\n");
-			print_debug(s);
-			break;
-		case FUNC_SLT:
-			ALU_out = ((int32_t)operandA < (int32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SLT\n");
-			print_debug(s);
-			break;
-		case FUNC_SGT:
-			ALU_out = ((int32_t)operandA > (int32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SGT\n");
-			print_debug(s);
-			break;
-		case FUNC_SLE:
-			ALU_out = ((int32_t)operandA <= (int32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SLE\n");
-			print_debug(s);
-			break;
-		case FUNC_SGE:
-			ALU_out = ((int32_t)operandA >= (int32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SGE\n");
-			print_debug(s);
-			break;
-		case FUNC_SLTU:
-			ALU_out = ((uint32_t)operandA < (uint32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SLTU\n");
-			print_debug(s);
-			break;
-		case FUNC_SGTU:
-			ALU_out = ((uint32_t)operandA > (uint32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SGTU\n");
-			print_debug(s);
-			break;
-		case FUNC_SLEU:
-			ALU_out = ((uint32_t)operandA <= (uint32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SLEU\n");
-			print_debug(s);
-			break;
-		case FUNC_SGEU:
-			ALU_out = ((uint32_t)operandA >= (uint32_t)operandB) ? 1 : 0;
-			sprintf(s, "[EXE] SGEU\n");
-			print_debug(s);
-			break;
-		default:
-			// Should never goes here
-			fprintf(stderr, "[EXE] shouldn't be here | ALU_opcode = %x\n", ALU_opcode);
-			printf("[EXE] shouldn't be here | ALU_opcode = %x\n", ALU_opcode);
-			free(pipeDecode);	// Free used mem
-			return NULL;
-	}		
+	if(alu_execute(ALU_opcode, operandA, operandB, &ALU_out) < 0){
+		// Should never goes here
+		fprintf(stderr, "[EXE] shouldn't be here | ALU_opcode = %x\n", ALU_opcode);
+		printf("[EXE] shouldn't be here | ALU_opcode = %x\n", ALU_opcode);
+		return NULL;
+	}
+	PRINT_DEBUG("[EXE] ALU_out: 0x%08x\n", ALU_out);
 
 	switch (pipeDecode->controlWord.jmp_eqz_neqz) {
 		case jump:
-			sprintf(s, "[EXE] JUMP\n");
-			print_debug(s);
+			PRINT_DEBUG("[EXE] JUMP\n");
 			
 			toJump = true;
 			break;
 		case jump_link:
-			sprintf(s, "[EXE] JUMP and LINK\n");
-			print_debug(s);
+			PRINT_DEBUG("[EXE] JUMP and LINK\n");
 			
 			toJump = true;
 			break;
 		case eqz:
-			sprintf(s, "[EXE] BEQZ\n");
-			print_debug(s);
+			PRINT_DEBUG("[EXE] BEQZ\n");
 			
 			toJump = (pipeDecode->rs1_val == 0x0);
 			break;
 		case neqz:
-			sprintf(s, "[EXE] BNEZ\n");
-			print_debug(s);
+			PRINT_DEBUG("[EXE] BNEZ\n");
 			
 			toJump = (pipeDecode->rs1_val != 0x0);
 			break;
@@ -569,104 +451,101 @@ pipeEx_t* instruction_exe(void *handle, pipeDecode_t *pipeDecode) {
 
 	pipeEx->ALU_out = ALU_out;
 	pipeEx->jump = toJump;
-#ifdef DELAYSLOT1
-	if(pipeDecode->controlWord.useRegisterToJump)
-		cpu->pc = pipeDecode->rs1_val/4;
-	else if(pipeEx->jump)
-		cpu->pc = pipeEx->ALU_out/4;
-	else
-		cpu->pc++; 
-#endif
 
 	// Propagate old signals
 	pipeEx->nextPC = pipeDecode->nextPC;
+	pipeEx->predicted = pipeDecode->predicted;
+	pipeEx->flushed = pipeDecode->flushed;
 	pipeEx->rs2_val = pipeDecode->rs2_val;
 	pipeEx->rd = pipeDecode->rd;
 	pipeEx->rs1_val = pipeDecode->rs1_val;
 
 	// Contols
 	pipeEx->controlWord = pipeDecode->controlWord;
+	pipeEx->instr	= pipeDecode->instr;
+	pipeEx->pc		= pipeDecode->pc;
+	if(delayslot == 1 && predict)
+		PIPE_JUMP_RESOLVE(cpu, pipeEx);
+	else if(delayslot == 1)
+		PIPE_JUMP_UPDATE(cpu, pipeEx);
 	
-	strcpy(pipeEx->instr_str, pipeDecode->instr_str);
-#ifndef AVOID_PRINT
-	if(strlen(pipeEx->instr_str) == 0)
-		printf("[EXE] NOP\n");
-	else
-		printf("[EXE] %s\n", pipeEx->instr_str);
-#endif
-	// Previous pipe is now useless
-	free(pipeDecode);
+	trace_stage(cpu, "EXE", pipeEx->pc, pipeEx->instr);
 	
 	return pipeEx;
 }
 
-// Mem stage
-pipeMem_t* instruction_mem(void *handle, pipeEx_t *pipeEx){
-	if(handle == NULL){
-		fprintf(stderr, "[MEM] Failed to access CPU\n");
-		free(pipeEx);
+pipeEx_t* instruction_exe(void *handle, const pipeDecode_t *pipeDecode, pipeEx_t *pipeEx) {
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[EXE] Failed to access CPU\n");
 		return NULL;
 	}
-	cpu_t *cpu = (cpu_t*)handle;
+	return exe_stage(cpu, pipeDecode, pipeEx, cpu->config.delayslot, cpu->config.relative_jump,
+		cpu->config.predictor != PREDICT_NONE);
+}
+
+// Keep the loaded half-word/byte of the memory word, extending it
+uint32_t load_extend(uint8_t opcode, uint32_t data) {
+	switch (opcode) {
+		case OPCODE_LH:
+			data = data & 0xffff;
+			if(data >> 15)
+				data |= 0xffff0000;		// Sign extension
+			break;
+		case OPCODE_LHU:
+			data = data & 0xffff;
+			break;
+		case OPCODE_LB:
+			data = data & 0xff;
+			if(data >> 7)
+				data |= 0xffffff00;		// Sign extension
+			break;
+		case OPCODE_LBU:
+			data = data & 0xff;
+			break;
+		default:
+			break;
+	}
+	return data;
+}
+
+// Keep the stored half-word/byte of the register
+uint32_t store_mask(controlWord_t controlWord, uint32_t data) {
+	switch (controlWord.ALU_opcode) {
+		case OPCODE_SH:
+			data = data & 0xffff;
+			break;
+		case OPCODE_SB:
+			data = data & 0xff;
+			break;
+		default:
+			break;
+	}
+	return data;
+}
+
+// Mem stage
+static inline __attribute__((always_inline))
+pipeMem_t* mem_stage(cpu_t *cpu, const pipeEx_t *pipeEx, pipeMem_t *pipeMem, const int delayslot, const bool predict){
 	if(pipeEx == NULL){
 		fprintf(stderr, "[MEM] Failed to access pipeEx or not reached yet\n");
 		return NULL;
 	}
-	pipeMem_t *pipeMem;
-
 	uint32_t DRAM_out=0;
-	char s[64];
 
-	pipeMem = (pipeMem_t*)malloc(sizeof(pipeMem_t));
-	if(pipeMem == NULL) {
-		fprintf(stderr, "Failed to allocate memory for pipeMem\n");
-		printf("[MEM] Failed to allocate memory for pipeMem\n");
-		return NULL;
-	}
 	memset(pipeMem, 0, sizeof(pipeMem_t));
 
 	uint32_t DRAM_addr = pipeEx->ALU_out;
 	uint32_t DRAM_data = pipeEx->rs2_val;
 	
 	if(pipeEx->controlWord.readMem) {
-		DRAM_out = cpu_get_mem_data(cpu, DRAM_addr);
-		switch (pipeEx->controlWord.opcode) {
-			case OPCODE_LH:
-				DRAM_out = DRAM_out & 0xffff;
-				if(DRAM_out >> 15)
-					DRAM_out |= 0xffff0000;		// Sign extension
-				break;
-			case OPCODE_LHU:
-				DRAM_out = DRAM_out & 0xffff;
-				break;
-			case OPCODE_LB:
-				DRAM_out = DRAM_out & 0xff;
-				if(DRAM_out >> 7)
-					DRAM_out |= 0xffffff00;		// Sign extension
-				break;
-			case OPCODE_LBU:
-				DRAM_out = DRAM_out & 0xff;
-				break;
-			default:
-				break;
-		}
-
-		sprintf(s, "[MEM] Reading from memory\n");
-		print_debug(s);
+		DRAM_out = load_extend(pipeEx->controlWord.opcode, cpu_load_word(cpu, DRAM_addr));
+		PRINT_DEBUG("[MEM] Reading from memory\n");
 	}else if(pipeEx->controlWord.writeMem) {
-		switch (pipeEx->controlWord.ALU_opcode) {
-			case OPCODE_SH:
-				DRAM_data = DRAM_data & 0xffff;
-				break;
-			case OPCODE_SB:
-				DRAM_data = DRAM_data & 0xff;
-				break;
-			default:
-				break;
-		}
-		cpu_write_mem_data(cpu, DRAM_addr, DRAM_data);
-		sprintf(s, "[MEM] Writing to memory: 0x%08x\n", DRAM_addr);
-		print_debug(s);
+		DRAM_data = store_mask(pipeEx->controlWord, DRAM_data);
+		cpu_store_word(cpu, DRAM_addr, DRAM_data);
+		pipeMem->DRAM_data = DRAM_data;
+		PRINT_DEBUG("[MEM] Writing to memory: 0x%08x\n", DRAM_addr);
 	}
 	pipeMem->DRAM_out = DRAM_out;
 
@@ -674,11 +553,9 @@ pipeMem_t* instruction_mem(void *handle, pipeEx_t *pipeEx){
 	if(pipeEx->jump){
 		//  If jump == true then ALU_out will hold the new PC
 		pipeMem->nextPC = pipeEx->ALU_out/4;
-		sprintf(s, "[MEM] JUMPING at 0x%08x\n", pipeMem->nextPC*4);
-		print_debug(s);
+		PRINT_DEBUG("[MEM] JUMPING at 0x%08x\n", pipeMem->nextPC*4);
 	}else {
-		sprintf(s, "[MEM] Incrementing PC\n");
-		print_debug(s);
+		PRINT_DEBUG("[MEM] Incrementing PC\n");
 	}
 	// New signals to feed the next steps
 	pipeMem->DRAM_out	= DRAM_out;
@@ -686,6 +563,8 @@ pipeMem_t* instruction_mem(void *handle, pipeEx_t *pipeEx){
 	// Propagate old signals
 	pipeMem->ALU_out	= pipeEx->ALU_out;
 	pipeMem->nextPC		= pipeEx->nextPC;
+	pipeMem->predicted	= pipeEx->predicted;
+	pipeMem->flushed	= pipeEx->flushed;
 	pipeMem->rd			= pipeEx->rd;
 	pipeMem->rs1_val	= pipeEx->rs1_val;
 
@@ -693,117 +572,277 @@ pipeMem_t* instruction_mem(void *handle, pipeEx_t *pipeEx){
 	pipeMem->controlWord	= pipeEx->controlWord;
 	pipeMem->jump			= pipeEx->jump;
 
-	strcpy(pipeMem->instr_str, pipeEx->instr_str);
-#ifndef AVOID_PRINT
-	if(strlen(pipeMem->instr_str) == 0)
-		printf("[MEM] NOP\n");
-	else
-		printf("[MEM] %s\n", pipeMem->instr_str);
-#endif	
-	// Previous pipe is now useless
-	free(pipeEx);
-
+	pipeMem->instr	= pipeEx->instr;
+	pipeMem->pc		= pipeEx->pc;
+	trace_stage(cpu, "MEM", pipeMem->pc, pipeMem->instr);
 
-#ifdef DELAYSLOT2
-	if(pipeEx->controlWord.useRegisterToJump)
-		cpu->pc = pipeEx->rs1_val/4;
-	else if(pipeMem->jump)
-		cpu->pc = pipeMem->ALU_out/4;
-	else
-		cpu->pc++; 
-#endif
+	if(delayslot == 2 && predict)
+		PIPE_JUMP_RESOLVE(cpu, pipeMem);
+	else if(delayslot == 2)
+		PIPE_JUMP_UPDATE(cpu, pipeMem);
 	return pipeMem;
 }
 
-// WB stage
-void instruction_WB(void *handle, pipeMem_t *pipeMem){
+pipeMem_t* instruction_mem(void *handle, const pipeEx_t *pipeEx, pipeMem_t *pipeMem){
 	if(handle == NULL){
-		fprintf(stderr, "[WB] Failed to access CPU\n");
-		free(pipeMem);
-		return;
+		fprintf(stderr, "[MEM] Failed to access CPU\n");
+		return NULL;
 	}
+	cpu_t *cpu = (cpu_t*)handle;
+	return mem_stage(cpu, pipeEx, pipeMem, cpu->config.delayslot, cpu->config.predictor != PREDICT_NONE);
+}
+
+// WB stage
+static inline __attribute__((always_inline))
+void wb_stage(cpu_t *cpu, const pipeMem_t *pipeMem, const int delayslot, const bool predict){
 	if(pipeMem == NULL){
 		fprintf(stderr, "[WB] Failed to access pipeMem or not reached yet\n");
 		return;
 	}
 
-	cpu_t *cpu = (cpu_t*)handle;
 	uint32_t val_to_store;
-	char s[64];
-#ifdef DELAYSLOT3
-	if(pipeMem->controlWord.useRegisterToJump)
-		cpu->pc = pipeMem->rs1_val/4;
-	else if(pipeMem->jump)
-		cpu->pc = pipeMem->ALU_out/4;
-	else
-		cpu->pc++; 
-#endif
+	if(delayslot == 3 && predict)
+		PIPE_JUMP_RESOLVE(cpu, pipeMem);
+	else if(delayslot == 3)
+		PIPE_JUMP_UPDATE(cpu, pipeMem);
 	if (pipeMem->controlWord.writeRF) {
 		if(pipeMem->jump) {
 			// JAL instruction -- rd set to 31
 			val_to_store = pipeMem->nextPC;
-			sprintf(s, "[WB] Storing next PC: 0x%08x\n", val_to_store);
-			print_debug(s);
+			PRINT_DEBUG("[WB] Storing next PC: 0x%08x\n", val_to_store);
 		}else if(pipeMem->controlWord.readMem) {
 			// LOAD instruction
 			val_to_store = pipeMem->DRAM_out;
-			sprintf(s, "[WB] Storing DRAM_out\n");
-			print_debug(s);
+			PRINT_DEBUG("[WB] Storing DRAM_out\n");
 		}else {
 			val_to_store = pipeMem->ALU_out;
-			sprintf(s, "[WB] Storing ALU_out\n");
-			print_debug(s);
+			PRINT_DEBUG("[WB] Storing ALU_out\n");
 		}
 		if (pipeMem->rd != 0)
 			cpu_write_reg(cpu, pipeMem->rd, val_to_store);
-		sprintf(s, "[WB] Storing to R%-2d\n", pipeMem->rd);
-		print_debug(s);
+		PRINT_DEBUG("[WB] Storing to R%-2d\n", pipeMem->rd);
 	}
 
-#ifndef AVOID_PRINT
-	if(strlen(pipeMem->instr_str) == 0)
-		printf("[WB] NOP\n");
-	else
-		printf("[WB] %s\n", pipeMem->instr_str);
-#endif
-	// Previous pipe is now useless
-	free(pipeMem);
+	trace_stage(cpu, "WB", pipeMem->pc, pipeMem->instr);
 }
 
-// Execute one step
-void cpu_step(void* handle) {
-	cpu_t* cpu = (cpu_t*)handle;
-	if(cpu == NULL){
-		fprintf(stderr, "[CPU STEP] CPU is NULL\n");
+void instruction_WB(void *handle, const pipeMem_t *pipeMem){
+	if(handle == NULL){
+		fprintf(stderr, "[WB] Failed to access CPU\n");
 		return;
 	}
+	cpu_t *cpu = (cpu_t*)handle;
+	wb_stage(cpu, pipeMem, cpu->config.delayslot, cpu->config.predictor != PREDICT_NONE);
+}
 
+////////////////////////////////////
+// STEP KERNELS
+////////////////////////////////////
+// Performance counters of the instruction written back
+static inline __attribute__((always_inline))
+void count_retired(cpuCounters_t *counters, const pipeMem_t *pipeMem){
+	uint8_t  opcode = (pipeMem->instr >> 26) & 0x3F;
+	uint32_t func   = pipeMem->instr & 0x7FF;
+
+	counters->opcode[opcode]++;
+	switch(opcode){
+		case OPCODE_RTYPE:
+			if(func < 64)
+				counters->rtype[func]++;
+			break;
+		case OPCODE_BEQZ: case OPCODE_BNEZ:
+			if(pipeMem->jump)
+				counters->taken++;
+			else
+				counters->not_taken++;
+			break;
+		case OPCODE_J: case OPCODE_JAL: case OPCODE_JR: case OPCODE_JALR:
+			counters->jumps++;
+			break;
+		case OPCODE_LW:						counters->loads[ACCESS_WORD]++;		break;
+		case OPCODE_LH: case OPCODE_LHU:	counters->loads[ACCESS_HALF]++;		break;
+		case OPCODE_LB: case OPCODE_LBU:	counters->loads[ACCESS_BYTE]++;		break;
+		case OPCODE_SW:						counters->stores[ACCESS_WORD]++;	break;
+		case OPCODE_SH:						counters->stores[ACCESS_HALF]++;	break;
+		case OPCODE_SB:						counters->stores[ACCESS_BYTE]++;	break;
+		default:
+			break;
+	}
+}
+
+// A pipeline register is a bubble if it holds a NOP, or nothing yet:
+// the stage k has written it if iteration >= k
+static inline __attribute__((always_inline))
+void count_bubbles(cpuCounters_t *counters, const pipeBank_t *bank, uint8_t iteration){
+	uint32_t instr[PIPE_STAGES] = { bank->fetch.instr, bank->decode.instr, bank->ex.instr, bank->mem.instr };
+	int k;
 
-#ifdef DELAYSLOT
-	if(cpu->iteration <= DELAYSLOT)
+	for(k = 0; k < PIPE_STAGES; k++)
+		if(iteration < k || ((instr[k] >> 26) & 0x3F) == OPCODE_NOP)
+			counters->bubbles[k]++;
+}
+
+// The instructions fetched after a mispredicted jump become NOPs, in
+// the registers the younger stages are about to read, flushed so that
+// they aren't retired
+static inline __attribute__((always_inline))
+void squash_younger(pipeBank_t *bank, const int delayslot){
+	uint32_t pc;
+
+	if(delayslot == 3){
+		pc = bank->ex.pc;
+		memset(&bank->ex, 0, sizeof(pipeEx_t));
+		bank->ex.pc						= pc;
+		bank->ex.instr					= NOP_Instruction;
+		bank->ex.controlWord.opcode		= OPCODE_NOP;
+		bank->ex.flushed				= true;
+	}
+	if(delayslot >= 2){
+		pc = bank->decode.pc;
+		memset(&bank->decode, 0, sizeof(pipeDecode_t));
+		bank->decode.pc					= pc;
+		bank->decode.instr				= NOP_Instruction;
+		bank->decode.controlWord.opcode	= OPCODE_NOP;
+		bank->decode.flushed			= true;
+	}
+	pc = bank->fetch.pc;
+	memset(&bank->fetch, 0, sizeof(pipeFetch_t));
+	bank->fetch.pc						= pc;
+	bank->fetch.instr					= NOP_Instruction;
+	bank->fetch.op.instr				= NOP_Instruction;
+	bank->fetch.op.controlWord.opcode	= OPCODE_NOP;
+	bank->fetch.op.flags				= DECODED_VALID | DECODED_NOP;
+	bank->fetch.op.handler				= H_NOP;
+	bank->fetch.flushed					= true;
+}
+
+// The configuration is a constant of each kernel, so that the compiler
+// drops the stages and checks it doesn't use. cpu_create() picks the
+// kernel of the configuration. The counting ones are the same kernels
+// with the performance counters
+static inline __attribute__((always_inline))
+void step_kernel(cpu_t *cpu, const int delayslot, const bool forwarding, const bool relative_jump, const bool predict,
+	const bool counting) {
+	uint32_t fwd;
+
+	if(cpu->func.active)
+		cpu_leave_functional(cpu);
+
+	pipeBank_t *cur  = PIPE_CUR(cpu);
+	pipeBank_t *next = PIPE_NEXT(cpu);
+	// With a predictor the fetch follows the prediction of the previous
+	// cycle, otherwise the PC moves on until the first jump is resolved
+	if(predict)
+		cpu->pc = cpu->iteration == 0 ? cpu->pc + 1 : cur->fetch.predicted;
+	else if(cpu->iteration <= delayslot)
 		cpu->pc++;
-#endif //DELAYSLOT
-	// In reverse, in this way it will be feed
-	// with the previous pipe
-	// At the end of each function the used pipe will be
-	// destroyed to avoid overuse of memory
-	if(cpu->iteration > 3)
-		instruction_WB(handle, cpu->pipeMem);
+
+	// Every stage reads the registers latched in the previous cycle
+	// and writes the ones of the next cycle. The stages are still
+	// called in reverse, so that the register file and the PC are
+	// updated before they are read by the decode and fetch stages
+	cpu->stats.cycles++;
+	if(cpu->iteration > 3){
+		wb_stage(cpu, &cur->mem, delayslot, predict);
+		// The ghosts have been executed by the functional model, the
+		// flushed ones never were
+		if(predict && cur->mem.flushed){
+			cpu->predict.flushed++;
+		}else if(cpu->func.ghosts == 0){
+			cpu->stats.retired++;
+			if(((cur->mem.instr >> 26) & 0x3F) == OPCODE_NOP)
+				cpu->stats.nops++;
+			if(counting)
+				count_retired(cpu->counters, &cur->mem);
+			if(cpu->commit != NULL || cpu->commit_hook != NULL)
+				cpu_commit(cpu, &cur->mem);
+		}
+	}
+	if(predict && delayslot == 3 && cpu->flush)
+		squash_younger(cur, delayslot);
 
 	if(cpu->iteration > 2)
-		cpu->pipeMem = instruction_mem(handle, cpu->pipeEx);
+		if(mem_stage(cpu, &cur->ex, &next->mem, delayslot, predict) == NULL)
+			memset(&next->mem, 0, sizeof(pipeMem_t));
+	if(predict && delayslot == 2 && cpu->flush)
+		squash_younger(cur, delayslot);
 
 	if(cpu->iteration > 1) 
-		cpu->pipeEx = instruction_exe(handle, cpu->pipeDecode);
+		if(exe_stage(cpu, &cur->decode, &next->ex, delayslot, relative_jump, predict) == NULL)
+			memset(&next->ex, 0, sizeof(pipeEx_t));
+	if(predict && delayslot == 1 && cpu->flush)
+		squash_younger(cur, delayslot);
 
 	if(cpu->iteration > 0)
-		cpu->pipeDecode = instruction_decode(handle, cpu->pipeFetch);
+		if(instruction_decode(cpu, &cur->fetch, &next->decode) == NULL)
+			memset(&next->decode, 0, sizeof(pipeDecode_t));
+
+	instruction_fetch(cpu, &next->fetch);
+	cpu_track_idle(cpu, next->fetch.pc);
+	// A loop is idle once the fetch goes around it with no flushes
+	if(predict && cpu->flush){
+		cpu->idle.len	= 0;
+		cpu->flush		= false;
+	}
 
-	cpu->pipeFetch = instruction_fetch(handle);
-	cpu->pipeFetch->controlWord = control_unit(cpu->pipeFetch->instr, cpu);
+	if(forwarding){
+		fwd = forward_mem_out(cpu);
+		if(counting)
+			cpu->counters->fwd_mem += fwd;
+		fwd = forward_alu_out(cpu);
+		if(counting)
+			cpu->counters->fwd_alu += fwd;
+	}
+	if(counting)
+		count_bubbles(cpu->counters, next, cpu->iteration);
 
+	// Latch the new values
+	cpu->cur ^= 1;
 
 	if(cpu->iteration < 5)
 		cpu->iteration++;
+	if(cpu->func.ghosts > 0)
+		cpu->func.ghosts--;
+	if(counting && cpu->stats.cycles >= cpu->counters_next)
+		cpu_counters_tick(cpu);
+}
+
+#define STEP_KERNEL(d, f, r, p, c) \
+	static void cpu_step_d##d##_f##f##_r##r##_p##p##_c##c(cpu_t *cpu) { step_kernel(cpu, d, f, r, p, c); }
+#define STEP_KERNELS(d, p, c) \
+	STEP_KERNEL(d, 0, 0, p, c) STEP_KERNEL(d, 0, 1, p, c) STEP_KERNEL(d, 1, 0, p, c) STEP_KERNEL(d, 1, 1, p, c)
+#define STEP_KERNELS_P(p, c) \
+	STEP_KERNELS(1, p, c) STEP_KERNELS(2, p, c) STEP_KERNELS(3, p, c)
+STEP_KERNELS_P(0, 0)
+STEP_KERNELS_P(1, 0)
+STEP_KERNELS_P(0, 1)
+STEP_KERNELS_P(1, 1)
+
+#define STEP_ENTRY(d, p, c) \
+	{ { cpu_step_d##d##_f0_r0_p##p##_c##c, cpu_step_d##d##_f0_r1_p##p##_c##c }, \
+	  { cpu_step_d##d##_f1_r0_p##p##_c##c, cpu_step_d##d##_f1_r1_p##p##_c##c } }
+#define STEP_ENTRIES(p, c) \
+	{ STEP_ENTRY(1, p, c), STEP_ENTRY(2, p, c), STEP_ENTRY(3, p, c) }
+// [counting][predictor != PREDICT_NONE][delayslot - 1][forwarding][relative_jump]
+static const cpuStepFn_t step_kernels[2][2][MAX_DELAYSLOT][2][2] = {
+	{ STEP_ENTRIES(0, 0), STEP_ENTRIES(1, 0) },
+	{ STEP_ENTRIES(0, 1), STEP_ENTRIES(1, 1) },
+};
+
+cpuStepFn_t cpu_step_kernel(const cpu_config_t *config, bool counting) {
+	if(config == NULL || config->delayslot < 1 || config->delayslot > MAX_DELAYSLOT ||
+		config->predictor >= PREDICT_KINDS)
+		return NULL;
+	return step_kernels[counting][config->predictor != PREDICT_NONE][config->delayslot - 1]
+		[config->forwarding][config->relative_jump];
+}
 
+// Execute one step
+void cpu_step(void* handle) {
+	cpu_t* cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[CPU STEP] CPU is NULL\n");
+		return;
+	}
+	cpu->step(cpu);
 }
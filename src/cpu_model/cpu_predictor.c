@@ -0,0 +1,267 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cpu_model/cpu_model.h>
+
+#define TABLE_SIZE	(1u << PREDICT_TABLE_BITS)
+#define TABLE_MASK	(TABLE_SIZE - 1)
+#define BTB_SIZE	(1u << PREDICT_BTB_BITS)
+#define BTB_MASK	(BTB_SIZE - 1)
+
+// Iterations of an idle loop filling the history, saturating the
+// counters and emptying the return stack: the tables don't change after
+#define IDLE_TRAIN_ITERATIONS	(PREDICT_TABLE_BITS + PREDICT_RAS_DEPTH)
+
+// 2-bit saturating counters, taken from 2 on
+#define COUNTER_INIT	1		// Weakly not taken
+#define COUNTER_TAKEN(c)	((c) >= 2)
+
+typedef struct {
+	uint32_t	tag;		// Word address of the jump
+	uint32_t	target;		// Word address
+	bool		valid;
+} btbEntry_t;
+
+// Direction predictor of BEQZ and BNEZ
+typedef struct {
+	const char	*name;
+	bool		(*predict)(predictor_t *p, uint32_t pc);
+	void		(*update)(predictor_t *p, uint32_t pc, bool taken);
+} directionOps_t;
+
+struct predictor {
+	const directionOps_t	*ops;
+	uint8_t					counters[TABLE_SIZE];
+	uint32_t				history;	// Outcomes of the last branches, the newest in bit 0
+	btbEntry_t				btb[BTB_SIZE];
+	uint32_t				ras[PREDICT_RAS_DEPTH];
+	uint32_t				ras_top;	// Next entry, the oldest ones are overwritten
+	uint32_t				ras_len;	// Valid entries
+};
+
+////////////////////////////////////
+// DIRECTION
+////////////////////////////////////
+static bool not_taken_predict(predictor_t *p, uint32_t pc){
+	(void)p; (void)pc;
+	return false;
+}
+
+static void not_taken_update(predictor_t *p, uint32_t pc, bool taken){
+	(void)p; (void)pc; (void)taken;
+}
+
+static inline void counter_update(uint8_t *counter, bool taken){
+	if(taken && *counter < 3)
+		(*counter)++;
+	else if(!taken && *counter > 0)
+		(*counter)--;
+}
+
+// A counter per word
+static bool bimodal_predict(predictor_t *p, uint32_t pc){
+	return COUNTER_TAKEN(p->counters[pc & TABLE_MASK]);
+}
+
+static void bimodal_update(predictor_t *p, uint32_t pc, bool taken){
+	counter_update(&p->counters[pc & TABLE_MASK], taken);
+}
+
+// A counter per word and global history
+static bool gshare_predict(predictor_t *p, uint32_t pc){
+	return COUNTER_TAKEN(p->counters[(pc ^ p->history) & TABLE_MASK]);
+}
+
+static void gshare_update(predictor_t *p, uint32_t pc, bool taken){
+	counter_update(&p->counters[(pc ^ p->history) & TABLE_MASK], taken);
+	p->history = ((p->history << 1) | taken) & TABLE_MASK;
+}
+
+// [predictorKind_t], none without a predictor
+static const directionOps_t direction_ops[PREDICT_KINDS] = {
+	[PREDICT_NONE]		= { "none",		 NULL,				NULL },
+	[PREDICT_NOT_TAKEN]	= { "not_taken", not_taken_predict,	not_taken_update },
+	[PREDICT_BIMODAL]	= { "bimodal",	 bimodal_predict,	bimodal_update },
+	[PREDICT_GSHARE]	= { "gshare",	 gshare_predict,	gshare_update },
+};
+
+const char *predictor_name(predictorKind_t kind){
+	if((unsigned)kind >= PREDICT_KINDS)
+		return "unknown";
+	return direction_ops[kind].name;
+}
+
+int predictor_kind(const char *name){
+	int kind;
+	for(kind = 0; kind < PREDICT_KINDS; kind++)
+		if(strcmp(name, direction_ops[kind].name) == 0)
+			return kind;
+	return -1;
+}
+
+////////////////////////////////////
+// TARGETS
+////////////////////////////////////
+static const btbEntry_t *btb_lookup(const predictor_t *p, uint32_t pc){
+	const btbEntry_t *entry = &p->btb[pc & BTB_MASK];
+	return entry->valid && entry->tag == pc ? entry : NULL;
+}
+
+static void btb_update(predictor_t *p, uint32_t pc, uint32_t target){
+	btbEntry_t *entry = &p->btb[pc & BTB_MASK];
+	entry->tag		= pc;
+	entry->target	= target;
+	entry->valid	= true;
+}
+
+static void ras_push(predictor_t *p, uint32_t ret){
+	p->ras[p->ras_top] = ret;
+	p->ras_top = (p->ras_top + 1) % PREDICT_RAS_DEPTH;
+	if(p->ras_len < PREDICT_RAS_DEPTH)
+		p->ras_len++;
+}
+
+static void ras_pop(predictor_t *p){
+	if(p->ras_len == 0)
+		return;
+	p->ras_top = (p->ras_top + PREDICT_RAS_DEPTH - 1) % PREDICT_RAS_DEPTH;
+	p->ras_len--;
+}
+
+// Top of the stack, false if empty
+static bool ras_peek(const predictor_t *p, uint32_t *ret){
+	if(p->ras_len == 0)
+		return false;
+	*ret = p->ras[(p->ras_top + PREDICT_RAS_DEPTH - 1) % PREDICT_RAS_DEPTH];
+	return true;
+}
+
+// JR R31
+static inline bool is_return(uint32_t instr){
+	return ((instr >> 26) & 0x3F) == OPCODE_JR && ((instr >> 21) & 0x1F) == 31;
+}
+
+////////////////////////////////////
+// PREDICTOR
+////////////////////////////////////
+predictor_t *predictor_create(predictorKind_t kind){
+	predictor_t *p;
+
+	if(kind == PREDICT_NONE || (unsigned)kind >= PREDICT_KINDS)
+		return NULL;
+	p = (predictor_t*)malloc(sizeof(predictor_t));
+	if(p == NULL){
+		fprintf(stderr, "[PREDICTOR] malloc() failed\n");
+		return NULL;
+	}
+	p->ops = &direction_ops[kind];
+	predictor_reset(p);
+	return p;
+}
+
+void predictor_free(predictor_t *predictor){
+	free(predictor);
+}
+
+void predictor_reset(predictor_t *predictor){
+	if(predictor == NULL)
+		return;
+	memset(predictor->counters, COUNTER_INIT, sizeof(predictor->counters));
+	memset(predictor->btb, 0, sizeof(predictor->btb));
+	predictor->history	= 0;
+	predictor->ras_top	= 0;
+	predictor->ras_len	= 0;
+}
+
+// Taken jumps go to the BTB target, if known
+uint32_t predictor_next(cpu_t *cpu, uint32_t pc, const decodedOp_t *op){
+	predictor_t			*p = cpu->predictor;
+	const btbEntry_t	*entry;
+	uint32_t			ret;
+
+	switch(op->handler){
+		case H_BEQZ: case H_BNEZ:
+			if(!p->ops->predict(p, pc))
+				return pc + 1;
+			break;
+		case H_JR:
+			if(op->rs1 == 31 && ras_peek(p, &ret))
+				return ret;
+			break;
+		case H_J: case H_JAL: case H_JALR:
+			break;
+		default:
+			return pc + 1;
+	}
+	entry = btb_lookup(p, pc);
+	return entry != NULL ? entry->target : pc + 1;
+}
+
+bool predictor_resolve(cpu_t *cpu, uint32_t pc, uint32_t instr, bool taken, uint32_t actual, uint32_t predicted){
+	predictor_t	*p = cpu->predictor;
+	uint8_t		opcode = (instr >> 26) & 0x3F;
+	bool		miss = actual != predicted;
+
+	switch(opcode){
+		case OPCODE_BEQZ: case OPCODE_BNEZ:
+			cpu->predict.branches++;
+			cpu->predict.branch_misses += miss;
+			p->ops->update(p, pc, taken);
+			break;
+		case OPCODE_JAL: case OPCODE_JALR:
+			ras_push(p, pc + 1);
+			// fall through
+		default:
+			cpu->predict.jumps++;
+			cpu->predict.jump_misses += miss;
+			if(is_return(instr)){
+				cpu->predict.returns++;
+				cpu->predict.return_misses += miss;
+				ras_pop(p);
+			}
+			break;
+	}
+	if(taken)
+		btb_update(p, pc, actual);
+	return miss;
+}
+
+void predictor_idle(cpu_t *cpu, uint32_t head, uint32_t len, uint64_t iterations){
+	const decodedOp_t	*op;
+	uint64_t			i, trained = iterations < IDLE_TRAIN_ITERATIONS ? iterations : IDLE_TRAIN_ITERATIONS;
+	uint32_t			idx, actual;
+	uint8_t				opcode;
+	bool				taken;
+
+	for(idx = head; idx < head + len; idx++){
+		op		= cpu_get_decoded(cpu, idx);
+		opcode	= (op->instr >> 26) & 0x3F;
+		if(op->controlWord.jmp_eqz_neqz == nop)
+			continue;
+		// Nothing written by the loop, the jumps always go the same way
+		taken	= true;
+		if(opcode == OPCODE_BEQZ || opcode == OPCODE_BNEZ)
+			taken = (cpu->regs[op->rs1] == 0) == (opcode == OPCODE_BEQZ);
+		actual	= idx + 1 < head + len ? idx + 1 : head;
+		for(i = 0; i < trained; i++)
+			predictor_resolve(cpu, idx, op->instr, taken, actual, actual);
+		if(opcode == OPCODE_BEQZ || opcode == OPCODE_BNEZ){
+			cpu->predict.branches += iterations - trained;
+		}else{
+			cpu->predict.jumps += iterations - trained;
+			if(is_return(op->instr))
+				cpu->predict.returns += iterations - trained;
+		}
+	}
+}
+
+const predictorStats_t *cpu_get_predictor_stats(void *handle){
+	cpu_t *cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[PREDICTOR] CPU is NULL\n");
+		return NULL;
+	}
+	return &cpu->predict;
+}
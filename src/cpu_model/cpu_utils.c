@@ -11,28 +11,107 @@
 ////////////////////////////////////
 // CPU management
 ////////////////////////////////////
+// The predecoded copy of the IRAM word is stale: it has been written,
+// or the breakpoint has moved
+void cpu_invalidate_decoded(void *handle, uint32_t idx){
+	cpu_t* cpu = (cpu_t*)handle;
+	if(idx >= IRAM_SIZE)
+		return;
+	cpu->decoded[idx].flags = 0;
+	if(cpu->jit != NULL)
+		jit_invalidate(cpu->jit, idx);
+	if(cpu->blocks != NULL)
+		block_invalidate(cpu->blocks, idx);
+}
+
 // Create CPU instance
-void* cpu_create() {
+void* cpu_create(const cpu_config_t *config) {
+	cpu_config_t defaults = CPU_CONFIG_DEFAULT;
+	if(config == NULL)
+		config = &defaults;
+	if(cpu_step_kernel(config, false) == NULL){
+		fprintf(stderr, "[CPU CREATE] DELAYSLOT or predictor not defined correctly: %d, %d\n", config->delayslot,
+			config->predictor);
+		return NULL;
+	}
 
-#ifndef DELAYSLOT3
-#ifndef DELAYSLOT2
-#ifndef DELAYSLOT1
-	fprintf(stderr, "[CRITICAL ERROR] DELAYSLOT not defined correctly\n");
-	exit(-1);
-#endif
-#endif
-#endif
 	cpu_t* cpu = (cpu_t*)malloc(sizeof(cpu_t));
 	if(cpu == NULL){
 		fprintf(stderr, "[CPU CREATE] malloc() failed\n");
 		return NULL;
 	}
 	memset(cpu, 0, sizeof(cpu_t));
+	cpu->config	= *config;
+	cpu->step	= cpu_step_kernel(config, false);
+
+	cpu->decoded = (decodedOp_t*)calloc(IRAM_SIZE, sizeof(decodedOp_t));
+	if(cpu->decoded == NULL){
+		fprintf(stderr, "[CPU CREATE] calloc() failed\n");
+		free(cpu);
+		return NULL;
+	}
+	cpu->predictor = predictor_create(config->predictor);
+	if(config->predictor != PREDICT_NONE && cpu->predictor == NULL){
+		free(cpu->decoded);
+		free(cpu);
+		return NULL;
+	}
 
-	bus_init(&cpu->bus);
+#ifndef AVOID_PRINT
+	cpu->trace = stdout;
+#endif
+	cpu->breakpoint = FF_NO_MARKER;
+	if(bus_init(&cpu->bus)){
+		bus_free(&cpu->bus);
+		predictor_free(cpu->predictor);
+		free(cpu->decoded);
+		free(cpu);
+		return NULL;
+	}
+	cpu->bus.iram_write_cb	= cpu_invalidate_decoded;
+	cpu->bus.iram_write_ctx	= cpu;
     return (void*)cpu;
 }
 
+// Change the microarchitecture
+int cpu_set_config(void *handle, const cpu_config_t *config){
+	cpu_t* cpu = (cpu_t*)handle;
+	predictor_t *predictor;
+	if(cpu == NULL || config == NULL){
+		fprintf(stderr, "[CPU CONFIG] CPU or config is NULL\n");
+		return -1;
+	}
+	if(cpu_step_kernel(config, false) == NULL){
+		fprintf(stderr, "[CPU CONFIG] DELAYSLOT or predictor not defined correctly: %d, %d\n", config->delayslot,
+			config->predictor);
+		return -1;
+	}
+	predictor = predictor_create(config->predictor);
+	if(config->predictor != PREDICT_NONE && predictor == NULL)
+		return -1;
+	predictor_free(cpu->predictor);
+	cpu->predictor	= predictor;
+	cpu->config	= *config;
+	cpu->step	= cpu_step_kernel(config, cpu->counting);
+	// The translations have the configuration built in, they are
+	// created again on the next run
+	jit_free(cpu->jit);
+	block_free(cpu->blocks);
+	cpu->jit	= NULL;
+	cpu->blocks	= NULL;
+	cpu_reset(cpu);
+	return 0;
+}
+
+const cpu_config_t *cpu_get_config(void *handle){
+	cpu_t* cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[CPU CONFIG] CPU is NULL\n");
+		return NULL;
+	}
+	return &cpu->config;
+}
+
 // Reset CPU
 void cpu_reset(void* handle) {
     cpu_t* cpu = (cpu_t*)handle;
@@ -46,17 +125,19 @@ if(cpu == NULL){
 	cpu->pc = -1;
    	bus_reset(&(cpu->bus));
 
-	free(cpu->pipeFetch);
-	free(cpu->pipeDecode);
-	free(cpu->pipeEx);
-	free(cpu->pipeMem);
-
-	cpu->pipeFetch	= NULL;
-	cpu->pipeDecode	= NULL;
-	cpu->pipeEx		= NULL;
-	cpu->pipeMem	= NULL;
+	memset(cpu->pipe, 0, sizeof(cpu->pipe));
+	cpu->cur = 0;
+	memset(&cpu->func, 0, sizeof(cpu->func));
 
 	memset(cpu->regs, 0, sizeof(cpu->regs));
+	memset(&cpu->stats, 0, sizeof(cpu->stats));
+	cpu_clear_counters(cpu);
+	memset(&cpu->idle, 0, sizeof(cpu->idle));
+	predictor_reset(cpu->predictor);
+	memset(&cpu->predict, 0, sizeof(cpu->predict));
+	cpu->flush = false;
+	if(cpu->commit != NULL)
+		cpu_commit_reset(cpu);
 }
 
 // Load instruction into memory
@@ -79,67 +160,206 @@ void cpu_load_rodata(void *handle, uint32_t addr, uint32_t data){
 		fprintf(stderr, "[RODATA] Address not correct: %d\n", addr);
 		return;
 	}
+#ifndef AVOID_PRINT
 	printf("Writing on RODATA: addr: 0x%08x -- data: 0x%0x8\n", addr, data);
+#endif
 	mem_write(&cpu->bus.rodata, addr, data);
 	return;
 }
 
+// Predecode the whole IRAM
+void cpu_predecode(void *handle){
+	cpu_t* cpu = (cpu_t*)handle;
+	uint32_t addr;
+	if(cpu == NULL){
+		fprintf(stderr, "[CPU PREDECODE] CPU is NULL\n");
+		return;
+	}
+	for(addr = 0; addr < IRAM_SIZE; addr++)
+		decode_instruction(cpu_get_instr(cpu, addr), &cpu->decoded[addr]);
+	if(cpu->breakpoint < IRAM_SIZE)
+		cpu->decoded[cpu->breakpoint].handler = H_BREAK;
+}
+
 void cpu_free(void *handle){
 	cpu_t* cpu = (cpu_t*)handle;
 	if(cpu == NULL){
 		return;
 	}
 
+	cpu_commit_close(cpu);
 	bus_free(&cpu->bus);
+	free(cpu->disasm);
+	free(cpu->decoded);
+	jit_free(cpu->jit);
+	block_free(cpu->blocks);
+	free(cpu->counters);
+	predictor_free(cpu->predictor);
 	free(cpu);
 }
 
-void forward_alu_out(cpu_t *cpu){
-	if(cpu == NULL)	return;
-	if(cpu->iteration <= 1) return;
-	if(cpu->pipeDecode == NULL)	return;
-	if(cpu->pipeEx == NULL)	return;
-	if(cpu->pipeEx->controlWord.writeRF == false) return;	// No writing in the register file
-	if(cpu->pipeEx->controlWord.readMem == true) return;	// Not concerning the exe unit
-	if(cpu->pipeEx->rd == 0) return;						// Writing on R0 doens't make sense
-	if(cpu->pipeDecode->rs1 == cpu->pipeEx->rd){
+// Set where the pipeline activity is printed
+void cpu_set_trace(void *handle, FILE *fd){
+	cpu_t* cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[CPU TRACE] CPU is NULL\n");
+		return;
+	}
+	cpu->trace = fd;
+}
+
+// Clear the pipeline statistics
+void cpu_clear_stats(void *handle){
+	cpu_t* cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[CPU STATS] CPU is NULL\n");
+		return;
+	}
+	memset(&cpu->stats, 0, sizeof(cpu->stats));
+	memset(&cpu->predict, 0, sizeof(cpu->predict));
+	cpu_clear_counters(cpu);
+}
+
+// The words can't change the state of the CPU
+static bool idle_pure(cpu_t *cpu, uint32_t head, uint32_t len){
+	const decodedOp_t *op;
+	uint32_t idx;
+	for(idx = head; idx < head + len; idx++){
+		if(idx >= IRAM_SIZE)
+			return false;
+		op = cpu_get_decoded(cpu, idx);
+		if(op->controlWord.readMem || op->controlWord.writeMem ||
+			(op->controlWord.writeRF && op->rd != 0) ||
+			op->handler == H_INVALID || op->handler == H_BREAK)
+			return false;
+	}
+	return true;
+}
+
+// A loop is the fetch moving back to a previous word, it is followed
+// while the fetch goes around it with no stalls
+void cpu_track_idle(cpu_t *cpu, uint32_t pc){
+	idleState_t *idle = &cpu->idle;
+	uint32_t expected = idle->last + 1;
+
+	if(idle->len != 0 && expected == idle->head + idle->len)
+		expected = idle->head;
+	if(idle->len != 0 && pc == expected){
+		idle->steady++;
+	}else if(pc <= idle->last && idle->last - pc < IDLE_LOOP_MAX &&
+		idle_pure(cpu, pc, idle->last - pc + 1)){
+		idle->head		= pc;
+		idle->len		= idle->last - pc + 1;
+		idle->steady	= 0;
+	}else{
+		idle->len		= 0;
+	}
+	idle->last = pc;
+}
+
+uint32_t cpu_get_idle(void *handle){
+	cpu_t* cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[CPU IDLE] CPU is NULL\n");
+		return 0;
+	}
+	if(cpu->idle.len == 0 || cpu->idle.steady < 2*cpu->idle.len + IDLE_MIN_CYCLES)
+		return 0;
+	// The pipeline registers are double buffered
+	return cpu->idle.len % 2 ? 2*cpu->idle.len : cpu->idle.len;
+}
+
+uint64_t cpu_skip_idle(void *handle, uint64_t cycles){
+	cpu_t* cpu = (cpu_t*)handle;
+	uint32_t period = cpu_get_idle(handle);
+	uint32_t idx, nops = 0;
+	uint64_t done, chunk;
+	// Every instruction retired is recorded
+	if(period == 0 || cpu->commit != NULL || cpu->commit_hook != NULL)
+		return 0;
+	for(idx = cpu->idle.head; idx < cpu->idle.head + cpu->idle.len; idx++)
+		if(cpu_get_decoded(cpu, idx)->flags & DECODED_NOP)
+			nops++;
+	cycles -= cycles % period;
+	for(done = 0; done < cycles; done += chunk){
+		chunk = cycles - done;
+		// Up to the end of the period reaching the periodic write
+		if(cpu->counting && cpu->counters_next - cpu->stats.cycles < chunk)
+			chunk = (cpu->counters_next - cpu->stats.cycles + period - 1) / period * period;
+		// A loop instruction is written back every cycle
+		cpu->stats.cycles	+= chunk;
+		cpu->stats.retired	+= chunk;
+		cpu->stats.nops		+= chunk / cpu->idle.len * nops;
+		cpu->idle.steady	+= chunk;
+		if(cpu->predictor != NULL)
+			predictor_idle(cpu, cpu->idle.head, cpu->idle.len, chunk / cpu->idle.len);
+		if(cpu->counting){
+			cpu_counters_idle(cpu, cpu->idle.head, cpu->idle.len, chunk / cpu->idle.len);
+			if(cpu->stats.cycles >= cpu->counters_next)
+				cpu_counters_tick(cpu);
+		}
+	}
+	return cycles;
+}
+
+// The forwarding is performed on the registers computed in the
+// current cycle, before they are latched
+uint32_t forward_alu_out(cpu_t *cpu){
+	uint32_t fwd = 0;
+	if(cpu == NULL)	return 0;
+	if(cpu->iteration <= 1) return 0;
+	pipeDecode_t *pipeDecode = &PIPE_NEXT(cpu)->decode;
+	pipeEx_t	 *pipeEx	 = &PIPE_NEXT(cpu)->ex;
+	if(pipeEx->controlWord.writeRF == false) return 0;	// No writing in the register file
+	if(pipeEx->controlWord.readMem == true) return 0;	// Not concerning the exe unit
+	if(pipeEx->rd == 0) return 0;						// Writing on R0 doens't make sense
+	if(pipeDecode->rs1 == pipeEx->rd){
 		print_debug("[CONTROL] Forwarding ALU out to RS1\n");
-		cpu->pipeDecode->rs1_val = cpu->pipeEx->ALU_out;
+		pipeDecode->rs1_val = pipeEx->ALU_out;
+		fwd++;
 	}
-	if(cpu->pipeDecode->rs2 == cpu->pipeEx->rd){
+	if(pipeDecode->rs2 == pipeEx->rd){
 		print_debug("[CONTROL] Forwarding ALU out to RS2\n");
-		cpu->pipeDecode->rs2_val = cpu->pipeEx->ALU_out;
+		pipeDecode->rs2_val = pipeEx->ALU_out;
+		fwd++;
 	}
+	return fwd;
 }
 
-void forward_mem_out(cpu_t *cpu){
-	if(cpu == NULL)	return;
-	if(cpu->iteration <= 2) return;
-	if(cpu->pipeDecode == NULL)	return;
-	if(cpu->pipeMem == NULL)	return;
-	if(cpu->pipeMem->controlWord.writeRF == false) return;	// No writing in the register file
-	if(cpu->pipeMem->rd == 0) return;						// Writing on R0 doens't make sense
-
-	if(cpu->pipeMem->controlWord.readMem == false){
-		if(cpu->pipeDecode->rs1 == cpu->pipeMem->rd) {
+uint32_t forward_mem_out(cpu_t *cpu){
+	uint32_t fwd = 0;
+	if(cpu == NULL)	return 0;
+	if(cpu->iteration <= 2) return 0;
+	pipeDecode_t *pipeDecode = &PIPE_NEXT(cpu)->decode;
+	pipeMem_t	 *pipeMem	 = &PIPE_NEXT(cpu)->mem;
+	if(pipeMem->controlWord.writeRF == false) return 0;	// No writing in the register file
+	if(pipeMem->rd == 0) return 0;						// Writing on R0 doens't make sense
+
+	if(pipeMem->controlWord.readMem == false){
+		if(pipeDecode->rs1 == pipeMem->rd) {
 			print_debug("[CONTROL] Forwarding MEM out to RS1\n");
-			cpu->pipeDecode->rs1_val = cpu->pipeMem->ALU_out;
+			pipeDecode->rs1_val = pipeMem->ALU_out;
+			fwd++;
 		}
-		if(cpu->pipeDecode->rs2 == cpu->pipeMem->rd) {
+		if(pipeDecode->rs2 == pipeMem->rd) {
 			print_debug("[CONTROL] Forwarding MEM out to RS2\n");
-			cpu->pipeDecode->rs2_val = cpu->pipeMem->ALU_out;
+			pipeDecode->rs2_val = pipeMem->ALU_out;
+			fwd++;
 		}
-		return;
+		return fwd;
 	}
 
-	if(cpu->pipeDecode->rs1 == cpu->pipeMem->rd) {
+	if(pipeDecode->rs1 == pipeMem->rd) {
 		print_debug("[CONTROL] Forwarding MEM out to RS1\n");
-		cpu->pipeDecode->rs1_val = cpu->pipeMem->DRAM_out;
+		pipeDecode->rs1_val = pipeMem->DRAM_out;
+		fwd++;
 	}
-	if(cpu->pipeDecode->rs2 == cpu->pipeMem->rd) {
+	if(pipeDecode->rs2 == pipeMem->rd) {
 		print_debug("[CONTROL] Forwarding MEM out to RS2\n");
-		cpu->pipeDecode->rs2_val = cpu->pipeMem->DRAM_out;
+		pipeDecode->rs2_val = pipeMem->DRAM_out;
+		fwd++;
 	}
+	return fwd;
 }
 ////////////////////////////////////
 // GETTER
@@ -198,6 +418,39 @@ uint32_t cpu_get_instr(void *handle, uint32_t addr){
 	return value;
 }
 
+// Get the predecoded IRAM content
+const decodedOp_t *cpu_get_decoded(void *handle, uint32_t addr){
+	cpu_t* cpu = (cpu_t*)handle;
+	decodedOp_t *op;
+	if(cpu == NULL){
+		fprintf(stderr, "[cpu_get_decoded] CPU is NULL\n");
+		return NULL;
+	}
+	if(addr >= IRAM_SIZE) {
+		// Not cached, cpu_get_instr() warns about the address
+		decode_instruction(cpu_get_instr(cpu, addr), &cpu->decoded_oob);
+		return &cpu->decoded_oob;
+	}
+
+	op = &cpu->decoded[addr];
+	if(!(op->flags & DECODED_VALID)){
+		decode_instruction(cpu_get_instr(cpu, addr), op);
+		if(addr == cpu->breakpoint)
+			op->handler = H_BREAK;
+	}
+	return op;
+}
+
+// Get the pipeline statistics
+const cpuStats_t *cpu_get_stats(void *handle){
+	cpu_t* cpu = (cpu_t*)handle;
+	if(cpu == NULL){
+		fprintf(stderr, "[cpu_get_stats] CPU is NULL\n");
+		return NULL;
+	}
+	return &cpu->stats;
+}
+
 ////////////////////////////////////
 // WRITING
 ////////////////////////////////////
@@ -222,10 +475,8 @@ void cpu_write_mem_data(void *handle, uint32_t addr, uint32_t data){
 		fprintf(stderr, "[cpu_get_mem_access] CPU is NULL\n");
 		return;
 	}
-	
-	char s[64];
-	sprintf(s, "[BUS] Writing to the address: 0x%08x\n", addr);
-	print_debug(s);
+
+	PRINT_DEBUG("[BUS] Writing to the address: 0x%08x\n", addr);
 	bus_write(&cpu->bus, addr, data);
 }
 
@@ -239,6 +490,36 @@ char *identify_instruction(uint32_t instr){
 		fprintf(stderr, "malloc() failed");
 		return NULL;
 	}
+	disassemble(instr, instr_str, 64);
+	return instr_str;
+}
+
+// Return the cached string of the instruction stored at addr
+const char *cpu_disasm(void *handle, uint32_t addr, uint32_t instr){
+	cpu_t* cpu = (cpu_t*)handle;
+	disasmEntry_t *entry;
+	if(cpu == NULL){
+		fprintf(stderr, "[DISASM] CPU is NULL\n");
+		return "";
+	}
+	if(cpu->disasm == NULL){
+		cpu->disasm = (disasmEntry_t*)calloc(IRAM_SIZE+1, sizeof(disasmEntry_t));
+		if(cpu->disasm == NULL){
+			fprintf(stderr, "[DISASM] calloc() failed\n");
+			return "";
+		}
+	}
+	// Last entry is shared by the addresses outside IRAM
+	entry = &cpu->disasm[addr < IRAM_SIZE ? addr : IRAM_SIZE];
+	if(!entry->valid || entry->instr != instr){
+		disassemble(instr, entry->str, DISASM_LEN);
+		entry->instr = instr;
+		entry->valid = true;
+	}
+	return entry->str;
+}
+
+void disassemble(uint32_t instr, char *instr_str, size_t size){
 	uint8_t opcode = (instr >> (32-6)) & 0x3F;
 	uint8_t rs1, rs2, rd;
 	uint16_t func;
@@ -323,8 +604,8 @@ char *identify_instruction(uint32_t instr){
 			default:        func_str = "UNKNOWN"; break;
 		}
 
-		//snprintf(instr_str+len, 64-len, " | rs1=%u | rs2=%u | rd=%u | func=%s",rs1, rs2, rd, func_str);
-		snprintf(instr_str+len, 64-len, "%s  R%u, R%u, R%-2u ",func_str, rd, rs1, rs2);
+		//snprintf(instr_str+len, size-len, " | rs1=%u | rs2=%u | rd=%u | func=%s",rs1, rs2, rd, func_str);
+		snprintf(instr_str+len, size-len, "%s  R%u, R%u, R%-2u ",func_str, rd, rs1, rs2);
 	} else if(opcode == OPCODE_J || opcode == OPCODE_JAL || opcode == OPCODE_JR || opcode == OPCODE_JALR) { 
 		// JTYPE
 		imm = instr & 0x03FFFFFF;
@@ -334,9 +615,9 @@ char *identify_instruction(uint32_t instr){
 		if(imm >> 25)
 			imm |= 0xFC000000;
 		if(opcode == OPCODE_JR || opcode == OPCODE_JALR)
-			snprintf(instr_str+len, 64-len, " R%-2d", rs1);
+			snprintf(instr_str+len, size-len, " R%-2d", rs1);
 		else
-			snprintf(instr_str+len, 64-len, " 0x%08x", imm);
+			snprintf(instr_str+len, size-len, " 0x%08x", imm);
 
 	} else if(opcode != OPCODE_NOP) {
 		// ITYPE
@@ -347,15 +628,12 @@ char *identify_instruction(uint32_t instr){
 		if(imm >> 15)
 			imm |= 0xFFFF0000;
 
-		//snprintf(instr_str+len, 64-len, " rs1=%u | rd=%u | imm=0x%08x",rs1, rd, imm);
+		//snprintf(instr_str+len, size-len, " rs1=%u | rd=%u | imm=0x%08x",rs1, rd, imm);
 		if (opcode == OPCODE_BEQZ || opcode == OPCODE_BNEZ)
-			snprintf(instr_str+len, 64-len, " R%u, 0x%08x", rs1, imm);
+			snprintf(instr_str+len, size-len, " R%u, 0x%08x", rs1, imm);
 		else
-			snprintf(instr_str+len, 64-len, " R%u, R%u, 0x%08x", rd, rs1, imm);
+			snprintf(instr_str+len, size-len, " R%u, R%u, 0x%08x", rd, rs1, imm);
 	}
-
-
-	return instr_str;
 }
 
 // Print only if DEBUG is defined
@@ -3,70 +3,186 @@
 #include <cpu_model/peripherals/uart/uart.h>
 #include <cpu_model/cpu_model.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-int bus_write(bus_t *bus, uint32_t addr, uint32_t val){
-	char s[128];
-	sprintf(s, "[BUS] Writing to the bus at addr: 0x%08x\n", addr);
-	print_debug(s);
-	/////////////////////////////////
-	// Memories
-	/////////////////////////////////
-	if (addr >= DRAM_BASE && addr < DRAM_BASE+DRAM_SIZE)
-		return mem_write(&bus->dram, addr, val);
-	
-	if (addr >= IRAM_BASE && addr < IRAM_BASE+IRAM_SIZE)
-		return mem_write(&bus->iram, addr, val);
-
-	// Read only data, no writing
-	if (addr >= RODATA_BASE && addr < RODATA_BASE+RODATA_SIZE)
+////////////////////////////////////
+// DEVICES
+////////////////////////////////////
+// Writes to the IRAM drop what was derived from the old word
+static int iram_write(void *ctx, uint32_t addr, uint32_t val){
+	bus_t *bus = (bus_t*)ctx;
+	mem_store(&bus->iram, addr - IRAM_BASE, val);
+	if(bus->iram_write_cb != NULL)
+		bus->iram_write_cb(bus->iram_write_ctx, addr - IRAM_BASE);
+	return 0;
+}
+
+// Read only data, no writing
+static int rodata_write(void *ctx, uint32_t addr, uint32_t val){
+	(void)ctx; (void)addr; (void)val;
+	return -1;
+}
+
+// First access to a XRAM page
+static int xram_read(bus_t *bus, uint32_t addr, uint32_t *out){
+	uint32_t	page = (addr - XRAM_BASE) >> BUS_PAGE_BITS;
+	uint32_t	*words = bus->xram.page[page];
+
+	if(words == NULL)
+		words = (uint32_t*)sparse_zero_page();
+	bus->read_page[addr >> BUS_PAGE_BITS] = words;
+	*out = words[addr & BUS_PAGE_MASK];
+	return 0;
+}
+
+static int xram_write(bus_t *bus, uint32_t addr, uint32_t val){
+	uint32_t	*words = bus_xram_page(bus, (addr - XRAM_BASE) >> BUS_PAGE_BITS);
+
+	if(words == NULL)
 		return -1;
+	words[addr & BUS_PAGE_MASK] = val;
+	return 0;
+}
 
-	/////////////////////////////////
-	// UART1
-	/////////////////////////////////
 #ifdef USING_UART1
+static int uart1_read(void *ctx, uint32_t addr, uint32_t *out){
+	bus_t *bus = (bus_t*)ctx;
+	if (addr == UART1_RX){
+		*out = uart_read(bus->uart1);
+		return 0;
+	}
+	if (addr == UART1_STATUS){
+		*out = uart_status(bus->uart1);
+		return 0;
+	}
+	fprintf(stderr, "[BUS] Reading to an address not mapped: 0x%08x\n", addr);
+	return -1;
+}
+
+static int uart1_write(void *ctx, uint32_t addr, uint32_t val){
+	bus_t *bus = (bus_t*)ctx;
 	if(addr == UART1_TX){
-		print_debug("[BUS] Writing to UART1\n");
+		PRINT_DEBUG("[BUS] Writing to UART1\n");
 		uart_write(bus->uart1, (uint8_t)val);
 		return 0;
 	}
-#endif
-	
 	fprintf(stderr, "[BUS] Writing to an address not mapped: 0x%08x\n", addr);
 	return -1;
 }
+#endif
 
-int bus_read(bus_t *bus, uint32_t addr, uint32_t *out){
-	
-	/////////////////////////////////
-	// Memories
-	/////////////////////////////////
-	if (addr >= DRAM_BASE && addr < DRAM_BASE+DRAM_SIZE)
-		return mem_read(&bus->dram, addr, out);
-	
-	if (addr >= IRAM_BASE && addr < IRAM_BASE+IRAM_SIZE)
-		return mem_read(&bus->iram, addr, out);
-
-	if (addr >= RODATA_BASE && addr < RODATA_BASE+RODATA_SIZE)
-		return mem_read(&bus->rodata, addr, out);
-	/////////////////////////////////
-	// UART1
-	/////////////////////////////////
-#ifdef USING_UART1
-	if (addr == UART1_RX){
-		*out = uart_read(bus->uart1);
+////////////////////////////////////
+// ACCESSES
+////////////////////////////////////
+int bus_write(bus_t *bus, uint32_t addr, uint32_t val){
+	uint32_t	*page = bus->write_page[addr >> BUS_PAGE_BITS];
+	uint8_t		device;
+
+	PRINT_DEBUG("[BUS] Writing to the bus at addr: 0x%08x\n", addr);
+	if(page != NULL){
+		page[addr & BUS_PAGE_MASK] = val;
 		return 0;
 	}
-	if (addr == UART1_STATUS){
-		*out = uart_status(bus->uart1);
+	if((addr - XRAM_BASE) >> BUS_PAGE_BITS < bus->xram.pages)
+		return xram_write(bus, addr, val);
+	device = bus->device[addr >> BUS_PAGE_BITS];
+	if(device != 0 && bus->devices[device - 1].write != NULL)
+		return bus->devices[device - 1].write(bus->devices[device - 1].ctx, addr, val);
+	fprintf(stderr, "[BUS] Writing to an address not mapped: 0x%08x\n", addr);
+	return -1;
+}
+
+int bus_read(bus_t *bus, uint32_t addr, uint32_t *out){
+	uint32_t	*page = bus->read_page[addr >> BUS_PAGE_BITS];
+	uint8_t		device;
+
+	if(page != NULL){
+		*out = page[addr & BUS_PAGE_MASK];
 		return 0;
 	}
-#endif
+	if((addr - XRAM_BASE) >> BUS_PAGE_BITS < bus->xram.pages)
+		return xram_read(bus, addr, out);
+	device = bus->device[addr >> BUS_PAGE_BITS];
+	if(device != 0 && bus->devices[device - 1].read != NULL)
+		return bus->devices[device - 1].read(bus->devices[device - 1].ctx, addr, out);
 	fprintf(stderr, "[BUS] Reading to an address not mapped: 0x%08x\n", addr);
 	return -1;
 }
 
+////////////////////////////////////
+// MAPPING
+////////////////////////////////////
+static int bus_add_device(bus_t *bus, const busDevice_t *device){
+	if(bus->ndevices == BUS_DEVICES_MAX){
+		fprintf(stderr, "[BUS] Too many devices, at most %d\n", BUS_DEVICES_MAX);
+		return -1;
+	}
+	bus->devices[bus->ndevices++] = *device;
+	return bus->ndevices;
+}
+
+int bus_map_memory(bus_t *bus, memory_t *mem, bool writable, const busDevice_t *device){
+	uint32_t	first = mem->base_addr >> BUS_PAGE_BITS;
+	uint32_t	pages = mem->size >> BUS_PAGE_BITS;
+	uint32_t	i;
+	int			id = 0;
+
+	if((mem->base_addr & BUS_PAGE_MASK) || (mem->size & BUS_PAGE_MASK) || mem->size == 0 ||
+		pages > BUS_PAGES - first){
+		fprintf(stderr, "[BUS] Memory at 0x%08x of %u words doesn't cover whole pages\n", mem->base_addr, mem->size);
+		return -1;
+	}
+	if(device != NULL && (id = bus_add_device(bus, device)) < 0)
+		return -1;
+	for(i = 0; i < pages; i++){
+		bus->read_page[first + i]	= mem->data + i*BUS_PAGE_WORDS;
+		bus->write_page[first + i]	= writable ? mem->data + i*BUS_PAGE_WORDS : NULL;
+		bus->device[first + i]		= (uint8_t)id;
+	}
+	return 0;
+}
+
+int bus_map_device(bus_t *bus, uint32_t base, uint32_t size, const busDevice_t *device){
+	uint32_t	first = base >> BUS_PAGE_BITS;
+	uint32_t	last;
+	uint32_t	i;
+	int			id;
+
+	if(size == 0 || size - 1 > UINT32_MAX - base){
+		fprintf(stderr, "[BUS] Device at 0x%08x of %u words out of the address space\n", base, size);
+		return -1;
+	}
+	last = (base + size - 1) >> BUS_PAGE_BITS;
+	if((id = bus_add_device(bus, device)) < 0)
+		return -1;
+	for(i = first; i <= last; i++){
+		bus->read_page[i]	= NULL;
+		bus->write_page[i]	= NULL;
+		bus->device[i]		= (uint8_t)id;
+	}
+	return 0;
+}
+
+uint32_t *bus_xram_page(bus_t *bus, uint32_t page){
+	uint32_t	*words = sparse_page(&bus->xram, page);
+
+	if(words != NULL){
+		bus->read_page[(XRAM_BASE >> BUS_PAGE_BITS) + page]		= words;
+		bus->write_page[(XRAM_BASE >> BUS_PAGE_BITS) + page]	= words;
+	}
+	return words;
+}
+
 int bus_init(bus_t *bus){
+	bus->read_page	= (uint32_t**)calloc(BUS_PAGES, sizeof(uint32_t*));
+	bus->write_page	= (uint32_t**)calloc(BUS_PAGES, sizeof(uint32_t*));
+	bus->device		= (uint8_t*)calloc(BUS_PAGES, sizeof(uint8_t));
+	bus->ndevices	= 0;
+	if(bus->read_page == NULL || bus->write_page == NULL || bus->device == NULL){
+		fprintf(stderr, "[BUS] calloc() failed\n");
+		return -1;
+	}
+
 	if(mem_init(&bus->iram, IRAM_SIZE, IRAM_BASE))
 		return -1;
 	if(mem_init(&bus->dram, DRAM_SIZE, DRAM_BASE))
@@ -75,12 +191,22 @@ int bus_init(bus_t *bus){
 	if(mem_init(&bus->rodata, RODATA_SIZE, RODATA_BASE))
 		return -1;
 
+	if(sparse_init(&bus->xram, XRAM_SIZE >> BUS_PAGE_BITS, XRAM_BASE))
+		return -1;
+
+	if(bus_map_memory(bus, &bus->dram, true, NULL) ||
+		bus_map_memory(bus, &bus->iram, false, &(busDevice_t){ NULL, iram_write, bus }) ||
+		bus_map_memory(bus, &bus->rodata, false, &(busDevice_t){ NULL, rodata_write, bus }))
+		return -1;
+
 #ifdef USING_UART1
 	bus->uart1 = (uart_t*)malloc(sizeof(uart_t));
 	if(bus->uart1 == NULL){
 		fprintf(stderr, "[BUS] malloc() failed to initilize uart\n");
 		return -1;
 	}
+	if(bus_map_device(bus, UART1_BASE, UART_STATUS_OFFSET + 1, &(busDevice_t){ uart1_read, uart1_write, bus }))
+		return -1;
 	uart_init(bus->uart1, 5555);
 	uart_accept(bus->uart1);
 #endif
@@ -88,17 +214,30 @@ int bus_init(bus_t *bus){
 }
 
 int bus_reset(bus_t *bus){
+	uint32_t	left = bus->xram.touched;
+	uint32_t	i;
 
-	mem_free(&bus->dram);
-	if(mem_init(&bus->dram, DRAM_SIZE, DRAM_BASE))
-		return -1;
+	mem_clear(&bus->dram);
+	// The written XRAM pages are dropped, the zero ones can stay mapped
+	for(i = 0; left > 0; i++){
+		if(bus->xram.page[i] != NULL){
+			bus->read_page[(XRAM_BASE >> BUS_PAGE_BITS) + i]	= NULL;
+			bus->write_page[(XRAM_BASE >> BUS_PAGE_BITS) + i]	= NULL;
+			left--;
+		}
+	}
+	sparse_clear(&bus->xram);
 	return 0;
 }
 
 void bus_free(bus_t *bus){
+	free(bus->read_page);
+	free(bus->write_page);
+	free(bus->device);
 	mem_free(&bus->iram);
 	mem_free(&bus->dram);
 	mem_free(&bus->rodata);
+	sparse_free(&bus->xram);
 #ifdef USING_UART1
 	uart_free(bus->uart1);
 #endif
@@ -4,51 +4,147 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 int mem_init(memory_t *mem, uint32_t size, uint32_t base_addr){
 	mem->size = size;
 	mem->base_addr = base_addr;
-	mem->data = (uint8_t *)malloc(size*4*sizeof(uint8_t));
+	mem->data = (uint32_t *)calloc(size, sizeof(uint32_t));
 	if(mem->data == NULL){
-		fprintf(stderr, "[MEMORY] malloc() failed\n");
+		fprintf(stderr, "[MEMORY] calloc() failed\n");
 		return -1;
 	}
-
-	memset(mem->data, 0, size*sizeof(uint32_t));
 	return 0;
 }
 
 int mem_read(memory_t *mem, uint32_t addr, uint32_t *out){
 	uint32_t idx = (addr - mem->base_addr);
-	uint32_t val;
-	int i;
 	if(idx >= mem->size){
 		fprintf(stderr, "[MEMORY] Reading from memory with wrong address: 0x%08x\n", addr);
 		return -1;
 	}
-	val = 0;
-	// Mem data is a 8-bit value, extact always a word from the memory
-	for(i = 0; i < 4; i++)
-		val = (val << 8) + mem->data[idx*4+i];
-	*out = val;
+	*out = mem_load(mem, idx);
 	return 0;
 }
 
 int mem_write(memory_t *mem, uint32_t addr, uint32_t val){
 	uint32_t idx = (addr - mem->base_addr);
-	int i;
 	if(idx >= mem->size){
 		fprintf(stderr, "[MEMORY] Writing from memory with wrong address: 0x%08x\n", addr);
 		return -1;
 	}
-	
-	for(i = 0; i < 4; i++)
-		mem->data[idx*4+i] = (val>>(8*(3-i))) & 0xff;
-	
+	mem_store(mem, idx, val);
+	return 0;
+}
+
+// n words from src to dst, 16 words per iteration
+static void mem_copy_words(uint32_t *dst, const uint32_t *src, uint32_t n){
+	uint32_t i = 0;
+#if defined(__SSE2__)
+	for(; i + 16 <= n; i += 16){
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + i + 8));
+		__m128i d = _mm_loadu_si128((const __m128i *)(src + i + 12));
+		_mm_storeu_si128((__m128i *)(dst + i), a);
+		_mm_storeu_si128((__m128i *)(dst + i + 4), b);
+		_mm_storeu_si128((__m128i *)(dst + i + 8), c);
+		_mm_storeu_si128((__m128i *)(dst + i + 12), d);
+	}
+#elif defined(__ARM_NEON)
+	for(; i + 16 <= n; i += 16){
+		uint32x4_t a = vld1q_u32(src + i);
+		uint32x4_t b = vld1q_u32(src + i + 4);
+		uint32x4_t c = vld1q_u32(src + i + 8);
+		uint32x4_t d = vld1q_u32(src + i + 12);
+		vst1q_u32(dst + i, a);
+		vst1q_u32(dst + i + 4, b);
+		vst1q_u32(dst + i + 8, c);
+		vst1q_u32(dst + i + 12, d);
+	}
+#endif
+	for(; i < n; i++)
+		dst[i] = src[i];
+}
+
+int mem_copy_in(memory_t *mem, uint32_t addr, const uint32_t *src, uint32_t n){
+	uint32_t idx = (addr - mem->base_addr);
+	if(idx > mem->size || n > mem->size - idx){
+		fprintf(stderr, "[MEMORY] Copying %u words to memory with wrong address: 0x%08x\n", n, addr);
+		return -1;
+	}
+	mem_copy_words(mem->data + idx, src, n);
 	return 0;
 }
 
+int mem_copy_out(const memory_t *mem, uint32_t addr, uint32_t *dst, uint32_t n){
+	uint32_t idx = (addr - mem->base_addr);
+	if(idx > mem->size || n > mem->size - idx){
+		fprintf(stderr, "[MEMORY] Copying %u words from memory with wrong address: 0x%08x\n", n, addr);
+		return -1;
+	}
+	mem_copy_words(dst, mem->data + idx, n);
+	return 0;
+}
+
+void mem_clear(memory_t *mem){
+	memset(mem->data, 0, mem->size*sizeof(uint32_t));
+}
+
 void mem_free(memory_t *mem){
 	free(mem->data);
 	return;
 }
+
+////////////////////////////////////
+// SPARSE
+////////////////////////////////////
+static const uint32_t zero_page[MEM_PAGE_WORDS];
+
+int sparse_init(sparseMem_t *mem, uint32_t pages, uint32_t base_addr){
+	mem->pages = pages;
+	mem->touched = 0;
+	mem->base_addr = base_addr;
+	mem->page = (uint32_t **)calloc(pages, sizeof(uint32_t *));
+	if(mem->page == NULL){
+		fprintf(stderr, "[MEMORY] calloc() failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+const uint32_t *sparse_zero_page(void){
+	return zero_page;
+}
+
+uint32_t *sparse_page(sparseMem_t *mem, uint32_t page){
+	if(mem->page[page] == NULL){
+		mem->page[page] = (uint32_t *)calloc(MEM_PAGE_WORDS, sizeof(uint32_t));
+		if(mem->page[page] == NULL){
+			fprintf(stderr, "[MEMORY] calloc() failed for page at 0x%08x\n", mem->base_addr + page*MEM_PAGE_WORDS);
+			return NULL;
+		}
+		mem->touched++;
+	}
+	return mem->page[page];
+}
+
+void sparse_clear(sparseMem_t *mem){
+	uint32_t i;
+	for(i = 0; i < mem->pages && mem->touched > 0; i++){
+		if(mem->page[i] != NULL){
+			free(mem->page[i]);
+			mem->page[i] = NULL;
+			mem->touched--;
+		}
+	}
+}
+
+void sparse_free(sparseMem_t *mem){
+	sparse_clear(mem);
+	free(mem->page);
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <extra/calls.h>
+
+#define FOLD_NAME_LEN	96		// Per frame of a folded stack
+
+////////////////////////////////////
+// STACK
+////////////////////////////////////
+static void calls_push(callTree_t *calls, uint32_t func){
+	callNode_t *node;
+
+	if(calls->depth >= CALL_DEPTH_MAX){
+		calls->overflow++;
+		return;
+	}
+	for(node = calls->top->child; node != NULL && node->func != func; node = node->sibling)
+		;
+	if(node == NULL){
+		node = (callNode_t*)calloc(1, sizeof(callNode_t));
+		if(node == NULL){
+			calls->failed = true;
+			calls->overflow++;
+			return;
+		}
+		node->func			= func;
+		node->parent		= calls->top;
+		node->sibling		= calls->top->child;
+		calls->top->child	= node;
+	}
+	node->calls++;
+	calls->top = node;
+	calls->depth++;
+}
+
+// A return with nothing called is ignored, e.g. from the start function
+static void calls_pop(callTree_t *calls){
+	if(calls->overflow > 0){
+		calls->overflow--;
+	}else if(calls->top != &calls->root){
+		calls->top = calls->top->parent;
+		calls->depth--;
+	}
+}
+
+void calls_retired(callTree_t *calls, const commitRecord_t *record){
+	uint8_t opcode = (record->instr >> 26) & 0x3F;
+
+	if(!calls->started){
+		calls->root.func	= record->pc;
+		calls->root.calls	= 1;
+		calls->top			= &calls->root;
+		calls->started		= true;
+	}else if(record->pc != calls->next && calls->xfer != XFER_NONE){
+		// Landed: the delay slots of the jump are behind
+		if(calls->xfer == XFER_CALL)
+			calls_push(calls, record->pc);
+		else if(calls->xfer == XFER_RETURN)
+			calls_pop(calls);
+		calls->xfer = XFER_NONE;
+	}
+	// The cycles since the last one, the pipeline fill on the first
+	calls->top->self	+= record->cycle - calls->cycle;
+	calls->cycle		= record->cycle;
+	calls->next			= record->pc + 1;
+
+	if(opcode == OPCODE_JAL || opcode == OPCODE_JALR)
+		calls->xfer = XFER_CALL;
+	else if(opcode == OPCODE_JR && ((record->instr >> 21) & 0x1F) == 31)
+		calls->xfer = XFER_RETURN;
+	else if(opcode == OPCODE_J || opcode == OPCODE_JR || opcode == OPCODE_BEQZ || opcode == OPCODE_BNEZ)
+		calls->xfer = XFER_JUMP;
+}
+
+////////////////////////////////////
+// TREE
+////////////////////////////////////
+static uint64_t node_sum(callNode_t *node, callFuncs_t *funcs){
+	callNode_t *child;
+
+	node->total = node->self;
+	funcs->on_path[node->func]++;
+	for(child = node->child; child != NULL; child = child->sibling)
+		node->total += node_sum(child, funcs);
+	funcs->on_path[node->func]--;
+
+	funcs->calls[node->func]		+= node->calls;
+	funcs->exclusive[node->func]	+= node->self;
+	// Only the outermost frame of a recursion
+	if(funcs->on_path[node->func] == 0)
+		funcs->inclusive[node->func] += node->total;
+	return node->total;
+}
+
+void calls_sum(callTree_t *calls, callFuncs_t *funcs){
+	if(calls->started)
+		node_sum(&calls->root, funcs);
+}
+
+// path holds the callers, len its length
+static void node_fold(const callNode_t *node, FILE *fd, char *path, size_t len,
+		const programLabel_t *labels, int nlabels){
+	const callNode_t	*child;
+	char				name[80], fallback[16];
+
+	snprintf(fallback, sizeof(fallback), "0x%08x", node->func*4);
+	program_addr_name(labels, nlabels, node->func, fallback, name, sizeof(name));
+	len += (size_t)snprintf(path + len, CALL_DEPTH_MAX*FOLD_NAME_LEN - len, "%s%s", len ? ";" : "", name);
+	if(node->self != 0)
+		fprintf(fd, "%s %llu\n", path, (unsigned long long)node->self);
+	for(child = node->child; child != NULL; child = child->sibling)
+		node_fold(child, fd, path, len, labels, nlabels);
+	path[len] = '\0';
+}
+
+int calls_fold(const callTree_t *calls, FILE *fd, const programLabel_t *labels, int nlabels){
+	char *path;
+
+	if(fd == NULL){
+		fprintf(stderr, "[CALLS] File is NULL\n");
+		return -1;
+	}
+	if(!calls->started)
+		return 0;
+	path = (char*)malloc(CALL_DEPTH_MAX*FOLD_NAME_LEN);
+	if(path == NULL){
+		fprintf(stderr, "[CALLS] malloc() failed\n");
+		return -1;
+	}
+	path[0] = '\0';
+	node_fold(&calls->root, fd, path, 0, labels, nlabels);
+	free(path);
+	return ferror(fd) ? -1 : 0;
+}
+
+static void node_free(callNode_t *node){
+	callNode_t *child, *next;
+
+	for(child = node->child; child != NULL; child = next){
+		next = child->sibling;
+		node_free(child);
+		free(child);
+	}
+	node->child = NULL;
+}
+
+void calls_free(callTree_t *calls){
+	node_free(&calls->root);
+}
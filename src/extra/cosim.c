@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <extra/cosim.h>
+
+#define COSIM_SPINS		1024		// Busy polls before yielding the core
+
+////////////////////////////////////
+// WAITING
+////////////////////////////////////
+typedef struct {
+	unsigned		spins;
+	struct timespec	start;
+} cosimWait_t;
+
+static void wait_start(cosimWait_t *wait){
+	wait->spins = 0;
+}
+
+static uint64_t elapsed_ms(const struct timespec *start){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// Busy poll first, the other side is usually a batch away, then yield.
+// Returns -1 once timeout_ms have passed
+static int wait_poll(cosimWait_t *wait, int timeout_ms){
+	if(wait->spins < COSIM_SPINS){
+		if(wait->spins++ == 0)
+			clock_gettime(CLOCK_MONOTONIC, &wait->start);
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+		return 0;
+	}
+	if(elapsed_ms(&wait->start) >= (uint64_t)timeout_ms)
+		return -1;
+	sched_yield();
+	return 0;
+}
+
+////////////////////////////////////
+// SESSION
+////////////////////////////////////
+static size_t shm_size(uint32_t slots){
+	return sizeof(cosimShm_t) + (size_t)slots*sizeof(commitRecord_t);
+}
+
+static cosimPort_t *port_new(const char *name){
+	cosimPort_t *port;
+
+	if(name == NULL || name[0] != '/' || strlen(name) >= sizeof(port->name)){
+		fprintf(stderr, "[COSIM] The name must start with '/' and be shorter than %zu characters\n", sizeof(port->name));
+		return NULL;
+	}
+	port = (cosimPort_t*)calloc(1, sizeof(cosimPort_t));
+	if(port == NULL){
+		fprintf(stderr, "[COSIM] calloc() failed\n");
+		return NULL;
+	}
+	strcpy(port->name, name);
+	return port;
+}
+
+cosimPort_t *cosim_create(const char *name, uint32_t slots, bool cycles){
+	cosimPort_t	*port;
+	int			fd;
+
+	if(slots == 0)
+		slots = COSIM_SLOTS;
+	if((slots & (slots - 1)) != 0 || slots % COSIM_BATCH != 0){
+		fprintf(stderr, "[COSIM] The slots must be a power of two, multiple of %d: %u\n", COSIM_BATCH, slots);
+		return NULL;
+	}
+	if((port = port_new(name)) == NULL)
+		return NULL;
+	port->size = shm_size(slots);
+	port->cycles = cycles;
+
+	// A new object, an HDL still attached to an old session keeps the old one
+	shm_unlink(name);
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd < 0){
+		fprintf(stderr, "[COSIM] shm_open() failed | name: %s\n", name);
+		free(port);
+		return NULL;
+	}
+	if(ftruncate(fd, (off_t)port->size) != 0){
+		fprintf(stderr, "[COSIM] ftruncate() failed | name: %s\n", name);
+		close(fd);
+		shm_unlink(name);
+		free(port);
+		return NULL;
+	}
+	port->shm = (cosimShm_t*)mmap(NULL, port->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(port->shm == MAP_FAILED){
+		fprintf(stderr, "[COSIM] mmap() failed | name: %s\n", name);
+		shm_unlink(name);
+		free(port);
+		return NULL;
+	}
+	port->owner = true;
+
+	port->shm->version = COSIM_VERSION;
+	port->shm->slots = slots;
+	atomic_init(&port->shm->state, COSIM_WAITING);
+	atomic_init(&port->shm->tail, 0);
+	atomic_init(&port->shm->head, 0);
+	__atomic_store_n(&port->shm->magic, COSIM_MAGIC, __ATOMIC_RELEASE);
+	return port;
+}
+
+int cosim_wait_attach(cosimPort_t *port, int timeout_ms){
+	cosimWait_t wait;
+
+	wait_start(&wait);
+	while(atomic_load_explicit(&port->shm->state, memory_order_acquire) == COSIM_WAITING){
+		if(wait_poll(&wait, timeout_ms) < 0){
+			fprintf(stderr, "[COSIM] No HDL attached to %s in %d ms\n", port->name, timeout_ms);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Map the session of the model, if it is waiting for the HDL.
+// Returns 0, 1 to retry, -1 on error
+static int attach_try(cosimPort_t *port){
+	struct stat	st;
+	cosimShm_t	*shm;
+	uint32_t	state = COSIM_WAITING;
+	int			fd;
+
+	fd = shm_open(port->name, O_RDWR, 0);
+	if(fd < 0)
+		return 1;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cosimShm_t)){
+		close(fd);
+		return 1;
+	}
+	shm = (cosimShm_t*)mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(shm == MAP_FAILED){
+		fprintf(stderr, "[COSIM] mmap() failed | name: %s\n", port->name);
+		return -1;
+	}
+	// Left by an old session, or not ready yet
+	if(__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != COSIM_MAGIC ||
+	   !atomic_compare_exchange_strong(&shm->state, &state, COSIM_RUNNING)){
+		munmap(shm, (size_t)st.st_size);
+		return 1;
+	}
+	if(shm->version != COSIM_VERSION || shm_size(shm->slots) > (size_t)st.st_size){
+		fprintf(stderr, "[COSIM] Session of version %u or size not supported | name: %s\n", shm->version, port->name);
+		atomic_store(&shm->state, COSIM_STOPPED);
+		munmap(shm, (size_t)st.st_size);
+		return -1;
+	}
+	port->shm = shm;
+	port->size = (size_t)st.st_size;
+	return 0;
+}
+
+cosimPort_t *cosim_attach(const char *name, int timeout_ms){
+	cosimPort_t		*port;
+	struct timespec	start;
+	int				ret;
+
+	if((port = port_new(name)) == NULL)
+		return NULL;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while((ret = attach_try(port)) == 1){
+		if(elapsed_ms(&start) >= (uint64_t)timeout_ms){
+			fprintf(stderr, "[COSIM] No model waiting on %s in %d ms\n", name, timeout_ms);
+			break;
+		}
+		usleep(1000);
+	}
+	if(ret != 0){
+		free(port);
+		return NULL;
+	}
+	return port;
+}
+
+void cosim_close(cosimPort_t *port){
+	uint32_t state;
+
+	if(port == NULL)
+		return;
+	if(port->owner){
+		state = atomic_load(&port->shm->state);
+		if(state == COSIM_WAITING || state == COSIM_RUNNING)
+			atomic_store(&port->shm->state, COSIM_STOPPED);
+		shm_unlink(port->name);
+	}
+	munmap(port->shm, port->size);
+	free(port);
+}
+
+////////////////////////////////////
+// RING
+////////////////////////////////////
+int cosim_send(cosimPort_t *port, const commitRecord_t *record){
+	cosimShm_t	*shm = port->shm;
+	cosimWait_t	wait;
+
+	if(port->index - port->other == shm->slots){
+		atomic_store_explicit(&shm->tail, port->index, memory_order_release);
+		wait_start(&wait);
+		while((port->other = atomic_load_explicit(&shm->head, memory_order_acquire)) + shm->slots == port->index){
+			if(atomic_load_explicit(&shm->state, memory_order_relaxed) == COSIM_STOPPED)
+				return -1;
+			if(wait_poll(&wait, COSIM_TIMEOUT_MS) < 0){
+				fprintf(stderr, "[COSIM] The model has stopped answering on %s\n", port->name);
+				return -1;
+			}
+		}
+	}
+	shm->ring[port->index & (shm->slots - 1)] = *record;
+	if(++port->index % COSIM_BATCH == 0){
+		atomic_store_explicit(&shm->tail, port->index, memory_order_release);
+		if(atomic_load_explicit(&shm->state, memory_order_relaxed) == COSIM_STOPPED)
+			return -1;
+	}
+	return 0;
+}
+
+void cosim_finish(cosimPort_t *port){
+	uint32_t state = COSIM_RUNNING;
+
+	atomic_store_explicit(&port->shm->tail, port->index, memory_order_release);
+	atomic_compare_exchange_strong(&port->shm->state, &state, COSIM_DONE);
+}
+
+int cosim_recv(cosimPort_t *port, commitRecord_t *record){
+	cosimShm_t	*shm = port->shm;
+	cosimWait_t	wait;
+
+	if(port->index == port->other){
+		atomic_store_explicit(&shm->head, port->index, memory_order_release);
+		wait_start(&wait);
+		while((port->other = atomic_load_explicit(&shm->tail, memory_order_acquire)) == port->index){
+			// The tail is published before the state, read it once more
+			if(atomic_load_explicit(&shm->state, memory_order_acquire) == COSIM_DONE){
+				port->other = atomic_load_explicit(&shm->tail, memory_order_acquire);
+				if(port->other == port->index)
+					return 0;
+				break;
+			}
+			if(wait_poll(&wait, COSIM_TIMEOUT_MS) < 0){
+				fprintf(stderr, "[COSIM] The HDL has stopped answering on %s\n", port->name);
+				return -1;
+			}
+		}
+	}
+	*record = shm->ring[port->index & (shm->slots - 1)];
+	if(++port->index % COSIM_BATCH == 0)
+		atomic_store_explicit(&shm->head, port->index, memory_order_release);
+	return 1;
+}
+
+////////////////////////////////////
+// CHECK
+////////////////////////////////////
+static uint32_t record_diff(const cosimPort_t *port, const commitRecord_t *a, const commitRecord_t *b){
+	uint32_t diff = 0;
+	uint8_t  flags = COMMIT_LOAD | COMMIT_STORE;
+
+	if(a->pc != b->pc)
+		diff |= COSIM_DIFF_PC;
+	if(a->instr != b->instr)
+		diff |= COSIM_DIFF_INSTR;
+	if((a->flags & COMMIT_REG) != (b->flags & COMMIT_REG) ||
+	   ((a->flags & COMMIT_REG) && (a->rd != b->rd || a->value != b->value)))
+		diff |= COSIM_DIFF_REG;
+	if((a->flags & flags) != (b->flags & flags) ||
+	   ((a->flags & flags) && (a->addr != b->addr || a->data != b->data)))
+		diff |= COSIM_DIFF_MEM;
+	if(port->cycles && a->cycle != b->cycle)
+		diff |= COSIM_DIFF_CYCLE;
+	return diff;
+}
+
+// Keep the first mismatch and stop the HDL
+static int check_fail(cosimPort_t *port, uint32_t diff, const commitRecord_t *model, const commitRecord_t *hdl){
+	port->diff = diff;
+	port->has_model = model != NULL;
+	port->has_hdl = hdl != NULL;
+	if(model != NULL)
+		port->model = *model;
+	if(hdl != NULL)
+		port->hdl = *hdl;
+	atomic_store(&port->shm->state, COSIM_STOPPED);
+	return -1;
+}
+
+int cosim_check(cosimPort_t *port, const commitRecord_t *record){
+	commitRecord_t	hdl;
+	uint32_t		diff;
+
+	if(cosim_recv(port, &hdl) <= 0)
+		return check_fail(port, COSIM_DIFF_MISSING, record, NULL);
+	if((diff = record_diff(port, record, &hdl)) != 0)
+		return check_fail(port, diff, record, &hdl);
+	port->checked++;
+	return 0;
+}
+
+void cosim_check_hook(void *ctx, const commitRecord_t *record){
+	cosimPort_t *port = (cosimPort_t*)ctx;
+	if(port->diff == 0)
+		cosim_check(port, record);
+}
+
+int cosim_end(cosimPort_t *port){
+	commitRecord_t hdl;
+
+	if(port->diff != 0)
+		return -1;
+	if(cosim_recv(port, &hdl) != 0)
+		return check_fail(port, COSIM_DIFF_MISSING, NULL, &hdl);
+	return 0;
+}
+
+static void print_record(const char *side, const commitRecord_t *record, bool valid, FILE *fd){
+	if(!valid){
+		fprintf(fd, "  %-5s nothing retired\n", side);
+		return;
+	}
+	fprintf(fd, "  %-5s ", side);
+	commit_print(fd, record);
+	fputc('\n', fd);
+}
+
+void cosim_report(const cosimPort_t *port, FILE *fd){
+	static const char *field[] = { "pc", "instruction", "register", "memory", "cycle", "retired" };
+	unsigned i;
+
+	if(port->diff == 0)
+		return;
+	fprintf(fd, "Mismatch at instruction %llu:", (unsigned long long)port->checked + 1);
+	for(i = 0; i < sizeof(field)/sizeof(field[0]); i++)
+		if(port->diff & (1u << i))
+			fprintf(fd, " %s", field[i]);
+	fputc('\n', fd);
+	print_record("model", &port->model, port->has_model, fd);
+	print_record("hdl", &port->hdl, port->has_hdl, fd);
+}
@@ -1,66 +1,51 @@
 #include "cpu_model/peripherals/bus/bus.h"
 #include <cpu_model/cpu_model.h>
 #include <extra/utils.h>
+#include <extra/image.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
 
-// Used to print the program to execute in the model of the CPU
-uint32_t *g_program      = NULL;
-int       g_program_size = 0;
-
-// Captured output from cpu_step()
-static char g_step_output[MAX_STEP_LINES][MAX_LINE_LEN];
-static int  g_step_line_count = 0;
-
-// Capture stdout into g_step_output by redirecting the fd
-void capture_cpu_step(void *handle) {
-    int saved_stdout;
-    int pipefd[2];
-    char buf[MAX_STEP_LINES * MAX_LINE_LEN];
-    ssize_t n;
-
-    g_step_line_count = 0;
-    memset(g_step_output, 0, sizeof(g_step_output));
-
-    // Create pipe and redirect stdout into it
-    if (pipe(pipefd) != 0) {
+// Run a step, keeping the pipeline activity for draw_left_panel()
+// The trace is written to a buffer of the panel, so that nothing
+// global (such as stdout) is touched
+void capture_cpu_step(tui_t *tui, void *handle) {
+    cpu_t *cpu = (cpu_t *)handle;
+    char   buf[MAX_STEP_LINES * MAX_LINE_LEN];
+    FILE  *trace, *old;
+    char  *line, *save;
+
+    tui->step_line_count = 0;
+    memset(tui->step_output, 0, sizeof(tui->step_output));
+    memset(buf, 0, sizeof(buf));
+
+    trace = fmemopen(buf, sizeof(buf) - 1, "w");
+    if (trace == NULL) {
         cpu_step(handle);   // fallback: just run normally
         return;
     }
-
-	fflush(stdout);
-    saved_stdout = dup(STDOUT_FILENO);	// Duplicate STDOUT
-    dup2(pipefd[1], STDOUT_FILENO);		
-    close(pipefd[1]);
-
+    old = cpu->trace;
+    cpu_set_trace(cpu, trace);
     cpu_step(handle);
-	fflush(stdout);
-
-    // Restore stdout
-    dup2(saved_stdout, STDOUT_FILENO);
-    close(saved_stdout);
-
-    // Read captured output
-    n = read(pipefd[0], buf, sizeof(buf) - 1);
-    close(pipefd[0]);
-    if (n <= 0) return;
-    buf[n] = '\0';
+    cpu_set_trace(cpu, old);
+    fclose(trace);
 
     // Split into lines
-    char *line = strtok(buf, "\n");
-    while (line != NULL && g_step_line_count < MAX_STEP_LINES) {
-        strncpy(g_step_output[g_step_line_count], line, MAX_LINE_LEN - 1);
-        g_step_line_count++;
-        line = strtok(NULL, "\n");
+    line = strtok_r(buf, "\n", &save);
+    while (line != NULL && tui->step_line_count < MAX_STEP_LINES) {
+        strncpy(tui->step_output[tui->step_line_count], line, MAX_LINE_LEN - 1);
+        tui->step_line_count++;
+        line = strtok_r(NULL, "\n", &save);
     }
 }
 
-void draw_program_panel(void *handle) {
+void draw_program_panel(tui_t *tui, void *handle) {
 	cpu_t    *cpu = (cpu_t *)handle;
 	uint32_t  currentPC = cpu_get_pc(cpu);
 	int i;
@@ -69,8 +54,8 @@ void draw_program_panel(void *handle) {
 	int scroll = 0;
 	if ((int)currentPC >= PANEL_HEIGHT / 2)
 		scroll = (int)currentPC - PANEL_HEIGHT / 2;
-	if (scroll + PANEL_HEIGHT > g_program_size)
-		scroll = g_program_size - PANEL_HEIGHT;
+	if (scroll + PANEL_HEIGHT > tui->program_size)
+		scroll = tui->program_size - PANEL_HEIGHT;
 	if (scroll < 0)
 		scroll = 0;
 
@@ -87,14 +72,16 @@ void draw_program_panel(void *handle) {
 	printf(COLOR_DIM "  --------------------------------" COLOR_RESET);
 
     // Draw only the visible window of instructions
-	for (i = 0; i < PANEL_HEIGHT && (scroll + i) < g_program_size; i++) {
+	for (i = 0; i < PANEL_HEIGHT && (scroll + i) < tui->program_size; i++) {
 		int idx = scroll + i;
 		MOVE_CURSOR(TOP_ROW + 2 + i, RIGHT_COL);
 		uint32_t byte_addr = (uint32_t)idx * 4;
+		uint32_t instr = cpu_get_instr(cpu, (uint32_t)idx);
+		const char *disasm = cpu_disasm(cpu, (uint32_t)idx, instr);
 		if ((uint32_t)idx == currentPC)
-			printf(COLOR_HIGHLIGHT "--> 0x%04x  %#010x  %-20s" COLOR_RESET, byte_addr, g_program[idx], identify_instruction(g_program[idx]));
+			printf(COLOR_HIGHLIGHT "--> 0x%04x  %#010x  %-20s" COLOR_RESET, byte_addr, instr, disasm);
 		else
-			printf("    0x%04x  %#010x  %-20s", byte_addr, g_program[idx], identify_instruction(g_program[idx]));
+			printf("    0x%04x  %#010x  %-20s", byte_addr, instr, disasm);
 	}
 
 	// Clear any leftover rows below the visible window
@@ -104,7 +91,7 @@ void draw_program_panel(void *handle) {
 	}
 }
 
-void draw_left_panel(int step) {
+void draw_left_panel(const tui_t *tui, int step) {
     int i;
 
     MOVE_CURSOR(1, 1);
@@ -113,12 +100,12 @@ void draw_left_panel(int step) {
     MOVE_CURSOR(3, 1);
     printf(COLOR_BOLD "Pipeline activity:" COLOR_RESET "                      ");
 
-    for (i = 0; i < g_step_line_count; i++) {
+    for (i = 0; i < tui->step_line_count; i++) {
         MOVE_CURSOR(4 + i, 1);
-        printf("%-40s", g_step_output[i]);
+        printf("%-40s", tui->step_output[i]);
     }
 
-    for (i = g_step_line_count; i < MAX_STEP_LINES; i++) {
+    for (i = tui->step_line_count; i < MAX_STEP_LINES; i++) {
         MOVE_CURSOR(4 + i, 1);
         printf("%-40s", "");
     }
@@ -177,14 +164,14 @@ void draw_registers(void *handle) {
     }
 }
 
-int press_and_continue(void *handle, int step) {
+int press_and_continue(tui_t *tui, void *handle, int step) {
     struct termios oldt, newt;
     int ch;
 
     CLEAR_SCREEN();
-    draw_program_panel(handle);
+    draw_program_panel(tui, handle);
     draw_registers(handle);      // always visible on the right
-    draw_left_panel(step);
+    draw_left_panel(tui, step);
     fflush(stdout);
 
     tcgetattr(STDIN_FILENO, &oldt);
@@ -205,18 +192,135 @@ int press_and_continue(void *handle, int step) {
     return OK;
 }
 
+// ─────────────────────────────────────────────────────────────────────────────
+// image_map
+//
+// Maps the binary image of fd (see extra/image.h), checking the header and
+// that every section lies in the file.
+//
+// Returns: the mapping of *size bytes, or NULL if not a valid image.
+// ─────────────────────────────────────────────────────────────────────────────
+static const uint8_t *image_map(FILE *fd, size_t *size) {
+    const imageHeader_t  *header;
+    const imageSection_t *section;
+    const uint8_t        *image;
+    struct stat           st;
+    size_t                entry;
+    uint32_t              i;
+
+    if (fstat(fileno(fd), &st) || st.st_size < (off_t)sizeof(imageHeader_t)) {
+        fprintf(stderr, "[LOADER] Image truncated\n");
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    image = (const uint8_t *)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "[LOADER] mmap() failed\n");
+        return NULL;
+    }
+
+    header  = (const imageHeader_t *)image;
+    section = (const imageSection_t *)(header + 1);
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION ||
+        header->nsections > (*size - sizeof(*header)) / sizeof(*section)) {
+        fprintf(stderr, "[LOADER] Not an image or wrong version\n");
+        munmap((void *)image, *size);
+        return NULL;
+    }
+    for (i = 0; i < header->nsections; i++, section++) {
+        entry = section->type == IMAGE_SYMTAB ? sizeof(imageSymbol_t) : sizeof(uint32_t);
+        if (section->offset % sizeof(uint32_t) || section->offset > *size ||
+            section->size > (*size - section->offset) / entry) {
+            fprintf(stderr, "[LOADER] Section %u out of the image\n", i);
+            munmap((void *)image, *size);
+            return NULL;
+        }
+    }
+    return image;
+}
+
+// First section of the given type, NULL if none
+static const imageSection_t *image_section(const uint8_t *image, uint32_t type) {
+    const imageHeader_t  *header  = (const imageHeader_t *)image;
+    const imageSection_t *section = (const imageSection_t *)(header + 1);
+    uint32_t              i;
+
+    for (i = 0; i < header->nsections; i++)
+        if (section[i].type == type)
+            return &section[i];
+    return NULL;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// cpu_load_image
+//
+// Loads a binary image: the sections are copied to the memories in bulk,
+// straight from the mapped file.
+//
+// Returns: number of TEXT instructions loaded, or -1 on error.
+// ─────────────────────────────────────────────────────────────────────────────
+static int cpu_load_image(cpu_t *cpu, FILE *fd) {
+    const imageSection_t *text, *rodata;
+    const uint8_t        *image;
+    size_t                size;
+    uint32_t              idx;
+    bool                  relative;
+
+    image = image_map(fd, &size);
+    if (image == NULL)
+        return -1;
+
+    relative = ((const imageHeader_t *)image)->flags & IMAGE_RELATIVE_JUMP;
+    text     = image_section(image, IMAGE_TEXT);
+    rodata   = image_section(image, IMAGE_RODATA);
+    if (relative != cpu->config.relative_jump) {
+        fprintf(stderr, "[LOADER] Image compiled with relative_jump=%s, the CPU has %s\n",
+                relative ? "yes" : "no", cpu->config.relative_jump ? "yes" : "no");
+        text = NULL;
+    } else if (text == NULL) {
+        fprintf(stderr, "[LOADER] Image without TEXT\n");
+    }
+    if (text == NULL ||
+        mem_copy_in(&cpu->bus.iram, text->addr, (const uint32_t *)(image + text->offset), text->size) ||
+        (rodata != NULL &&
+         mem_copy_in(&cpu->bus.rodata, rodata->addr, (const uint32_t *)(image + rodata->offset), rodata->size))) {
+        munmap((void *)image, size);
+        return -1;
+    }
+
+    // The IRAM has been written behind the bus
+    for (idx = 0; idx < text->size; idx++)
+        cpu_invalidate_decoded(cpu, text->addr - IRAM_BASE + idx);
+    cpu_predecode(cpu);
+
+#ifndef AVOID_PRINT
+    printf("[LOADER] TEXT: %u instructions, RODATA: %u words at 0x%08x\n",
+           text->size, rodata != NULL ? rodata->size : 0, rodata != NULL ? rodata->addr : (unsigned)RODATA_BASE);
+#endif
+    idx = text->size;
+    munmap((void *)image, size);
+    return (int)idx;
+}
+
 // ─────────────────────────────────────────────────────────────────────────────
 // cpu_load_program
 //
 // Reads a .mem file generated by the compiler and loads:
 //   @TEXT   → IRAM  via cpu_load_instr(handle, word_index, word)
 //   @RODATA → RODATA via cpu_load_rodata(handle, absolute_addr, word)
+// A binary image (.bin) is recognized by its magic and loaded by
+// cpu_load_image().
 //
 // Returns: number of TEXT instructions loaded, or -1 on error.
 // ─────────────────────────────────────────────────────────────────────────────
 int cpu_load_program(void *handle, FILE *fd) {
     if (!handle || !fd) return -1;
 
+    uint32_t magic;
+    if (fread(&magic, sizeof(magic), 1, fd) == 1 && magic == IMAGE_MAGIC)
+        return cpu_load_image((cpu_t *)handle, fd);
+    rewind(fd);
+
     typedef enum { SEC_NONE, SEC_TEXT, SEC_RODATA } Section;
     Section  sec         = SEC_NONE;
     int      text_index  = 0;
@@ -245,7 +349,178 @@ int cpu_load_program(void *handle, FILE *fd) {
         }
     }
 
+    // Decode the program once, the fetch stage reuses it
+    cpu_predecode(handle);
+
+#ifndef AVOID_PRINT
     printf("[LOADER] TEXT: %d instructions, RODATA: %d words at 0x%08x\n",
            text_index, rodata_index, (unsigned)RODATA_BASE);
+#else
+    (void)rodata_index;
+#endif
     return text_index;
 }
+
+// Labels in the SYMTAB of the image, their number or -1
+static int image_load_labels(const char *filename, programLabel_t **labels) {
+    const imageSection_t *symtab;
+    const imageSymbol_t  *symbol;
+    const uint8_t        *image;
+    size_t                size;
+    uint32_t              i;
+    FILE                 *fd;
+
+    fd = fopen(filename, "rb");
+    if (fd == NULL) {
+        fprintf(stderr, "[LOADER] fopen() failed | filename: %s\n", filename);
+        return -1;
+    }
+    image = image_map(fd, &size);
+    fclose(fd);
+    if (image == NULL)
+        return -1;
+
+    symtab  = image_section(image, IMAGE_SYMTAB);
+    symbol  = symtab != NULL ? (const imageSymbol_t *)(image + symtab->offset) : NULL;
+    *labels = (programLabel_t *)calloc(symtab != NULL && symtab->size > 0 ? symtab->size : 1, sizeof(programLabel_t));
+    if (*labels == NULL) {
+        fprintf(stderr, "[LOADER] calloc() failed\n");
+        munmap((void *)image, size);
+        return -1;
+    }
+    for (i = 0; symtab != NULL && i < symtab->size; i++) {
+        (*labels)[i].addr = symbol[i].addr / 4;
+        memcpy((*labels)[i].name, symbol[i].name, sizeof((*labels)[i].name) - 1);
+    }
+    munmap((void *)image, size);
+    return (int)i;
+}
+
+static int label_compare(const void *a, const void *b) {
+    const programLabel_t *la = (const programLabel_t *)a, *lb = (const programLabel_t *)b;
+    return la->addr < lb->addr ? -1 : la->addr > lb->addr;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// program_load_labels
+//
+// Reads the TEXT labels of the program from the symbol table written by
+// the compiler next to the .mem file (name.asm.mem → name.asm.sym), or
+// from the SYMTAB of a binary image (name.asm.bin). The labels are
+// sorted by address, *labels is freed by the caller.
+//
+// Returns: number of labels, or -1 on error.
+// ─────────────────────────────────────────────────────────────────────────────
+int program_load_labels(const char *filename, programLabel_t **labels) {
+    char      sym_name[256];
+    char      line[128];
+    char      name[64];
+    uint32_t  addr;
+    size_t    len;
+    int       n = 0, max = 64;
+    FILE     *fd;
+
+    if (!filename || !labels) return -1;
+
+    len = strlen(filename);
+    if (len >= 4 && strcmp(filename + len - 4, ".bin") == 0) {
+        n = image_load_labels(filename, labels);
+    } else {
+        if (len >= 4 && strcmp(filename + len - 4, ".mem") == 0)
+            len -= 4;
+        snprintf(sym_name, sizeof(sym_name), "%.*s.sym", (int)len, filename);
+        fd = fopen(sym_name, "r");
+        if (fd == NULL) {
+            fprintf(stderr, "[LOADER] fopen() failed | filename: %s\n", sym_name);
+            return -1;
+        }
+        *labels = (programLabel_t *)malloc(max * sizeof(programLabel_t));
+        while (*labels != NULL && fgets(line, sizeof(line), fd)) {
+            if (sscanf(line, "%x %63s", &addr, name) != 2)
+                continue;
+            if (n == max) {
+                programLabel_t *grown = (programLabel_t *)realloc(*labels, 2 * max * sizeof(programLabel_t));
+                if (grown == NULL) {
+                    free(*labels);
+                    *labels = NULL;
+                    break;
+                }
+                *labels = grown;
+                max    *= 2;
+            }
+            (*labels)[n].addr = addr / 4;
+            strcpy((*labels)[n].name, name);
+            n++;
+        }
+        fclose(fd);
+        if (*labels == NULL) {
+            fprintf(stderr, "[LOADER] malloc() failed\n");
+            return -1;
+        }
+    }
+    if (n > 0)
+        qsort(*labels, n, sizeof(programLabel_t), label_compare);
+    return n;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// program_label_of
+//
+// Returns: the last label at or before the IRAM word addr, NULL if none.
+// ─────────────────────────────────────────────────────────────────────────────
+const programLabel_t *program_label_of(const programLabel_t *labels, int n, uint32_t addr) {
+    int lo = 0, hi = n;
+
+    // First label after addr
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (labels[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? &labels[lo - 1] : NULL;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// program_addr_name
+//
+// Names the IRAM word addr after the last label at or before it, label or
+// label+offset (bytes), fallback if no label precedes it.
+// ─────────────────────────────────────────────────────────────────────────────
+void program_addr_name(const programLabel_t *labels, int n, uint32_t addr, const char *fallback, char *buf, size_t size) {
+    const programLabel_t *label = program_label_of(labels, n, addr);
+
+    if (label == NULL)
+        snprintf(buf, size, "%s", fallback);
+    else if (label->addr == addr)
+        snprintf(buf, size, "%s", label->name);
+    else
+        snprintf(buf, size, "%s+0x%x", label->name, (addr - label->addr) * 4);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+// program_find_label
+//
+// Looks the TEXT label up in the labels of the program (see
+// program_load_labels()).
+//
+// Returns: IRAM word of the label, or -1 if not found.
+// ─────────────────────────────────────────────────────────────────────────────
+int program_find_label(const char *filename, const char *label) {
+    programLabel_t *labels;
+    int             n, i, addr = -1;
+
+    if (!filename || !label) return -1;
+
+    n = program_load_labels(filename, &labels);
+    if (n < 0)
+        return -1;
+    for (i = 0; i < n && addr < 0; i++)
+        if (strcmp(labels[i].name, label) == 0)
+            addr = (int)labels[i].addr;
+    free(labels);
+    if (addr < 0)
+        fprintf(stderr, "[LOADER] Label '%s' not found in %s\n", label, filename);
+    return addr;
+}
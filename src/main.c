@@ -9,19 +9,16 @@
 #include <termios.h>
 #include <unistd.h>
 
-// Used by draw_program_panel() in utils.c
-extern uint32_t *g_program;
-extern int       g_program_size;
-
 int main(int argc, char *argv[]) {
     cpu_t *cpu;
     FILE  *fd;
     char  *filename;
     int    num_of_row_to_execute;
     int    ch_pressed;
+    tui_t  tui;
 
     if (argc < 3) {
-        fprintf(stderr, "Wrong usage: %s <filename> <num_of_row_to_execute>\n", argv[0]);
+        fprintf(stderr, "Wrong usage: %s <filename> <num_of_row_to_execute> [<instructions>|<label>]\n", argv[0]);
         exit(-1);
     }
     filename              = argv[1];
@@ -33,7 +30,7 @@ int main(int argc, char *argv[]) {
         exit(-2);
     }
 
-    cpu = (cpu_t *)cpu_create();
+    cpu = (cpu_t *)cpu_create(NULL);
     if (cpu == NULL) {
         fprintf(stderr, "cpu_create() failed\n");
         fclose(fd);
@@ -47,61 +44,41 @@ int main(int argc, char *argv[]) {
 
     if (text_count <= 0) {
         fprintf(stderr, "cpu_load_program() failed or empty program\n");
-        free(cpu);
+        cpu_free(cpu);
         exit(-4);
     }
 
-    // Build g_program for the visual panel (TEXT instructions only)
-    // Re-open and re-read only the @TEXT words
-    fd = fopen(filename, "r");
-    if (fd == NULL) {
-        fprintf(stderr, "fopen() failed on second open\n");
-        free(cpu);
-        exit(-5);
-    }
-
-    g_program = (uint32_t *)malloc(sizeof(uint32_t) * (size_t)text_count);
-    if (g_program == NULL) {
-        fprintf(stderr, "malloc() failed\n");
-        fclose(fd); free(cpu); exit(-6);
-    }
+    if (num_of_row_to_execute == -1 || num_of_row_to_execute > text_count)
+        num_of_row_to_execute = text_count;
+    memset(&tui, 0, sizeof(tui));
+    tui.program_size = num_of_row_to_execute;
 
-    {
-        typedef enum { SEC_NONE, SEC_TEXT, SEC_RODATA } Section;
-        Section  sec = SEC_NONE;
-        char     line[64];
-        int      idx = 0;
-        while (fgets(line, sizeof(line), fd) && idx < text_count) {
-            line[strcspn(line, "\r\n")] = 0;
-            if (strcmp(line, "@TEXT")   == 0) { 
-				sec = SEC_TEXT;   
-				continue; 
-			}
-            if (strcmp(line, "@RODATA") == 0) { 
-				sec = SEC_RODATA; 
-				continue; 
-			}
-            if (line[0] == '\0') continue;
-            if (sec == SEC_TEXT) {
-                uint32_t word;
-                if (sscanf(line, "%x", &word) == 1)
-                    g_program[idx++] = word;
+    // Fast-forward: the instructions before the region of interest run
+    // on the functional model, up to the given count or label
+    if (argc > 3) {
+        char     *end;
+        uint64_t  n      = strtoull(argv[3], &end, 0);
+        uint32_t  marker = FF_NO_MARKER;
+        if (*end != '\0') {
+            int label = program_find_label(filename, argv[3]);
+            if (label < 0) {
+                cpu_free(cpu);
+                exit(-7);
             }
+            n      = UINT64_MAX;
+            marker = (uint32_t)label;
         }
+        n = cpu_fast_forward(cpu, n, marker);
+        printf("[FAST-FORWARD] %llu instructions, PC 0x%08x\n", (unsigned long long)n, cpu_get_pc(cpu) * 4);
     }
-    fclose(fd);
-
-    if (num_of_row_to_execute == -1 || num_of_row_to_execute > text_count)
-        num_of_row_to_execute = text_count;
-    g_program_size = num_of_row_to_execute;
 
     // Step 0: initial state before any execution
-    ch_pressed = press_and_continue(cpu, 0);
+    ch_pressed = press_and_continue(&tui, cpu, 0);
     if (ch_pressed != QUIT) {
         bool flag = true;
         for (int i = 1; flag; i++) {
-            capture_cpu_step(cpu);
-            ch_pressed = press_and_continue(cpu, i);
+            capture_cpu_step(&tui, cpu);
+            ch_pressed = press_and_continue(&tui, cpu, i);
             if (ch_pressed == RESTART) {
                 cpu_reset(cpu);
 			} else if (ch_pressed == QUIT) {
@@ -111,12 +88,11 @@ int main(int argc, char *argv[]) {
 				for(i = 0; i < IRAM_SIZE; i++){
             		cpu_step(cpu);
 				}
-				capture_cpu_step(cpu);
+				capture_cpu_step(&tui, cpu);
 			}
         }
     }
 
-    free(g_program);
-    free(cpu);
+    cpu_free(cpu);
     return 0;
 }
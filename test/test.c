@@ -1,17 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <test/test.h>
 #include <cpu_model/cpu_model.h>
 #include <extra/utils.h>
+#include <extra/cosim.h>
+#include <extra/calls.h>
 
 // A known program is executed, so the comparison is done,
 // knowing the expected results
 
-int basic_test(void *handle) {
-    cpu_t *cpu = handle;
+// Load the test program, returns its size
+static int load_test_program(cpu_t *cpu) {
     FILE  *fd;
-    uint32_t val;
-    int i;
 
     if (cpu == NULL) {
         fprintf(stderr, "[TEST] CPU is NULL\n");
@@ -33,20 +34,13 @@ int basic_test(void *handle) {
         exit(1);
     }
     printf("Program size: %d instructions\n", program_size);
+    return program_size;
+}
 
-    // Execute all instructions
-    i = 0;
-    printf("#### STEP %-3d ####\n", ++i);
-    cpu_step(cpu);
-    printf("\n\n\n\n");
-
-    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4)) {
-        printf("#### STEP %-3d ####\n", ++i);
-        cpu_step(cpu);
-        printf("\n\n\n\n");
-    }
-
-    CLEAR_SCREEN();
+// Registers at the end of the test program
+void compare_expected_values(void *handle) {
+    cpu_t *cpu = handle;
+    uint32_t val;
 
     /* r0 — hardwired zero */
     val =          0; ASSERT(cpu_get_reg(cpu,  0) == val, "R0  = 0 (hardwired)");
@@ -97,14 +91,880 @@ int basic_test(void *handle) {
 
     /* Section 8 — Loop counter */
     val =          2; ASSERT(cpu_get_reg(cpu, 31) == val, "R31 = 2 (loop count)");
+}
+
+int basic_test(void *handle) {
+    cpu_t *cpu = handle;
+    int i;
+
+    int program_size = load_test_program(cpu);
+
+    // Execute all instructions
+    i = 0;
+    printf("#### STEP %-3d ####\n", ++i);
+    cpu_step(cpu);
+    printf("\n\n\n\n");
+
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4)) {
+        printf("#### STEP %-3d ####\n", ++i);
+        cpu_step(cpu);
+        printf("\n\n\n\n");
+    }
+
+    CLEAR_SCREEN();
+
+    compare_expected_values(cpu);
+    return 0;
+}
+
+// Same program on the functional model
+int functional_test(void *handle) {
+    cpu_t *cpu = handle;
+
+    int program_size = load_test_program(cpu);
+
+    // The PC is -1 after the reset
+    do {
+        cpu_run_functional(cpu, 1);
+    } while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4));
+
+    compare_expected_values(cpu);
+    return 0;
+}
+
+// Same program, moving back and forth between the two models
+int mixed_test(void *handle) {
+    cpu_t *cpu = handle;
+    int i;
+
+    int program_size = load_test_program(cpu);
+    cpu_set_trace(cpu, NULL);
+
+    do {
+        for (i = 0; i < 7; i++)
+            cpu_step(cpu);
+        cpu_run_functional(cpu, 5);
+    } while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4));
+
+    compare_expected_values(cpu);
+    return 0;
+}
+
+// Same program, with the blocks translated to x86-64 code
+// (closures on other hosts)
+int jit_test(void *handle) {
+    cpu_t *cpu = handle;
+
+    int program_size = load_test_program(cpu);
+    cpu_set_dispatch(cpu, FUNC_DISPATCH_JIT);
+
+    do {
+        cpu_run_functional(cpu, 64);
+    } while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4));
+
+    compare_expected_values(cpu);
+    cpu_set_dispatch(cpu, FUNC_DISPATCH_THREADED);
+    return 0;
+}
+
+// Same program, with the blocks translated to closures
+int blocks_test(void *handle) {
+    cpu_t *cpu = handle;
+
+    int program_size = load_test_program(cpu);
+    cpu_set_dispatch(cpu, FUNC_DISPATCH_BLOCKS);
+
+    do {
+        cpu_run_functional(cpu, 64);
+    } while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4));
+
+    compare_expected_values(cpu);
+    cpu_set_dispatch(cpu, FUNC_DISPATCH_THREADED);
+    return 0;
+}
+
+// Same program, fast-forwarded to the loop then on the pipeline
+int fast_forward_test(void *handle) {
+    cpu_t *cpu = handle;
+    const cpuStats_t *stats;
+    uint64_t skipped;
+    int marker;
+
+    int program_size = load_test_program(cpu);
+    marker = program_find_label("./programs/testprogram.asm.mem", "LOOP");
+    ASSERT(marker > 0, "LOOP found in the symbol table");
+
+    cpu_set_dispatch(cpu, FUNC_DISPATCH_BLOCKS);
+    skipped = cpu_fast_forward(cpu, UINT64_MAX, (uint32_t)marker);
+    cpu_set_dispatch(cpu, FUNC_DISPATCH_THREADED);
+    ASSERT(skipped >= (uint64_t)marker, "Fast-forwarded up to LOOP");
+    ASSERT(cpu_get_pc(cpu) >= (uint32_t)marker && cpu_get_pc(cpu) <= (uint32_t)marker + 2, "Pipeline restarted at LOOP");
+
+    stats = cpu_get_stats(cpu);
+    ASSERT(stats->cycles == 0 && stats->retired == 0, "Statistics cleared for the region of interest");
+
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+    ASSERT(stats->retired > 0 && stats->retired < stats->cycles, "Only the region of interest is counted");
+
+    compare_expected_values(cpu);
+    return 0;
+}
+
+// Same program, profiled then restored from a checkpoint halfway
+int checkpoint_test(void *handle) {
+    cpu_t *cpu = handle;
+    static uint64_t bbv[IRAM_SIZE];
+    uint64_t executed, counted = 0;
+    FILE *fd;
+    int i;
+
+    int program_size = load_test_program(cpu);
+    cpu_set_bbv(cpu, bbv);
+    executed = cpu_run_functional(cpu, program_size / 2);
+    cpu_set_bbv(cpu, NULL);
+    for (i = 0; i < IRAM_SIZE; i++)
+        counted += bbv[i];
+    ASSERT(counted == executed, "Every instruction counted in the BBV");
+
+    fd = tmpfile();
+    ASSERT(fd != NULL, "tmpfile() for the checkpoint");
+    ASSERT(cpu_checkpoint_save(cpu, fd) == 0, "Checkpoint saved");
+
+    // The checkpoint replaces whatever the CPU was doing
+    cpu_reset(cpu);
+    cpu_run_functional(cpu, 16);
+    rewind(fd);
+    ASSERT(cpu_checkpoint_load(cpu, fd) == 0, "Checkpoint loaded");
+    fclose(fd);
+
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+
+    compare_expected_values(cpu);
+    return 0;
+}
+
+// Spin loops: "halt: j halt" is idle, a loop incrementing a register isn't
+int idle_test(void *handle) {
+    cpu_t *cpu = handle;
+    uint32_t jump_self = (OPCODE_J << 26) | ((1*4 - JUMP_BASE(&cpu->config, 1)) & 0x03FFFFFF);
+    uint32_t jump_back = (OPCODE_J << 26) | ((0*4 - JUMP_BASE(&cpu->config, 1)) & 0x03FFFFFF);
+    uint64_t nops, skipped;
+    uint32_t pc;
+    int i;
+
+    // Delay slots
+    for (i = 2; i < 2 + MAX_DELAYSLOT; i++)
+        cpu_load_instr(cpu, i, NOP_Instruction);
+
+    cpu_reset(cpu);
+    cpu_load_instr(cpu, 0, NOP_Instruction);
+    cpu_load_instr(cpu, 1, jump_self);
+    for (i = 0; i < 100 && cpu_get_idle(cpu) == 0; i++)
+        cpu_step(cpu);
+    ASSERT(cpu_get_idle(cpu) != 0, "j halt detected as idle");
+
+    pc = cpu_get_pc(cpu);
+    nops = cpu_get_stats(cpu)->nops;
+    skipped = cpu_skip_idle(cpu, 1000);
+    ASSERT(skipped > 0, "Idle cycles skipped");
+    ASSERT(cpu_get_stats(cpu)->cycles > 1000, "Skipped cycles counted");
+    // One NOP in each delay slot of the loop jump
+    ASSERT(cpu_get_stats(cpu)->nops - nops == skipped / (cpu->config.delayslot + 1) * cpu->config.delayslot,
+           "The delay slot NOPs of the loop counted");
+    ASSERT(cpu_get_pc(cpu) == pc, "Skipping whole periods keeps the pipeline state");
+
+    // addi r1, r1, #1 in the loop
+    cpu_reset(cpu);
+    cpu_load_instr(cpu, 0, (OPCODE_ADDI << 26) | (1 << 21) | (1 << 16) | 1);
+    cpu_load_instr(cpu, 1, jump_back);
+    for (i = 0; i < 100; i++) {
+        cpu_step(cpu);
+        ASSERT(cpu_get_idle(cpu) == 0, "A loop writing a register isn't idle");
+    }
+    ASSERT(cpu_skip_idle(cpu, 1000) == 0, "Nothing skipped");
+    return 0;
+}
+
+// Every microarchitecture on the same binary: the kernel of the pipeline
+// and the functional model agree on the registers after the same
+// instructions
+int config_test(void *handle) {
+    cpu_t *cpu = handle;
+    cpu_config_t config = { 0 }, defaults = *cpu_get_config(cpu);
+    uint32_t regs[REGS_NUM];
+    uint64_t n;
+    int i, r;
+
+    ASSERT(cpu_set_config(cpu, &(cpu_config_t){ 0, true, true, PREDICT_NONE }) == -1, "No delay slot rejected");
+    ASSERT(cpu_set_config(cpu, &(cpu_config_t){ MAX_DELAYSLOT + 1, true, true, PREDICT_NONE }) == -1,
+           "Too many delay slots rejected");
+
+    cpu_set_trace(cpu, NULL);
+    for (i = 0; i < MAX_DELAYSLOT*4; i++) {
+        config.delayslot     = 1 + i/4;
+        config.forwarding    = i & 2;
+        config.relative_jump = i & 1;
+        ASSERT(cpu_set_config(cpu, &config) == 0, "Configuration set");
+        ASSERT(cpu_get_config(cpu)->delayslot == config.delayslot, "Configuration kept");
+
+        load_test_program(cpu);
+        n = cpu_run_functional(cpu, 64);
+        for (r = 0; r < REGS_NUM; r++)
+            regs[r] = cpu_get_reg(cpu, r);
+
+        load_test_program(cpu);
+        while (cpu_get_stats(cpu)->retired < n)
+            cpu_step(cpu);
+        for (r = 0; r < REGS_NUM; r++)
+            ASSERT(cpu_get_reg(cpu, r) == regs[r], "Pipeline kernel matches the functional model");
+    }
+    ASSERT(cpu_set_config(cpu, &defaults) == 0, "Default configuration restored");
+    cpu_set_trace(cpu, stdout);
+    return 0;
+}
+
+// Ten calls in a loop, with no delay slots:
+//	    addi r1, r0, #10
+//	loop:
+//	    jal  func
+//	    subi r1, r1, #1
+//	    bnez r1, loop
+//	halt:
+//	    j    halt
+//	func:
+//	    addi r2, r2, #1
+//	    jr   r31
+// NOPs cover the hazards with no forwarding
+static void load_predictor_program(cpu_t *cpu) {
+    const cpu_config_t *config = cpu_get_config(cpu);
+    int i;
+
+    for (i = 0; i < 32; i++)
+        cpu_load_instr(cpu, i, NOP_Instruction);
+    cpu_load_instr(cpu, 1,  (OPCODE_ADDI << 26) | (1 << 16) | 10);
+    cpu_load_instr(cpu, 6,  (OPCODE_JAL << 26) | ((20*4 - JUMP_BASE(config, 6)) & 0x03FFFFFF));
+    cpu_load_instr(cpu, 7,  (OPCODE_SUBI << 26) | (1 << 21) | (1 << 16) | 1);
+    cpu_load_instr(cpu, 12, (OPCODE_BNEZ << 26) | (1 << 21) | ((6*4 - JUMP_BASE(config, 12)) & 0xFFFF));
+    cpu_load_instr(cpu, 16, (OPCODE_J << 26) | ((16*4 - JUMP_BASE(config, 16)) & 0x03FFFFFF));
+    cpu_load_instr(cpu, 20, (OPCODE_ADDI << 26) | (2 << 21) | (2 << 16) | 1);
+    cpu_load_instr(cpu, 25, (OPCODE_JR << 26) | (31 << 21));
+}
+
+static void count_records(void *ctx, const commitRecord_t *record) {
+    (void)record;
+    (*(uint64_t *)ctx)++;
+}
+
+// Every predictor in every stage resolving the jumps: the same results,
+// the returns from the stack, the loop branch learned, the squashed
+// instructions not retired
+int predictor_test(void *handle) {
+    cpu_t *cpu = handle;
+    cpu_config_t config = *cpu_get_config(cpu), defaults = config;
+    const predictorStats_t *predict;
+    const cpuStats_t *stats = cpu_get_stats(cpu);
+    predictorStats_t skip_predict;
+    cpuStats_t skip_stats;
+    uint64_t cycles[PREDICT_KINDS], misses[PREDICT_KINDS], retired[PREDICT_KINDS], records, skipped;
+    int program_size, kind, i;
+
+    ASSERT(cpu_set_config(cpu, &(cpu_config_t){ 1, true, true, PREDICT_KINDS }) == -1, "Unknown predictor rejected");
+    ASSERT(predictor_kind("gshare") == PREDICT_GSHARE && predictor_kind("taken") == -1, "Predictors by name");
+    ASSERT(strcmp(predictor_name(PREDICT_NOT_TAKEN), "not_taken") == 0, "Names of the predictors");
+
+    cpu_set_trace(cpu, NULL);
+    for (config.delayslot = 1; config.delayslot <= MAX_DELAYSLOT; config.delayslot++) {
+        for (kind = PREDICT_NOT_TAKEN; kind < PREDICT_KINDS; kind++) {
+            config.predictor = kind;
+            ASSERT(cpu_set_config(cpu, &config) == 0, "Predictor set");
+
+            // The test program only has NOPs in its delay slots
+            program_size = load_test_program(cpu);
+            cpu_step(cpu);
+            while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+                cpu_step(cpu);
+            compare_expected_values(cpu);
+            ASSERT(cpu_get_predictor_stats(cpu)->branches == 2, "The loop branch resolved twice");
+
+            cpu_reset(cpu);
+            load_predictor_program(cpu);
+            records = 0;
+            cpu_set_commit_hook(cpu, count_records, &records);
+            for (i = 0; i < 2000 && cpu_get_idle(cpu) == 0; i++)
+                cpu_step(cpu);
+            cpu_set_commit_hook(cpu, NULL, NULL);
+            ASSERT(cpu_get_idle(cpu) != 0, "The program halts in j halt");
+            ASSERT(cpu_get_reg(cpu, 1) == 0 && cpu_get_reg(cpu, 2) == 10 && cpu_get_reg(cpu, 31) == 7*4,
+                   "Calls and branches without delay slots");
+            predict = cpu_get_predictor_stats(cpu);
+            ASSERT(predict->branches == 10 && predict->returns == 10, "Jumps resolved once each");
+            ASSERT(predict->return_misses == 0, "Returns predicted by the stack");
+            ASSERT(predict->branch_misses <= predict->branches && predict->jump_misses <= predict->jumps,
+                   "Mispredicts among the jumps");
+            ASSERT(predict->flushed == (predict->branch_misses + predict->jump_misses) * config.delayslot,
+                   "The instructions fetched past a mispredict squashed");
+            ASSERT(records == stats->retired && stats->cycles - stats->retired - predict->flushed == 4,
+                   "The squashed instructions neither retired nor committed");
+            cycles[kind]  = stats->cycles;
+            misses[kind]  = predict->branch_misses;
+            retired[kind] = stats->retired;
+
+            // The loop skipped, then stepped to the same cycle
+            skipped = cpu_skip_idle(cpu, 1000);
+            for (i = 0; i < 10; i++)
+                cpu_step(cpu);
+            skip_stats = *stats;
+            skip_predict = *predict;
+            cpu_reset(cpu);
+            while (stats->cycles < skip_stats.cycles)
+                cpu_step(cpu);
+            ASSERT(skipped > 0 && stats->retired == skip_stats.retired, "The loop skipped");
+            ASSERT(memcmp(&skip_predict, predict, sizeof(skip_predict)) == 0, "The skipped jumps resolved as stepped");
+            ASSERT(cpu_run_functional(cpu, 1) == 0, "No functional model with a predictor");
+        }
+        ASSERT(misses[PREDICT_NOT_TAKEN] == 9, "Not taken misses the taken branches");
+        ASSERT(misses[PREDICT_BIMODAL] == 2, "Bimodal misses the first and the last branch");
+        ASSERT(cycles[PREDICT_BIMODAL] < cycles[PREDICT_NOT_TAKEN], "Fewer mispredicts, fewer cycles");
+        ASSERT(retired[PREDICT_BIMODAL] == retired[PREDICT_NOT_TAKEN] &&
+               retired[PREDICT_GSHARE] == retired[PREDICT_NOT_TAKEN], "The same instructions retired by every predictor");
+        ASSERT((double)cycles[PREDICT_BIMODAL] / (double)retired[PREDICT_BIMODAL] <
+               (double)cycles[PREDICT_NOT_TAKEN] / (double)retired[PREDICT_NOT_TAKEN], "Fewer mispredicts, lower CPI");
+    }
+    ASSERT(cpu_set_config(cpu, &defaults) == 0, "Default configuration restored");
+    cpu_set_trace(cpu, stdout);
+    return 0;
+}
+
+// Bulk copies and the inline word accesses agree with the bus
+int memory_test(void *handle) {
+    cpu_t *cpu = handle;
+    uint32_t in[37], out[37];
+    int i;
+
+    cpu_reset(cpu);
+    for (i = 0; i < 37; i++)
+        in[i] = 0x01020304u * (i + 1);
+    ASSERT(mem_copy_in(&cpu->bus.dram, DRAM_BASE + 3, in, 37) == 0, "Words copied in");
+    for (i = 0; i < 37; i++)
+        ASSERT(cpu_get_mem_data(cpu, DRAM_BASE + 3 + i) == in[i], "Copied words read by the bus");
+    ASSERT(cpu_get_mem_data(cpu, DRAM_BASE + 2) == 0 && cpu_get_mem_data(cpu, DRAM_BASE + 40) == 0, "Nothing copied around");
+
+    cpu_store_word(cpu, DRAM_BASE + 5, 0xCAFEBABE);
+    ASSERT(cpu_load_word(cpu, DRAM_BASE + 5) == 0xCAFEBABE, "Inline store read back inline");
+    ASSERT(cpu_get_mem_data(cpu, DRAM_BASE + 5) == 0xCAFEBABE, "Inline store read by the bus");
+    ASSERT(load_extend(OPCODE_LBU, cpu_load_word(cpu, DRAM_BASE + 5)) == 0xBE, "Bytes are the low bits of the word");
+
+    ASSERT(mem_copy_out(&cpu->bus.dram, DRAM_BASE + 3, out, 37) == 0, "Words copied out");
+    in[2] = 0xCAFEBABE;
+    for (i = 0; i < 37; i++)
+        ASSERT(out[i] == in[i], "Copied words match");
+
+    ASSERT(mem_copy_in(&cpu->bus.dram, DRAM_BASE + DRAM_SIZE - 4, in, 5) == -1, "Copy past the end rejected");
+    ASSERT(mem_copy_out(&cpu->bus.dram, DRAM_BASE + DRAM_SIZE + 1, out, 0) == -1, "Copy out of the memory rejected");
+    cpu_reset(cpu);
+    return 0;
+}
+
+// Device counting its accesses, for bus_test()
+static int test_device_read(void *ctx, uint32_t addr, uint32_t *out) {
+    (*(int *)ctx)++;
+    *out = addr ^ 0xFFFFFFFF;
+    return 0;
+}
+
+// Page decode: memories, read only data, devices and holes
+int bus_test(void *handle) {
+    cpu_t *cpu = handle;
+    bus_t *bus = &cpu->bus;
+    uint32_t val;
+    int accesses = 0;
+
+    cpu_reset(cpu);
+    ASSERT(bus_write(bus, DRAM_BASE + DRAM_SIZE - 1, 0x11111111) == 0, "Last DRAM word written");
+    ASSERT(bus_read(bus, DRAM_BASE + DRAM_SIZE - 1, &val) == 0 && val == 0x11111111, "Last DRAM word read");
+    ASSERT(bus_read(bus, RODATA_BASE, &val) == 0 && val != 0x11111111, "Next page is the read only data");
+    ASSERT(bus_write(bus, RODATA_BASE, 0x22222222) == -1, "Read only data not written");
+    ASSERT(bus_read(bus, RODATA_BASE, &val) == 0 && val != 0x22222222, "Read only data unchanged");
+    ASSERT(bus_read(bus, 0x10000000, &val) == -1, "Hole not mapped");
+
+    ASSERT(bus_map_device(bus, 0x30000000, 2, &(busDevice_t){ test_device_read, NULL, &accesses }) == 0, "Device mapped");
+    ASSERT(bus_read(bus, 0x30000001, &val) == 0 && val == (0x30000001 ^ 0xFFFFFFFF), "Device read through its handler");
+    ASSERT(bus_write(bus, 0x30000001, 0) == -1, "Device without write handler not written");
+    ASSERT(accesses == 1, "One access to the device");
+    ASSERT(bus_read(bus, DRAM_BASE + DRAM_SIZE - 1, &val) == 0 && val == 0x11111111, "Memories still mapped");
+    return 0;
+}
+
+// XRAM: pages allocated when written, the others read as zero
+int sparse_test(void *handle) {
+    cpu_t *cpu = handle;
+    bus_t *bus = &cpu->bus;
+    uint32_t val;
+    FILE *fd;
+
+    cpu_reset(cpu);
+    ASSERT(bus->xram.touched == 0, "No XRAM page after reset");
+    ASSERT(bus_read(bus, XRAM_BASE, &val) == 0 && val == 0, "XRAM reads as zero");
+    ASSERT(bus_read(bus, 0xFFFFFFFF, &val) == 0 && val == 0, "Last word of the space reads as zero");
+    ASSERT(bus->xram.touched == 0, "Reads don't allocate");
+
+    ASSERT(bus_write(bus, 0xFFFFFFFF, 0x33333333) == 0, "Last word of the space written");
+    cpu_store_word(cpu, 0x80000000, 0x44444444);
+    ASSERT(bus->xram.touched == 2, "One page per written page");
+    ASSERT(cpu_load_word(cpu, 0xFFFFFFFF) == 0x33333333, "Written word read back");
+    ASSERT(cpu_load_word(cpu, 0xFFFFFFFE) == 0, "Rest of the page is zero");
+    ASSERT(bus_read(bus, XRAM_BASE, &val) == 0 && val == 0, "Zero page not written");
+
+    fd = tmpfile();
+    ASSERT(fd != NULL, "tmpfile() for the checkpoint");
+    ASSERT(cpu_checkpoint_save(cpu, fd) == 0, "Checkpoint with XRAM saved");
+    cpu_reset(cpu);
+    ASSERT(bus->xram.touched == 0, "Reset drops the XRAM pages");
+    ASSERT(cpu_load_word(cpu, 0x80000000) == 0, "Dropped page reads as zero");
+    rewind(fd);
+    ASSERT(cpu_checkpoint_load(cpu, fd) == 0, "Checkpoint with XRAM loaded");
+    fclose(fd);
+    ASSERT(bus->xram.touched == 2, "Only the written pages restored");
+    ASSERT(cpu_load_word(cpu, 0x80000000) == 0x44444444 && cpu_load_word(cpu, 0xFFFFFFFF) == 0x33333333, "XRAM restored");
+    cpu_reset(cpu);
+    return 0;
+}
+
+// The binary image loads the same memories and labels of the .mem file
+int image_test(void *handle) {
+    cpu_t *cpu = handle;
+    static uint32_t iram[IRAM_SIZE], rodata[RODATA_SIZE];
+    int program_size, i;
+    FILE *fd;
+
+    program_size = load_test_program(cpu);
+    ASSERT(mem_copy_out(&cpu->bus.iram, IRAM_BASE, iram, IRAM_SIZE) == 0, "IRAM of the .mem file");
+    ASSERT(mem_copy_out(&cpu->bus.rodata, RODATA_BASE, rodata, RODATA_SIZE) == 0, "RODATA of the .mem file");
+
+    cpu_reset(cpu);
+    for (i = 0; i < program_size; i++)
+        cpu_load_instr(cpu, i, NOP_Instruction);
+    fd = fopen("./programs/testprogram.asm.bin", "rb");
+    ASSERT(fd != NULL, "Image written by the compiler");
+    ASSERT(cpu_load_program(cpu, fd) == program_size, "Same program size");
+    fclose(fd);
+    for (i = 0; i < IRAM_SIZE; i++)
+        ASSERT(cpu_get_instr(cpu, i) == iram[i], "Same IRAM");
+    for (i = 0; i < RODATA_SIZE; i++)
+        ASSERT(cpu_get_mem_data(cpu, RODATA_BASE + i) == rodata[i], "Same RODATA");
+    ASSERT(program_find_label("./programs/testprogram.asm.bin", "LOOP") ==
+           program_find_label("./programs/testprogram.asm.mem", "LOOP"), "Same label");
+    ASSERT(program_find_label("./programs/testprogram.asm.bin", "LOOP") > 0, "Label found in the image");
+
+    cpu_step(cpu);
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+    compare_expected_values(cpu);
+    return 0;
+}
+
+// Commit trace: the records replay the registers and the stores
+int commit_test(void *handle) {
+    cpu_t *cpu = handle;
+    commitRecord_t in = { 0x123456789ull, 0xFFFFFFFF, 0xDEADBEEF, 0xFFFFFFFF, 0x80000000, 7, 31,
+                          COMMIT_REG | COMMIT_STORE };
+    commitRecord_t out;
+    commitCoder_t enc = { 0 }, dec = { 0 };
+    uint8_t buf[COMMIT_RECORD_MAX], *trace;
+    uint32_t regs[REGS_NUM] = { 0 }, header[2];
+    static uint32_t stored[DRAM_SIZE];
+    static uint8_t written[DRAM_SIZE];
+    uint64_t records = 0;
+    size_t len, pos, n;
+    char name[] = "/tmp/dlx_commitXXXXXX";
+    FILE *fd;
+    int i, program_size;
+
+    len = commit_encode(&enc, &in, buf);
+    ASSERT(len <= COMMIT_RECORD_MAX, "Record within the bound");
+    ASSERT(commit_decode(&dec, buf, len - 1, &out) == 0, "Truncated record detected");
+    memset(&dec, 0, sizeof(dec));
+    ASSERT(commit_decode(&dec, buf, len, &out) == len, "Whole record decoded");
+    ASSERT(out.cycle == in.cycle && out.pc == in.pc && out.instr == in.instr && out.rd == in.rd &&
+           out.value == in.value && out.addr == in.addr && out.data == in.data, "Record decoded as encoded");
+
+    i = mkstemp(name);
+    ASSERT(i >= 0, "mkstemp() for the trace");
+    close(i);
+    program_size = load_test_program(cpu);
+    ASSERT(cpu_commit_open(cpu, name) == 0, "Trace opened");
+    cpu_step(cpu);
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+    ASSERT(cpu_commit_close(cpu) == 0, "Trace written");
+
+    fd = fopen(name, "rb");
+    ASSERT(fd != NULL, "Trace reopened");
+    fseek(fd, 0, SEEK_END);
+    len = (size_t)ftell(fd) - sizeof(header);
+    rewind(fd);
+    trace = (uint8_t *)malloc(len);
+    ASSERT(trace != NULL && fread(header, sizeof(header), 1, fd) == 1 && fread(trace, 1, len, fd) == len, "Trace read");
+    fclose(fd);
+    remove(name);
+    ASSERT(header[0] == COMMIT_MAGIC && header[1] == COMMIT_VERSION, "Trace header");
+
+    memset(&dec, 0, sizeof(dec));
+    for (pos = 0; pos < len; pos += n) {
+        n = commit_decode(&dec, trace + pos, len - pos, &out);
+        ASSERT(n > 0, "Every record complete");
+        if (out.flags & COMMIT_RESET)
+            continue;
+        records++;
+        if (out.flags & COMMIT_REG)
+            regs[out.rd] = out.value;
+        if ((out.flags & COMMIT_STORE) && out.addr - DRAM_BASE < DRAM_SIZE) {
+            stored[out.addr - DRAM_BASE]  = out.data;
+            written[out.addr - DRAM_BASE] = 1;
+        }
+        ASSERT(out.instr == cpu_get_instr(cpu, out.pc), "Instruction of the PC");
+    }
+    free(trace);
+    ASSERT(records == cpu_get_stats(cpu)->retired, "One record per retired instruction");
+    for (i = 0; i < REGS_NUM; i++)
+        ASSERT(regs[i] == cpu_get_reg(cpu, i), "Registers replayed from the trace");
+    for (i = 0; i < DRAM_SIZE; i++)
+        if (written[i])
+            ASSERT(cpu_get_mem_data(cpu, DRAM_BASE + i) == stored[i], "Stores replayed from the trace");
+
+    // A j halt loop, stepped to record each instruction
+    for (i = 2; i < 2 + MAX_DELAYSLOT; i++)
+        cpu_load_instr(cpu, i, NOP_Instruction);
+    cpu_load_instr(cpu, 0, NOP_Instruction);
+    cpu_load_instr(cpu, 1, (OPCODE_J << 26) | ((1*4 - JUMP_BASE(&cpu->config, 1)) & 0x03FFFFFF));
+    cpu_reset(cpu);
+    records = 0;
+    cpu_set_commit_hook(cpu, count_records, &records);
+    for (i = 0; i < 100 && cpu_get_idle(cpu) == 0; i++)
+        cpu_step(cpu);
+    ASSERT(cpu_get_idle(cpu) != 0, "The halt loop is idle");
+    ASSERT(cpu_skip_idle(cpu, 1000) == 0, "Nothing skipped while hooked");
+    cpu_set_commit_hook(cpu, NULL, NULL);
+    ASSERT(records == cpu_get_stats(cpu)->retired, "One record per retired instruction in the loop");
+    return 0;
+}
+
+// Performance counters: consistent with the statistics and the opcodes
+// retired, left as they are when not counting, written every period
+int counters_test(void *handle) {
+    cpu_t *cpu = handle;
+    const cpuCounters_t *counters;
+    cpuCounters_t before;
+    uint64_t sum = 0, cycles, rows = 0, interval, start;
+    char line[256], retired[64];
+    FILE *fd;
+    int i, program_size, loop;
+
+    program_size = load_test_program(cpu);
+    cpu_set_counters(cpu, true);
+    cpu_step(cpu);
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+    counters = cpu_get_counters(cpu);
+    for (i = 0; i < 64; i++)
+        sum += counters->opcode[i];
+    ASSERT(sum == cpu_get_stats(cpu)->retired, "One opcode counted per retired instruction");
+    ASSERT(counters->opcode[OPCODE_NOP] == cpu_get_stats(cpu)->nops, "NOPs counted");
+    ASSERT(counters->taken + counters->not_taken == counters->opcode[OPCODE_BEQZ] + counters->opcode[OPCODE_BNEZ],
+           "Every branch taken or not");
+    ASSERT(counters->loads[ACCESS_WORD] == counters->opcode[OPCODE_LW] &&
+           counters->stores[ACCESS_WORD] == counters->opcode[OPCODE_SW], "Accesses counted by width");
+    ASSERT(counters->bubbles[0] < cpu_get_stats(cpu)->cycles && counters->bubbles[PIPE_STAGES - 1] >= 3,
+           "Bubbles while filling the pipeline");
+    ASSERT((counters->fwd_alu + counters->fwd_mem > 0) == cpu_get_config(cpu)->forwarding, "Operands forwarded");
+
+    // Written as counted
+    fd = tmpfile();
+    ASSERT(fd != NULL && cpu_counters_write(cpu, fd, COUNTERS_JSON, false) == 0, "Counters written");
+    rewind(fd);
+    snprintf(retired, sizeof(retired), "\"retired\":%llu,", (unsigned long long)cpu_get_stats(cpu)->retired);
+    ASSERT(fgets(line, sizeof(line), fd) != NULL && line[0] == '{' && strstr(line, retired) != NULL, "JSON object");
+    fclose(fd);
+
+    // Not counting
+    before = *counters;
+    cpu_set_counters(cpu, false);
+    for (i = 0; i < 10; i++)
+        cpu_step(cpu);
+    ASSERT(memcmp(&before, cpu_get_counters(cpu), sizeof(before)) == 0, "Counters kept when not counting");
+
+    // Every 10 cycles, after the header
+    fd = tmpfile();
+    program_size = load_test_program(cpu);
+    ASSERT(fd != NULL && cpu_counters_every(cpu, fd, COUNTERS_CSV, 10) == 0, "Periodic counters");
+    cpu_step(cpu);
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+    cycles = cpu_get_stats(cpu)->cycles;
+    cpu_counters_every(cpu, NULL, COUNTERS_CSV, 0);
+    cpu_set_counters(cpu, false);
+    rewind(fd);
+    ASSERT(fgets(line, sizeof(line), fd) != NULL && strcmp(line, "cycle,counter,value\n") == 0, "CSV header");
+    while (fgets(line, sizeof(line), fd) != NULL)
+        if (strncmp(strchr(line, ',') + 1, "retired,", 8) == 0)
+            rows++;
+    fclose(fd);
+    ASSERT(rows == cycles / 10, "A set of rows per period");
+
+    // An idle loop skipped: addi r0, r0, #1; bnez r0; j back
+    for (i = 0; i < 2 * MAX_DELAYSLOT + 3; i++)
+        cpu_load_instr(cpu, i, NOP_Instruction);
+    cpu_load_instr(cpu, 0, (OPCODE_ADDI << 26) | 1);
+    cpu_load_instr(cpu, 1, OPCODE_BNEZ << 26);
+    loop = MAX_DELAYSLOT + 2;
+    cpu_load_instr(cpu, loop, (OPCODE_J << 26) | ((0*4 - JUMP_BASE(cpu_get_config(cpu), loop)) & 0x03FFFFFF));
+    cpu_reset(cpu);
+    cpu_set_counters(cpu, true);
+    for (i = 0; i < 200 && cpu_get_idle(cpu) == 0; i++)
+        cpu_step(cpu);
+    ASSERT(cpu_get_idle(cpu) != 0, "Loop detected as idle");
+    fd = tmpfile();
+    interval = 5 * cpu_get_idle(cpu);
+    ASSERT(fd != NULL && cpu_counters_every(cpu, fd, COUNTERS_CSV, interval) == 0, "Periodic counters of the loop");
+    start = cpu_get_stats(cpu)->cycles;
+    ASSERT(cpu_skip_idle(cpu, 100 * interval) == 100 * interval, "Idle loop skipped");
+    for (i = 0; (uint64_t)i < 3 * interval; i++)
+        cpu_step(cpu);
+    cycles = cpu_get_stats(cpu)->cycles;
+    cpu_counters_every(cpu, NULL, COUNTERS_CSV, 0);
+    cpu_set_counters(cpu, false);
+
+    for (i = 0, sum = 0; i < 64; i++)
+        sum += counters->opcode[i];
+    ASSERT(sum == cpu_get_stats(cpu)->retired, "One opcode counted per retired instruction skipped");
+    ASSERT(counters->opcode[OPCODE_NOP] == cpu_get_stats(cpu)->nops, "NOPs skipped counted");
+    ASSERT(counters->not_taken == counters->opcode[OPCODE_BNEZ] && counters->taken == 0 &&
+           counters->jumps == counters->opcode[OPCODE_J], "Jumps skipped counted");
+    ASSERT(counters->bubbles[PIPE_STAGES - 1] >= counters->opcode[OPCODE_NOP], "Bubbles skipped counted");
+    rewind(fd);
+    rows = 0;
+    ASSERT(fgets(line, sizeof(line), fd) != NULL, "CSV header of the loop");
+    while (fgets(line, sizeof(line), fd) != NULL)
+        if (strncmp(strchr(line, ',') + 1, "retired,", 8) == 0)
+            rows++;
+    fclose(fd);
+    ASSERT(rows == cycles / interval - start / interval, "The rows of the skipped cycles and after");
+    return 0;
+}
+
+// Labels of the program, sorted, found by address
+int labels_test(void *handle) {
+    const programLabel_t *label;
+    programLabel_t *labels;
+    int n, i, loop;
+
+    (void)handle;
+    loop = program_find_label("./programs/testprogram.asm.mem", "LOOP");
+    n = program_load_labels("./programs/testprogram.asm.mem", &labels);
+    ASSERT(n > 0 && loop > 0, "Labels loaded");
+    for (i = 1; i < n; i++)
+        ASSERT(labels[i - 1].addr <= labels[i].addr, "Labels sorted by address");
+    label = program_label_of(labels, n, (uint32_t)loop);
+    ASSERT(label != NULL && label->addr == (uint32_t)loop, "Label at its address");
+    label = program_label_of(labels, n, labels[n - 1].addr + 10);
+    ASSERT(label == &labels[n - 1], "Last label before the address");
+    ASSERT(labels[0].addr == 0 || program_label_of(labels, n, labels[0].addr - 1) == NULL, "No label before the first");
+    free(labels);
+    return 0;
+}
+
+// A recursive call, with the delay slots of the build:
+//	    addi r31, r0, #entry
+//	    addi r3, r0, #1
+//	    jr   r31            ; return with nothing called
+//	entry:
+//	    jal  f
+//	halt:
+//	    j    halt
+//	f:
+//	    beqz r3, leaf
+//	    addi r4, r31, #0
+//	    subi r3, r3, #1
+//	    jal  f
+//	    addi r31, r4, #0
+//	    jr   r31
+//	leaf:
+//	    jr   r31
+// NOPs fill the delay slots and cover the hazards with no forwarding
+static void load_calls_program(cpu_t *cpu) {
+    const cpu_config_t *config = cpu_get_config(cpu);
+    int i;
+
+    cpu_reset(cpu);
+    for (i = 0; i < 80; i++)
+        cpu_load_instr(cpu, i, NOP_Instruction);
+    cpu_load_instr(cpu, 0,  (OPCODE_ADDI << 26) | (31 << 16) | 16*4);
+    cpu_load_instr(cpu, 1,  (OPCODE_ADDI << 26) | (3 << 16) | 1);
+    cpu_load_instr(cpu, 6,  (OPCODE_JR << 26) | (31 << 21));
+    cpu_load_instr(cpu, 16, (OPCODE_JAL << 26) | ((32*4 - JUMP_BASE(config, 16)) & 0x03FFFFFF));
+    cpu_load_instr(cpu, 24, (OPCODE_J << 26) | ((24*4 - JUMP_BASE(config, 24)) & 0x03FFFFFF));
+    cpu_load_instr(cpu, 32, (OPCODE_BEQZ << 26) | (3 << 21) | ((64*4 - JUMP_BASE(config, 32)) & 0xFFFF));
+    cpu_load_instr(cpu, 37, (OPCODE_ADDI << 26) | (31 << 21) | (4 << 16));
+    cpu_load_instr(cpu, 38, (OPCODE_SUBI << 26) | (3 << 21) | (3 << 16) | 1);
+    cpu_load_instr(cpu, 43, (OPCODE_JAL << 26) | ((32*4 - JUMP_BASE(config, 43)) & 0x03FFFFFF));
+    cpu_load_instr(cpu, 51, (OPCODE_ADDI << 26) | (4 << 21) | (31 << 16));
+    cpu_load_instr(cpu, 56, (OPCODE_JR << 26) | (31 << 21));
+    cpu_load_instr(cpu, 69, (OPCODE_JR << 26) | (31 << 21));
+}
+
+static void calls_hook(void *ctx, const commitRecord_t *record) {
+    calls_retired((callTree_t *)ctx, record);
+}
+
+// Shadow call stack: the calls, the recursion counted once in the
+// inclusive cycles, the return with nothing called ignored, the folded
+// stacks
+int calls_test(void *handle) {
+    cpu_t *cpu = handle;
+    const programLabel_t labels[] = { { 0, "main" }, { 32, "f" } };
+    callTree_t calls;
+    callFuncs_t *funcs;
+    callNode_t *outer, *inner;
+    char line[64], name[32];
+    unsigned long long cycles;
+    FILE *fd;
+    int i;
+
+    memset(&calls, 0, sizeof(calls));
+    cpu_set_trace(cpu, NULL);
+    load_calls_program(cpu);
+    cpu_set_commit_hook(cpu, calls_hook, &calls);
+    for (i = 0; i < 2000 && cpu_get_idle(cpu) == 0; i++)
+        cpu_step(cpu);
+    cpu_set_commit_hook(cpu, NULL, NULL);
+    cpu_set_trace(cpu, stdout);
+    ASSERT(cpu_get_idle(cpu) != 0 && cpu_get_reg(cpu, 3) == 0, "The program halts in j halt");
+
+    outer = calls.root.child;
+    ASSERT(calls.started && calls.root.func == 0 && calls.root.calls == 1, "Started in the first instruction");
+    ASSERT(calls.top == &calls.root && calls.depth == 0 && calls.overflow == 0, "Every call returned");
+    ASSERT(outer != NULL && outer->sibling == NULL && outer->func == 32 && outer->calls == 1,
+           "Return with nothing called ignored, f called once from main");
+    inner = outer->child;
+    ASSERT(inner != NULL && inner->sibling == NULL && inner->func == 32 && inner->calls == 1 && inner->child == NULL,
+           "f called once from itself");
+    ASSERT(calls.root.self != 0 && outer->self != 0 && inner->self != 0, "Cycles on top of the stack");
+
+    funcs = (callFuncs_t *)calloc(1, sizeof(callFuncs_t));
+    ASSERT(funcs != NULL, "Functions allocated");
+    calls_sum(&calls, funcs);
+    ASSERT(calls.root.total == calls.cycle, "Every cycle in the tree");
+    ASSERT(funcs->calls[0] == 1 && funcs->calls[32] == 2, "Calls per function");
+    ASSERT(funcs->exclusive[0] == calls.root.self && funcs->exclusive[32] == outer->self + inner->self,
+           "Exclusive cycles");
+    ASSERT(funcs->inclusive[0] == calls.cycle && funcs->inclusive[32] == outer->total &&
+           funcs->inclusive[32] == funcs->exclusive[32], "Inclusive cycles, the recursion counted once");
+    free(funcs);
+
+    program_addr_name(labels, 2, 36, "", name, sizeof(name));
+    ASSERT(strcmp(name, "f+0x10") == 0, "Address named after its label");
+    fd = tmpfile();
+    ASSERT(fd != NULL && calls_fold(&calls, fd, labels, 2) == 0, "Folded stacks written");
+    rewind(fd);
+    ASSERT(fgets(line, sizeof(line), fd) && sscanf(line, "main %llu", &cycles) == 1 && cycles == calls.root.self,
+           "Folded main");
+    ASSERT(fgets(line, sizeof(line), fd) && sscanf(line, "main;f %llu", &cycles) == 1 && cycles == outer->self,
+           "Folded main;f");
+    ASSERT(fgets(line, sizeof(line), fd) && sscanf(line, "main;f;f %llu", &cycles) == 1 && cycles == inner->self,
+           "Folded main;f;f");
+    ASSERT(fgets(line, sizeof(line), fd) == NULL, "A line per path");
+    fclose(fd);
+    calls_free(&calls);
+    ASSERT(calls.root.child == NULL, "Tree freed");
+    return 0;
+}
+
+// Sends the records of the run as the HDL would, the first register
+// write from the fault-th one on corrupted
+typedef struct {
+    cosimPort_t *port;
+    uint64_t sent;
+    uint64_t fault;
+    uint64_t corrupted;     // Record corrupted, 0 if none
+} cosim_hdl_t;
+
+static void cosim_hdl_send(void *ctx, const commitRecord_t *record) {
+    cosim_hdl_t *hdl = ctx;
+    commitRecord_t sent = *record;
+
+    if (++hdl->sent >= hdl->fault && hdl->fault != 0 && (sent.flags & COMMIT_REG)) {
+        sent.value ^= 1;
+        hdl->fault = 0;
+        hdl->corrupted = hdl->sent;
+    }
+    cosim_send(hdl->port, &sent);
+}
+
+// Run the program through a session: once sending as the HDL, once
+// checking against the records sent. Returns the checking port
+static cosimPort_t *cosim_run(cpu_t *cpu, const char *name, uint64_t fault, uint64_t *corrupted) {
+    cosim_hdl_t hdl = { NULL, 0, fault, 0 };
+    cosimPort_t *port;
+    int program_size;
+
+    port = cosim_create(name, 0, true);
+    ASSERT(port != NULL, "Session created");
+    hdl.port = cosim_attach(name, 1000);
+    ASSERT(hdl.port != NULL && cosim_wait_attach(port, 1000) == 0, "HDL attached");
+
+    program_size = load_test_program(cpu);
+    cpu_set_commit_hook(cpu, cosim_hdl_send, &hdl);
+    cpu_step(cpu);
+    while (cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+    cosim_finish(hdl.port);
+    *corrupted = hdl.corrupted;
+    ASSERT(hdl.sent == cpu_get_stats(cpu)->retired && hdl.sent < COSIM_SLOTS, "Whole run in the ring");
+
+    program_size = load_test_program(cpu);
+    cpu_set_commit_hook(cpu, cosim_check_hook, port);
+    cpu_step(cpu);
+    while (port->diff == 0 && cpu_get_pc(cpu) < (uint32_t)(program_size + 4))
+        cpu_step(cpu);
+    cpu_set_commit_hook(cpu, NULL, NULL);
+    cosim_close(hdl.port);
+    return port;
+}
+
+// Lockstep co-simulation: the same run matches, a corrupted record stops
+// the model at that instruction
+int cosim_test(void *handle) {
+    cpu_t *cpu = handle;
+    cosimPort_t *port;
+    char name[32];
+    uint64_t retired, corrupted;
+
+    snprintf(name, sizeof(name), "/dlx_test_%d", (int)getpid());
+    port = cosim_run(cpu, name, 0, &corrupted);
+    retired = cpu_get_stats(cpu)->retired;
+    ASSERT(cosim_end(port) == 0 && port->diff == 0, "Same run matches");
+    ASSERT(port->checked == retired, "Every instruction checked");
+    cosim_close(port);
 
+    port = cosim_run(cpu, name, 20, &corrupted);
+    ASSERT(corrupted >= 20, "Record corrupted");
+    ASSERT(cosim_end(port) < 0, "Mismatch reported at the end");
+    ASSERT(port->checked == corrupted - 1 && port->has_model && port->has_hdl, "Stopped at the corrupted instruction");
+    ASSERT(port->diff == COSIM_DIFF_REG && port->hdl.value == (port->model.value ^ 1), "Only the corrupted field differs");
+    ASSERT(atomic_load(&port->shm->state) == COSIM_STOPPED, "HDL told to stop");
+    cosim_close(port);
     return 0;
 }
 
 int main() {
+    cpu_config_t config = CPU_CONFIG_DEFAULT;
     cpu_t *cpu = NULL;
 
-    cpu = (cpu_t *)cpu_create();
+    // The programs rely on their delay slots, predictor_test() sets the predictors
+    config.predictor = PREDICT_NONE;
+    cpu = (cpu_t *)cpu_create(&config);
     if (cpu == NULL) {
         fprintf(stderr, "cpu_create() failed\n");
         exit(-3);
@@ -112,9 +972,27 @@ int main() {
     cpu_reset(cpu);
 
     basic_test(cpu);
+    functional_test(cpu);
+    mixed_test(cpu);
+    jit_test(cpu);
+    blocks_test(cpu);
+    fast_forward_test(cpu);
+    checkpoint_test(cpu);
+    idle_test(cpu);
+    config_test(cpu);
+    memory_test(cpu);
+    bus_test(cpu);
+    sparse_test(cpu);
+    image_test(cpu);
+    commit_test(cpu);
+    cosim_test(cpu);
+    counters_test(cpu);
+    labels_test(cpu);
+    calls_test(cpu);
+    predictor_test(cpu);
 
     printf("All tests passed\n");
 
-    free(cpu);
+    cpu_free(cpu);
     return 0;
 }
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cpu_model/cpu_model.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Commit trace diff
+// Compares two commit traces (see cpu_commit_open()), e.g. of the model
+// under two configs or of the model and the HDL, and reports the first
+// instruction retired differently, with the records around it.
+// The encoder is deterministic and each trace starts from the same
+// state, so the traces are byte for byte equal up to the first record
+// that differs: the mapped files are compared 64 bytes at a time with
+// SIMD, then only the bytes before the first difference are decoded to
+// find the record. With --ignore-cycles the cycles don't count (e.g.
+// the HDL has a different reset latency, or the configs fill the
+// pipeline differently), the records are decoded and compared one by
+// one instead.
+// --context <n> sets the records printed around the difference (5).
+// Returns 0 if the traces are equal, 1 if they differ, -1 on error
+
+#define CONTEXT_MAX 64
+
+typedef struct {
+	const char    *name;
+	uint8_t       *map;
+	size_t         size;
+	const uint8_t *data;		// Records, after the header
+	size_t         len;
+} trace_t;
+
+static int trace_map(trace_t *trace, const char *name) {
+	struct stat st;
+	uint32_t    header[2];
+	int         fd;
+
+	trace->name = name;
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[TRACEDIFF] open() failed | filename: %s\n", name);
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header)) {
+		fprintf(stderr, "[TRACEDIFF] Not a commit trace | filename: %s\n", name);
+		close(fd);
+		return -1;
+	}
+	trace->size = (size_t)st.st_size;
+	trace->map  = (uint8_t *)mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (trace->map == MAP_FAILED) {
+		fprintf(stderr, "[TRACEDIFF] mmap() failed | filename: %s\n", name);
+		return -1;
+	}
+	madvise(trace->map, trace->size, MADV_SEQUENTIAL);
+	memcpy(header, trace->map, sizeof(header));
+	if (header[0] != COMMIT_MAGIC || header[1] != COMMIT_VERSION) {
+		fprintf(stderr, "[TRACEDIFF] Not a commit trace of version %d | filename: %s\n", COMMIT_VERSION, name);
+		munmap(trace->map, trace->size);
+		return -1;
+	}
+	trace->data = trace->map + sizeof(header);
+	trace->len  = trace->size - sizeof(header);
+	return 0;
+}
+
+// Index of the first byte that differs, n if none, 64 bytes per iteration
+static size_t first_diff(const uint8_t *a, const uint8_t *b, size_t n) {
+	size_t i = 0;
+#if defined(__SSE2__)
+	for (; i + 64 <= n; i += 64) {
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),      _mm_loadu_si128((const __m128i *)(b + i)));
+		__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)), _mm_loadu_si128((const __m128i *)(b + i + 16)));
+		__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)), _mm_loadu_si128((const __m128i *)(b + i + 32)));
+		__m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)), _mm_loadu_si128((const __m128i *)(b + i + 48)));
+		if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3))) != 0xffff)
+			break;
+	}
+#elif defined(__aarch64__)
+	// vminvq_u8() and vld1q_u8_x4() are AArch64 only, 32-bit ARM takes the scalar loop
+	for (; i + 64 <= n; i += 64) {
+		uint8x16x4_t va = vld1q_u8_x4(a + i), vb = vld1q_u8_x4(b + i);
+		uint8x16_t   e  = vandq_u8(vandq_u8(vceqq_u8(va.val[0], vb.val[0]), vceqq_u8(va.val[1], vb.val[1])),
+		                           vandq_u8(vceqq_u8(va.val[2], vb.val[2]), vceqq_u8(va.val[3], vb.val[3])));
+		if (vminvq_u8(e) != 0xff)
+			break;
+	}
+#endif
+	// The chunk holding the difference, or the tail
+	for (; i < n; i++)
+		if (a[i] != b[i])
+			break;
+	return i;
+}
+
+static bool same_record(const commitRecord_t *a, const commitRecord_t *b, bool cycles) {
+	uint8_t flags = COMMIT_REG | COMMIT_LOAD | COMMIT_STORE | COMMIT_RESET;
+
+	if ((a->flags & flags) != (b->flags & flags) || (cycles && a->cycle != b->cycle))
+		return false;
+	if (a->flags & COMMIT_RESET)
+		return true;
+	return a->pc == b->pc && a->instr == b->instr &&
+	       (!(a->flags & COMMIT_REG) || (a->rd == b->rd && a->value == b->value)) &&
+	       (!(a->flags & (COMMIT_LOAD | COMMIT_STORE)) || (a->addr == b->addr && a->data == b->data));
+}
+
+// Records before the difference, the last context ones kept
+typedef struct {
+	commitRecord_t record[CONTEXT_MAX];
+	uint64_t       count;
+} history_t;
+
+static void history_push(history_t *history, const commitRecord_t *record) {
+	history->record[history->count++ % CONTEXT_MAX] = *record;
+}
+
+static void print_line(const char *mark, uint64_t idx, const commitRecord_t *record) {
+	printf("%s #%-10llu ", mark, (unsigned long long)idx);
+	commit_print(stdout, record);
+	putchar('\n');
+}
+
+// Records of the trace from pos, up to n, "end" if it ends before
+static void print_after(const char *mark, const trace_t *trace, commitCoder_t coder, size_t pos,
+                        uint64_t idx, int n) {
+	commitRecord_t record;
+	size_t         len;
+
+	for (; n > 0; n--, idx++, pos += len) {
+		if (pos == trace->len) {
+			printf("%s #%-10llu end of %s\n", mark, (unsigned long long)idx, trace->name);
+			return;
+		}
+		len = commit_decode(&coder, trace->data + pos, trace->len - pos, &record);
+		if (len == 0) {
+			printf("%s #%-10llu truncated record\n", mark, (unsigned long long)idx);
+			return;
+		}
+		print_line(mark, idx, &record);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	trace_t        a, b;
+	history_t     *history;
+	commitCoder_t  coder_a = { 0 }, coder_b = { 0 }, before_a, before_b;
+	commitRecord_t rec_a, rec_b;
+	size_t         pos_a = 0, pos_b = 0, diff, len_a, len_b;
+	uint64_t       idx, i;
+	bool           cycles = true;
+	int            context = 5, argi = 1;
+
+	while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+		if (strcmp(argv[argi], "--ignore-cycles") == 0) {
+			cycles = false;
+			argi++;
+		} else if (strcmp(argv[argi], "--context") == 0 && argi + 1 < argc) {
+			context = atoi(argv[argi + 1]);
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+	if (argc != argi + 2 || context < 0 || context > CONTEXT_MAX) {
+		fprintf(stderr, "Wrong usage: %s [--ignore-cycles] [--context <0..%d>] <a.commit> <b.commit>\n", argv[0], CONTEXT_MAX);
+		exit(-1);
+	}
+	if (trace_map(&a, argv[argi]) < 0 || trace_map(&b, argv[argi + 1]) < 0)
+		exit(-2);
+
+	diff = cycles ? first_diff(a.data, b.data, a.len < b.len ? a.len : b.len) : 0;
+	if (cycles && diff == a.len && a.len == b.len) {
+		printf("Traces equal: %zu bytes\n", a.size);
+		return 0;
+	}
+	history = (history_t *)calloc(1, sizeof(history_t));
+	if (history == NULL) {
+		fprintf(stderr, "[TRACEDIFF] calloc() failed\n");
+		exit(-3);
+	}
+
+	// Up to the first byte that differs everything is equal, decoded only
+	// to count the records and keep the context
+	while (pos_a < diff) {
+		before_a = coder_a;
+		len_a = commit_decode(&coder_a, a.data + pos_a, a.len - pos_a, &rec_a);
+		if (len_a == 0 || pos_a + len_a > diff) {
+			coder_a = before_a;
+			break;
+		}
+		history_push(history, &rec_a);
+		pos_a += len_a;
+	}
+	pos_b   = pos_a;
+	coder_b = coder_a;
+
+	// Record by record from there on: the first one usually differs, unless
+	// a trace has been encoded otherwise (e.g. by the HDL testbench).
+	// Every one with --ignore-cycles
+	while (1) {
+		before_a = coder_a;
+		before_b = coder_b;
+		len_a = pos_a < a.len ? commit_decode(&coder_a, a.data + pos_a, a.len - pos_a, &rec_a) : 0;
+		len_b = pos_b < b.len ? commit_decode(&coder_b, b.data + pos_b, b.len - pos_b, &rec_b) : 0;
+		if (len_a == 0 || len_b == 0 || !same_record(&rec_a, &rec_b, cycles))
+			break;
+		history_push(history, &rec_a);
+		pos_a += len_a;
+		pos_b += len_b;
+	}
+	if (pos_a == a.len && pos_b == b.len) {
+		printf("Traces equal: %llu records\n", (unsigned long long)history->count);
+		return 0;
+	}
+
+	idx = history->count;
+	printf("Traces differ at record #%llu\n< %s, byte %zu\n> %s, byte %zu\n", (unsigned long long)idx,
+	       a.name, pos_a + 2*sizeof(uint32_t), b.name, pos_b + 2*sizeof(uint32_t));
+	for (i = idx - (idx < (uint64_t)context ? idx : (uint64_t)context); i < idx; i++)
+		print_line(" ", i, &history->record[i % CONTEXT_MAX]);
+	print_after("<", &a, before_a, pos_a, idx, context + 1);
+	print_after(">", &b, before_b, pos_b, idx, context + 1);
+	return 1;
+}